@@ -110,6 +110,15 @@ typedef struct thread {
     /* are we allowed to be interrupted on the current thing we're blocked/sleeping on */
     bool interruptable;
 
+    /* direct handoff state for synchronous ipc, see thread_handoff_begin() */
+    struct thread *handoff_target;
+    bool handoff_first;
+    bool handed_off;
+
+    /* reschedule ipis held back by thread_wake_batch_begin() */
+    int wake_batch_depth;
+    uint32_t wake_batch_cpus;
+
     /* non-NULL if stopped in an exception */
     const struct arch_exception_context *exception_context;
 
@@ -235,6 +244,30 @@ void thread_yield(void);             /* give up the cpu and time slice voluntari
 void thread_preempt(bool interrupt); /* get preempted (return to head of queue and reschedule) */
 void thread_resched(void);
 
+/* Direct handoff for synchronous ipc. Between thread_handoff_begin(t) and
+ * thread_handoff_end(), if the current thread wakes |t| and |t| has the same
+ * priority, |t| is queued to run next on this cpu with the remainder of the
+ * current thread's time slice, rather than being sent to another cpu. Any
+ * other thread woken in between is placed as usual. If |t| is NULL, the
+ * target is whichever thread the current thread wakes first, and no later
+ * wakeup is a candidate.
+ * thread_handoff_end() returns true if the handoff happened, in which case the
+ * caller must promptly either block or call thread_handoff_yield() to switch
+ * to the target.
+ */
+void thread_handoff_begin(thread_t *t);
+bool thread_handoff_end(void);
+void thread_handoff_yield(void);
+
+/* Batch the reschedule ipis for threads woken by the current thread between
+ * thread_wake_batch_begin() and thread_wake_batch_end(): the woken threads are
+ * made runnable immediately, but each target cpu is kicked at most once, when
+ * the outermost thread_wake_batch_end() is reached or the current thread
+ * blocks, whichever comes first. Calls nest.
+ */
+void thread_wake_batch_begin(void);
+void thread_wake_batch_end(void);
+
 static inline bool thread_is_realtime(thread_t *t)
 {
     return (t->flags & THREAD_FLAG_REAL_TIME) && t->priority > DEFAULT_PRIORITY;
@@ -280,6 +313,7 @@ struct thread_stats {
     ulong irq_preempts;
     ulong preempts;
     ulong yields;
+    ulong handoffs;
 
     /* cpu level interrupts and exceptions */
     ulong interrupts; /* hardware interrupts, minus timer interrupts or inter-processor interrupts */
@@ -53,8 +53,10 @@ static mp_cpu_mask_t rand_cpu(const mp_cpu_mask_t mask)
     }
 }
 
-/* find a cpu to wake up */
-static mp_cpu_mask_t find_cpu(thread_t *t)
+/* find a cpu to wake up. |kicked| is the set of cpus already being sent a
+ * reschedule ipi for the same batch of wakeups; an idle cpu in it will pick
+ * up the run queue anyway, so it is not worth choosing again. */
+static mp_cpu_mask_t find_cpu(thread_t *t, mp_cpu_mask_t kicked)
 {
 #if BROADCAST_RESCHEDULE
     return MP_CPU_ALL_BUT_LOCAL;
@@ -73,6 +75,12 @@ static mp_cpu_mask_t find_cpu(thread_t *t)
             return 0;
         }
 
+        if ((idle_cpu_mask & ~kicked) == 0) {
+            /* every idle cpu is already on its way to the run queue */
+            return 0;
+        }
+        idle_cpu_mask &= ~kicked;
+
         if (last_ran_cpu_mask & idle_cpu_mask) {
             /* the last core it ran on is idle and isn't the current cpu */
             return last_ran_cpu_mask;
@@ -122,6 +130,67 @@ static void insert_in_run_queue_tail(thread_t *t)
     run_queue_bitmap |= (1<<t->priority);
 }
 
+/* if the current thread asked to hand off to |t| (see thread_handoff_begin()),
+ * let |t| run next on this cpu with the rest of our quantum instead of kicking
+ * another cpu to run it */
+static bool sched_try_handoff(thread_t *t)
+{
+    thread_t *current_thread = get_current_thread();
+
+    if (likely(current_thread->handoff_target != t && !current_thread->handoff_first) ||
+        arch_in_int_handler())
+        return false;
+
+    /* a target not named in advance is the first thread woken, win or lose */
+    current_thread->handoff_first = false;
+
+    /* only trade places with an equal, anything else takes the normal path */
+    if (t->priority != current_thread->priority)
+        return false;
+#if WITH_SMP
+    if (t->pinned_cpu >= 0 && (uint)t->pinned_cpu != arch_curr_cpu_num())
+        return false;
+#endif
+
+    current_thread->handoff_target = NULL;
+    current_thread->handed_off = true;
+
+    /* the pair shares one quantum, so a ping-ponging pair still gets preempted */
+    t->remaining_time_slice = current_thread->remaining_time_slice;
+
+    THREAD_STATS_INC(handoffs);
+    return true;
+}
+
+/* get a cpu to pick up the newly runnable |t|. inside a wake batch (see
+ * thread_wake_batch_begin()) the ipi is accumulated on the current thread and
+ * sent later, otherwise it is added to |kick| for the caller to send */
+static void sched_kick(thread_t *t, mp_cpu_mask_t *kick)
+{
+    if (sched_try_handoff(t))
+        return;
+
+    thread_t *current_thread = get_current_thread();
+    if (current_thread->wake_batch_depth > 0 && !arch_in_int_handler()) {
+        current_thread->wake_batch_cpus |= find_cpu(t, current_thread->wake_batch_cpus);
+    } else {
+        *kick |= find_cpu(t, *kick);
+    }
+}
+
+/* send the reschedule ipis accumulated by the current thread's wake batch */
+void sched_flush_wake_batch(void)
+{
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    thread_t *current_thread = get_current_thread();
+    mp_cpu_mask_t cpus = current_thread->wake_batch_cpus;
+    if (cpus) {
+        current_thread->wake_batch_cpus = 0;
+        mp_reschedule(cpus, 0);
+    }
+}
+
 thread_t *sched_get_top_thread(uint cpu)
 {
     thread_t *newthread;
@@ -162,6 +231,9 @@ void sched_block(void)
 
     // XXX deal with time slice fiddling here
 
+    /* don't sit on the ipis for threads we woke while we're not running */
+    sched_flush_wake_batch();
+
     /* we are blocking on something. the blocking code should have already stuck us on a queue */
     thread_resched();
 }
@@ -186,7 +258,9 @@ void sched_unblock(thread_t *t, bool resched)
     t->state = THREAD_READY;
     insert_in_run_queue_head(t);
 
-    mp_reschedule(find_cpu(t), 0);
+    mp_cpu_mask_t kick = 0;
+    sched_kick(t, &kick);
+    mp_reschedule(kick, 0);
 
     if (resched)
         thread_resched();
@@ -208,7 +282,9 @@ void sched_unblock_list(struct list_node *list, bool resched)
         insert_in_run_queue_head(current_thread);
     }
 
-    /* pop the list of threads and shove into the scheduler */
+    /* pop the list of threads and shove into the scheduler, kicking each
+     * cpu that needs to pick some of them up only once */
+    mp_cpu_mask_t kick = 0;
     thread_t *t;
     while ((t = list_remove_tail_type(list, thread_t, queue_node))) {
         DEBUG_ASSERT(t->magic == THREAD_MAGIC);
@@ -218,8 +294,9 @@ void sched_unblock_list(struct list_node *list, bool resched)
         t->state = THREAD_READY;
         insert_in_run_queue_head(t);
 
-        mp_reschedule(find_cpu(t), 0);
+        sched_kick(t, &kick);
     }
+    mp_reschedule(kick, 0);
 
     if (resched)
         thread_resched();
@@ -236,6 +313,7 @@ void sched_yield(void)
     if (likely(!thread_is_idle(current_thread))) { /* idle thread doesn't go in the run queue */
         insert_in_run_queue_tail(current_thread);
     }
+    sched_flush_wake_batch();
     thread_resched();
 }
 
@@ -254,6 +332,25 @@ void sched_preempt(void)
     sched_block();
 }
 
+void sched_handoff_yield(void)
+{
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    /* the thread we handed off to was put at the head of our run queue. requeue
+     * ourselves right behind it, so it runs now and we run right after it */
+    thread_t *current_thread = get_current_thread();
+    current_thread->state = THREAD_READY;
+
+    thread_t *next = list_peek_head_type(&run_queue[current_thread->priority], thread_t, queue_node);
+    if (next) {
+        list_add_after(&next->queue_node, &current_thread->queue_node);
+    } else {
+        /* another cpu already picked it up */
+        insert_in_run_queue_head(current_thread);
+    }
+    thread_resched();
+}
+
 void sched_init_early(void)
 {
     /* initialize the run queues */
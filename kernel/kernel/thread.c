@@ -153,6 +153,11 @@ thread_t *thread_create_etc(
     t->blocking_wait_queue = NULL;
     t->blocked_status = NO_ERROR;
     t->interruptable = false;
+    t->handoff_target = NULL;
+    t->handoff_first = false;
+    t->handed_off = false;
+    t->wake_batch_depth = 0;
+    t->wake_batch_cpus = 0;
     thread_set_last_cpu(t, 0);
 
     t->retcode = 0;
@@ -812,6 +817,81 @@ void thread_yield(void)
     THREAD_UNLOCK(state);
 }
 
+void thread_handoff_begin(thread_t *t)
+{
+    thread_t *current_thread = get_current_thread();
+
+    DEBUG_ASSERT(current_thread->magic == THREAD_MAGIC);
+    DEBUG_ASSERT(!current_thread->handoff_target && !current_thread->handoff_first);
+    DEBUG_ASSERT(!current_thread->handed_off);
+    DEBUG_ASSERT(t != current_thread);
+
+    current_thread->handoff_target = t;
+    current_thread->handoff_first = (t == NULL);
+}
+
+bool thread_handoff_end(void)
+{
+    thread_t *current_thread = get_current_thread();
+
+    bool handed_off = current_thread->handed_off;
+    current_thread->handoff_target = NULL;
+    current_thread->handoff_first = false;
+    current_thread->handed_off = false;
+    return handed_off;
+}
+
+void thread_wake_batch_begin(void)
+{
+    thread_t *current_thread = get_current_thread();
+
+    DEBUG_ASSERT(current_thread->magic == THREAD_MAGIC);
+    DEBUG_ASSERT(!arch_in_int_handler());
+
+    current_thread->wake_batch_depth++;
+}
+
+void thread_wake_batch_end(void)
+{
+    thread_t *current_thread = get_current_thread();
+
+    DEBUG_ASSERT(current_thread->wake_batch_depth > 0);
+
+    if (--current_thread->wake_batch_depth > 0)
+        return;
+
+    /* only ever touched by this thread, so no need for the lock to peek */
+    if (current_thread->wake_batch_cpus == 0)
+        return;
+
+    THREAD_LOCK(state);
+
+    sched_flush_wake_batch();
+
+    THREAD_UNLOCK(state);
+}
+
+/**
+ * @brief Switch to the thread the current thread just handed off to
+ *
+ * The current thread stays runnable and runs again right after the
+ * thread it handed off to. See thread_handoff_begin().
+ */
+void thread_handoff_yield(void)
+{
+    __UNUSED thread_t *current_thread = get_current_thread();
+
+    DEBUG_ASSERT(current_thread->magic == THREAD_MAGIC);
+    DEBUG_ASSERT(current_thread->state == THREAD_RUNNING);
+    DEBUG_ASSERT(!arch_in_int_handler());
+
+    THREAD_LOCK(state);
+
+    sched_handoff_yield();
+
+    THREAD_UNLOCK(state);
+}
+
 /**
  * @brief Preempt the current thread, usually from an interrupt
  *
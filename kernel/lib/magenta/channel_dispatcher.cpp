@@ -182,8 +182,15 @@ status_t ChannelDispatcher::Write(mxtl::unique_ptr<MessagePacket> msg) {
         other = other_;
     }
 
-    if (other->WriteSelf(mxtl::move(msg)) > 0)
-        thread_preempt(false);
+    bool handed_off = false;
+    if (other->WriteSelf(mxtl::move(msg), &handed_off) > 0) {
+        // A reply woke the thread blocked in Call(). Run it here and now.
+        if (handed_off) {
+            thread_handoff_yield();
+        } else {
+            thread_preempt(false);
+        }
+    }
 
     return NO_ERROR;
 }
@@ -219,8 +226,12 @@ status_t ChannelDispatcher::Call(mxtl::unique_ptr<MessagePacket> msg,
         waiters_.push_back(waiter);
     }
 
-    // (1) Write outbound message to opposing endpoint.
-    other->WriteSelf(mxtl::move(msg));
+    // (1) Write outbound message to opposing endpoint. Whichever server
+    // thread that wakes, in channel_read or port_wait, runs next on this cpu
+    // since we are about to block until it replies.
+    thread_handoff_begin(nullptr);
+    other->WriteSelf(mxtl::move(msg), nullptr);
+    thread_handoff_end();
 
     // Reuse the code from the half-call used for retrying a Call after thread
     // suspend.
@@ -263,7 +274,7 @@ status_t ChannelDispatcher::ResumeInterruptedCall(mx_time_t timeout,
     return status;
 }
 
-int ChannelDispatcher::WriteSelf(mxtl::unique_ptr<MessagePacket> msg) {
+int ChannelDispatcher::WriteSelf(mxtl::unique_ptr<MessagePacket> msg, bool* handed_off) {
     canary_.Assert();
 
     AutoLock lock(&lock_);
@@ -279,8 +290,14 @@ int ChannelDispatcher::WriteSelf(mxtl::unique_ptr<MessagePacket> msg) {
             // Remove waiter from list.
             if (waiter.get_txid() == txid) {
                 waiters_.erase(waiter);
-                // we return how many threads have been woken up, or zero.
-                return waiter.Deliver(mxtl::move(msg));
+                if (!handed_off) {
+                    // we return how many threads have been woken up, or zero.
+                    return waiter.Deliver(mxtl::move(msg));
+                }
+                thread_handoff_begin(waiter.get_thread());
+                int woken = waiter.Deliver(mxtl::move(msg));
+                *handed_off = thread_handoff_end();
+                return woken;
             }
         }
     }
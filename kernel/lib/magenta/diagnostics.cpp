@@ -11,6 +11,7 @@
 #include <kernel/auto_lock.h>
 #include <lib/console.h>
 
+#include <magenta/handle_reaper.h>
 #include <magenta/job_dispatcher.h>
 #include <magenta/magenta.h>
 #include <magenta/process_dispatcher.h>
@@ -341,6 +342,7 @@ static int cmd_diagnostics(int argc, const cmd_args* argv, uint32_t flags) {
         printf("%s jb   <pid> : list job tree\n", argv[0].str);
         printf("%s kill <pid> : kill process\n", argv[0].str);
         printf("%s asd  <pid> : dump process address space\n", argv[0].str);
+        printf("%s reap       : dump handle reaper stats\n", argv[0].str);
         return -1;
     }
 
@@ -377,6 +379,8 @@ static int cmd_diagnostics(int argc, const cmd_args* argv, uint32_t flags) {
         if (argc < 3)
             goto usage;
         DumpProcessAddressSpace(argv[2].u);
+    } else if (strcmp(argv[1].str, "reap") == 0) {
+        DumpHandleReaperStats();
     } else {
         printf("unrecognized subcommand\n");
         goto usage;
@@ -6,30 +6,103 @@
 
 #include <assert.h>
 #include <inttypes.h>
-#include <lib/dpc.h>
+#include <stdio.h>
+
+#include <kernel/auto_lock.h>
+#include <kernel/event.h>
+#include <kernel/mp.h>
 #include <kernel/mutex.h>
+#include <kernel/thread.h>
+#include <lk/init.h>
 #include <magenta/dispatcher.h>
 #include <magenta/handle_reaper.h>
 #include <magenta/magenta.h>
+#include <magenta/user_thread.h>
+#include <mxtl/atomic.h>
+#include <platform.h>
 #include <trace.h>
 
 #define LOCAL_TRACE 0
 
-static void ReaperRoutine(dpc_t* dpc);
+// Handles are queued on the cpu that released them and deleted by a reaper
+// thread pinned to that cpu. The reapers run at DEFAULT_PRIORITY, so they
+// take turns with ordinary work rather than waiting for the cpu to go idle,
+// and delete at most kReapBatchesPerWakeup batches of kReapBatchSize handles
+// before going to the back of the run queue. A reaper which has emptied its
+// own queue helps empty the others before it sleeps.
+//
+// Rather than raise the reapers' priority when they fall behind, which would
+// starve everything else for as long as a large teardown lasts, a user thread
+// which queues handles while more than kBackpressureWatermark are waiting
+// deletes as many itself before it returns to user mode. See
+// ReapOwedHandles().
+static constexpr uint32_t kReapBatchSize = 64u;
+static constexpr uint32_t kReapBatchesPerWakeup = 4u;
+static constexpr uint64_t kBackpressureWatermark = 256u;
+static constexpr int kReapPriority = DEFAULT_PRIORITY;
+
+namespace {
 
-static Mutex reaper_mutex;
-static mxtl::DoublyLinkedList<Handle*> reaper_handles TA_GUARDED(reaper_mutex);
-static dpc_t reaper_dpc = {
-    .node = LIST_INITIAL_CLEARED_VALUE,
-    .func = ReaperRoutine,
-    .arg = nullptr,
+struct ReaperQueue {
+    Mutex lock;
+    mxtl::DoublyLinkedList<Handle*> handles TA_GUARDED(lock);
+    // Time the oldest handle still in |handles| was queued, or 0 if empty.
+    lk_bigtime_t oldest TA_GUARDED(lock) = 0;
+    event_t event = EVENT_INITIAL_VALUE(event, false, EVENT_FLAG_AUTOUNSIGNAL);
+    thread_t* thread = nullptr;
 };
 
+} // namespace
+
+static ReaperQueue reaper_queues[SMP_MAX_CPUS];
+
+// Statistics. |backlog| also decides when producers must help.
+static mxtl::atomic<uint64_t> reaper_backlog(0u);
+static mxtl::atomic<uint64_t> reaper_peak_backlog(0u);
+static mxtl::atomic<uint64_t> reaper_reaped(0u);
+static mxtl::atomic<uint64_t> reaper_batches(0u);
+static mxtl::atomic<uint64_t> reaper_inline(0u);
+static mxtl::atomic<uint64_t> reaper_total_lag(0u);
+static mxtl::atomic<uint64_t> reaper_max_lag(0u);
+
+static void UpdateMax(mxtl::atomic<uint64_t>* max, uint64_t value) {
+    uint64_t cur = max->load();
+    while (value > cur && !max->compare_exchange_weak(&cur, value, mxtl::memory_order_relaxed,
+                                                      mxtl::memory_order_relaxed)) {
+    }
+}
+
 void ReapHandles(mxtl::DoublyLinkedList<Handle*>* handles) {
     LTRACE_ENTRY;
-    AutoLock lock(&reaper_mutex);
-    reaper_handles.splice(reaper_handles.end(), *handles);
-    dpc_queue(&reaper_dpc, false);
+    size_t count = handles->size_slow();
+    if (count == 0u)
+        return;
+
+    // Callers may hold arbitrary locks (including a process handle table
+    // lock), so never delete synchronously here. Before the reaper threads
+    // exist everything collects on the boot cpu's queue.
+    uint cpu = arch_curr_cpu_num();
+    if (reaper_queues[cpu].thread == nullptr)
+        cpu = 0u;
+    ReaperQueue& q = reaper_queues[cpu];
+
+    uint64_t backlog = reaper_backlog.fetch_add(count) + count;
+    UpdateMax(&reaper_peak_backlog, backlog);
+
+    // Only this thread touches its own count, so no lock is needed.
+    if (backlog > kBackpressureWatermark) {
+        UserThread* thread = UserThread::GetCurrent();
+        if (thread != nullptr)
+            thread->set_reap_owed(thread->reap_owed() + count);
+    }
+
+    {
+        AutoLock lock(&q.lock);
+        if (q.handles.is_empty())
+            q.oldest = current_time_hires();
+        q.handles.splice(q.handles.end(), *handles);
+    }
+    event_signal(&q.event, false);
 }
 
 void ReapHandles(Handle** handles, uint32_t num_handles) {
@@ -40,20 +113,124 @@ void ReapHandles(Handle** handles, uint32_t num_handles) {
     ReapHandles(&list);
 }
 
-static void ReaperRoutine(dpc_t* dpc) {
-    LTRACE_ENTRY;
-    mxtl::DoublyLinkedList<Handle*> list;
-    {
-        AutoLock lock(&reaper_mutex);
-        list.swap(reaper_handles);
+// Takes up to kReapBatchSize handles from |q|. Returns the number taken.
+static uint32_t TakeBatch(ReaperQueue* q, mxtl::DoublyLinkedList<Handle*>* batch) {
+    AutoLock lock(&q->lock);
+    uint32_t count = 0u;
+    Handle* handle;
+    while (count < kReapBatchSize && (handle = q->handles.pop_front()) != nullptr) {
+        batch->push_back(handle);
+        count++;
+    }
+    if (count != 0u) {
+        uint64_t lag = current_time_hires() - q->oldest;
+        reaper_total_lag.fetch_add(lag * count);
+        UpdateMax(&reaper_max_lag, lag);
+        // Without a per-handle timestamp, anything left over keeps the old
+        // enqueue time, so lag is only ever over-reported.
+        if (q->handles.is_empty())
+            q->oldest = 0;
     }
+    return count;
+}
+
+// Takes a batch from |own|, or failing that from another cpu's queue.
+static uint32_t TakeAnyBatch(ReaperQueue* own, mxtl::DoublyLinkedList<Handle*>* batch) {
+    uint32_t count = TakeBatch(own, batch);
+    for (uint i = 0; count == 0u && i < arch_max_num_cpus(); i++) {
+        if (&reaper_queues[i] != own)
+            count = TakeBatch(&reaper_queues[i], batch);
+    }
+    return count;
+}
+
+// Deletes the handles in |batch|, which came out of the shared backlog.
+static void DeleteBatch(mxtl::DoublyLinkedList<Handle*>* batch, uint32_t count) {
     Handle* handle;
-    while ((handle = list.pop_front()) != nullptr) {
+    while ((handle = batch->pop_front()) != nullptr) {
         LTRACEF("Reaping handle of koid %" PRIu64 " of pid %" PRIu64 "\n",
                 handle->dispatcher()->get_koid(), handle->process_id());
         DEBUG_ASSERT(handle->process_id() == 0u);
         DeleteHandle(handle);
     }
-    LTRACE_EXIT;
-;
+    reaper_reaped.fetch_add(count);
+    reaper_batches.fetch_add(1u);
+    reaper_backlog.fetch_sub(count);
 }
+
+static int ReaperThread(void* arg) {
+    ReaperQueue* q = static_cast<ReaperQueue*>(arg);
+
+    for (;;) {
+        event_wait(&q->event);
+
+        mxtl::DoublyLinkedList<Handle*> batch;
+        uint32_t count = 0u;
+        for (uint32_t i = 0; i < kReapBatchesPerWakeup; i++) {
+            if ((count = TakeAnyBatch(q, &batch)) == 0u)
+                break;
+            DeleteBatch(&batch, count);
+        }
+        if (count != 0u) {
+            // There may be more. Let everything else waiting for this cpu
+            // have a turn before coming back for it.
+            event_signal(&q->event, false);
+            thread_yield();
+        }
+    }
+    return 0;
+}
+
+void ReapOwedHandles() {
+    UserThread* thread = UserThread::GetCurrent();
+    if (likely(thread == nullptr || thread->reap_owed() == 0u))
+        return;
+
+    ReaperQueue* q = &reaper_queues[arch_curr_cpu_num()];
+    mxtl::DoublyLinkedList<Handle*> batch;
+    uint32_t count;
+    // Deleting handles may queue more, which this thread then owes too.
+    while (thread->reap_owed() != 0u && (count = TakeAnyBatch(q, &batch)) != 0u) {
+        DeleteBatch(&batch, count);
+        reaper_inline.fetch_add(count);
+        uint64_t owed = thread->reap_owed();
+        thread->set_reap_owed(owed > count ? owed - count : 0u);
+    }
+    // Whatever is left was taken by the reapers in the meantime.
+    thread->set_reap_owed(0u);
+}
+
+void DumpHandleReaperStats() {
+    uint64_t reaped = reaper_reaped.load();
+    printf("handle reaper: backlog %" PRIu64 " peak %" PRIu64 " reaped %" PRIu64
+           " batches %" PRIu64 " inline %" PRIu64 "\n",
+           reaper_backlog.load(), reaper_peak_backlog.load(), reaped,
+           reaper_batches.load(), reaper_inline.load());
+    printf("handle reaper: lag avg %" PRIu64 " us max %" PRIu64 " us\n",
+           reaped ? reaper_total_lag.load() / reaped : 0u, reaper_max_lag.load());
+    for (uint i = 0; i < arch_max_num_cpus(); i++) {
+        ReaperQueue& q = reaper_queues[i];
+        AutoLock lock(&q.lock);
+        if (!q.handles.is_empty())
+            printf("  cpu %u: %zu queued\n", i, q.handles.size_slow());
+    }
+}
+
+static void handle_reaper_init(uint level) {
+    for (uint i = 0; i < arch_max_num_cpus(); i++) {
+        char name[THREAD_NAME_LENGTH];
+        snprintf(name, sizeof(name), "reaper %u", i);
+        thread_t* t = thread_create(name, ReaperThread, &reaper_queues[i],
+                                    kReapPriority, DEFAULT_STACK_SIZE);
+        if (t == nullptr)
+            panic("failed to create handle reaper for cpu %u\n", i);
+        thread_set_pinned_cpu(t, i);
+        thread_detach(t);
+        reaper_queues[i].thread = t;
+        thread_resume(t);
+    }
+    // Anything released before the reapers existed is on cpu 0's queue.
+    event_signal(&reaper_queues[0].event, false);
+}
+
+LK_INIT_HOOK(handle_reaper, handle_reaper_init, LK_INIT_LEVEL_THREADING);
@@ -8,6 +8,8 @@
 
 #include <stdint.h>
 
+#include <kernel/thread.h>
+
 #include <magenta/dispatcher.h>
 #include <magenta/message_packet.h>
 #include <magenta/state_tracker.h>
@@ -86,6 +88,7 @@ public:
 
             txid_ = txid;
             status_ = ERR_TIMED_OUT;
+            thread_ = get_current_thread();
             channel_ = mxtl::move(channel);
             event_.Unsignal();
             return NO_ERROR;
@@ -102,6 +105,9 @@ public:
 
         mx_txid_t get_txid() const { return txid_; }
 
+        // The thread blocked in Call().
+        thread_t* get_thread() const { return thread_; }
+
         mx_status_t Wait(lk_time_t timeout) {
             DEBUG_ASSERT(armed());
             return event_.Wait(timeout);
@@ -120,6 +126,7 @@ public:
 
         mxtl::RefPtr<ChannelDispatcher> channel_;
         mxtl::unique_ptr<MessagePacket> msg_;
+        thread_t* thread_ = nullptr;
         // TODO(teisenbe/swetland): Investigate hoisting this outside to reduce
         // userthread size
         WaitEvent event_;
@@ -135,7 +142,10 @@ private:
 
     ChannelDispatcher(uint32_t flags);
     void Init(mxtl::RefPtr<ChannelDispatcher> other);
-    int WriteSelf(mxtl::unique_ptr<MessagePacket> msg);
+    // If |handed_off| is non-null and |msg| is the reply to a pending call,
+    // the thread which made the call is handed this cpu (see
+    // thread_handoff_begin()) and |*handed_off| says whether that happened.
+    int WriteSelf(mxtl::unique_ptr<MessagePacket> msg, bool* handed_off);
     status_t UserSignalSelf(uint32_t clear_mask, uint32_t set_mask);
     void OnPeerZeroHandles();
 
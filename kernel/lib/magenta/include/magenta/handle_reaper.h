@@ -9,6 +9,15 @@
 #include <magenta/handle.h>
 #include <mxtl/intrusive_double_list.h>
 
-// Delete handles out-of-band, using a deferred procedure call.
+// Delete handles out-of-band, using per-cpu reaper threads.
+// Safe to call with locks held; never deletes synchronously.
 void ReapHandles(mxtl::DoublyLinkedList<Handle*>* handles);
 void ReapHandles(Handle** handles, uint32_t num_handles);
+
+// Deletes, on the current thread, the handles it queued while the reapers
+// were behind. Must be called with no locks held; the syscall return path
+// calls it for every syscall.
+void ReapOwedHandles();
+
+// Print reaper backlog, throughput and lag statistics to the console.
+void DumpHandleReaperStats();
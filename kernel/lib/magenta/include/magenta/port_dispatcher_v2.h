@@ -109,6 +109,7 @@ private:
     bool OnCancel(Handle* handle) final;
     bool OnCancelByKey(Handle* handle, const void* port, uint64_t key) final;
     void OnRemoved() final;
+    mx_signals_t watched_signals() const final { return trigger_; }
 
     // The following method can only be called from
     // OnInitialize(), OnStateChange() and OnCancel().
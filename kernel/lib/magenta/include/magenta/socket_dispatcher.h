@@ -44,31 +44,58 @@ public:
     mx_status_t Read(void* dest, size_t len, bool from_user,
                      size_t* nread);
 
+    // Splice between the socket and a vmo without an intermediate buffer.
+    mx_status_t WriteFromVmo(mxtl::RefPtr<VmObject> vmo, uint64_t offset, size_t len,
+                             size_t* nwritten);
+    mx_status_t ReadToVmo(mxtl::RefPtr<VmObject> vmo, uint64_t offset, size_t len,
+                          size_t* nread);
+
     void OnPeerZeroHandles();
 
 private:
+    // Circular buffer backed by a lazily committed VMO. No memory is
+    // allocated until the first write, pages are committed as the head
+    // advances into them, and everything but the first few pages is
+    // returned to the system whenever the buffer drains.
     class CBuf {
     public:
-        ~CBuf();
-        bool Init(uint32_t len);
-        size_t Write(const void* src, size_t len, bool from_user);
-        size_t Read(void* dest, size_t len, bool from_user);
+        void Init(uint32_t len_pow2);
+        mx_status_t Write(const void* src, size_t len, bool from_user, size_t* written);
+        mx_status_t Read(void* dest, size_t len, bool from_user, size_t* read);
+        mx_status_t WriteFromVmo(VmObject* vmo, uint64_t offset, size_t len, size_t* written);
+        mx_status_t ReadToVmo(VmObject* vmo, uint64_t offset, size_t len, size_t* read);
         size_t CouldRead() const;
         size_t free() const;
         bool empty() const;
 
     private:
+        // |copy_in| and |copy_out| move |len| bytes at |pos| in the caller's
+        // source or destination to or from |offset| in the buffer's vmo.
+        // Both fail only if nothing could be copied; a later fault makes the
+        // transfer short instead.
+        template <typename T>
+        mx_status_t WriteInternal(size_t len, size_t* written, T copy_in);
+        template <typename T>
+        mx_status_t ReadInternal(size_t len, size_t* read, T copy_out);
+        void Drained();
+
         size_t head_ = 0u;
         size_t tail_ = 0u;
+        // One past the highest offset written since the buffer last drained,
+        // i.e. the extent of the committed pages.
+        size_t high_water_ = 0u;
         uint32_t len_pow2_ = 0u;
-        char* buf_ = nullptr;
         mxtl::RefPtr<VmObject> vmo_;
     };
 
     SocketDispatcher(uint32_t flags);
-    mx_status_t Init(mxtl::RefPtr<SocketDispatcher> other);
-    mx_status_t WriteSelf(const void* src, size_t len, bool from_user,
-                          size_t* nwritten);
+    mx_status_t Init(mxtl::RefPtr<SocketDispatcher> other, uint32_t size_log2);
+    template <typename T>
+    mx_status_t WriteHelper(T cbuf_write, size_t* nwritten);
+    template <typename T>
+    mx_status_t WriteSelf(T cbuf_write, size_t* nwritten);
+    template <typename T>
+    mx_status_t ReadHelper(T cbuf_read, size_t* nread);
     status_t UserSignalSelf(uint32_t clear_mask, uint32_t set_mask);
     status_t HalfCloseOther();
 
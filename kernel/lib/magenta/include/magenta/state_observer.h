@@ -55,6 +55,12 @@ public:
     // is safe to delete the observer.
     virtual void OnRemoved() {}
 
+    // The signals this observer needs OnStateChange() for. The StateTracker reads this once,
+    // when the observer is added, and skips the observer for changes that neither set nor
+    // clear any of these signals. Observers that never care about state changes (only about
+    // cancellation) can return 0.
+    virtual mx_signals_t watched_signals() const { return ~0u; }
+
     // Return true to have the observer removed from the state_observer after calling either
     // OnInitialize() OnStateChange() or OnCancel().
     bool remove() const { return remove_; }
@@ -67,8 +73,14 @@ protected:
 private:
     mxtl::Canary<mxtl::magic("SOBS")> canary_;
 
+    friend class StateTracker;
     friend struct StateObserverListTraits;
     mxtl::DoublyLinkedListNodeState<StateObserver*> state_observer_list_node_state_;
+
+    // Which of the StateTracker's observer lists this is on, and the watched_signals() it was
+    // filed under. Owned by the StateTracker, under its lock.
+    mx_signals_t tracker_watched_ = 0u;
+    uint32_t tracker_list_ = 0u;
 };
 
 // For use by StateTracker to maintain a list of StateObservers. (We don't use the default traits so
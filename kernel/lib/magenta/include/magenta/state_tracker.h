@@ -66,11 +66,26 @@ public:
     mx_status_t GetCookie(CookieJar* cookiejar, mx_koid_t scope, uint64_t* cookie);
 
 private:
+    // Observers are filed on one list per distinct StateObserver::watched_signals() mask, so
+    // that a state change only walks the observers watching a signal that changed. Objects
+    // rarely have more than a couple of distinct masks at a time; observers whose mask does not
+    // get a list of its own share the last one and are filtered one by one.
+    static constexpr uint32_t kNumObserverLists = 4u;
+    static constexpr uint32_t kSharedList = kNumObserverLists - 1u;
+
+    // Calls |f| on every observer watching any of |changed| (or on every observer if |all|),
+    // moving those that ask to be removed to |obs_to_remove|. Returns true if |f| did.
+    template <typename Func>
+    bool ForEachObserverLocked(bool all, mx_signals_t changed, ObserverList* obs_to_remove,
+                               Func f) TA_REQ(lock_);
+
     mxtl::Canary<mxtl::magic("STRK")> canary_;
 
     mx_signals_t signals_;
     Mutex lock_;
 
-    // Active observers are elements in |observers_|.
-    ObserverList observers_ TA_GUARDED(lock_);
+    // Active observers are elements in |observers_|. A non-empty list is keyed by
+    // |list_watched_|, which for the shared list is the union of its observers' masks.
+    ObserverList observers_[kNumObserverLists] TA_GUARDED(lock_);
+    mx_signals_t list_watched_[kNumObserverLists] TA_GUARDED(lock_) = {};
 };
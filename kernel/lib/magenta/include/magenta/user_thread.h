@@ -155,6 +155,11 @@ public:
     // For ChannelDispatcher use.
     ChannelDispatcher::MessageWaiter* GetMessageWaiter() { return &channel_waiter_; }
 
+    // For the handle reaper, see ReapOwedHandles(). Only the thread itself
+    // touches this.
+    uint64_t reap_owed() const { return reap_owed_; }
+    void set_reap_owed(uint64_t count) { reap_owed_ = count; }
+
 private:
     UserThread(const UserThread&) = delete;
     UserThread& operator=(const UserThread&) = delete;
@@ -205,6 +210,9 @@ private:
     // Node for linked list of threads blocked on a futex
     FutexNode futex_node_;
 
+    // Handles this thread queued for the reapers while they were behind.
+    uint64_t reap_owed_ = 0u;
+
     StateTracker state_tracker_;
 
     // A thread-level exception port for this thread.
@@ -65,8 +65,9 @@ public:
 
         ~Entry();
 
-        // Const, hence these don't care about locking:
-        mx_signals_t watched_signals() const { return watched_signals_; }
+        // Results report the handle's whole signal state, so entries hear
+        // about every change, not just changes to |watched_signals_|.
+        mx_signals_t watched_signals() const final { return ~0u; }
 
         void InitLocked(WaitSetDispatcher* wait_set, Handle* handle);
         State GetStateLocked() const;
@@ -150,6 +151,7 @@ private:
     bool OnInitialize(mx_signals_t initial_state, const StateObserver::CountInfo* cinfo) final;
     bool OnStateChange(mx_signals_t new_state) final;
     bool OnCancel(Handle* handle) final;
+    mx_signals_t watched_signals() const final { return 0u; }
 
     mxtl::Canary<mxtl::magic("WTSD")> canary_;
 
@@ -39,6 +39,7 @@ private:
     bool OnInitialize(mx_signals_t initial_state, const StateObserver::CountInfo* cinfo) final;
     bool OnStateChange(mx_signals_t new_state) final;
     bool OnCancel(Handle* handle) final;
+    mx_signals_t watched_signals() const final { return watched_signals_; }
 
     mxtl::Canary<mxtl::magic("WTSO")> canary_;
 
@@ -17,7 +17,6 @@
 #include <lib/user_copy/user_ptr.h>
 
 #include <kernel/auto_lock.h>
-#include <kernel/vm/vm_aspace.h>
 #include <kernel/vm/vm_object.h>
 
 #include <magenta/handle.h>
@@ -28,7 +27,12 @@
 constexpr mx_rights_t kDefaultSocketRights =
     MX_RIGHT_TRANSFER | MX_RIGHT_DUPLICATE | MX_RIGHT_READ | MX_RIGHT_WRITE;
 
-constexpr size_t kDeFaultSocketBufferSize = 256 * 1024u;
+// Each end buffers up to 256KB by default. Memory is committed on demand.
+constexpr uint32_t kDefaultSocketBufferSizeLog2 = 18u;
+
+// How much of a buffer stays committed when it drains, so that small
+// messages going back and forth do not fault in pages on every write.
+constexpr size_t kDrainKeepSize = 4u * PAGE_SIZE;
 
 constexpr mx_signals_t kValidSignalMask =
     MX_SOCKET_READABLE | MX_SOCKET_PEER_CLOSED | MX_USER_SIGNAL_ALL;
@@ -40,29 +44,18 @@ template <typename T> T vmodpow2(T val, uint modp2) { return val & ((1U << modp2
 
 #define INC_POINTER(len_pow2, ptr, inc) vmodpow2(((ptr) + (inc)), len_pow2)
 
-SocketDispatcher::CBuf::~CBuf() {
-    VmAspace::kernel_aspace()->FreeRegion(reinterpret_cast<vaddr_t>(buf_));
+void SocketDispatcher::CBuf::Init(uint32_t len_pow2) {
+    len_pow2_ = len_pow2;
 }
 
-bool SocketDispatcher::CBuf::Init(uint32_t len) {
-    vmo_ = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, len);
-    if (!vmo_)
-        return false;
-
-    void* start = nullptr;
-    auto st = VmAspace::kernel_aspace()->MapObject(
-        vmo_, "socket", 0u, len, &start, PAGE_SIZE_SHIFT, 0,
-        0, ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE);
-
-    if (st < 0)
-        return false;
-
-    buf_ = reinterpret_cast<char*>(start);
-
-    if (!buf_)
-        return false;
-    len_pow2_ = log2_uint_floor(len);
-    return true;
+void SocketDispatcher::CBuf::Drained() {
+    // Restart at the front so that the next writes land in the pages we
+    // keep, and hand everything past them back to the system.
+    head_ = tail_ = 0u;
+    if (high_water_ > kDrainKeepSize) {
+        vmo_->DecommitRange(kDrainKeepSize, high_water_ - kDrainKeepSize, nullptr);
+        high_water_ = kDrainKeepSize;
+    }
 }
 
 size_t SocketDispatcher::CBuf::free() const {
@@ -74,7 +67,14 @@ bool SocketDispatcher::CBuf::empty() const {
     return tail_ == head_;
 }
 
-size_t SocketDispatcher::CBuf::Write(const void* src, size_t len, bool from_user) {
+template <typename T>
+mx_status_t SocketDispatcher::CBuf::WriteInternal(size_t len, size_t* written, T copy_in) {
+    if (!vmo_) {
+        // The pages themselves are only committed as they are written.
+        vmo_ = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, valpow2(len_pow2_));
+        if (!vmo_)
+            return ERR_NO_MEMORY;
+    }
 
     size_t write_len;
     size_t pos = 0;
@@ -100,55 +100,136 @@ size_t SocketDispatcher::CBuf::Write(const void* src, size_t len, bool from_user
             break;
         }
 
-        const char *ptr = (const char*)src;
-        ptr += pos;
-        if (from_user) {
-            // TODO: find a safer way to do this
-            user_ptr<const void> uptr(ptr);
-            vmo_->WriteUser(uptr, head_, write_len, nullptr);
-        } else {
-            memcpy(buf_ + head_, ptr, write_len);
+        status_t status = copy_in(head_, pos, write_len);
+        if (status != NO_ERROR) {
+            // Report a short write if anything made it in.
+            if (pos == 0)
+                return status;
+            break;
         }
 
+        high_water_ = MAX(high_water_, head_ + write_len);
         head_ = INC_POINTER(len_pow2_, head_, write_len);
         pos += write_len;
     }
-    return pos;
+    *written = pos;
+    return NO_ERROR;
 }
 
-size_t SocketDispatcher::CBuf::Read(void* dest, size_t len, bool from_user) {
-    size_t ret = 0;
-
-    if (tail_ != head_) {
-        size_t pos = 0;
-        // loop until we've read everything we need
-        // at most this will make two passes to deal with wraparound
-        while (pos < len && tail_ != head_) {
-            size_t read_len;
-            if (head_ > tail_) {
-                // simple case where there is no wraparound
-                read_len = MIN(head_ - tail_, len - pos);
-            } else {
-                // read to the end of buffer in this pass
-                read_len = MIN(valpow2(len_pow2_) - tail_, len - pos);
-            }
+template <typename T>
+mx_status_t SocketDispatcher::CBuf::ReadInternal(size_t len, size_t* read, T copy_out) {
+    size_t pos = 0;
 
-            char *ptr = (char*)dest;
-            ptr += pos;
-            if (from_user) {
-                // TODO: find a safer way to do this
-                user_ptr<void> uptr(ptr);
-                vmo_->ReadUser(uptr, tail_, read_len, nullptr);
-            } else {
-                memcpy(ptr, buf_ + tail_, read_len);
-            }
+    // loop until we've read everything we need
+    // at most this will make two passes to deal with wraparound
+    while (pos < len && tail_ != head_) {
+        size_t read_len;
+        if (head_ > tail_) {
+            // simple case where there is no wraparound
+            read_len = MIN(head_ - tail_, len - pos);
+        } else {
+            // read to the end of buffer in this pass
+            read_len = MIN(valpow2(len_pow2_) - tail_, len - pos);
+        }
 
-            tail_ = INC_POINTER(len_pow2_, tail_, read_len);
-            pos += read_len;
+        // Leave the data in place if it could not be copied out, and report
+        // a short read if anything was.
+        status_t status = copy_out(tail_, pos, read_len);
+        if (status != NO_ERROR) {
+            if (pos == 0)
+                return status;
+            break;
         }
-        ret = pos;
+
+        tail_ = INC_POINTER(len_pow2_, tail_, read_len);
+        pos += read_len;
     }
-    return ret;
+
+    if (pos > 0 && tail_ == head_)
+        Drained();
+
+    *read = pos;
+    return NO_ERROR;
+}
+
+mx_status_t SocketDispatcher::CBuf::Write(const void* src, size_t len, bool from_user,
+                                          size_t* written) {
+    return WriteInternal(len, written, [this, src, from_user](size_t offset, size_t pos,
+                                                               size_t len) -> status_t {
+        const char* ptr = static_cast<const char*>(src) + pos;
+        if (from_user) {
+            // TODO: find a safer way to do this
+            user_ptr<const void> uptr(ptr);
+            return vmo_->WriteUser(uptr, offset, len, nullptr);
+        }
+        return vmo_->Write(ptr, offset, len, nullptr);
+    });
+}
+
+mx_status_t SocketDispatcher::CBuf::Read(void* dest, size_t len, bool from_user,
+                                         size_t* read) {
+    return ReadInternal(len, read, [this, dest, from_user](size_t offset, size_t pos,
+                                                     size_t len) -> status_t {
+        char* ptr = static_cast<char*>(dest) + pos;
+        if (from_user) {
+            // TODO: find a safer way to do this
+            user_ptr<void> uptr(ptr);
+            return vmo_->ReadUser(uptr, offset, len, nullptr);
+        }
+        return vmo_->Read(ptr, offset, len, nullptr);
+    });
+}
+
+namespace {
+struct VmoCopyArgs {
+    VmObject* other;
+    // The range of the buffer's vmo being copied, and where it lands in |other|.
+    uint64_t offset;
+    uint64_t len;
+    uint64_t other_offset;
+    bool to_other;
+};
+
+// Lookup callback that copies between one page of a socket buffer and
+// another vmo through the kernel's physmap, without an intermediate buffer.
+status_t VmoCopyPage(void* context, size_t offset, size_t index, paddr_t pa) {
+    auto args = static_cast<VmoCopyArgs*>(context);
+
+    uint64_t start = MAX(offset, args->offset);
+    uint64_t end = MIN(offset + PAGE_SIZE, args->offset + args->len);
+    char* ptr = static_cast<char*>(paddr_to_kvaddr(pa)) + (start - offset);
+    uint64_t other_offset = args->other_offset + (start - args->offset);
+    size_t len = static_cast<size_t>(end - start);
+
+    size_t actual = 0;
+    status_t status = args->to_other ? args->other->Write(ptr, other_offset, len, &actual)
+                                     : args->other->Read(ptr, other_offset, len, &actual);
+    if (status != NO_ERROR)
+        return status;
+    return (actual == len) ? NO_ERROR : ERR_OUT_OF_RANGE;
+}
+} // namespace
+
+// Both directions walk the pages of the socket buffer's own vmo, so its lock
+// is always taken before the lock of |vmo|. The buffer's vmo is never
+// exposed outside the socket, so this cannot invert against another path.
+mx_status_t SocketDispatcher::CBuf::WriteFromVmo(VmObject* vmo, uint64_t vmo_offset, size_t len,
+                                                 size_t* written) {
+    return WriteInternal(len, written, [this, vmo, vmo_offset](size_t offset, size_t pos,
+                                                                size_t len) -> status_t {
+        VmoCopyArgs args = {vmo, offset, len, vmo_offset + pos, false};
+        return vmo_->Lookup(offset, len, VMM_PF_FLAG_SW_FAULT | VMM_PF_FLAG_WRITE,
+                            VmoCopyPage, &args);
+    });
+}
+
+mx_status_t SocketDispatcher::CBuf::ReadToVmo(VmObject* vmo, uint64_t vmo_offset, size_t len,
+                                              size_t* read) {
+    return ReadInternal(len, read, [this, vmo, vmo_offset](size_t offset, size_t pos,
+                                                      size_t len) -> status_t {
+        VmoCopyArgs args = {vmo, offset, len, vmo_offset + pos, true};
+        return vmo_->Lookup(offset, len, VMM_PF_FLAG_SW_FAULT, VmoCopyPage, &args);
+    });
 }
 
 size_t SocketDispatcher::CBuf::CouldRead() const {
@@ -162,6 +243,13 @@ status_t SocketDispatcher::Create(uint32_t flags,
                                   mx_rights_t* rights) {
     LTRACE_ENTRY;
 
+    uint32_t size_log2 = (flags & MX_SOCKET_SIZE_MASK) >> MX_SOCKET_SIZE_SHIFT;
+    if (size_log2 == 0u) {
+        size_log2 = kDefaultSocketBufferSizeLog2;
+    } else if (size_log2 < MX_SOCKET_SIZE_LOG2_MIN || size_log2 > MX_SOCKET_SIZE_LOG2_MAX) {
+        return ERR_INVALID_ARGS;
+    }
+
     AllocChecker ac;
     auto socket0 = mxtl::AdoptRef(new (&ac) SocketDispatcher(flags));
     if (!ac.check())
@@ -172,9 +260,9 @@ status_t SocketDispatcher::Create(uint32_t flags,
         return ERR_NO_MEMORY;
 
     mx_status_t status;
-    if ((status = socket0->Init(socket1)) != NO_ERROR)
+    if ((status = socket0->Init(socket1, size_log2)) != NO_ERROR)
         return status;
-    if ((status = socket1->Init(socket0)) != NO_ERROR)
+    if ((status = socket1->Init(socket0, size_log2)) != NO_ERROR)
         return status;
 
     *rights = kDefaultSocketRights;
@@ -194,10 +282,12 @@ SocketDispatcher::~SocketDispatcher() {
 
 // This is called before either SocketDispatcher is accessible from threads other than the one
 // initializing the socket, so it does not need locking.
-mx_status_t SocketDispatcher::Init(mxtl::RefPtr<SocketDispatcher> other) TA_NO_THREAD_SAFETY_ANALYSIS {
+mx_status_t SocketDispatcher::Init(mxtl::RefPtr<SocketDispatcher> other,
+                                   uint32_t size_log2) TA_NO_THREAD_SAFETY_ANALYSIS {
     other_ = mxtl::move(other);
     peer_koid_ = other_->get_koid();
-    return cbuf_.Init(kDeFaultSocketBufferSize) ? NO_ERROR : ERR_NO_MEMORY;
+    cbuf_.Init(size_log2);
+    return NO_ERROR;
 }
 
 void SocketDispatcher::on_zero_handles() {
@@ -306,8 +396,8 @@ status_t SocketDispatcher::HalfCloseOther() {
     return NO_ERROR;
 }
 
-mx_status_t SocketDispatcher::Write(const void* src, size_t len,
-                                    bool from_user, size_t* nwritten) {
+template <typename T>
+mx_status_t SocketDispatcher::WriteHelper(T cbuf_write, size_t* nwritten) {
     canary_.Assert();
 
     mxtl::RefPtr<SocketDispatcher> other;
@@ -320,11 +410,11 @@ mx_status_t SocketDispatcher::Write(const void* src, size_t len,
         other = other_;
     }
 
-    return other->WriteSelf(src, len, from_user, nwritten);
+    return other->WriteSelf(cbuf_write, nwritten);
 }
 
-mx_status_t SocketDispatcher::WriteSelf(const void* src, size_t len,
-                                        bool from_user, size_t* written) {
+template <typename T>
+mx_status_t SocketDispatcher::WriteSelf(T cbuf_write, size_t* written) {
     canary_.Assert();
 
     AutoLock lock(&lock_);
@@ -334,7 +424,10 @@ mx_status_t SocketDispatcher::WriteSelf(const void* src, size_t len,
 
     bool was_empty = cbuf_.empty();
 
-    auto st = cbuf_.Write(src, len, from_user);
+    size_t st;
+    mx_status_t status = cbuf_write(&cbuf_, &st);
+    if (status != NO_ERROR)
+        return status;
 
     if (st > 0) {
         if (was_empty)
@@ -350,18 +443,12 @@ mx_status_t SocketDispatcher::WriteSelf(const void* src, size_t len,
     return NO_ERROR;
 }
 
-mx_status_t SocketDispatcher::Read(void* dest, size_t len,
-                                   bool from_user, size_t* nread) {
+template <typename T>
+mx_status_t SocketDispatcher::ReadHelper(T cbuf_read, size_t* nread) {
     canary_.Assert();
 
     AutoLock lock(&lock_);
 
-    // Just query for bytes outstanding.
-    if (!dest && len == 0) {
-        *nread = cbuf_.CouldRead();
-        return NO_ERROR;
-    }
-
     bool closed = half_closed_[1] || !other_;
 
     if (cbuf_.empty())
@@ -369,7 +456,10 @@ mx_status_t SocketDispatcher::Read(void* dest, size_t len,
 
     bool was_full = cbuf_.free() == 0u;
 
-    auto st = cbuf_.Read(dest, len, from_user);
+    size_t st;
+    mx_status_t status = cbuf_read(&cbuf_, &st);
+    if (status != NO_ERROR)
+        return status;
 
     if (cbuf_.empty()) {
         state_tracker_.UpdateState(MX_SOCKET_READABLE, 0u);
@@ -378,6 +468,43 @@ mx_status_t SocketDispatcher::Read(void* dest, size_t len,
     if (!closed && was_full && (st > 0))
         other_->state_tracker_.UpdateState(0u, MX_SOCKET_WRITABLE);
 
-    *nread = static_cast<size_t>(st);
+    *nread = st;
     return NO_ERROR;
 }
+
+mx_status_t SocketDispatcher::Write(const void* src, size_t len,
+                                    bool from_user, size_t* nwritten) {
+    return WriteHelper([src, len, from_user](CBuf* cbuf, size_t* written) {
+        return cbuf->Write(src, len, from_user, written);
+    }, nwritten);
+}
+
+mx_status_t SocketDispatcher::WriteFromVmo(mxtl::RefPtr<VmObject> vmo, uint64_t offset,
+                                           size_t len, size_t* nwritten) {
+    return WriteHelper([&vmo, offset, len](CBuf* cbuf, size_t* written) {
+        return cbuf->WriteFromVmo(vmo.get(), offset, len, written);
+    }, nwritten);
+}
+
+mx_status_t SocketDispatcher::Read(void* dest, size_t len,
+                                   bool from_user, size_t* nread) {
+    canary_.Assert();
+
+    // Just query for bytes outstanding.
+    if (!dest && len == 0) {
+        AutoLock lock(&lock_);
+        *nread = cbuf_.CouldRead();
+        return NO_ERROR;
+    }
+
+    return ReadHelper([dest, len, from_user](CBuf* cbuf, size_t* read) {
+        return cbuf->Read(dest, len, from_user, read);
+    }, nread);
+}
+
+mx_status_t SocketDispatcher::ReadToVmo(mxtl::RefPtr<VmObject> vmo, uint64_t offset,
+                                        size_t len, size_t* nread) {
+    return ReadHelper([&vmo, offset, len](CBuf* cbuf, size_t* read) {
+        return cbuf->ReadToVmo(vmo.get(), offset, len, read);
+    }, nread);
+}
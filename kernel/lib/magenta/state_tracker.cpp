@@ -7,50 +7,86 @@
 #include <magenta/state_tracker.h>
 
 #include <kernel/auto_lock.h>
+#include <kernel/thread.h>
 #include <magenta/wait_event.h>
 
 namespace {
 
+void FinishNotify(StateTracker::ObserverList* obs_to_remove, bool awoke_threads) {
+    while (!obs_to_remove->is_empty()) {
+        obs_to_remove->pop_front()->OnRemoved();
+    }
+
+    if (awoke_threads)
+        thread_preempt(false);
+}
+}  // namespace
+
 template <typename Func>
-void CancelWithFunc(StateTracker::ObserverList* observers, Mutex* observer_lock, Func f) {
+bool StateTracker::ForEachObserverLocked(bool all, mx_signals_t changed,
+                                         ObserverList* obs_to_remove, Func f) {
     bool awoke_threads = false;
 
-    StateTracker::ObserverList obs_to_remove;
+    for (uint32_t i = 0; i < kNumObserverLists; ++i) {
+        ObserverList& observers = observers_[i];
+        if (observers.is_empty() || (!all && !(list_watched_[i] & changed)))
+            continue;
 
-    {
-        AutoLock lock(observer_lock);
-        for (auto it = observers->begin(); it != observers->end();) {
+        // Everyone on a dedicated list watches exactly |list_watched_[i]|.
+        bool filter = !all && (i == kSharedList);
+
+        for (auto it = observers.begin(); it != observers.end();) {
+            if (filter && !(it->tracker_watched_ & changed)) {
+                ++it;
+                continue;
+            }
             awoke_threads = f(it.CopyPointer()) || awoke_threads;
             if (it->remove()) {
                 auto to_remove = it;
                 ++it;
-                obs_to_remove.push_back(observers->erase(to_remove));
+                obs_to_remove->push_back(observers.erase(to_remove));
             } else {
                 ++it;
             }
         }
     }
 
-    while (!obs_to_remove.is_empty()) {
-        obs_to_remove.pop_front()->OnRemoved();
-    }
-
-    if (awoke_threads)
-        thread_preempt(false);
+    return awoke_threads;
 }
-}  // namespace
 
 void StateTracker::AddObserver(StateObserver* observer, const StateObserver::CountInfo* cinfo) {
     canary_.Assert();
     DEBUG_ASSERT(observer != nullptr);
 
+    mx_signals_t watched = observer->watched_signals();
+
     bool awoke_threads = false;
     {
         AutoLock lock(&lock_);
 
         awoke_threads = observer->OnInitialize(signals_, cinfo);
-        if (!observer->remove())
-            observers_.push_front(observer);
+        if (!observer->remove()) {
+            // Join the list for this mask, or claim an empty one, or fall back to sharing.
+            uint32_t list = kSharedList;
+            for (uint32_t i = 0; i < kSharedList; ++i) {
+                if (observers_[i].is_empty()) {
+                    if (list == kSharedList)
+                        list = i;
+                } else if (list_watched_[i] == watched) {
+                    list = i;
+                    break;
+                }
+            }
+            if (observers_[list].is_empty()) {
+                list_watched_[list] = watched;
+            } else if (list == kSharedList) {
+                list_watched_[list] |= watched;
+            }
+
+            observer->tracker_watched_ = watched;
+            observer->tracker_list_ = list;
+            observers_[list].push_front(observer);
+        }
     }
     if (awoke_threads)
         thread_preempt(false);
@@ -61,23 +97,42 @@ void StateTracker::RemoveObserver(StateObserver* observer) {
 
     AutoLock lock(&lock_);
     DEBUG_ASSERT(observer != nullptr);
-    observers_.erase(*observer);
+    DEBUG_ASSERT(observer->tracker_list_ < kNumObserverLists);
+    observers_[observer->tracker_list_].erase(*observer);
 }
 
 void StateTracker::Cancel(Handle* handle) {
     canary_.Assert();
 
-    CancelWithFunc(&observers_, &lock_, [handle](StateObserver* obs) {
-        return obs->OnCancel(handle);
-    });
+    bool awoke_threads;
+    ObserverList obs_to_remove;
+
+    {
+        AutoLock lock(&lock_);
+        awoke_threads = ForEachObserverLocked(true, 0u, &obs_to_remove,
+                                              [handle](StateObserver* obs) {
+            return obs->OnCancel(handle);
+        });
+    }
+
+    FinishNotify(&obs_to_remove, awoke_threads);
 }
 
 void StateTracker::CancelByKey(Handle* handle, const void* port, uint64_t key) {
     canary_.Assert();
 
-    CancelWithFunc(&observers_, &lock_, [handle, port, key](StateObserver* obs) {
-        return obs->OnCancelByKey(handle, port, key);
-    });
+    bool awoke_threads;
+    ObserverList obs_to_remove;
+
+    {
+        AutoLock lock(&lock_);
+        awoke_threads = ForEachObserverLocked(true, 0u, &obs_to_remove,
+                                              [handle, port, key](StateObserver* obs) {
+            return obs->OnCancelByKey(handle, port, key);
+        });
+    }
+
+    FinishNotify(&obs_to_remove, awoke_threads);
 }
 
 void StateTracker::UpdateState(mx_signals_t clear_mask,
@@ -88,6 +143,8 @@ void StateTracker::UpdateState(mx_signals_t clear_mask,
 
     ObserverList obs_to_remove;
 
+    // Wake everyone first, and kick each cpu that has to pick them up once.
+    thread_wake_batch_begin();
     {
         AutoLock lock(&lock_);
 
@@ -95,62 +152,47 @@ void StateTracker::UpdateState(mx_signals_t clear_mask,
         signals_ &= ~clear_mask;
         signals_ |= set_mask;
 
-        if (previous_signals == signals_)
-            return;
-
-        for (auto it = observers_.begin(); it != observers_.end();) {
-            awoke_threads = it->OnStateChange(signals_) || awoke_threads;
-            if (it->remove()) {
-                auto to_remove = it;
-                ++it;
-                obs_to_remove.push_back(observers_.erase(to_remove));
-            } else {
-                ++it;
-            }
+        // Only observers watching a signal that actually flipped care; in
+        // particular nobody hears about a no-op update.
+        mx_signals_t changed = previous_signals ^ signals_;
+        if (changed) {
+            mx_signals_t new_state = signals_;
+            awoke_threads = ForEachObserverLocked(false, changed, &obs_to_remove,
+                                                  [new_state](StateObserver* obs) {
+                return obs->OnStateChange(new_state);
+            });
         }
     }
+    thread_wake_batch_end();
 
-    while (!obs_to_remove.is_empty()) {
-        obs_to_remove.pop_front()->OnRemoved();
-    }
-
-    if (awoke_threads) {
-        thread_preempt(false);
-    }
+    FinishNotify(&obs_to_remove, awoke_threads);
 }
 
 void StateTracker::StrobeState(mx_signals_t notify_mask) {
     canary_.Assert();
 
+    if (notify_mask == 0u)
+        return;
+
     bool awoke_threads = false;
 
     ObserverList obs_to_remove;
 
+    thread_wake_batch_begin();
     {
         AutoLock lock(&lock_);
 
         // include currently active signals as well
-        notify_mask |= signals_;
-
-        for (auto it = observers_.begin(); it != observers_.end();) {
-            awoke_threads = it->OnStateChange(notify_mask) || awoke_threads;
-            if (it->remove()) {
-                auto to_remove = it;
-                ++it;
-                obs_to_remove.push_back(observers_.erase(to_remove));
-            } else {
-                ++it;
-            }
-        }
-    }
+        mx_signals_t new_state = notify_mask | signals_;
 
-    while (!obs_to_remove.is_empty()) {
-        obs_to_remove.pop_front()->OnRemoved();
+        awoke_threads = ForEachObserverLocked(false, notify_mask, &obs_to_remove,
+                                              [new_state](StateObserver* obs) {
+            return obs->OnStateChange(new_state);
+        });
     }
+    thread_wake_batch_end();
 
-    if (awoke_threads) {
-        thread_preempt(false);
-    }
+    FinishNotify(&obs_to_remove, awoke_threads);
 }
 
 mx_status_t StateTracker::SetCookie(CookieJar* cookiejar, mx_koid_t scope, uint64_t cookie) {
@@ -43,8 +43,12 @@ mx_signals_t WaitStateObserver::End() {
 
     auto tracker = dispatcher_->get_state_tracker();
     DEBUG_ASSERT(tracker);
-    if (tracker)
+    if (tracker) {
         tracker->RemoveObserver(this);
+        // We are only told about changes to |watched_signals_|, so pick up
+        // whatever else is asserted now.
+        wakeup_reasons_ |= tracker->GetSignalsState();
+    }
     dispatcher_.reset();
 
     // Return the set of reasons that we may have been woken.  Basically, this
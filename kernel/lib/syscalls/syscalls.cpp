@@ -7,6 +7,7 @@
 #include <err.h>
 #include <lib/ktrace.h>
 #include <kernel/thread.h>
+#include <magenta/handle_reaper.h>
 #include <platform.h>
 #include <trace.h>
 
@@ -67,6 +68,9 @@ extern "C" void arm64_syscall(struct arm64_iframe_long* frame, bool is_64bit, ui
     /* put the return code back */
     frame->r[0] = ret;
 
+    /* delete any handles we queued faster than the reapers keep up */
+    ReapOwedHandles();
+
     /* check to see if there are any pending signals */
     thread_process_pending_signals();
 
@@ -105,6 +109,9 @@ uint64_t x86_64_syscall(uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t ar
 
     uint64_t ret = invoke_syscall(syscall_num, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8);
 
+    /* delete any handles we queued faster than the reapers keep up */
+    ReapOwedHandles();
+
     /* check to see if there are any pending signals */
     thread_process_pending_signals();
 
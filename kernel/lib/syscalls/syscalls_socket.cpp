@@ -16,9 +16,12 @@
 #include <lib/user_copy.h>
 #include <lib/user_copy/user_ptr.h>
 
+#include <kernel/vm/vm_object.h>
+
 #include <magenta/handle_owner.h>
 #include <magenta/process_dispatcher.h>
 #include <magenta/socket_dispatcher.h>
+#include <magenta/vm_object_dispatcher.h>
 
 #include <mxtl/ref_ptr.h>
 
@@ -29,7 +32,7 @@
 mx_status_t sys_socket_create(uint32_t options, user_ptr<mx_handle_t> _out0, user_ptr<mx_handle_t> _out1) {
     LTRACEF("entry out_handles %p, %p\n", _out0.get(), _out1.get());
 
-    if (options != 0u)
+    if (options & ~MX_SOCKET_SIZE_MASK)
         return ERR_INVALID_ARGS;
 
     mxtl::RefPtr<Dispatcher> socket0, socket1;
@@ -124,3 +127,77 @@ mx_status_t sys_socket_read(mx_handle_t handle, uint32_t options,
 
     return status;
 }
+
+mx_status_t sys_socket_write_vmo(mx_handle_t handle, uint32_t options,
+                                 mx_handle_t vmo_handle, uint64_t offset, size_t size,
+                                 user_ptr<size_t> _actual) {
+    LTRACEF("handle %d, vmo %d, offset %#" PRIx64 ", size %#zx\n",
+            handle, vmo_handle, offset, size);
+
+    if (options)
+        return ERR_INVALID_ARGS;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<SocketDispatcher> socket;
+    mx_status_t status = up->GetDispatcherWithRights(handle, MX_RIGHT_WRITE, &socket);
+    if (status != NO_ERROR)
+        return status;
+
+    mxtl::RefPtr<VmObjectDispatcher> vmo;
+    status = up->GetDispatcherWithRights(vmo_handle, MX_RIGHT_READ, &vmo);
+    if (status != NO_ERROR)
+        return status;
+
+    // Transfers stop short at the end of the vmo.
+    uint64_t vmo_size = vmo->vmo()->size();
+    if (offset > vmo_size)
+        return ERR_OUT_OF_RANGE;
+    size = static_cast<size_t>(MIN(size, vmo_size - offset));
+
+    size_t nwritten;
+    status = socket->WriteFromVmo(vmo->vmo(), offset, size, &nwritten);
+
+    // Caller may ignore results if desired.
+    if (status == NO_ERROR && _actual)
+        status = _actual.copy_to_user(nwritten);
+
+    return status;
+}
+
+mx_status_t sys_socket_read_vmo(mx_handle_t handle, uint32_t options,
+                                mx_handle_t vmo_handle, uint64_t offset, size_t size,
+                                user_ptr<size_t> _actual) {
+    LTRACEF("handle %d, vmo %d, offset %#" PRIx64 ", size %#zx\n",
+            handle, vmo_handle, offset, size);
+
+    if (options)
+        return ERR_INVALID_ARGS;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<SocketDispatcher> socket;
+    mx_status_t status = up->GetDispatcherWithRights(handle, MX_RIGHT_READ, &socket);
+    if (status != NO_ERROR)
+        return status;
+
+    mxtl::RefPtr<VmObjectDispatcher> vmo;
+    status = up->GetDispatcherWithRights(vmo_handle, MX_RIGHT_WRITE, &vmo);
+    if (status != NO_ERROR)
+        return status;
+
+    // Transfers stop short at the end of the vmo.
+    uint64_t vmo_size = vmo->vmo()->size();
+    if (offset > vmo_size)
+        return ERR_OUT_OF_RANGE;
+    size = static_cast<size_t>(MIN(size, vmo_size - offset));
+
+    size_t nread;
+    status = socket->ReadToVmo(vmo->vmo(), offset, size, &nread);
+
+    // Caller may ignore results if desired.
+    if (status == NO_ERROR && _actual)
+        status = _actual.copy_to_user(nread);
+
+    return status;
+}
@@ -188,9 +188,10 @@ static void setup_bootfs(void) {
                 const char* errmsg;
                 mx_handle_t bootfs_vmo;
                 printf("devmgr: decompressing bootfs #%u\n", idx);
-                status = decompress_bootdata(mx_vmar_root_self(), vmo,
-                                             off, bootdata.length + sizeof(bootdata),
-                                             &bootfs_vmo, &errmsg);
+                status = decompress_bootdata_parallel(mx_vmar_root_self(), vmo,
+                                                      off, bootdata.length + sizeof(bootdata),
+                                                      mx_system_get_num_cpus(),
+                                                      &bootfs_vmo, &errmsg);
                 if (status < 0) {
                     printf("devmgr: failed to decompress bootdata\n");
                 } else {
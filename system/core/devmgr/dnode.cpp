@@ -45,6 +45,8 @@ void Dnode::RemoveFromParent() {
 
     // Detach from parent
     if (parent_) {
+        // Names change beneath memfs and devfs without going through Vfs.
+        fs::Vfs::DcacheInvalidate(parent_->vnode_, name_.get(), NameLen());
         parent_->children_.erase(*this);
         if (IsDirectory()) {
             // '..' no longer references parent.
@@ -75,6 +77,7 @@ void Dnode::AddChild(mxtl::RefPtr<Dnode> parent, mxtl::RefPtr<Dnode> child) {
     MX_DEBUG_ASSERT(child != parent);
     MX_DEBUG_ASSERT(parent->IsDirectory());
 
+    fs::Vfs::DcacheInvalidate(parent->vnode_, child->name_.get(), child->NameLen());
     child->parent_ = parent;
     child->vnode_->link_count_++;
     if (child->IsDirectory()) {
@@ -7,6 +7,7 @@
 
 #pragma GCC visibility push(hidden)
 
+#include <bootdata/bootfs.h>
 #include <magenta/boot/bootdata.h>
 #include <magenta/syscalls.h>
 #include <string.h>
@@ -33,60 +34,27 @@ void bootfs_unmount(mx_handle_t vmar, mx_handle_t log, mx_handle_t vmo, struct b
     check(log, status, "mx_vmar_unmap failed\n");
 }
 
-struct bootfs_magic {
-    bootdata_t boothdr;
-    char fsmagic[16];
-};
-
 struct bootfs_file {
     uint32_t size, offset;
 };
 
-struct bootfs_header {
-    uint32_t namelen;
-    struct bootfs_file file;
-};
-
 static struct bootfs_file bootfs_search(mx_handle_t log,
                                         struct bootfs *fs,
                                         const char* filename) {
-    static const char FSMAGIC[16] = "[BOOTFS]\0\0\0\0\0\0\0\0";
-    size_t magic_size = sizeof(bootdata_t);
-    if (fs->len < sizeof(struct bootfs_magic))
+    if (fs->len < sizeof(bootdata_t))
         fail(log, ERR_INVALID_ARGS, "bootfs image too small!\n");
-    struct bootfs_magic* magic = (struct bootfs_magic*)fs->contents;
-    if (magic->boothdr.type != BOOTDATA_BOOTFS_BOOT)
+    bootdata_t boothdr;
+    memcpy(&boothdr, fs->contents, sizeof(boothdr));
+    if (boothdr.type != BOOTDATA_BOOTFS_BOOT)
         fail(log, ERR_INVALID_ARGS, "bootdata is not a bootfs!\n");
-    // This field is obsolete, so we can skip it if it doesn't exist.
-    if (!memcmp(magic->fsmagic, FSMAGIC, sizeof(FSMAGIC))) {
-        magic_size = sizeof(struct bootfs_magic);
-    }
-    const uint8_t* p = &fs->contents[magic_size];
-
-    size_t filename_len = strlen(filename) + 1;
-
-    while ((size_t)(p - fs->contents) < fs->len) {
-        struct bootfs_header header;
-        memcpy(&header, p, sizeof(header));
-        p += sizeof(header);
-        size_t left = fs->len - (p - fs->contents);
-
-        if (header.namelen == 0)
-            break;
-
-        if (header.namelen > left)
-            fail(log, ERR_INVALID_ARGS,
-                 "bootfs has bogus namelen in header\n");
-
-        const char* name = (const void*)p;
-        p += header.namelen;
-
-        if (!memcmp(name, filename, filename_len))
-            return header.file;
-    }
 
-    struct bootfs_file runt = { 0, 0 };
-    return runt;
+    struct bootfs_file file = { 0, 0 };
+    mx_status_t status = bootfs_find(fs->contents, fs->len, filename,
+                                     &file.offset, &file.size);
+    if (status == ERR_IO)
+        fail(log, ERR_INVALID_ARGS,
+             "bootfs has bogus namelen in header\n");
+    return file;
 }
 
 mx_handle_t bootfs_open(mx_handle_t log,
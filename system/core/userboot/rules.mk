@@ -43,15 +43,19 @@ MODULE_COMPILEFLAGS += $(NO_SAFESTACK)
 MODULE_STATIC_LIBS := ulib/runtime
 MODULE_HEADER_DEPS := ulib/magenta
 
-# Fortunately, each of these libraries is just a single source file.
-# So we just use their sources directly rather than getting
-# clever with the build system somehow.
+# Fortunately, each of these libraries is just a source file or two
+# (for bootdata, only the serial half of it).  So we just use their
+# sources directly rather than getting clever with the build system
+# somehow.
 
 MODULE_HEADER_DEPS += ulib/elfload
 MODULE_SRCS += system/ulib/elfload/elf-load.c
 
 MODULE_HEADER_DEPS += ulib/bootdata
-MODULE_SRCS += system/ulib/bootdata/decompress.c
+MODULE_SRCS += \
+    system/ulib/bootdata/bootfs.c \
+    system/ulib/bootdata/decompress.c \
+    system/ulib/bootdata/lz4-frame.c
 
 MODULE_HEADER_DEPS += ulib/lz4
 MODULE_SRCS += third_party/ulib/lz4/lz4.c
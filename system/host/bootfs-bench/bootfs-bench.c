@@ -0,0 +1,195 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <lz4frame.h>
+
+#include "decompress-private.h"
+
+// Compresses a file the way mkbootfs compresses a bootfs image, then times
+// decompressing it the way userboot (serially) and devmgr (in parallel) do.
+
+// Must match mkbootfs's defaults.
+static LZ4F_preferences_t lz4_prefs = {
+    .frameInfo = {
+        .blockSizeID = LZ4F_max64KB,
+        .blockMode = LZ4F_blockIndependent,
+    },
+    .compressionLevel = 4,
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint8_t* read_file(const char* fn, size_t* len) {
+    int fd = open(fn, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "error: cannot open '%s'\n", fn);
+        return NULL;
+    }
+    struct stat s;
+    uint8_t* data = NULL;
+    if ((fstat(fd, &s) < 0) || (s.st_size == 0)) {
+        fprintf(stderr, "error: cannot stat '%s', or it is empty\n", fn);
+        goto done;
+    }
+    if ((data = malloc(s.st_size)) == NULL) {
+        fprintf(stderr, "error: cannot allocate %lld bytes\n", (long long)s.st_size);
+        goto done;
+    }
+    size_t off = 0;
+    while (off < (size_t)s.st_size) {
+        ssize_t r = read(fd, data + off, s.st_size - off);
+        if (r <= 0) {
+            fprintf(stderr, "error: cannot read '%s'\n", fn);
+            free(data);
+            data = NULL;
+            goto done;
+        }
+        off += r;
+    }
+    *len = s.st_size;
+done:
+    close(fd);
+    return data;
+}
+
+// Returns the average time of 'iterations' decompressions, or 0 on error.
+static uint64_t bench(const uint8_t* blocks, size_t block_max, uint8_t* dst,
+                      const uint8_t* expected, size_t len, unsigned threads,
+                      unsigned iterations) {
+    uint64_t total = 0;
+    for (unsigned i = 0; i < iterations; i++) {
+        memset(dst, 0, len);
+        size_t actual;
+        const char* err;
+        uint64_t start = now_ns();
+        mx_status_t status;
+        if (threads == 0) {
+            status = lz4_frame_decompress(blocks, dst, len, &actual, &err);
+        } else {
+            status = lz4_frame_decompress_parallel(blocks, block_max, dst, len, threads,
+                                                   &actual, &err);
+        }
+        total += now_ns() - start;
+        if (status != NO_ERROR) {
+            fprintf(stderr, "error: %s (%d)\n", err, status);
+            return 0;
+        }
+        if ((actual != len) || memcmp(dst, expected, len)) {
+            fprintf(stderr, "error: decompressed data does not match\n");
+            return 0;
+        }
+    }
+    return total / iterations;
+}
+
+static void usage(const char* me) {
+    fprintf(stderr,
+            "usage: %s [-t <max-threads>] [-n <iterations>] [-b <block-kb>] <file>\n"
+            "\n"
+            "Compresses <file> as mkbootfs would, then reports the time taken to\n"
+            "decompress it serially and with 1, 2, 4... up to <max-threads> threads.\n"
+            "<block-kb> is the LZ4 block size: 64 (the default), 256, 1024 or 4096.\n",
+            me);
+}
+
+int main(int argc, char** argv) {
+    const char* me = argv[0];
+    unsigned max_threads = 8;
+    unsigned iterations = 10;
+    LZ4F_preferences_t prefs = lz4_prefs;
+    argc--;
+    argv++;
+    while ((argc > 1) && (argv[0][0] == '-')) {
+        if (!strcmp(argv[0], "-t")) {
+            max_threads = atoi(argv[1]);
+        } else if (!strcmp(argv[0], "-n")) {
+            iterations = atoi(argv[1]);
+        } else if (!strcmp(argv[0], "-b")) {
+            switch (atoi(argv[1])) {
+            case 64: prefs.frameInfo.blockSizeID = LZ4F_max64KB; break;
+            case 256: prefs.frameInfo.blockSizeID = LZ4F_max256KB; break;
+            case 1024: prefs.frameInfo.blockSizeID = LZ4F_max1MB; break;
+            case 4096: prefs.frameInfo.blockSizeID = LZ4F_max4MB; break;
+            default: usage(me); return -1;
+            }
+        } else {
+            break;
+        }
+        argc -= 2;
+        argv += 2;
+    }
+    if ((argc != 1) || (max_threads == 0) || (iterations == 0)) {
+        usage(me);
+        return -1;
+    }
+
+    size_t len;
+    uint8_t* data = read_file(argv[0], &len);
+    if (data == NULL) {
+        return -1;
+    }
+
+    prefs.frameInfo.contentSize = len;
+    size_t max = LZ4F_compressFrameBound(len, &prefs);
+    uint8_t* frame = malloc(max);
+    uint8_t* dst = malloc(len);
+    if ((frame == NULL) || (dst == NULL)) {
+        fprintf(stderr, "error: out of memory\n");
+        return -1;
+    }
+    size_t framelen = LZ4F_compressFrame(frame, max, data, len, &prefs);
+    if (LZ4F_isError(framelen)) {
+        fprintf(stderr, "error: cannot compress: %s\n", LZ4F_getErrorName(framelen));
+        return -1;
+    }
+
+    const uint8_t* blocks;
+    size_t block_max;
+    const char* err;
+    mx_status_t status = lz4_frame_check(frame + sizeof(uint32_t), len, &blocks,
+                                         &block_max, &err);
+    if (status != NO_ERROR) {
+        fprintf(stderr, "error: %s (%d)\n", err, status);
+        return -1;
+    }
+
+    printf("%s: %zu bytes, %zu compressed, %zu blocks\n", argv[0], len, framelen,
+           (len + block_max - 1) / block_max);
+    uint64_t serial = bench(blocks, block_max, dst, data, len, 0, iterations);
+    if (serial == 0) {
+        return -1;
+    }
+    printf("serial:     %8llu usec, %6llu MB/s\n",
+           (unsigned long long)(serial / 1000),
+           (unsigned long long)(len * 1000ull / serial));
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+        uint64_t t = bench(blocks, block_max, dst, data, len, threads, iterations);
+        if (t == 0) {
+            return -1;
+        }
+        printf("%2u threads: %8llu usec, %6llu MB/s, %.2fx\n", threads,
+               (unsigned long long)(t / 1000),
+               (unsigned long long)(len * 1000ull / t), (double)serial / t);
+    }
+
+    free(dst);
+    free(frame);
+    free(data);
+    return 0;
+}
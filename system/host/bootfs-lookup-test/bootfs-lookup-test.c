@@ -0,0 +1,162 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <bootdata/bootfs.h>
+#include <magenta/boot/bootdata.h>
+
+// Builds large synthetic bootfs directories, with and without an index,
+// checks that bootfs_find() resolves every name in them, and reports how
+// long lookups take either way.
+
+#define FSENTRYSZ 12
+#define PAGE 4096
+
+typedef struct {
+    uint8_t* data;
+    size_t len;
+} image_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void file_name(char* buf, size_t len, unsigned n) {
+    snprintf(buf, len, "lib/pkg%04u/file%06u.so", n % 997, n);
+}
+
+// Each file gets a distinct (made up) offset and size, so that a lookup which
+// lands on the wrong record is noticed. No file data is actually stored.
+static uint32_t file_offset(unsigned n) {
+    return (n + 1) * PAGE;
+}
+
+static uint32_t file_size(unsigned n) {
+    return n * 7 + 1;
+}
+
+static bool build(image_t* img, unsigned count, bool indexed) {
+    char name[64];
+    size_t index_size = indexed ? bootfs_index_size(count) : 0;
+    size_t dirsize = FSENTRYSZ;
+    if (indexed) {
+        dirsize += FSENTRYSZ + sizeof(BOOTFS_INDEX_NAME);
+    }
+    for (unsigned n = 0; n < count; n++) {
+        file_name(name, sizeof(name), n);
+        dirsize += FSENTRYSZ + strlen(name) + 1;
+    }
+    size_t index_off = (sizeof(bootdata_t) + dirsize + PAGE - 1) & ~(PAGE - 1);
+    img->len = index_off + index_size;
+    if ((img->data = calloc(1, img->len)) == NULL) {
+        return false;
+    }
+
+    bootdata_t hdr = {
+        .type = BOOTDATA_BOOTFS_BOOT,
+        .length = img->len - sizeof(bootdata_t),
+    };
+    memcpy(img->data, &hdr, sizeof(hdr));
+
+    uint8_t* index = img->data + index_off;
+    uint8_t* p = img->data + sizeof(bootdata_t);
+    if (indexed) {
+        bootfs_index_init(index, count);
+        uint32_t rec[3] = { sizeof(BOOTFS_INDEX_NAME), index_size, index_off };
+        memcpy(p, rec, sizeof(rec));
+        memcpy(p + FSENTRYSZ, BOOTFS_INDEX_NAME, sizeof(BOOTFS_INDEX_NAME));
+        p += FSENTRYSZ + sizeof(BOOTFS_INDEX_NAME);
+    }
+    for (unsigned n = 0; n < count; n++) {
+        file_name(name, sizeof(name), n);
+        size_t namelen = strlen(name) + 1;
+        uint32_t rec[3] = { namelen, file_size(n), file_offset(n) };
+        if (indexed) {
+            bootfs_index_add(index, name, namelen - 1, p - img->data);
+        }
+        memcpy(p, rec, sizeof(rec));
+        memcpy(p + FSENTRYSZ, name, namelen);
+        p += FSENTRYSZ + namelen;
+    }
+    // The zeroed end record is already there.
+    return true;
+}
+
+// Looks up every 'step'th name, and a name which is not there.
+static bool check(const image_t* img, unsigned count, unsigned step, uint64_t* ns) {
+    char name[64];
+    uint32_t off, size;
+    uint64_t start = now_ns();
+    for (unsigned n = 0; n < count; n += step) {
+        file_name(name, sizeof(name), n);
+        mx_status_t status = bootfs_find(img->data, img->len, name, &off, &size);
+        if (status != NO_ERROR) {
+            fprintf(stderr, "error: '%s' not found (%d)\n", name, status);
+            return false;
+        }
+        if ((off != file_offset(n)) || (size != file_size(n))) {
+            fprintf(stderr, "error: '%s' found at %#x size %u\n", name, off, size);
+            return false;
+        }
+    }
+    *ns = now_ns() - start;
+    const char* missing[] = { "lib/pkg0000/file", "lib/nosuchfile", BOOTFS_INDEX_NAME "x", "" };
+    for (size_t n = 0; n < sizeof(missing) / sizeof(missing[0]); n++) {
+        mx_status_t status = bootfs_find(img->data, img->len, missing[n], &off, &size);
+        if (status != ERR_NOT_FOUND) {
+            fprintf(stderr, "error: '%s' lookup returned %d\n", missing[n], status);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    static const unsigned counts[] = { 1, 10, 1000, 10000, 100000 };
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        unsigned count = counts[i];
+        // A full linear lookup of every name is quadratic, so sample.
+        unsigned step = (count > 1000) ? count / 1000 : 1;
+        unsigned looked = (count + step - 1) / step;
+        image_t linear, indexed;
+        if (!build(&linear, count, false) || !build(&indexed, count, true)) {
+            fprintf(stderr, "error: out of memory\n");
+            return -1;
+        }
+        uint64_t linear_ns, indexed_ns;
+        if (!check(&linear, count, step, &linear_ns) ||
+            !check(&indexed, count, step, &indexed_ns)) {
+            fprintf(stderr, "FAILED: %u files\n", count);
+            return -1;
+        }
+
+        // A damaged index must not stop names from being found.
+        bootfs_index_t* index = (bootfs_index_t*)(indexed.data + indexed.len -
+                                                  bootfs_index_size(count));
+        index->magic = ~BOOTFS_INDEX_MAGIC;
+        uint64_t damaged_ns;
+        if (!check(&indexed, count, step, &damaged_ns)) {
+            fprintf(stderr, "FAILED: %u files, damaged index\n", count);
+            return -1;
+        }
+
+        printf("%6u files: linear %8llu ns/lookup, indexed %5llu ns/lookup\n", count,
+               (unsigned long long)(linear_ns / looked),
+               (unsigned long long)(indexed_ns / looked));
+        free(linear.data);
+        free(indexed.data);
+    }
+    printf("PASSED\n");
+    return 0;
+}
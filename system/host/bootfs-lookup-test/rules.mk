@@ -0,0 +1,17 @@
+# Copyright 2017 The Fuchsia Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+LOCAL_DIR := $(GET_LOCAL_DIR)
+
+MODULE := $(LOCAL_DIR)
+
+MODULE_TYPE := hostapp
+
+MODULE_SRCS += \
+    system/ulib/bootdata/bootfs.c \
+    $(LOCAL_DIR)/bootfs-lookup-test.c \
+
+MODULE_CFLAGS := -Isystem/ulib/bootdata/include
+
+include make/module.mk
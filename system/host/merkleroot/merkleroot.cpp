@@ -30,6 +30,8 @@ int main(int argc, char** argv) {
     mxtl::unique_ptr<uint8_t[]> tree(nullptr);
     char strbuf[merkle::Digest::kLength * 2 + 1];
     merkle::Digest digest;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned threads = cpus > 0 ? static_cast<unsigned>(cpus) : 1;
     for (size_t i = 1; i < argc; ++i) {
         const char* arg = argv[i];
         if (stat(arg, &info) < 0) {
@@ -67,8 +69,8 @@ int main(int argc, char** argv) {
             fprintf(stderr, "[-] Failed to mmap '%s.\n", arg);
             return 1;
         }
-        mx_status_t rc =
-            mt.Create(data, info.st_size, tree.get(), tree_len, &digest);
+        mx_status_t rc = mt.Create(data, info.st_size, tree.get(), tree_len,
+                                   &digest, threads);
         if (info.st_size != 0 && munmap(data, info.st_size) != 0) {
             perror("munmap");
             fprintf(stderr, "[-] Failed to munmap '%s.\n", arg);
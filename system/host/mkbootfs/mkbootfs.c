@@ -9,22 +9,30 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 
+#include <lz4.h>
 #include <lz4frame.h>
+#include <lz4hc.h>
+#include <xxhash.h>
 
+#include <bootdata/bootfs.h>
 #include <magenta/boot/bootdata.h>
 
 #define MAXBUFFER (1024*1024)
 
 int verbose = 0;
+bool stats = false;
 
 // BOOTFS is a trivial "filesystem" format
 //
@@ -36,6 +44,11 @@ int verbose = 0;
 //   namedata   (namelength bytes, includes \0)
 //
 // - fileoffsets must be page aligned (multiple of 4096)
+//
+// Unless --no-index is given, the first record of each bootfs is an index
+// of the rest (see <bootdata/bootfs.h>).
+//
+// - files with the same contents share one copy of the data
 
 #define FSENTRYSZ 12
 
@@ -50,6 +63,11 @@ struct fsentry {
     uint32_t length;
 
     char* srcpath;
+    // contents, for entries which are generated rather than read from srcpath
+    void* data;
+
+    // an earlier entry with the same contents, whose data this one shares
+    fsentry_t* dup;
 };
 
 #define ITEM_BOOTDATA 0
@@ -70,6 +88,9 @@ struct item {
     // used by bootfs items
     size_t hdrsize;
     size_t outsize;
+
+    // whether a zero page follows the files, so none starts at the end
+    bool tail_pad;
 };
 
 char* trim(char* str) {
@@ -169,6 +190,42 @@ void add_entry(item_t* fs, fsentry_t* e) {
     fs->hdrsize += e->namelen + FSENTRYSZ;
 }
 
+// Puts an (empty) index entry at the front of a bootfs.
+int add_index(item_t* fs) {
+    size_t count = 0;
+    for (fsentry_t* e = fs->first; e != NULL; e = e->next) {
+        count++;
+    }
+    fsentry_t* e;
+    if ((e = calloc(1, sizeof(*e))) == NULL) goto fail;
+    if ((e->name = strdup(BOOTFS_INDEX_NAME)) == NULL) goto fail;
+    e->namelen = sizeof(BOOTFS_INDEX_NAME);
+    e->length = bootfs_index_size(count);
+    if ((e->data = malloc(e->length)) == NULL) goto fail;
+    bootfs_index_init(e->data, count);
+    e->next = fs->first;
+    fs->first = e;
+    fs->hdrsize += e->namelen + FSENTRYSZ;
+    return 0;
+fail:
+    if (e) {
+        free(e->name);
+        free(e);
+    }
+    fprintf(stderr, "error: cannot allocate bootfs index\n");
+    return -1;
+}
+
+// Adds every other entry of a bootfs to the index at its front.
+void fill_index(item_t* fs) {
+    // Records follow the bootdata header.
+    uint32_t dirent = sizeof(bootdata_t) + FSENTRYSZ + fs->first->namelen;
+    for (fsentry_t* e = fs->first->next; e != NULL; e = e->next) {
+        bootfs_index_add(fs->first->data, e->name, e->namelen - 1, dirent);
+        dirent += FSENTRYSZ + e->namelen;
+    }
+}
+
 int import_manifest(FILE* fp, const char* fn, item_t* fs) {
     int lineno = 0;
     fsentry_t* e;
@@ -395,6 +452,9 @@ static LZ4F_preferences_t lz4_prefs = {
     .compressionLevel = 4,
 };
 
+// Threads to compress with (0: one per CPU).
+static unsigned compress_threads;
+
 static bool check_and_log_lz4_error(LZ4F_errorCode_t code, const char* msg) {
     if (LZ4F_isError(code)) {
         fprintf(stderr, "%s: %s\n", msg, LZ4F_getErrorName(code));
@@ -403,7 +463,130 @@ static bool check_and_log_lz4_error(LZ4F_errorCode_t code, const char* msg) {
     return false;
 }
 
+// The frame's blocks are independent, so rather than streaming through one
+// LZ4F context, data is gathered a batch of blocks at a time, the blocks of
+// a batch are compressed by a pool of threads, and the results are written
+// out in order. The frame is the same as LZ4F would make.
+
+#define LZ4_BLOCK_UNCOMPRESSED 0x80000000u
+// LZ4F uses LZ4HC from this level up.
+#define LZ4_HC_LEVEL_MIN 3
+// Data each thread is given per batch.
+#define COMPRESS_BATCH_PER_THREAD (1024*1024)
+
+typedef struct {
+    int fd;
+    unsigned threads;
+    size_t block_size;
+    // Most a block can take in the frame, with its size word.
+    size_t block_bound;
+    size_t batch_blocks;
+
+    uint8_t* in;
+    size_t inlen;
+    uint8_t* out;
+    size_t* outlen;
+
+    // The batch being compressed.
+    size_t count;
+    atomic_size_t next;
+    void** states;
+} compressor_t;
+
+typedef struct {
+    compressor_t* c;
+    void* state;
+} compress_worker_t;
+
+static size_t lz4_block_size(LZ4F_blockSizeID_t id) {
+    // 64kB, 256kB, 1MB or 4MB
+    return (size_t)1 << (8 + 2 * id);
+}
+
+static void* compress_worker(void* arg) {
+    compress_worker_t* w = arg;
+    compressor_t* c = w->c;
+    int level = lz4_prefs.compressionLevel;
+    size_t n;
+    while ((n = atomic_fetch_add(&c->next, 1)) < c->count) {
+        const char* src = (const char*)c->in + n * c->block_size;
+        size_t len = c->inlen - n * c->block_size;
+        if (len > c->block_size) {
+            len = c->block_size;
+        }
+        uint8_t* dst = c->out + n * c->block_bound;
+        // Anything which does not shrink is stored as is.
+        int r;
+        if (level < LZ4_HC_LEVEL_MIN) {
+            r = LZ4_compress_fast_extState(w->state, src, (char*)dst + sizeof(uint32_t),
+                                           len, len - 1, 1);
+        } else {
+            r = LZ4_compress_HC_extStateHC(w->state, src, (char*)dst + sizeof(uint32_t),
+                                           len, len - 1, level);
+        }
+        uint32_t hdr = r;
+        if (r <= 0) {
+            hdr = len | LZ4_BLOCK_UNCOMPRESSED;
+            memcpy(dst + sizeof(uint32_t), src, len);
+            r = len;
+        }
+        memcpy(dst, &hdr, sizeof(hdr));
+        c->outlen[n] = sizeof(uint32_t) + r;
+    }
+    return NULL;
+}
+
+static int compress_batch(compressor_t* c) {
+    if (c->inlen == 0) {
+        return 0;
+    }
+    c->count = (c->inlen + c->block_size - 1) / c->block_size;
+    atomic_store(&c->next, 0);
+
+    unsigned threads = (c->threads > c->count) ? c->count : c->threads;
+    compress_worker_t workers[threads];
+    pthread_t tids[threads];
+    unsigned started = 0;
+    for (unsigned n = 0; n < threads; n++) {
+        workers[n].c = c;
+        workers[n].state = c->states[n];
+    }
+    while (started + 1 < threads) {
+        if (pthread_create(&tids[started], NULL, compress_worker, &workers[started + 1]) != 0) {
+            // Make do with the threads we have.
+            break;
+        }
+        started++;
+    }
+    compress_worker(&workers[0]);
+    for (unsigned n = 0; n < started; n++) {
+        pthread_join(tids[n], NULL);
+    }
+
+    for (size_t n = 0; n < c->count; n++) {
+        if (writex(c->fd, c->out + n * c->block_bound, c->outlen[n]) < 0) {
+            return -1;
+        }
+    }
+    c->inlen = 0;
+    return 0;
+}
+
+static void compress_free(compressor_t* c) {
+    if (c->states) {
+        for (unsigned n = 0; n < c->threads; n++) {
+            free(c->states[n]);
+        }
+    }
+    free(c->states);
+    free(c->outlen);
+    free(c->out);
+    free(c->in);
+    free(c);
+}
+
 ssize_t compress_setup(int fd, void** cookie) {
+    // The frame header is LZ4F's, so that it has its checksum.
     LZ4F_compressionContext_t cctx;
     LZ4F_errorCode_t errc = LZ4F_createCompressionContext(&cctx, LZ4F_VERSION);
     if (check_and_log_lz4_error(errc, "could not initialize compression context")) {
@@ -411,26 +594,65 @@ ssize_t compress_setup(int fd, void** cookie) {
     }
     uint8_t buf[128];
     size_t r = LZ4F_compressBegin(cctx, buf, sizeof(buf), &lz4_prefs);
+    LZ4F_freeCompressionContext(cctx);
     if (check_and_log_lz4_error(r, "could not begin compression")) {
-        return r;
+        return -1;
     }
 
-    // Note: LZ4F_compressionContext_t is a typedef to a pointer, so this is
-    // "safe".
-    *cookie = (void*)cctx;
-
+    compressor_t* c = calloc(1, sizeof(*c));
+    if (c == NULL) {
+        goto oom;
+    }
+    c->fd = fd;
+    c->threads = compress_threads;
+    c->block_size = lz4_block_size(lz4_prefs.frameInfo.blockSizeID);
+    c->block_bound = sizeof(uint32_t) + c->block_size;
+    c->batch_blocks = (c->threads * (size_t)COMPRESS_BATCH_PER_THREAD) / c->block_size;
+    if (c->batch_blocks < c->threads) {
+        c->batch_blocks = c->threads;
+    }
+    size_t state_size = (lz4_prefs.compressionLevel < LZ4_HC_LEVEL_MIN) ?
+                        LZ4_sizeofState() : LZ4_sizeofStateHC();
+    if (((c->in = malloc(c->batch_blocks * c->block_size)) == NULL) ||
+        ((c->out = malloc(c->batch_blocks * c->block_bound)) == NULL) ||
+        ((c->outlen = calloc(c->batch_blocks, sizeof(size_t))) == NULL) ||
+        ((c->states = calloc(c->threads, sizeof(void*))) == NULL)) {
+        goto oom;
+    }
+    for (unsigned n = 0; n < c->threads; n++) {
+        if ((c->states[n] = malloc(state_size)) == NULL) {
+            goto oom;
+        }
+    }
+    *cookie = c;
     return writex(fd, buf, r);
+
+oom:
+    fprintf(stderr, "error: cannot allocate compression buffers\n");
+    if (c) {
+        compress_free(c);
+    }
+    return -1;
 }
 
 ssize_t compress_data(int fd, const void* src, size_t len, void* cookie) {
-    // max will be, worst case, a bit larger than MAXBUFFER
-    size_t max = LZ4F_compressBound(len, &lz4_prefs);
-    uint8_t buf[max];
-    size_t r = LZ4F_compressUpdate((LZ4F_compressionContext_t)cookie, buf, max, src, len, NULL);
-    if (check_and_log_lz4_error(r, "could not compress data")) {
-        return -1;
+    compressor_t* c = cookie;
+    size_t total = len;
+    size_t cap = c->batch_blocks * c->block_size;
+    while (len > 0) {
+        size_t xfer = cap - c->inlen;
+        if (xfer > len) {
+            xfer = len;
+        }
+        memcpy(c->in + c->inlen, src, xfer);
+        c->inlen += xfer;
+        src += xfer;
+        len -= xfer;
+        if ((c->inlen == cap) && (compress_batch(c) < 0)) {
+            return -1;
+        }
     }
-    return writex(fd, buf, r);
+    return total;
 }
 
 ssize_t compress_file(int fd, const char* fn, size_t len, void* cookie) {
@@ -439,45 +661,44 @@ ssize_t compress_file(int fd, const char* fn, size_t len, void* cookie) {
         return 0;
     }
 
-    char buf[MAXBUFFER];
+    compressor_t* c = cookie;
+    size_t cap = c->batch_blocks * c->block_size;
     int r, fdi;
     if ((fdi = open(fn, O_RDONLY)) < 0) {
         fprintf(stderr, "error: cannot open '%s'\n", fn);
         return -1;
     }
 
+    // Read straight into the batch.
     r = 0;
     size_t total = len;
     while (len > 0) {
-        size_t xfer = (len > sizeof(buf)) ? sizeof(buf) : len;
-        if ((r = readx(fdi, buf, xfer)) < 0) {
-            break;
+        size_t xfer = cap - c->inlen;
+        if (xfer > len) {
+            xfer = len;
         }
-        if ((r = compress_data(fd, buf, xfer, cookie)) < 0) {
+        if ((r = readx(fdi, c->in + c->inlen, xfer)) < 0) {
             break;
         }
+        c->inlen += xfer;
         len -= xfer;
+        if ((c->inlen == cap) && ((r = compress_batch(c)) < 0)) {
+            break;
+        }
     }
     close(fdi);
     return (r < 0) ? -1 : total;
 }
 
 ssize_t compress_finish(int fd, void* cookie) {
-    // Max write is one block (64kB uncompressed) plus 8 bytes of footer.
-    size_t max = LZ4F_compressBound(65536, &lz4_prefs) + 8;
-    uint8_t buf[max];
-    size_t r = LZ4F_compressEnd((LZ4F_compressionContext_t)cookie, buf, max, NULL);
-    if (check_and_log_lz4_error(r, "could not finish compression")) {
-        r = -1;
-    } else {
-        r = writex(fd, buf, r);
-    }
-
-    LZ4F_errorCode_t errc = LZ4F_freeCompressionContext((LZ4F_compressionContext_t)cookie);
-    if (check_and_log_lz4_error(errc, "could not free compression context")) {
-        r = -1;
+    compressor_t* c = cookie;
+    ssize_t r = compress_batch(c);
+    if (r == 0) {
+        // The end mark; there is no content checksum.
+        uint32_t end = 0;
+        r = writex(fd, &end, sizeof(end));
     }
-
+    compress_free(c);
     return r;
 }
 
@@ -535,6 +756,134 @@ fail:
 #define PAGEALIGN(n) (((n) + 4095) & (~4095))
 #define PAGEFILL(n) (PAGEALIGN(n) - (n))
 
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Hashes, or with 'other', compares, the contents of a file.
+static int scan_file(const char* fn, size_t len, uint64_t* hash, const char* other) {
+    static uint8_t buf[2][MAXBUFFER];
+    int r = -1;
+    int fd = open(fn, O_RDONLY);
+    int fdo = other ? open(other, O_RDONLY) : -1;
+    XXH64_state_t* state = XXH64_createState();
+    if ((fd < 0) || (other && (fdo < 0)) || (state == NULL)) {
+        fprintf(stderr, "error: cannot open '%s'\n", (fd < 0 || !other) ? fn : other);
+        goto done;
+    }
+    XXH64_reset(state, 0);
+    while (len > 0) {
+        size_t xfer = (len > MAXBUFFER) ? MAXBUFFER : len;
+        if ((readx(fd, buf[0], xfer) < 0) || (other && (readx(fdo, buf[1], xfer) < 0))) {
+            fprintf(stderr, "error: cannot read '%s'\n", fn);
+            goto done;
+        }
+        if (other) {
+            if (memcmp(buf[0], buf[1], xfer)) {
+                r = 1;
+                goto done;
+            }
+        } else {
+            XXH64_update(state, buf[0], xfer);
+        }
+        len -= xfer;
+    }
+    if (hash) {
+        *hash = XXH64_digest(state);
+    }
+    r = 0;
+done:
+    XXH64_freeState(state);
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (fdo >= 0) {
+        close(fdo);
+    }
+    return r;
+}
+
+typedef struct {
+    fsentry_t* e;
+    size_t seq;
+    uint64_t hash;
+} dedupe_t;
+
+static int dedupe_cmp(const void* _a, const void* _b) {
+    const dedupe_t* a = _a;
+    const dedupe_t* b = _b;
+    if (a->e->length != b->e->length) {
+        return (a->e->length < b->e->length) ? -1 : 1;
+    }
+    if (a->hash != b->hash) {
+        return (a->hash < b->hash) ? -1 : 1;
+    }
+    return (a->seq < b->seq) ? -1 : (a->seq > b->seq);
+}
+
+// Points each file whose contents match those of an earlier file at that
+// file, so that its data is only stored once.
+int dedupe(item_t* fs) {
+    uint64_t t0 = now_ns();
+    size_t count = 0;
+    for (fsentry_t* e = fs->first; e != NULL; e = e->next) {
+        count++;
+    }
+    dedupe_t* v = calloc(count, sizeof(dedupe_t));
+    if ((v == NULL) && (count > 0)) {
+        fprintf(stderr, "error: out of memory\n");
+        return -1;
+    }
+    // Empty files take no space, and generated ones are unique.
+    size_t n = 0;
+    for (fsentry_t* e = fs->first; e != NULL; e = e->next) {
+        if ((e->length == 0) || (e->srcpath == NULL)) {
+            continue;
+        }
+        v[n].e = e;
+        v[n].seq = n;
+        if (scan_file(e->srcpath, e->length, &v[n].hash, NULL) < 0) {
+            free(v);
+            return -1;
+        }
+        n++;
+    }
+    qsort(v, n, sizeof(dedupe_t), dedupe_cmp);
+
+    size_t dups = 0;
+    size_t saved = 0;
+    for (size_t i = 1; i < n; i++) {
+        // Sorting put any candidates just before this file.
+        for (size_t j = i; j-- > 0; ) {
+            if ((v[j].e->length != v[i].e->length) || (v[j].hash != v[i].hash)) {
+                break;
+            }
+            if (v[j].e->dup) {
+                continue;
+            }
+            int r = scan_file(v[i].e->srcpath, v[i].e->length, NULL, v[j].e->srcpath);
+            if (r < 0) {
+                free(v);
+                return -1;
+            }
+            if (r == 0) {
+                v[i].e->dup = v[j].e;
+                dups++;
+                saved += PAGEALIGN(v[i].e->length);
+                break;
+            }
+        }
+    }
+    free(v);
+    if (stats) {
+        fprintf(stderr, "bootfs: %zu files, %zu duplicates (%zu bytes saved), hashed in %.3fs\n",
+                count, dups, saved, (now_ns() - t0) / 1e9);
+    }
+    return 0;
+}
+
 char fill[4096];
 
 #define CHECK(w) do { if ((w) < 0) goto fail; } while (0)
@@ -611,7 +960,7 @@ int write_bootdata(const char* fn, item_t* item) {
                 CHECK(op->setup(fd, &cookie));
             }
 
-            fsentry_t* last_entry = NULL;
+            uint64_t t0 = now_ns();
             for (e = item->first; e != NULL; e = e->next) {
                 uint32_t hdr[3];
                 hdr[0] = e->namelen;
@@ -619,10 +968,7 @@ int write_bootdata(const char* fn, item_t* item) {
                 hdr[2] = e->offset;
                 CHECK(op->write(fd, hdr, sizeof(hdr), cookie));
                 CHECK(op->write(fd, e->name, e->namelen, cookie));
-                last_entry = e;
             }
-            // Record length of last file
-            uint32_t last_length = last_entry ? last_entry->length : 0;
 
             // null terminator record
             CHECK(op->write(fd, fill, 12, cookie));
@@ -633,17 +979,25 @@ int write_bootdata(const char* fn, item_t* item) {
 
             for (e = item->first; e != NULL; e = e->next) {
                 if (verbose) {
-                    fprintf(stderr, "%08x %08x %s\n", e->offset, e->length, e->name);
+                    fprintf(stderr, "%08x %08x %s%s\n", e->offset, e->length, e->name,
+                            e->dup ? " (duplicate)" : "");
+                }
+                if (e->dup) {
+                    continue;
+                }
+                if (e->data) {
+                    CHECK(op->write(fd, e->data, e->length, cookie));
+                } else {
+                    CHECK(op->write_file(fd, e->srcpath, e->length, cookie));
                 }
-                CHECK(op->write_file(fd, e->srcpath, e->length, cookie));
                 if ((n = PAGEFILL(e->length))) {
                     CHECK(op->write(fd, fill, n, cookie));
                 }
             }
-            // If the last entry has length zero, add an extra zero page at the end.
+            // If a zero length file is at the very end, add an extra zero page.
             // This prevents the possibility of trying to read/map past the end of the
             // bootfs at runtime.
-            if (last_length == 0) {
+            if (item->tail_pad) {
                 CHECK(op->write(fd, fill, sizeof(fill), cookie));
             }
 
@@ -670,6 +1024,17 @@ int write_bootdata(const char* fn, item_t* item) {
             }
 
             size_t wrote = (end - start) - sizeof(bootdata_t);
+            if (stats) {
+                fprintf(stderr, "bootfs: %zu bytes %s to %zu in %.3fs",
+                        item->outsize, compressed ? "compressed" : "written", wrote,
+                        (now_ns() - t0) / 1e9);
+                if (compressed) {
+                    fprintf(stderr, " (%u threads, level %d, %zukB blocks)", compress_threads,
+                            lz4_prefs.compressionLevel,
+                            lz4_block_size(lz4_prefs.frameInfo.blockSizeID) / 1024);
+                }
+                fprintf(stderr, "\n");
+            }
 
             bootdata_t boothdr = {
                 .type = (item->type == ITEM_BOOTFS_SYSTEM) ?
@@ -802,6 +1167,11 @@ void usage(void) {
     "         -v               verbose output\n"
     "         -t <filename>    dump bootdata contents\n"
     "         --uncompressed   don't compress bootfs image (debug only)\n"
+    "         --no-index       don't index the bootfs directory\n"
+    "         -j <threads>     compress with <threads> threads (default: one per cpu)\n"
+    "         --level=<n>      lz4 compression level, 1-16 (default: 4)\n"
+    "         --block-size=<n> lz4 block size: 64K (default), 256K, 1M or 4M\n"
+    "         --stats          report deduplication and compression statistics\n"
     "         --target=system  bootfs to be unpacked at /system\n"
     "         --target=boot    bootfs to be unpacked at /boot\n"
     "\n"
@@ -819,6 +1189,7 @@ int main(int argc, char **argv) {
     const char* output_file = "user.bootfs";
 
     bool compressed = true;
+    bool indexed = true;
     bool have_kernel = false;
     unsigned incount = 0;
 
@@ -876,6 +1247,39 @@ int main(int argc, char **argv) {
             compressed = true;
         } else if (!strcmp(cmd,"--uncompressed")) {
             compressed = false;
+        } else if (!strcmp(cmd,"--no-index")) {
+            indexed = false;
+        } else if (!strcmp(cmd,"-j")) {
+            if ((argc < 2) || (atoi(argv[1]) < 1)) {
+                fprintf(stderr, "error: -j needs a thread count\n");
+                return -1;
+            }
+            compress_threads = atoi(argv[1]);
+            argc--;
+            argv++;
+        } else if (!strncmp(cmd,"--level=", 8)) {
+            int level = atoi(cmd + 8);
+            if ((level < 1) || (level > 16)) {
+                fprintf(stderr, "error: compression level must be 1-16\n");
+                return -1;
+            }
+            lz4_prefs.compressionLevel = level;
+        } else if (!strncmp(cmd,"--block-size=", 13)) {
+            const char* size = cmd + 13;
+            if (!strcmp(size, "64K")) {
+                lz4_prefs.frameInfo.blockSizeID = LZ4F_max64KB;
+            } else if (!strcmp(size, "256K")) {
+                lz4_prefs.frameInfo.blockSizeID = LZ4F_max256KB;
+            } else if (!strcmp(size, "1M")) {
+                lz4_prefs.frameInfo.blockSizeID = LZ4F_max1MB;
+            } else if (!strcmp(size, "4M")) {
+                lz4_prefs.frameInfo.blockSizeID = LZ4F_max4MB;
+            } else {
+                fprintf(stderr, "error: block size must be 64K, 256K, 1M or 4M\n");
+                return -1;
+            }
+        } else if (!strcmp(cmd,"--stats")) {
+            stats = true;
         } else if (!strcmp(cmd,"--target=system")) {
             system = true;
         } else if (!strcmp(cmd,"--target=boot")) {
@@ -910,30 +1314,57 @@ int main(int argc, char **argv) {
         fprintf(stderr, "error: no inputs given\n");
         return -1;
     }
+    if (compress_threads == 0) {
+        compress_threads = 1;
+#ifdef _SC_NPROCESSORS_ONLN
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (cpus > 1) {
+            compress_threads = cpus;
+        }
+#endif
+    }
 
     // preflight calculations for bootfs items
     for (item_t* item = first_item; item != NULL; item = item->next) {
         switch (item->type) {
         case ITEM_BOOTFS_BOOT:
         case ITEM_BOOTFS_SYSTEM:
+            if (indexed && (item->first != NULL) && (add_index(item) < 0)) {
+                return -1;
+            }
+
+            if (dedupe(item) < 0) {
+                return -1;
+            }
+
             // account for bootdata plus the end record
             item->hdrsize += sizeof(bootdata_t) + 12;
 
             size_t off = PAGEALIGN(item->hdrsize);
-            fsentry_t* last_entry = NULL;
             for (fsentry_t* e = item->first; e != NULL; e = e->next) {
+                if (e->dup) {
+                    e->offset = e->dup->offset;
+                    continue;
+                }
                 e->offset = off;
                 off += PAGEALIGN(e->length);
                 if (off > INT32_MAX) {
                     fprintf(stderr, "error: userfs too large\n");
                     return -1;
                 }
-                last_entry = e;
             }
-            if (last_entry && last_entry->length == 0) {
+            for (fsentry_t* e = item->first; e != NULL; e = e->next) {
+                if ((e->length == 0) && (e->offset == off)) {
+                    item->tail_pad = true;
+                }
+            }
+            if (item->tail_pad) {
                 off += sizeof(fill);
             }
             item->outsize = off;
+            if ((item->first != NULL) && item->first->data) {
+                fill_index(item);
+            }
             break;
         default:
             break;
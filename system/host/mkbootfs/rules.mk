@@ -16,7 +16,10 @@ MODULE_SRCS += \
     $(LZ4_DIR)/lz4hc.c \
     $(LZ4_DIR)/xxhash.c \
     $(LOCAL_DIR)/mkbootfs.c \
+    system/ulib/bootdata/bootfs.c \
 
-MODULE_CFLAGS := -I$(LZ4_DIR)/include/lz4
+MODULE_CFLAGS := -I$(LZ4_DIR)/include/lz4 -Isystem/ulib/bootdata/include
+
+MODULE_HOST_LIBS := -lpthread
 
 include make/module.mk
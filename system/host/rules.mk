@@ -26,6 +26,8 @@ EXTRA_BUILDDEPS += $(EXPORTED_HEADERS)
 
 
 HOSTAPPS := \
+	$(LOCAL_DIR)/bootfs-bench/rules.mk \
+	$(LOCAL_DIR)/bootfs-lookup-test/rules.mk \
 	$(LOCAL_DIR)/bootserver/rules.mk \
 	$(LOCAL_DIR)/loglistener/rules.mk \
 	$(LOCAL_DIR)/mdi/rules.mk \
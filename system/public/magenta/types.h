@@ -256,6 +256,14 @@ typedef int64_t mx_rel_off_t;
 // Socket options and limits.
 #define MX_SOCKET_HALF_CLOSE                1u
 
+// Socket create options. The top byte selects the capacity of each end
+// of the socket as a power of two; zero selects the default capacity.
+#define MX_SOCKET_SIZE_SHIFT                24u
+#define MX_SOCKET_SIZE_MASK                 (0xffu << MX_SOCKET_SIZE_SHIFT)
+#define MX_SOCKET_SIZE(log2)                (((uint32_t)(log2)) << MX_SOCKET_SIZE_SHIFT)
+#define MX_SOCKET_SIZE_LOG2_MIN             12u
+#define MX_SOCKET_SIZE_LOG2_MAX             24u
+
 // Flags which can be used to to control cache policy for APIs which map memory.
 typedef enum {
     MX_CACHE_POLICY_CACHED          = 0,
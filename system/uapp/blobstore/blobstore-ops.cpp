@@ -28,6 +28,10 @@ void VnodeBlob::Release() {
     delete this;
 }
 
+bool VnodeBlob::IsCacheable() const {
+    return IsDirectory() || (blob->GetState() == kBlobStateReadable);
+}
+
 mx_status_t VnodeBlob::Open(uint32_t flags) {
     if ((flags & O_DIRECTORY) && !IsDirectory()) {
         return ERR_NOT_DIR;
@@ -66,6 +70,13 @@ ssize_t VnodeBlob::Write(const void* data, size_t len, size_t off) {
     return actual;
 }
 
+mx_status_t VnodeBlob::GetVmo(mx_handle_t* out, size_t* size) {
+    if (IsDirectory()) {
+        return ERR_NOT_FILE;
+    }
+    return blob->GetVmo(out, size);
+}
+
 mx_status_t VnodeBlob::Lookup(fs::Vnode** out, const char* name, size_t len) {
     assert(memchr(name, '/', len) == nullptr);
     if ((len == 1) && (name[0] == '.') && IsDirectory()) {
@@ -177,9 +188,10 @@ mx_status_t VnodeBlob::Unlink(const char* name, size_t len, bool must_be_dir) {
 }
 
 mx_status_t VnodeBlob::Sync() {
-    // TODO(smklein): For now, this is a no-op, but it will change
-    // once the kBlobFlagSync flag is in use.
-    return NO_ERROR;
+    if (IsDirectory()) {
+        return blobstore->Sync();
+    }
+    return blob->Sync();
 }
 
 } // namespace blobstore
@@ -5,8 +5,11 @@
 #pragma once
 
 #include "blobstore.h"
+#include "free-extents.h"
+#include "writeback.h"
 
 #include <bitmap/raw-bitmap.h>
+#include <bitmap/storage.h>
 #include <merkle/digest.h>
 #include <mxtl/algorithm.h>
 #include <mxtl/macros.h>
@@ -98,6 +101,11 @@ public:
     // Requires: kBlobStateReadable
     mx_status_t Read(void* data, size_t len, size_t off, size_t* actual);
 
+    // Returns a read-only handle to the VMO holding the blob, after checking
+    // all of it against the Merkle tree, and the size of the blob.
+    // Requires: kBlobStateReadable
+    mx_status_t GetVmo(mx_handle_t* out, size_t* size);
+
     // Creates an emtpy Blob with the given name.
     // Initializes to kBlobStateEmpty
     static mxtl::RefPtr<Blob> Create(const merkle::Digest& digest);
@@ -108,6 +116,7 @@ public:
     VnodeBlob* vn;
 
 private:
+    friend class Blobstore;
     friend struct TypeListTraits;
     friend struct TypeWavlTraits;
 
@@ -115,20 +124,70 @@ private:
     Blob(const merkle::Digest& digest);
     void BlobCloseHandles();
 
-    // Read both VMOs into memory, if we haven't already.
+    // Create and map both VMOs, if we haven't already. Their contents are
+    // read from disk on demand, by VerifyRange.
     //
     // TODO(smklein): When we have can register the Blob Store as a pager
     // service, and it can properly handle pages faults on a vnode's contents,
-    // then we can avoid reading the entire blob up-front. Until then, read
-    // the contents of a VMO into memory when it is opened.
+    // then the VMOs could be handed out and filled by page faults instead.
     mx_status_t InitVmos();
 
+    // Find out where the blob is on disk, if that is not known yet.
+    mx_status_t LoadExtents();
+
+    // Read |nblocks| blocks from block |n| of the blob, counting from the
+    // first block of the Merkle tree, with one I/O for each extent touched.
+    mx_status_t ReadBlocks(uint64_t n, uint64_t nblocks, void* out);
+
+    // Add to |txn| a write of |len| bytes (the last block padded with
+    // zeroes) to block |n| of the blob onwards, one for each extent touched.
+    // The bytes come from |vmo| if it is valid, and are copied from |data|
+    // if it is not.
+    mx_status_t WriteBlocks(WriteTxn* txn, uint64_t n, mx_handle_t vmo, const void* data,
+                            uint64_t len);
+
+    // Give back all but the first |nblocks| blocks of the blob, none of
+    // which may be marked as allocated on disk yet.
+    void TrimBlocks(uint64_t nblocks);
+
+    // Write the table of extents, for a blob which needs one.
+    mx_status_t WriteExtentTable(WriteTxn* txn);
+
+    // Read blocks [start, end) of the blob, counting from the first block of
+    // the Merkle tree, into the VMOs, skipping any which are already there.
+    mx_status_t LoadBlocks(uint64_t start, uint64_t end);
+
+    // For compressed blobs: read the table of chunks, and read and
+    // decompress one chunk of the data into the data VMO.
+    mx_status_t LoadLZ4Table();
+    mx_status_t LoadChunk(uint64_t chunk);
+
+    // Ensure the data in [off, off + len) has been read and checked against
+    // the Merkle tree. Only the data blocks in the range which have not
+    // been verified before, and the tree nodes above them, are read.
+    mx_status_t VerifyRange(uint64_t off, size_t len);
+
+    // Check a blob which has just been written against its name, building
+    // its Merkle tree afresh on all CPUs and comparing it with the one that
+    // was written. Afterwards all of the data counts as verified.
+    mx_status_t VerifyBlob();
+
     mx_status_t WriteShared(const void** data, size_t* len, size_t* actual,
-                            uint64_t maxlen, mx_handle_t vmo, uint64_t start_block);
+                            uint64_t maxlen, mx_handle_t vmo);
+
+    // Compress the data into at most |max_blocks| blocks after the Merkle
+    // tree, returning how many were used. ERR_BUFFER_TOO_SMALL means it did
+    // not fit; what was added to |txn| is then left for the caller to drop.
+    mx_status_t WriteCompressed(WriteTxn* txn, uint64_t max_blocks, uint64_t* blocks_out);
 
-    // Called by Blob once the last write has completed, updating the
-    // on-disk metadata.
-    mx_status_t WriteMetadata();
+    // Called by Blob once the data has been checked, adding the tree and
+    // the data (compressed, if that saves space) to |txn|.
+    mx_status_t WriteData(WriteTxn* txn);
+
+    // Called by Blob once the last write has completed, adding the on-disk
+    // metadata to |txn| and queueing it to be written. The blob is readable
+    // from then on, from memory; Sync waits for it to reach the disk.
+    mx_status_t WriteMetadata(mxtl::unique_ptr<WriteTxn> txn);
 
     NodeState type_list_state_;
     WAVLTreeNodeState type_wavl_state_;
@@ -138,9 +197,26 @@ private:
     mx_handle_t vmo_blob_;
     uintptr_t   vmo_blob_addr_;
 
+    // Where the blob is on disk, in order; known once space has been
+    // allocated for it, or LoadExtents has read it.
+    mxtl::unique_ptr<blobstore_extent_t[]> extents_;
+    uint64_t extent_count_;
+
+    // One bit per block of the blob (tree, then data) present in the VMOs.
+    bitmap::RawBitmapGeneric<bitmap::DefaultStorage> loaded_;
+    // One bit per data block which has passed verification.
+    bitmap::RawBitmapGeneric<bitmap::DefaultStorage> verified_;
+
+    // Where the chunks of a compressed blob are, once InitVmos has read it.
+    blobstore_lz4_header_t lz4_header_;
+    mxtl::unique_ptr<uint64_t[]> lz4_offsets_;
+
     mx_handle_t readable_event_;
     uint64_t bytes_written_;
 
+    // While kBlobFlagSync is set, the txn which writes the blob to disk.
+    uint64_t sync_seq_;
+
     BlobFlags flags_;
     uint8_t digest_[merkle::Digest::kLength];
 
@@ -194,6 +270,9 @@ public:
     // Deletes the blob if requested.
     mx_status_t ReleaseBlob(mxtl::RefPtr<Blob> blob);
 
+    // Wait for everything queued so far to be written to disk.
+    mx_status_t Sync();
+
     int blockfd_;
     blobstore_info_t info_;
 private:
@@ -208,10 +287,25 @@ private:
     static mx_status_t VnodeNew(mxtl::RefPtr<Blobstore> bs, mxtl::RefPtr<Blob> blob,
                                 VnodeBlob** out);
 
-    // Finds space for a block in memory. Does not update disk.
+    // Finds space for contiguous blocks in memory. Does not update disk.
     mx_status_t AllocateBlocks(size_t nblocks, size_t* blkno_out);
     void FreeBlocks(size_t nblocks, size_t blkno);
 
+    // Finds space for |nblocks| blocks in memory: the shortest free extent
+    // which holds them all or, failing that, the longest free extents, as
+    // many as it takes up to kBlobstoreMaxExtents. Does not update disk.
+    mx_status_t AllocateExtents(uint64_t nblocks,
+                                mxtl::unique_ptr<blobstore_extent_t[]>* out,
+                                uint64_t* count_out);
+    void FreeExtents(const blobstore_extent_t* extents, uint64_t count);
+
+    // Give back the blocks of removed blobs whose nodes have been cleared on
+    // disk, queueing the bitmap blocks which show them free. Until then the
+    // blocks cannot be reused, lest a crash leave an old node naming a new
+    // blob's data. If |wait|, first wait for every removal queued so far.
+    // Returns whether any blocks were given back.
+    bool ReapFrees(bool wait);
+
     // Finds space for a blob node in memory. Does not update disk.
     mx_status_t AllocateNode(size_t* node_index_out);
     void FreeNode(size_t node_index);
@@ -221,12 +315,12 @@ private:
     // Access the nth block of the node map.
     void* GetNodemapData(uint64_t n) const;
 
-    // Given a contiguous number of blocks after a starting block,
-    // write out the bitmap to disk for the corresponding blocks.
-    mx_status_t WriteBitmap(uint64_t nblocks, uint64_t start_block);
+    // Add to |txn| the blocks of the bitmap which cover a list of extents,
+    // each of them once.
+    mx_status_t WriteBitmap(WriteTxn* txn, const blobstore_extent_t* extents, uint64_t count);
 
-    // Given a node within the node map at an index, write it to disk.
-    mx_status_t WriteNode(size_t map_index);
+    // Add to |txn| the block of the node map which holds the node at an index.
+    mx_status_t WriteNode(WriteTxn* txn, size_t map_index);
 
     using WAVLTreeByMerkle = mxtl::WAVLTree<const uint8_t*,
                                             mxtl::RefPtr<Blob>,
@@ -235,16 +329,17 @@ private:
     WAVLTreeByMerkle hash_; // Map of all 'in use' blobs
 
     RawBitmap block_map_;
+    // The free blocks of block_map_, by run.
+    FreeExtentIndex free_extents_;
     mxtl::unique_ptr<blobstore_inode_t[]> node_map_;
-};
 
-int blobstore_mkfs(int fd);
+    mxtl::unique_ptr<Writeback> writeback_;
+    // The writeback sequence number of the newest table of extents.
+    uint64_t extent_table_seq_;
+};
 
 mx_status_t blobstore_mount(VnodeBlob** out, int blockfd);
 
-mx_status_t readblk(int fd, uint64_t bno, void* data);
-mx_status_t writeblk(int fd, uint64_t bno, const void* data);
-
 mx_handle_t vfs_rpc_server(VnodeBlob* vn);
 
 class VnodeBlob final : public fs::Vnode {
@@ -253,6 +348,9 @@ public:
         blobstore(bs), blob(b) {}
 
     bool IsDirectory() const { return blob == nullptr; }
+    // Blobs which are still being written must be discarded when their last
+    // reference goes away, so they are kept out of the dentry cache.
+    bool IsCacheable() const final;
 
     ssize_t Ioctl(uint32_t op, const void* in_buf, size_t in_len,
                   void* out_buf, size_t out_len) final;
@@ -268,6 +366,7 @@ private:
     mx_status_t Close() final;
     ssize_t Read(void* data, size_t len, size_t off) final;
     ssize_t Write(const void* data, size_t len, size_t off) final;
+    mx_status_t GetVmo(mx_handle_t* out, size_t* size) final;
     mx_status_t Lookup(fs::Vnode** out, const char* name, size_t len) final;
     mx_status_t Getattr(vnattr_t* a) final;
     mx_status_t Create(fs::Vnode** out, const char* name, size_t len, uint32_t mode) final;
@@ -21,6 +21,7 @@
 #define MXDEBUG 0
 
 #include "blobstore-private.h"
+#include "compression.h"
 
 namespace {
 
@@ -46,88 +47,8 @@ mx_status_t vmo_write_exact(mx_handle_t h, const void* data, uint64_t offset, si
     return NO_ERROR;
 }
 
-// Number of blocks reserved for the Merkle Tree
-uint64_t MerkleTreeBlocks(const blobstore_inode_t& blobNode) {
-    uint64_t size_merkle = merkle::Tree::GetTreeLength(blobNode.blob_size);
-    return mxtl::roundup(size_merkle, kBlobstoreBlockSize) / kBlobstoreBlockSize;
-}
-
-// Get a pointer to the nth block of the bitmap.
-inline void* get_raw_bitmap_data(const RawBitmap& bm, uint64_t n) {
-    assert(n * kBlobstoreBlockSize < bm.size()); // Accessing beyond end of bitmap
-    assert(kBlobstoreBlockSize <= (n + 1) * kBlobstoreBlockSize); // Avoid overflow
-    return (void*)((uintptr_t)(bm.StorageUnsafe()->GetData()) +
-                   (uintptr_t)(kBlobstoreBlockSize * n));
-}
-
-// Read data from disk at block 'bno', into the 'nth' logical block of the vmo.
-mx_status_t vn_fill_block(int fd, mx_handle_t vmo, uint64_t n, uint64_t bno) {
-    // TODO(smklein): read directly from block device into vmo; no need to copy
-    // into an intermediate buffer.
-    char bdata[kBlobstoreBlockSize];
-    if (blobstore::readblk(fd, bno, bdata) != NO_ERROR) {
-        return ERR_IO;
-    }
-    mx_status_t status = vmo_write_exact(vmo, bdata, n * kBlobstoreBlockSize, kBlobstoreBlockSize);
-    if (status != NO_ERROR) {
-        return status;
-    }
-    return NO_ERROR;
-}
-
-// Write data to disk at block 'bno', from the 'nth' logical block of the vmo.
-mx_status_t vn_dump_block(int fd, mx_handle_t vmo, uint64_t n, uint64_t bno, bool partial) {
-    // TODO(smklein): read directly into block device from vmo; no need to copy
-    // into an intermediate buffer.
-    char bdata[kBlobstoreBlockSize];
-    size_t actual;
-    mx_status_t status = mx_vmo_read(vmo, bdata, n * kBlobstoreBlockSize,
-                                     kBlobstoreBlockSize, &actual);
-    if (status != NO_ERROR) {
-        return status;
-    }
-
-    if (partial)  {
-        // It's okay to read a partial block -- set the rest to 'zero'.
-        memset(bdata + actual, 0, sizeof(bdata) - actual);
-    } else if (actual != kBlobstoreBlockSize) {
-        // We should have been able to read the whole block.
-        return ERR_IO;
-    }
-
-    if (blobstore::writeblk(fd, bno, bdata) != NO_ERROR) {
-        return ERR_IO;
-    }
-    return NO_ERROR;
-}
-
-// Sanity check the metadata for the blobstore, given a maximum number of
-// available blocks.
-mx_status_t blobstore_check_info(const blobstore_info_t* info, uint64_t max) {
-    if ((info->magic0 != kBlobstoreMagic0) ||
-        (info->magic1 != kBlobstoreMagic1)) {
-        fprintf(stderr, "blobstore: bad magic\n");
-        return ERR_INVALID_ARGS;
-    }
-    if (info->version != kBlobstoreVersion) {
-        fprintf(stderr, "blobstore: FS Version: %08x. Driver version: %08x\n", info->version,
-              kBlobstoreVersion);
-        return ERR_INVALID_ARGS;
-    }
-    if (info->block_size != kBlobstoreBlockSize) {
-        fprintf(stderr, "blobstore: bsz %u unsupported\n", info->block_size);
-        return ERR_INVALID_ARGS;
-    }
-    if (info->block_count > max) {
-        fprintf(stderr, "blobstore: too large for device\n");
-        return ERR_INVALID_ARGS;
-    }
-    if (info->blob_header_next != 0) {
-        fprintf(stderr, "blobstore: linked blob headers not yet supported\n");
-        return ERR_INVALID_ARGS;
-    }
-    return NO_ERROR;
-}
+// The most blocks LoadBlocks reads at once.
+constexpr uint64_t kMaxReadBlocks = 128;
 
 } // namespace
 
@@ -144,39 +65,12 @@ void* Blobstore::GetNodemapData(uint64_t n) const {
     return (void*)((uintptr_t)(node_map_.get()) + (uintptr_t)(kBlobstoreBlockSize * n));
 }
 
-mx_status_t readblk(int fd, uint64_t bno, void* data) {
-    off_t off = bno * kBlobstoreBlockSize;
-    if (lseek(fd, off, SEEK_SET) < 0) {
-        fprintf(stderr, "blobstore: cannot seek to block %lu\n", bno);
-        return ERR_IO;
-    }
-    if (read(fd, data, kBlobstoreBlockSize) != kBlobstoreBlockSize) {
-        fprintf(stderr, "blobstore: cannot read block %lu\n", bno);
-        return ERR_IO;
-    }
-    return NO_ERROR;
-}
-
-mx_status_t writeblk(int fd, uint64_t bno, const void* data) {
-    off_t off = bno * kBlobstoreBlockSize;
-    if (lseek(fd, off, SEEK_SET) < 0) {
-        fprintf(stderr, "blobstore: cannot seek to block %lu\n", bno);
-        return ERR_IO;
-    }
-    if (write(fd, data, kBlobstoreBlockSize) != kBlobstoreBlockSize) {
-        fprintf(stderr, "blobstore: cannot write block %lu\n", bno);
-        return ERR_IO;
-    }
-    return NO_ERROR;
-}
-
 mx_status_t Blob::InitVmos() {
     if (vmo_blob_ != MX_HANDLE_INVALID) {
         return NO_ERROR;
     }
 
     mx_status_t status;
-    int fd = vn->blobstore->blockfd_;
     blobstore_inode_t* inode = &vn->blobstore->node_map_[map_index_];
     uint64_t merkle_vmo_size = MerkleTreeBlocks(*inode) * kBlobstoreBlockSize;
     uint64_t data_vmo_size = BlobDataBlocks(*inode) * kBlobstoreBlockSize;
@@ -187,14 +81,6 @@ mx_status_t Blob::InitVmos() {
             goto fail;
         }
 
-        for (uint64_t n = 0; n < MerkleTreeBlocks(*inode); n++) {
-            uint64_t bno = inode->start_block + n;
-            if ((status = vn_fill_block(fd, vmo_merkle_tree_, n, bno)) != NO_ERROR) {
-                error("Failed to fill bno\n");
-                goto fail;
-            }
-        }
-
         if ((status = mx_vmar_map(mx_vmar_root_self(), 0, vmo_merkle_tree_, 0,
                                   merkle_vmo_size,
                                   MX_VM_FLAG_PERM_READ,
@@ -208,14 +94,6 @@ mx_status_t Blob::InitVmos() {
         goto fail;
     }
 
-    for (uint64_t n = 0; n < BlobDataBlocks(*inode); n++) {
-        uint64_t bno = inode->start_block + n + MerkleTreeBlocks(*inode);
-        if ((status = vn_fill_block(fd, vmo_blob_, n, bno)) != NO_ERROR) {
-            error("Failed to fill bno\n");
-            goto fail;
-        }
-    }
-
     if ((status = mx_vmar_map(mx_vmar_root_self(), 0, vmo_blob_, 0,
                               data_vmo_size,
                               MX_VM_FLAG_PERM_READ,
@@ -223,6 +101,19 @@ mx_status_t Blob::InitVmos() {
         goto fail;
     }
 
+    // Nothing has been read from disk yet.
+    if (((status = loaded_.Reset(MerkleTreeBlocks(*inode) + BlobDataBlocks(*inode))) != NO_ERROR) ||
+        ((status = verified_.Reset(BlobDataBlocks(*inode))) != NO_ERROR)) {
+        goto fail;
+    }
+
+    if ((status = LoadExtents()) != NO_ERROR) {
+        goto fail;
+    }
+    if ((inode->flags & kBlobstoreInodeLZ4) && ((status = LoadLZ4Table()) != NO_ERROR)) {
+        goto fail;
+    }
+
     return NO_ERROR;
 fail:
     BlobCloseHandles();
@@ -242,8 +133,10 @@ Blob::Blob(const merkle::Digest& digest) :
     vmo_merkle_tree_addr_(0),
     vmo_blob_(MX_HANDLE_INVALID),
     vmo_blob_addr_(0),
+    extent_count_(0),
     readable_event_(MX_HANDLE_INVALID),
     bytes_written_(0),
+    sync_seq_(0),
     flags_(kBlobStateEmpty) {
 
     digest.CopyTo(digest_, sizeof(digest_));
@@ -305,9 +198,12 @@ mx_status_t Blob::SpaceAllocate(uint64_t size_data) {
     blobstore_inode_t* inode = &vn->blobstore->node_map_[map_index_];
     memset(inode->merkle_root_hash, 0, merkle::Digest::kLength);
     inode->blob_size = size_data;
+    inode->flags = 0;
     inode->num_blocks = MerkleTreeBlocks(*inode) + BlobDataBlocks(*inode);
 
-    // Open VMOs, so we can begin writing after allocate succeeds.
+    // Open VMOs, so we can begin writing after allocate succeeds. The data
+    // VMO runs to the end of the last block, so that the writeback thread
+    // can write it whole.
     uint64_t size_merkle = merkle::Tree::GetTreeLength(size_data);
     if (size_merkle != 0) {
         if ((status = mx_vmo_create(size_merkle, 0, &vmo_merkle_tree_)) != NO_ERROR) {
@@ -319,7 +215,8 @@ mx_status_t Blob::SpaceAllocate(uint64_t size_data) {
             goto fail;
         }
     }
-    if ((status = mx_vmo_create(size_data, 0, &vmo_blob_)) != NO_ERROR) {
+    if ((status = mx_vmo_create(BlobDataBlocks(*inode) * kBlobstoreBlockSize, 0,
+                                &vmo_blob_)) != NO_ERROR) {
         goto fail;
     } else if ((status = mx_vmar_map(mx_vmar_root_self(), 0, vmo_blob_, 0,
                                      size_data,
@@ -328,8 +225,30 @@ mx_status_t Blob::SpaceAllocate(uint64_t size_data) {
         goto fail;
     }
 
-    // Allocate space for the blob
-    if ((status = vn->blobstore->AllocateBlocks(inode->num_blocks, &inode->start_block)) != NO_ERROR) {
+    if (((status = loaded_.Reset(inode->num_blocks)) != NO_ERROR) ||
+        ((status = verified_.Reset(BlobDataBlocks(*inode))) != NO_ERROR)) {
+        goto fail;
+    }
+
+    // Allocate space for the blob, and for a table of its extents if it
+    // does not fit in one. Space held by blobs which are still being removed
+    // may be enough, once that is on disk.
+    vn->blobstore->ReapFrees(false);
+    status = vn->blobstore->AllocateExtents(inode->num_blocks, &extents_, &extent_count_);
+    if ((status == ERR_NO_SPACE) && vn->blobstore->ReapFrees(true)) {
+        status = vn->blobstore->AllocateExtents(inode->num_blocks, &extents_, &extent_count_);
+    }
+    if (status != NO_ERROR) {
+        goto fail;
+    }
+    if (extent_count_ == 1) {
+        inode->start_block = extents_[0].start;
+    } else if ((status = vn->blobstore->AllocateBlocks(1, &inode->start_block)) == NO_ERROR) {
+        inode->flags |= kBlobstoreInodeExtents;
+    } else {
+        vn->blobstore->FreeExtents(extents_.get(), extent_count_);
+        extents_.reset();
+        extent_count_ = 0;
         goto fail;
     }
 
@@ -342,84 +261,250 @@ fail:
     return status;
 }
 
-// A helper function for dumping either the Merkle Tree or the actual blob data
-// to both (1) The containing VMO, and (2) disk.
+// A helper function for gathering either the Merkle Tree or the actual blob
+// data into the containing VMO.
 mx_status_t Blob::WriteShared(const void** data, size_t* len, size_t* actual,
-                              uint64_t maxlen, mx_handle_t vmo, uint64_t start_block) {
+                              uint64_t maxlen, mx_handle_t vmo) {
     size_t to_write = mxtl::min(*len, maxlen - bytes_written_);
     mx_status_t status = vmo_write_exact(vmo, *data, bytes_written_, to_write);
     if (status != NO_ERROR) {
         return status;
     }
 
-    // Write as many 'entire blocks' as possible
-    uint64_t n = bytes_written_ / kBlobstoreBlockSize;
-    uint64_t n_end = (bytes_written_ + to_write) / kBlobstoreBlockSize;
-    while (n < n_end) {
-        status = vn_dump_block(vn->blobstore->blockfd_, vmo, n, n + start_block, false);
-        if (status != NO_ERROR) {
+    bytes_written_ += to_write;
+    assert(bytes_written_ <= maxlen);
+    *actual += to_write;
+    *len -= to_write;
+    *data = (const void*)((uintptr_t)(*data) + (uintptr_t)(to_write));
+    return NO_ERROR;
+}
+
+mx_status_t Blob::LoadExtents() {
+    if (extents_ != nullptr) {
+        return NO_ERROR;
+    }
+    // Only a table of extents is read from disk, and it may have been
+    // written so recently that it is still queued. Rather than keep track of
+    // which blobs have tables queued, wait for the newest one.
+    auto inode = &vn->blobstore->node_map_[map_index_];
+    if (inode->flags & kBlobstoreInodeExtents) {
+        mx_status_t status;
+        uint64_t seq = vn->blobstore->extent_table_seq_;
+        if ((status = vn->blobstore->writeback_->Wait(seq)) != NO_ERROR) {
             return status;
         }
-        n++;
     }
+    return blobstore_load_extents(vn->blobstore->blockfd_, vn->blobstore->info_, *inode,
+                                  &extents_, &extent_count_);
+}
 
-    // Special case: We've written all the 'whole blocks', but we're missing
-    // a partial block at the very end.
-    if ((bytes_written_ + to_write == maxlen) &&
-        (maxlen % kBlobstoreBlockSize != 0)) {
-        status = vn_dump_block(vn->blobstore->blockfd_, vmo, n, n + start_block, true);
+mx_status_t Blob::ReadBlocks(uint64_t n, uint64_t nblocks, void* out) {
+    return blobstore_read_blocks(vn->blobstore->blockfd_, extents_.get(), extent_count_,
+                                 n, nblocks, out);
+}
+
+mx_status_t Blob::WriteBlocks(WriteTxn* txn, uint64_t n, mx_handle_t vmo, const void* data,
+                              uint64_t len) {
+    for (uint64_t done = 0; done < len;) {
+        uint64_t bno, run;
+        if (!blobstore_map_block(extents_.get(), extent_count_, n, &bno, &run)) {
+            return ERR_OUT_OF_RANGE;
+        }
+        uint64_t count = mxtl::min(run * kBlobstoreBlockSize, len - done);
+        mx_status_t status;
+        if (vmo != MX_HANDLE_INVALID) {
+            status = txn->AddVmo(vmo, done, count, bno);
+        } else {
+            status = txn->AddData(kWriteData, static_cast<const uint8_t*>(data) + done,
+                                  count, bno);
+        }
         if (status != NO_ERROR) {
             return status;
         }
+        n += run;
+        done += count;
     }
-
-    bytes_written_ += to_write;
-    assert(bytes_written_ <= maxlen);
-    *actual += to_write;
-    *len -= to_write;
-    *data = (const void*)((uintptr_t)(*data) + (uintptr_t)(to_write));
     return NO_ERROR;
 }
 
-mx_status_t Blob::WriteMetadata() {
-    assert(GetState() == kBlobStateDataWrite);
+void Blob::TrimBlocks(uint64_t nblocks) {
+    auto inode = &vn->blobstore->node_map_[map_index_];
+    uint64_t kept = 0;
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < extent_count_; i++) {
+        blobstore_extent_t* e = &extents_[i];
+        uint64_t keep = mxtl::min(e->length, nblocks - kept);
+        if (keep < e->length) {
+            vn->blobstore->FreeBlocks(e->length - keep, e->start + keep);
+            e->length = keep;
+        }
+        if (keep != 0) {
+            kept += keep;
+            count++;
+        }
+    }
+    extent_count_ = count;
+    inode->num_blocks = nblocks;
 
-    // All data has been written to the containing VMO
-    SetState(kBlobStateReadable);
-    if (readable_event_ != MX_HANDLE_INVALID) {
-        mx_status_t status = mx_object_signal(readable_event_, 0u, MX_USER_SIGNAL_0);
-        if (status != NO_ERROR) {
-            SetState(kBlobStateError);
+    // What is left may fit in one extent, which needs no table.
+    if ((extent_count_ == 1) && (inode->flags & kBlobstoreInodeExtents)) {
+        vn->blobstore->FreeBlocks(1, inode->start_block);
+        inode->start_block = extents_[0].start;
+        inode->flags &= ~kBlobstoreInodeExtents;
+    }
+}
+
+mx_status_t Blob::WriteExtentTable(WriteTxn* txn) {
+    auto inode = &vn->blobstore->node_map_[map_index_];
+    assert(extent_count_ <= kBlobstoreMaxExtents);
+    char bdata[kBlobstoreBlockSize];
+    memset(bdata, 0, sizeof(bdata));
+    blobstore_extent_header_t hdr;
+    hdr.magic = kBlobstoreExtentMagic;
+    hdr.count = extent_count_;
+    memcpy(bdata, &hdr, sizeof(hdr));
+    memcpy(bdata + sizeof(hdr), extents_.get(), extent_count_ * sizeof(blobstore_extent_t));
+    return txn->AddData(kWriteData, bdata, sizeof(bdata), inode->start_block);
+}
+
+mx_status_t Blob::WriteCompressed(WriteTxn* txn, uint64_t max_blocks, uint64_t* blocks_out) {
+    auto inode = &vn->blobstore->node_map_[map_index_];
+    uint64_t start_block = MerkleTreeBlocks(*inode);
+    blobstore_lz4_header_t hdr;
+    hdr.magic = kBlobstoreLZ4Magic;
+    hdr.chunk_size = kBlobstoreLZ4ChunkSize;
+    hdr.chunk_count = static_cast<uint32_t>(LZ4ChunkCount(inode->blob_size, hdr.chunk_size));
+    uint64_t table_size = LZ4TableSize(hdr.chunk_count);
+    uint64_t max_size = max_blocks * kBlobstoreBlockSize;
+    if (table_size >= max_size) {
+        return ERR_BUFFER_TOO_SMALL;
+    }
+
+    AllocChecker ac;
+    mxtl::unique_ptr<uint8_t[]> table(new (&ac) uint8_t[table_size]);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    // Compressed chunks are gathered here until they fill whole blocks.
+    mxtl::unique_ptr<uint8_t[]> buf(new (&ac) uint8_t[hdr.chunk_size + kBlobstoreBlockSize]);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    memset(table.get(), 0, table_size);
+    memcpy(table.get(), &hdr, sizeof(hdr));
+    uint64_t* offsets = reinterpret_cast<uint64_t*>(table.get() + sizeof(hdr));
+
+    // The chunks are added to |txn| as they are compressed, and the table
+    // after them, once it is known. Should the result come to more than
+    // |max_blocks|, the caller writes the blob out uncompressed instead.
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(vmo_blob_addr_);
+    uint64_t off = table_size;
+    uint64_t bno = table_size / kBlobstoreBlockSize;
+    size_t fill = 0;
+    mx_status_t status;
+    for (uint64_t n = 0; n < hdr.chunk_count; n++) {
+        offsets[n] = off;
+        size_t len = LZ4ChunkLength(hdr, inode->blob_size, n);
+        size_t clen = CompressChunk(data + n * hdr.chunk_size, len, buf.get() + fill);
+        off += clen;
+        fill += clen;
+        if (mxtl::roundup(off, kBlobstoreBlockSize) > max_size) {
+            return ERR_BUFFER_TOO_SMALL;
+        }
+        size_t whole = fill / kBlobstoreBlockSize;
+        if ((status = WriteBlocks(txn, start_block + bno, MX_HANDLE_INVALID, buf.get(),
+                                  whole * kBlobstoreBlockSize)) != NO_ERROR) {
             return status;
         }
+        bno += whole;
+        fill -= whole * kBlobstoreBlockSize;
+        memmove(buf.get(), buf.get() + whole * kBlobstoreBlockSize, fill);
+    }
+    offsets[hdr.chunk_count] = off;
+    if (fill != 0) {
+        if ((status = WriteBlocks(txn, start_block + bno++, MX_HANDLE_INVALID, buf.get(),
+                                  fill)) != NO_ERROR) {
+            return status;
+        }
+    }
+    if ((status = WriteBlocks(txn, start_block, MX_HANDLE_INVALID, table.get(),
+                              table_size)) != NO_ERROR) {
+        return status;
     }
+    *blocks_out = bno;
+    return NO_ERROR;
+}
 
-    // TODO(smklein): We could probably flush out these disk structures asynchronously.
-    // Even writing the above blocks could be done async. The "node" write must be done
-    // LAST, after everything else is complete, but that's the only restriction.
-    //
-    // This 'kBlobFlagSync' is currently not used, but it indicates when the sync is
-    // complete.
-    flags_ |= kBlobFlagSync;
+mx_status_t Blob::WriteData(WriteTxn* txn) {
     auto inode = &vn->blobstore->node_map_[map_index_];
+    uint64_t merkle_blocks = MerkleTreeBlocks(*inode);
+    uint64_t data_blocks = BlobDataBlocks(*inode);
+    uint64_t size_merkle = merkle::Tree::GetTreeLength(inode->blob_size);
+    mx_status_t status;
+    if ((status = WriteBlocks(txn, 0, vmo_merkle_tree_, nullptr, size_merkle)) != NO_ERROR) {
+        return status;
+    }
 
-    // Write block allocation bitmap
-    if (vn->blobstore->WriteBitmap(inode->num_blocks, inode->start_block) != NO_ERROR) {
-        return ERR_IO;
+    // Compression has to save at least a block to be worth having.
+    size_t op_count = txn->op_count();
+    uint64_t blocks;
+    status = WriteCompressed(txn, data_blocks - 1, &blocks);
+    if (status == NO_ERROR) {
+        // Give back the blocks which are no longer needed. None of them
+        // have been marked as allocated on disk yet.
+        TrimBlocks(merkle_blocks + blocks);
+        inode->flags |= kBlobstoreInodeLZ4;
+        return NO_ERROR;
+    } else if (status != ERR_BUFFER_TOO_SMALL) {
+        return status;
     }
+    txn->Truncate(op_count);
+    return WriteBlocks(txn, merkle_blocks, vmo_blob_, nullptr, inode->blob_size);
+}
+
+mx_status_t Blob::WriteMetadata(mxtl::unique_ptr<WriteTxn> txn) {
+    assert(GetState() == kBlobStateDataWrite);
+    auto inode = &vn->blobstore->node_map_[map_index_];
 
-    // Flush the block allocation bitmap to disk
-    fsync(vn->blobstore->blockfd_);
+    // Write the table of extents, if the blob needs one, and the block
+    // allocation bitmap. The writeback thread puts these on disk before the
+    // node, so that it never names blocks which are not there yet.
+    mx_status_t status;
+    if (inode->flags & kBlobstoreInodeExtents) {
+        blobstore_extent_t table;
+        table.start = inode->start_block;
+        table.length = 1;
+        if (((status = WriteExtentTable(txn.get())) != NO_ERROR) ||
+            ((status = vn->blobstore->WriteBitmap(txn.get(), &table, 1)) != NO_ERROR)) {
+            return status;
+        }
+    }
+    if ((status = vn->blobstore->WriteBitmap(txn.get(), extents_.get(),
+                                             extent_count_)) != NO_ERROR) {
+        return status;
+    }
 
-    // Update the on-disk hash
+    // Update the on-disk hash, and write back the blob node
     memcpy(inode->merkle_root_hash, &digest_[0], merkle::Digest::kLength);
-
-    // Write back the blob node
-    if (vn->blobstore->WriteNode(map_index_)) {
-        return ERR_IO;
+    if ((status = vn->blobstore->WriteNode(txn.get(), map_index_)) != NO_ERROR) {
+        return status;
+    }
+    sync_seq_ = vn->blobstore->writeback_->Enqueue(mxtl::move(txn));
+    flags_ |= kBlobFlagSync;
+    if (inode->flags & kBlobstoreInodeExtents) {
+        vn->blobstore->extent_table_seq_ = sync_seq_;
     }
 
-    flags_ &= ~kBlobFlagSync;
+    // All data has been written to the containing VMO
+    loaded_.Set(0, MerkleTreeBlocks(*inode) + BlobDataBlocks(*inode));
+    SetState(kBlobStateReadable);
+    if (readable_event_ != MX_HANDLE_INVALID) {
+        status = mx_object_signal(readable_event_, 0u, MX_USER_SIGNAL_0);
+        if (status != NO_ERROR) {
+            SetState(kBlobStateError);
+            return status;
+        }
+    }
     return NO_ERROR;
 }
 
@@ -433,8 +518,7 @@ mx_status_t Blob::Write(const void* data, size_t len, size_t* actual) {
     mx_status_t status;
     if (GetState() == kBlobStateMerkleWrite) {
         uint64_t size_merkle = merkle::Tree::GetTreeLength(inode->blob_size);
-        status = WriteShared(&data, &len, actual, size_merkle,
-                             vmo_merkle_tree_, inode->start_block);
+        status = WriteShared(&data, &len, actual, size_merkle, vmo_merkle_tree_);
         if (status != NO_ERROR) {
             return status;
         }
@@ -453,8 +537,7 @@ mx_status_t Blob::Write(const void* data, size_t len, size_t* actual) {
     }
 
     if (GetState() == kBlobStateDataWrite) {
-        status = WriteShared(&data, &len, actual, inode->blob_size,
-                             vmo_blob_, inode->start_block + MerkleTreeBlocks(*inode));
+        status = WriteShared(&data, &len, actual, inode->blob_size, vmo_blob_);
         if (status != NO_ERROR) {
             return status;
         }
@@ -464,8 +547,17 @@ mx_status_t Blob::Write(const void* data, size_t len, size_t* actual) {
             return NO_ERROR;
         }
 
-        // No more data to write. Flush to disk.
-        if ((status = WriteMetadata()) != NO_ERROR) {
+        // No more data to write. Check it, then queue it to be written to
+        // disk; the writeback thread writes it while the next blob is hashed.
+        AllocChecker ac;
+        mxtl::unique_ptr<WriteTxn> txn(new (&ac) WriteTxn());
+        if (!ac.check()) {
+            status = ERR_NO_MEMORY;
+        } else if (((status = VerifyBlob()) == NO_ERROR) &&
+                   ((status = WriteData(txn.get())) == NO_ERROR)) {
+            status = WriteMetadata(mxtl::move(txn));
+        }
+        if (status != NO_ERROR) {
             SetState(kBlobStateError);
             return status;
         }
@@ -504,10 +596,202 @@ mx_status_t Blob::Read(void* data, size_t len, size_t off, size_t* actual) {
         return status;
     }
 
+    auto inode = &vn->blobstore->node_map_[map_index_];
+    if (off >= inode->blob_size) {
+        *actual = 0;
+        return NO_ERROR;
+    }
+    len = mxtl::min(len, static_cast<size_t>(inode->blob_size - off));
+    if ((status = VerifyRange(off, len)) != NO_ERROR) {
+        return status;
+    }
+
+    return mx_vmo_read(vmo_blob_, data, off, len, actual);
+}
+
+mx_status_t Blob::GetVmo(mx_handle_t* out, size_t* size) {
+    if (GetState() != kBlobStateReadable) {
+        return ERR_BAD_STATE;
+    }
+
+    mx_status_t status = InitVmos();
+    if (status != NO_ERROR) {
+        return status;
+    }
+
+    // Once handed out, the VMO may be read without asking the blobstore, so
+    // the whole blob is verified up front.
+    auto inode = &vn->blobstore->node_map_[map_index_];
+    if ((status = VerifyRange(0, inode->blob_size)) != NO_ERROR) {
+        return status;
+    }
+    if ((status = mx_handle_duplicate(vmo_blob_, VFS_VMO_RIGHTS_READONLY, out)) != NO_ERROR) {
+        return status;
+    }
+    *size = inode->blob_size;
+    return NO_ERROR;
+}
+
+mx_status_t Blob::LoadBlocks(uint64_t start, uint64_t end) {
+    auto inode = &vn->blobstore->node_map_[map_index_];
+    uint64_t merkle_blocks = MerkleTreeBlocks(*inode);
+    mx_status_t status;
+    mxtl::unique_ptr<uint8_t[]> buf;
+    for (uint64_t n = start; n < end;) {
+        size_t first_unset;
+        if (loaded_.Get(n, end, &first_unset)) {
+            break;
+        }
+        n = first_unset;
+        if ((n >= merkle_blocks) && (inode->flags & kBlobstoreInodeLZ4)) {
+            // Compressed data comes a whole chunk at a time.
+            uint64_t chunk_blocks = lz4_header_.chunk_size / kBlobstoreBlockSize;
+            uint64_t chunk = (n - merkle_blocks) / chunk_blocks;
+            if ((status = LoadChunk(chunk)) != NO_ERROR) {
+                error("Failed to load chunk\n");
+                return status;
+            }
+            n = merkle_blocks + chunk * chunk_blocks;
+            uint64_t next = mxtl::min(n + chunk_blocks, loaded_.size());
+            loaded_.Set(n, next);
+            n = next;
+            continue;
+        }
+
+        // Read as many of the missing blocks as lie together in one VMO, with
+        // one read for each extent they span.
+        uint64_t limit = (n < merkle_blocks) ? mxtl::min(end, merkle_blocks) : end;
+        uint64_t next = mxtl::min(loaded_.Scan(n, limit, false), n + kMaxReadBlocks);
+        if (buf == nullptr) {
+            AllocChecker ac;
+            buf.reset(new (&ac) uint8_t[kMaxReadBlocks * kBlobstoreBlockSize]);
+            if (!ac.check()) {
+                return ERR_NO_MEMORY;
+            }
+        }
+        if ((status = ReadBlocks(n, next - n, buf.get())) != NO_ERROR) {
+            error("Failed to fill bno\n");
+            return status;
+        }
+        mx_handle_t vmo = (n < merkle_blocks) ? vmo_merkle_tree_ : vmo_blob_;
+        uint64_t vmo_block = (n < merkle_blocks) ? n : n - merkle_blocks;
+        if ((status = vmo_write_exact(vmo, buf.get(), vmo_block * kBlobstoreBlockSize,
+                                      (next - n) * kBlobstoreBlockSize)) != NO_ERROR) {
+            return status;
+        }
+        loaded_.Set(n, next);
+        n = next;
+    }
+    return NO_ERROR;
+}
+
+mx_status_t Blob::LoadLZ4Table() {
+    auto inode = &vn->blobstore->node_map_[map_index_];
+    uint64_t merkle_blocks = MerkleTreeBlocks(*inode);
+    uint64_t data_blocks = inode->num_blocks - merkle_blocks;
+
+    char bdata[kBlobstoreBlockSize];
+    mx_status_t status;
+    if ((data_blocks == 0) || ((status = ReadBlocks(merkle_blocks, 1, bdata)) != NO_ERROR)) {
+        return ERR_IO;
+    }
+    memcpy(&lz4_header_, bdata, sizeof(lz4_header_));
+    if ((status = CheckLZ4Header(lz4_header_, inode->blob_size)) != NO_ERROR) {
+        return status;
+    }
+    uint64_t table_blocks = LZ4TableSize(lz4_header_.chunk_count) / kBlobstoreBlockSize;
+    if (table_blocks > data_blocks) {
+        return ERR_IO_DATA_INTEGRITY;
+    }
+
+    AllocChecker ac;
+    mxtl::unique_ptr<uint8_t[]> table(new (&ac) uint8_t[table_blocks * kBlobstoreBlockSize]);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    lz4_offsets_.reset(new (&ac) uint64_t[lz4_header_.chunk_count + 1]);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    memcpy(table.get(), bdata, kBlobstoreBlockSize);
+    if ((status = ReadBlocks(merkle_blocks + 1, table_blocks - 1,
+                             table.get() + kBlobstoreBlockSize)) != NO_ERROR) {
+        return status;
+    }
+    memcpy(lz4_offsets_.get(), table.get() + sizeof(lz4_header_),
+           (lz4_header_.chunk_count + 1) * sizeof(uint64_t));
+    return CheckLZ4Table(lz4_header_, lz4_offsets_.get(), inode->blob_size,
+                         data_blocks * kBlobstoreBlockSize);
+}
+
+mx_status_t Blob::LoadChunk(uint64_t chunk) {
+    auto inode = &vn->blobstore->node_map_[map_index_];
+    uint64_t start_block = MerkleTreeBlocks(*inode);
+    uint64_t off = lz4_offsets_[chunk];
+    size_t clen = lz4_offsets_[chunk + 1] - off;
+    size_t len = LZ4ChunkLength(lz4_header_, inode->blob_size, chunk);
+    size_t len_rounded = mxtl::roundup(len, kBlobstoreBlockSize);
+    uint64_t first = off / kBlobstoreBlockSize;
+    uint64_t last = mxtl::roundup(off + clen, kBlobstoreBlockSize) / kBlobstoreBlockSize;
+
+    AllocChecker ac;
+    mxtl::unique_ptr<uint8_t[]> cdata(new (&ac) uint8_t[(last - first) * kBlobstoreBlockSize]);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    mxtl::unique_ptr<uint8_t[]> data(new (&ac) uint8_t[len_rounded]);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    mx_status_t status;
+    if ((status = ReadBlocks(start_block + first, last - first, cdata.get())) != NO_ERROR) {
+        return status;
+    }
+    if ((status = DecompressChunk(cdata.get() + off % kBlobstoreBlockSize, clen,
+                                  data.get(), len)) != NO_ERROR) {
+        return status;
+    }
+    memset(data.get() + len, 0, len_rounded - len);
+    return vmo_write_exact(vmo_blob_, data.get(), chunk * lz4_header_.chunk_size, len_rounded);
+}
+
+mx_status_t Blob::VerifyRange(uint64_t off, size_t len) {
+    static_assert(merkle::Tree::kNodeSize == kBlobstoreBlockSize,
+                  "Merkle tree nodes must be blocks");
+    auto inode = &vn->blobstore->node_map_[map_index_];
+    uint64_t start = off / kBlobstoreBlockSize;
+    uint64_t end = mxtl::roundup(off + len, kBlobstoreBlockSize) / kBlobstoreBlockSize;
+    size_t first_unverified;
+    if (verified_.Get(start, end, &first_unverified)) {
+        return NO_ERROR;
+    }
+    start = first_unverified;
+    off = start * kBlobstoreBlockSize;
+    len = mxtl::min(end * kBlobstoreBlockSize, inode->blob_size) - off;
+
+    // Fetch the tree nodes on the path from the root to these blocks...
+    mx_status_t status;
     merkle::Tree mt;
+    if ((status = mt.SetRanges(inode->blob_size, off, len)) != NO_ERROR) {
+        return status;
+    }
+    for (size_t i = 0; i < mt.ranges().size(); i++) {
+        const merkle::Tree::Range& range = mt.ranges()[i];
+        uint64_t tree_start = range.offset / kBlobstoreBlockSize;
+        uint64_t tree_end = mxtl::roundup(range.offset + range.length, kBlobstoreBlockSize) /
+                kBlobstoreBlockSize;
+        if ((status = LoadBlocks(tree_start, tree_end)) != NO_ERROR) {
+            return status;
+        }
+    }
+    // ... and the blocks themselves.
+    uint64_t merkle_blocks = MerkleTreeBlocks(*inode);
+    if ((status = LoadBlocks(merkle_blocks + start, merkle_blocks + end)) != NO_ERROR) {
+        return status;
+    }
+
     merkle::Digest d;
     d = ((const uint8_t*) &digest_[0]);
-    auto inode = &vn->blobstore->node_map_[map_index_];
     uint64_t size_merkle = merkle::Tree::GetTreeLength(inode->blob_size);
     status = mt.Verify((const void*)vmo_blob_addr_, inode->blob_size,
                        (const void*)vmo_merkle_tree_addr_, size_merkle,
@@ -515,8 +799,46 @@ mx_status_t Blob::Read(void* data, size_t len, size_t off, size_t* actual) {
     if (status != NO_ERROR) {
         return status;
     }
+    verified_.Set(start, end);
+    return NO_ERROR;
+}
 
-    return mx_vmo_read(vmo_blob_, data, off, len, actual);
+mx_status_t Blob::VerifyBlob() {
+    auto inode = &vn->blobstore->node_map_[map_index_];
+    uint64_t size_merkle = merkle::Tree::GetTreeLength(inode->blob_size);
+    AllocChecker ac;
+    mxtl::unique_ptr<uint8_t[]> tree;
+    if (size_merkle != 0) {
+        tree.reset(new (&ac) uint8_t[size_merkle]);
+        if (!ac.check()) {
+            return ERR_NO_MEMORY;
+        }
+    }
+    merkle::Tree mt;
+    merkle::Digest d;
+    mx_status_t status = mt.Create((const void*)vmo_blob_addr_, inode->blob_size,
+                                   tree.get(), size_merkle, &d, mx_system_get_num_cpus());
+    if (status != NO_ERROR) {
+        return status;
+    }
+    if ((d != digest_) ||
+        ((size_merkle != 0) &&
+         memcmp(tree.get(), (const void*)vmo_merkle_tree_addr_, size_merkle))) {
+        return ERR_IO_DATA_INTEGRITY;
+    }
+    verified_.Set(0, BlobDataBlocks(*inode));
+    return NO_ERROR;
+}
+
+mx_status_t Blob::Sync() {
+    if (!(flags_ & kBlobFlagSync)) {
+        return NO_ERROR;
+    }
+    mx_status_t status = vn->blobstore->writeback_->Wait(sync_seq_);
+    if (status == NO_ERROR) {
+        flags_ &= ~kBlobFlagSync;
+    }
+    return status;
 }
 
 void Blob::QueueUnlink() {
@@ -525,13 +847,14 @@ void Blob::QueueUnlink() {
 
 // Allocates Blocks IN MEMORY
 mx_status_t Blobstore::AllocateBlocks(size_t nblocks, size_t* blkno_out) {
-    mx_status_t status;
-    if ((status = block_map_.Find(false, 0, block_map_.size(), nblocks, blkno_out)) != NO_ERROR) {
+    uint64_t blkno;
+    if (free_extents_.TakeBestFit(nblocks, &blkno) != NO_ERROR) {
         return ERR_NO_SPACE;
     }
-    assert(DataStartBlock(info_) <= *blkno_out);
-    status = block_map_.Set(*blkno_out, *blkno_out + nblocks);
+    assert(DataStartBlock(info_) <= blkno);
+    mx_status_t status = block_map_.Set(blkno, blkno + nblocks);
     assert(status == NO_ERROR);
+    *blkno_out = blkno;
     return NO_ERROR;
 }
 
@@ -540,6 +863,59 @@ void Blobstore::FreeBlocks(size_t nblocks, size_t blkno) {
     assert(DataStartBlock(info_) <= blkno);
     mx_status_t status = block_map_.Clear(blkno, blkno + nblocks);
     assert(status == NO_ERROR);
+    free_extents_.Give(blkno, nblocks);
+}
+
+// Allocates Extents IN MEMORY
+mx_status_t Blobstore::AllocateExtents(uint64_t nblocks,
+                                       mxtl::unique_ptr<blobstore_extent_t[]>* out,
+                                       uint64_t* count_out) {
+    if (nblocks > free_extents_.free_blocks()) {
+        return ERR_NO_SPACE;
+    }
+    uint64_t max = mxtl::min(nblocks, kBlobstoreMaxExtents);
+    AllocChecker ac;
+    mxtl::unique_ptr<blobstore_extent_t[]> extents(new (&ac) blobstore_extent_t[max]);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+
+    // Take the longest extents until what is left fits in one of the rest,
+    // which keeps the number of pieces as low as it can be.
+    uint64_t count = 0;
+    uint64_t left = nblocks;
+    while (left > 0) {
+        blobstore_extent_t* e = &extents[count];
+        if (free_extents_.TakeBestFit(left, &e->start) == NO_ERROR) {
+            e->length = left;
+        } else if ((count + 1 == max) ||
+                   (free_extents_.TakeLongest(&e->start, &e->length) != NO_ERROR)) {
+            // Too broken up to store; give back what was taken.
+            for (uint64_t i = 0; i < count; i++) {
+                free_extents_.Give(extents[i].start, extents[i].length);
+            }
+            return ERR_NO_SPACE;
+        }
+        left -= e->length;
+        count++;
+    }
+
+    for (uint64_t i = 0; i < count; i++) {
+        assert(DataStartBlock(info_) <= extents[i].start);
+        mx_status_t status = block_map_.Set(extents[i].start,
+                                            extents[i].start + extents[i].length);
+        assert(status == NO_ERROR);
+    }
+    *out = mxtl::move(extents);
+    *count_out = count;
+    return NO_ERROR;
+}
+
+// Frees Extents IN MEMORY
+void Blobstore::FreeExtents(const blobstore_extent_t* extents, uint64_t count) {
+    for (uint64_t i = 0; i < count; i++) {
+        FreeBlocks(extents[i].length, extents[i].start);
+    }
 }
 
 // Allocates a node IN MEMORY
@@ -560,33 +936,70 @@ void Blobstore::FreeNode(size_t node_index) {
     memset(&node_map_[node_index], 0, sizeof(blobstore_inode_t));
 }
 
+bool Blobstore::ReapFrees(bool wait) {
+    if (wait && writeback_->FreesPending()) {
+        writeback_->Sync();
+    }
+    bool reaped = false;
+    mxtl::unique_ptr<WriteTxn> done;
+    while ((done = writeback_->TakeFreed()) != nullptr) {
+        FreeExtents(done->freed(), done->freed_count());
+        // Should the bitmap not be queued, the blocks are free in memory but
+        // not on disk, which only loses them until the next mount.
+        AllocChecker ac;
+        mxtl::unique_ptr<WriteTxn> txn(new (&ac) WriteTxn());
+        if (ac.check() &&
+            (WriteBitmap(txn.get(), done->freed(), done->freed_count()) == NO_ERROR)) {
+            writeback_->Enqueue(mxtl::move(txn));
+        }
+        reaped = true;
+    }
+    return reaped;
+}
+
+mx_status_t Blobstore::Sync() {
+    return writeback_->Sync();
+}
+
 mx_status_t Blobstore::Unmount() {
+    // Wait for queued removals, so that the bitmap blocks which free their
+    // space are queued too; stopping the thread writes out the rest.
+    ReapFrees(true);
+    writeback_->Stop();
     close(blockfd_);
     return NO_ERROR;
 }
 
-mx_status_t Blobstore::WriteBitmap(uint64_t nblocks, uint64_t start_block) {
-    uint64_t bbm_start_block = (start_block) / kBlobstoreBlockBits;
-    uint64_t bbm_end_block = mxtl::roundup(start_block + nblocks, kBlobstoreBlockBits) /
-            kBlobstoreBlockBits;
+mx_status_t Blobstore::WriteBitmap(WriteTxn* txn, const blobstore_extent_t* extents,
+                                   uint64_t count) {
+    // Find the blocks of the bitmap which cover the extents...
+    bitmap::RawBitmapGeneric<bitmap::DefaultStorage> dirty;
+    mx_status_t status;
+    if ((status = dirty.Reset(BlockMapBlocks(info_))) != NO_ERROR) {
+        return status;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t start = extents[i].start;
+        uint64_t end = start + extents[i].length;
+        dirty.Set(start / kBlobstoreBlockBits,
+                  mxtl::roundup(end, kBlobstoreBlockBits) / kBlobstoreBlockBits);
+    }
 
-    // Write back the block allocation bitmap
-    for (uint64_t b = bbm_start_block; b < bbm_end_block; b++) {
-        void* data = GetBlockmapData(b);
-        if (writeblk(blockfd_, BlockMapStartBlock() + b, data) != NO_ERROR) {
-            return ERR_IO;
+    // ... and add each of them once.
+    for (size_t b = dirty.Scan(0, dirty.size(), false); b < dirty.size();
+         b = dirty.Scan(b + 1, dirty.size(), false)) {
+        if ((status = txn->AddData(kWriteBitmap, GetBlockmapData(b), kBlobstoreBlockSize,
+                                   BlockMapStartBlock() + b)) != NO_ERROR) {
+            return status;
         }
     }
     return NO_ERROR;
 }
 
-mx_status_t Blobstore::WriteNode(size_t map_index) {
+mx_status_t Blobstore::WriteNode(WriteTxn* txn, size_t map_index) {
     uint64_t b = (map_index * sizeof(blobstore_inode_t)) / kBlobstoreBlockSize;
-    void* data = GetNodemapData(b);
-    if (writeblk(blockfd_, NodeMapStartBlock(info_) + b, data) != NO_ERROR) {
-        return ERR_IO;
-    }
-    return NO_ERROR;
+    return txn->AddData(kWriteNode, GetNodemapData(b), kBlobstoreBlockSize,
+                        NodeMapStartBlock(info_) + b);
 }
 
 mx_status_t Blobstore::VnodeNew(mxtl::RefPtr<Blobstore> bs, mxtl::RefPtr<Blob> blob,
@@ -634,11 +1047,6 @@ mx_status_t Blobstore::NewBlob(mxtl::RefPtr<Blobstore> bs, const merkle::Digest&
 }
 
 mx_status_t Blobstore::ReleaseBlob(mxtl::RefPtr<Blob> blob) {
-    // TODO(smklein): What if kBlobFlagSync is set? Do we risk writing out
-    // parts of the blob AFTER it has been deleted?
-    // Ex: open, alloc, disk write async start, unlink, release, disk write async end.
-    // FWIW, this isn't a problem right now with synchronous writes, but it
-    // would become a problem with asynchronous writes.
     switch (blob->GetState()) {
         case kBlobStateEmpty: {
             // There are no in-memory or on-disk structures allocated.
@@ -658,12 +1066,37 @@ mx_status_t Blobstore::ReleaseBlob(mxtl::RefPtr<Blob> blob) {
         case kBlobStateError: {
             blob->SetState(kBlobStateReleasing);
             size_t node_index = blob->GetMapIndex();
-            uint64_t start_block = node_map_[node_index].start_block;
-            uint64_t nblocks = node_map_[node_index].num_blocks;
+            // If the blob's extents cannot be read, its blocks are left
+            // allocated, which is safer than freeing the wrong ones.
+            bool extents_known = (blob->LoadExtents() == NO_ERROR);
+            uint64_t table_block = 0;
+            if (node_map_[node_index].flags & kBlobstoreInodeExtents) {
+                table_block = node_map_[node_index].start_block;
+            }
             FreeNode(node_index);
-            FreeBlocks(nblocks, start_block);
-            WriteNode(node_index);
-            WriteBitmap(nblocks, start_block);
+
+            // The node is cleared on disk after anything already queued for
+            // the blob, and its blocks freed only once that is done.
+            AllocChecker ac;
+            mxtl::unique_ptr<WriteTxn> txn(new (&ac) WriteTxn());
+            if (!ac.check() || (WriteNode(txn.get(), node_index) != NO_ERROR)) {
+                hash_.erase(*blob);
+                return ERR_NO_MEMORY;
+            }
+            uint64_t count = (table_block != 0) ? blob->extent_count_ + 1 : blob->extent_count_;
+            if (extents_known && (count != 0)) {
+                mxtl::unique_ptr<blobstore_extent_t[]> freed(new (&ac) blobstore_extent_t[count]);
+                if (ac.check()) {
+                    memcpy(freed.get(), blob->extents_.get(),
+                           blob->extent_count_ * sizeof(blobstore_extent_t));
+                    if (table_block != 0) {
+                        freed[count - 1].start = table_block;
+                        freed[count - 1].length = 1;
+                    }
+                    txn->SetFreed(mxtl::move(freed), count);
+                }
+            }
+            writeback_->Enqueue(mxtl::move(txn));
             hash_.erase(*blob);
             return NO_ERROR;
         }
@@ -713,7 +1146,8 @@ mx_status_t Blobstore::LookupBlob(mxtl::RefPtr<Blobstore> bs, const merkle::Dige
     return ERR_NOT_FOUND;
 }
 
-Blobstore::Blobstore(int fd, const blobstore_info_t* info) : blockfd_(fd) {
+Blobstore::Blobstore(int fd, const blobstore_info_t* info) :
+    blockfd_(fd), extent_table_seq_(0) {
     memcpy(&info_, info, sizeof(blobstore_info_t));
 }
 
@@ -752,6 +1186,18 @@ mx_status_t Blobstore::Create(int fd, const blobstore_info_t* info, VnodeBlob**
     if ((status = fs->LoadBitmaps()) < 0) {
         fprintf(stderr, "blobstore: Failed to load bitmaps\n");
         return status;
+    } else if ((status = fs->free_extents_.Load(fs->block_map_, DataStartBlock(fs->info_),
+                                                fs->info_.block_count)) != NO_ERROR) {
+        fprintf(stderr, "blobstore: Failed to index free space\n");
+        return status;
+    }
+
+    fs->writeback_.reset(new (&ac) Writeback(fs->blockfd_));
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    } else if ((status = fs->writeback_->Start()) != NO_ERROR) {
+        fprintf(stderr, "blobstore: Failed to start writeback\n");
+        return status;
     } else if (Blobstore::RootVnodeNew(fs, out)) {
         fprintf(stderr, "blobstore: Failed to allocate root vnode\n");
         return status;
@@ -804,86 +1250,4 @@ mx_status_t blobstore_mount(VnodeBlob** out, int blockfd) {
     return NO_ERROR;
 }
 
-int blobstore_mkfs(int fd) {
-    struct stat s;
-    if (fstat(fd, &s) < 0) {
-        fprintf(stderr, "blobstore: cannot find end of underlying device\n");
-        return ERR_BAD_STATE;
-    }
-
-    uint64_t blocks = s.st_size / kBlobstoreBlockSize;
-    uint64_t inodes = 32768;
-
-    blobstore_info_t info;
-    memset(&info, 0x00, sizeof(info));
-    info.magic0 = kBlobstoreMagic0;
-    info.magic1 = kBlobstoreMagic1;
-    info.version = kBlobstoreVersion;
-    info.flags = kBlobstoreFlagClean;
-    info.block_size = kBlobstoreBlockSize;
-    info.block_count = blocks;
-    info.inode_count = inodes;
-    info.blob_header_next = 0; // TODO(smklein): Allow chaining
-
-    xprintf("Blobstore Mkfs\n");
-    xprintf("Disk size  : %llu\n", s.st_size);
-    xprintf("Block Size : %u\n", kBlobstoreBlockSize);
-    xprintf("Block Count: %lu\n", blocks);
-    xprintf("Inode Count: %lu\n", inodes);
-
-    // Determine the number of blocks necessary for the block map and node map.
-    uint64_t bbm_blocks = BlockMapBlocks(info);
-    uint64_t nbm_blocks = NodeMapBlocks(info);
-    RawBitmap abm;
-    if (abm.Reset(bbm_blocks * kBlobstoreBlockBits)) {
-        fprintf(stderr, "Couldn't allocate blobstore block map\n");
-        return -1;
-    } else if (abm.Shrink(info.block_count)) {
-        fprintf(stderr, "Couldn't shrink blobstore block map\n");
-        return -1;
-    }
-
-    if (info.inode_count * sizeof(blobstore_inode_t) != nbm_blocks * kBlobstoreBlockSize) {
-        fprintf(stderr, "For simplicity, inode table block must be entirely filled\n");
-        return -1;
-    }
-
-    // update block bitmap:
-    // reserve all blocks before the data storage area.
-    abm.Set(0, DataStartBlock(info));
-
-    // All in-memory structures have been created successfully. Dump everything to disk.
-    char block[kBlobstoreBlockSize];
-    mx_status_t status;
-
-    // write the root block to disk
-    memset(block, 0, sizeof(block));
-    memcpy(block, &info, sizeof(info));
-    if ((status = writeblk(fd, 0, block)) != NO_ERROR) {
-        fprintf(stderr, "Failed to write root block\n");
-        return status;
-    }
-
-    // write allocation bitmap to disk
-    for (uint64_t n = 0; n < bbm_blocks; n++) {
-        void* bmdata = get_raw_bitmap_data(abm, n);
-        if ((status = writeblk(fd, BlockMapStartBlock() + n, bmdata)) < 0) {
-            fprintf(stderr, "Failed to write blockmap block %lu\n", n);
-            return status;
-        }
-    }
-
-    // write node map to disk
-    for (uint64_t n = 0; n < nbm_blocks; n++) {
-        memset(block, 0, sizeof(block));
-        if (writeblk(fd, NodeMapStartBlock(info) + n, block)) {
-            fprintf(stderr, "blobstore: failed writing inode map\n");
-            return ERR_IO;
-        }
-    }
-
-    xprintf("BLOBSTORE: mkfs success\n");
-    return 0;
-}
-
 } // namespace blobstore
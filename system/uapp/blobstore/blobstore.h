@@ -15,6 +15,7 @@
 #include <mxtl/ref_counted.h>
 #include <mxtl/ref_ptr.h>
 #include <mxtl/unique_free_ptr.h>
+#include <mxtl/unique_ptr.h>
 
 #include <magenta/types.h>
 
@@ -23,13 +24,20 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#ifdef __Fuchsia__
 using RawBitmap = bitmap::RawBitmapGeneric<bitmap::VmoStorage>;
+#else
+using RawBitmap = bitmap::RawBitmapGeneric<bitmap::DefaultStorage>;
+#endif
 
 // clang-format off
 
 constexpr uint64_t kBlobstoreMagic0  = (0xac2153479e694d21ULL);
 constexpr uint64_t kBlobstoreMagic1  = (0x985000d4d4d3d314ULL);
-constexpr uint32_t kBlobstoreVersion = 0x00000001;
+constexpr uint32_t kBlobstoreVersion = 0x00000003;
+// Version 1 predates inode flags, and so LZ4 compressed blobs: the field was
+// reserved. Version 2 predates extent tables, which a version 2 driver would
+// read as blob data. Both are refused, and must be reformatted.
 
 constexpr uint32_t kBlobstoreFlagClean      = 1;
 constexpr uint32_t kBlobstoreFlagDirty      = 2;
@@ -39,8 +47,10 @@ constexpr uint32_t kBlobstoreBlockMapStart  = 1;
 constexpr uint32_t kBlobstoreInodeSize      = 64;
 constexpr uint32_t kBlobstoreInodesPerBlock = (kBlobstoreBlockSize / kBlobstoreInodeSize);
 
+#ifdef __Fuchsia__
 static_assert(kBlobstoreBlockSize % PAGE_SIZE == 0,
               "Blobstore block size should be a multiple of page size");
+#endif
 
 // Notes:
 // - block 0 is always allocated
@@ -89,9 +99,13 @@ typedef struct {
     uint64_t start_block;
     uint64_t num_blocks;
     uint64_t blob_size;
-    uint64_t reserved;
+    uint64_t flags;
 } blobstore_inode_t;
 
+// Inode flags.
+constexpr uint64_t kBlobstoreInodeLZ4     = 0x1; // Data is stored as LZ4 chunks
+constexpr uint64_t kBlobstoreInodeExtents = 0x2; // start_block is an extent table
+
 static_assert(sizeof(blobstore_inode_t) == kBlobstoreInodeSize,
               "Blobstore Inode size is wrong");
 static_assert(kBlobstoreBlockSize % kBlobstoreInodeSize == 0,
@@ -102,5 +116,119 @@ constexpr uint64_t BlobDataBlocks(const blobstore_inode_t& blobNode) {
     return mxtl::roundup(blobNode.blob_size, kBlobstoreBlockSize) / kBlobstoreBlockSize;
 }
 
+// Number of blocks reserved for the Merkle Tree
+inline uint64_t MerkleTreeBlocks(const blobstore_inode_t& blobNode) {
+    uint64_t size_merkle = merkle::Tree::GetTreeLength(blobNode.blob_size);
+    return mxtl::roundup(size_merkle, kBlobstoreBlockSize) / kBlobstoreBlockSize;
+}
+
+// Compressed blobs
+//
+// The data of a blob with kBlobstoreInodeLZ4 set is cut into chunks of
+// |chunk_size| bytes (the last may be short), and each chunk is compressed
+// on its own so that any part of the blob can be read without decompressing
+// what comes before it. The blocks after the Merkle tree hold a header,
+// then a table of where each chunk starts, then the chunks:
+//
+//   blobstore_lz4_header_t
+//   uint64_t offsets[chunk_count + 1]
+//   (zeroes up to the next block boundary)
+//   chunk 0, chunk 1, ...
+//
+// Offsets count from the start of the header, and chunk n runs from
+// offsets[n] to offsets[n + 1]. A chunk which LZ4 could not shrink is stored
+// as it is; these are told apart by their length, which is then exactly
+// that of the uncompressed chunk. The Merkle tree always covers the
+// uncompressed data, which is what is checked on every read.
+
+constexpr uint64_t kBlobstoreLZ4Magic     = (0x347a6c2d626f6c62ULL); // "blob-lz4"
+constexpr uint32_t kBlobstoreLZ4ChunkSize = (8 * kBlobstoreBlockSize);
+constexpr uint32_t kBlobstoreLZ4MaxChunk  = (128 * kBlobstoreBlockSize);
+
+typedef struct {
+    uint64_t magic;
+    uint32_t chunk_size;  // Uncompressed bytes per chunk; a multiple of the block size
+    uint32_t chunk_count;
+} blobstore_lz4_header_t;
+
+constexpr uint64_t LZ4ChunkCount(uint64_t blob_size, uint32_t chunk_size) {
+    return (blob_size + chunk_size - 1) / chunk_size;
+}
+
+// Bytes taken up by the header and table of offsets, rounded up to whole
+// blocks; this is where the first chunk starts.
+constexpr uint64_t LZ4TableSize(uint64_t chunk_count) {
+    return mxtl::roundup(sizeof(blobstore_lz4_header_t) + (chunk_count + 1) * sizeof(uint64_t),
+                         static_cast<uint64_t>(kBlobstoreBlockSize));
+}
+
+// Fragmented blobs
+//
+// A blob is normally stored in one run of |num_blocks| blocks from
+// |start_block|: its Merkle tree, then its data. When free space is too
+// broken up for that, kBlobstoreInodeExtents is set and |start_block| names
+// a block holding a table of the runs ("extents") instead:
+//
+//   blobstore_extent_header_t
+//   blobstore_extent_t extents[count]
+//
+// The extents are listed in the order of the blob's blocks, and together
+// hold exactly |num_blocks| of them; the table block is not counted. A blob
+// which fits in one extent is always stored the plain way.
+
+constexpr uint64_t kBlobstoreExtentMagic = (0x7478652d626f6c62ULL); // "blob-ext"
+
+typedef struct {
+    uint64_t magic;
+    uint64_t count;
+} blobstore_extent_header_t;
+
+typedef struct {
+    uint64_t start;
+    uint64_t length;
+} blobstore_extent_t;
+
+constexpr uint64_t kBlobstoreMaxExtents = ((kBlobstoreBlockSize -
+                                            sizeof(blobstore_extent_header_t)) /
+                                           sizeof(blobstore_extent_t));
+
 void* GetBlock(const RawBitmap& bitmap, uint32_t blkno);
 void* GetBitBlock(const RawBitmap& bitmap, uint32_t* blkno_out, uint32_t bitno);
+
+namespace blobstore {
+
+mx_status_t readblk(int fd, uint64_t bno, void* data);
+mx_status_t writeblk(int fd, uint64_t bno, const void* data);
+
+// Read or write |count| consecutive blocks from |bno| in one go.
+mx_status_t readblks(int fd, uint64_t bno, uint64_t count, void* data);
+mx_status_t writeblks(int fd, uint64_t bno, uint64_t count, const void* data);
+
+// Get the extents of a blob, reading its extent table if it has one, and
+// check that they lie within the data area and add up to the blob.
+mx_status_t blobstore_load_extents(int fd, const blobstore_info_t& info,
+                                   const blobstore_inode_t& inode,
+                                   mxtl::unique_ptr<blobstore_extent_t[]>* out,
+                                   uint64_t* count_out);
+
+// Find the disk block holding block |n| of a blob, counting from the start
+// of its Merkle tree, and how many blocks of the same extent follow it (it
+// included). Returns false if the blob is not that long.
+bool blobstore_map_block(const blobstore_extent_t* extents, uint64_t count, uint64_t n,
+                         uint64_t* bno_out, uint64_t* run_out);
+
+// Read blocks [n, n + nblocks) of a blob, as above, with one read for each
+// extent they touch.
+mx_status_t blobstore_read_blocks(int fd, const blobstore_extent_t* extents, uint64_t count,
+                                  uint64_t n, uint64_t nblocks, void* out);
+
+// Sanity check the metadata for the blobstore, given a maximum number of
+// available blocks.
+mx_status_t blobstore_check_info(const blobstore_info_t* info, uint64_t max);
+
+// Get a pointer to the nth block of the bitmap.
+void* get_raw_bitmap_data(const RawBitmap& bm, uint64_t n);
+
+int blobstore_mkfs(int fd);
+
+} // namespace blobstore
@@ -0,0 +1,285 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Pieces of blobstore which do not depend on Magenta, so that the host tool
+// can use them too.
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <magenta/new.h>
+#include <mxio/debug.h>
+
+#define MXDEBUG 0
+
+#include "blobstore.h"
+
+namespace blobstore {
+
+// Get a pointer to the nth block of the bitmap.
+void* get_raw_bitmap_data(const RawBitmap& bm, uint64_t n) {
+    assert(n * kBlobstoreBlockSize < bm.size()); // Accessing beyond end of bitmap
+    assert(kBlobstoreBlockSize <= (n + 1) * kBlobstoreBlockSize); // Avoid overflow
+    return (void*)((uintptr_t)(bm.StorageUnsafe()->GetData()) +
+                   (uintptr_t)(kBlobstoreBlockSize * n));
+}
+
+// Sanity check the metadata for the blobstore, given a maximum number of
+// available blocks.
+mx_status_t blobstore_check_info(const blobstore_info_t* info, uint64_t max) {
+    if ((info->magic0 != kBlobstoreMagic0) ||
+        (info->magic1 != kBlobstoreMagic1)) {
+        fprintf(stderr, "blobstore: bad magic\n");
+        return ERR_INVALID_ARGS;
+    }
+    if (info->version != kBlobstoreVersion) {
+        fprintf(stderr, "blobstore: FS Version: %08x. Driver version: %08x\n", info->version,
+              kBlobstoreVersion);
+        if (info->version < kBlobstoreVersion) {
+            fprintf(stderr, "blobstore: the filesystem must be reformatted\n");
+        }
+        return ERR_INVALID_ARGS;
+    }
+    if (info->block_size != kBlobstoreBlockSize) {
+        fprintf(stderr, "blobstore: bsz %u unsupported\n", info->block_size);
+        return ERR_INVALID_ARGS;
+    }
+    if (info->block_count > max) {
+        fprintf(stderr, "blobstore: too large for device\n");
+        return ERR_INVALID_ARGS;
+    }
+    if (info->blob_header_next != 0) {
+        fprintf(stderr, "blobstore: linked blob headers not yet supported\n");
+        return ERR_INVALID_ARGS;
+    }
+    return NO_ERROR;
+}
+
+// pread() and pwrite() leave the file offset alone, so the blobstore's
+// writeback thread can write through the same fd as it reads from.
+mx_status_t readblk(int fd, uint64_t bno, void* data) {
+    off_t off = bno * kBlobstoreBlockSize;
+    if (pread(fd, data, kBlobstoreBlockSize, off) != kBlobstoreBlockSize) {
+        fprintf(stderr, "blobstore: cannot read block %lu\n", bno);
+        return ERR_IO;
+    }
+    return NO_ERROR;
+}
+
+mx_status_t writeblk(int fd, uint64_t bno, const void* data) {
+    off_t off = bno * kBlobstoreBlockSize;
+    if (pwrite(fd, data, kBlobstoreBlockSize, off) != kBlobstoreBlockSize) {
+        fprintf(stderr, "blobstore: cannot write block %lu\n", bno);
+        return ERR_IO;
+    }
+    return NO_ERROR;
+}
+
+mx_status_t readblks(int fd, uint64_t bno, uint64_t count, void* data) {
+    off_t off = bno * kBlobstoreBlockSize;
+    size_t len = count * kBlobstoreBlockSize;
+    for (size_t done = 0; done < len;) {
+        ssize_t r = pread(fd, static_cast<uint8_t*>(data) + done, len - done, off + done);
+        if (r <= 0) {
+            fprintf(stderr, "blobstore: cannot read blocks %lu-%lu\n", bno, bno + count - 1);
+            return ERR_IO;
+        }
+        done += r;
+    }
+    return NO_ERROR;
+}
+
+mx_status_t writeblks(int fd, uint64_t bno, uint64_t count, const void* data) {
+    off_t off = bno * kBlobstoreBlockSize;
+    size_t len = count * kBlobstoreBlockSize;
+    for (size_t done = 0; done < len;) {
+        ssize_t r = pwrite(fd, static_cast<const uint8_t*>(data) + done, len - done,
+                           off + done);
+        if (r <= 0) {
+            fprintf(stderr, "blobstore: cannot write blocks %lu-%lu\n", bno, bno + count - 1);
+            return ERR_IO;
+        }
+        done += r;
+    }
+    return NO_ERROR;
+}
+
+mx_status_t blobstore_load_extents(int fd, const blobstore_info_t& info,
+                                   const blobstore_inode_t& inode,
+                                   mxtl::unique_ptr<blobstore_extent_t[]>* out,
+                                   uint64_t* count_out) {
+    uint64_t data_start = DataStartBlock(info);
+    AllocChecker ac;
+    if (!(inode.flags & kBlobstoreInodeExtents)) {
+        if ((inode.start_block < data_start) ||
+            (inode.num_blocks > info.block_count - inode.start_block)) {
+            return ERR_IO_DATA_INTEGRITY;
+        }
+        out->reset(new (&ac) blobstore_extent_t[1]);
+        if (!ac.check()) {
+            return ERR_NO_MEMORY;
+        }
+        (*out)[0].start = inode.start_block;
+        (*out)[0].length = inode.num_blocks;
+        *count_out = 1;
+        return NO_ERROR;
+    }
+
+    if ((inode.start_block < data_start) || (inode.start_block >= info.block_count)) {
+        return ERR_IO_DATA_INTEGRITY;
+    }
+    uint8_t block[kBlobstoreBlockSize];
+    mx_status_t status;
+    if ((status = readblk(fd, inode.start_block, block)) != NO_ERROR) {
+        return status;
+    }
+    blobstore_extent_header_t hdr;
+    memcpy(&hdr, block, sizeof(hdr));
+    if ((hdr.magic != kBlobstoreExtentMagic) || (hdr.count < 2) ||
+        (hdr.count > kBlobstoreMaxExtents)) {
+        return ERR_IO_DATA_INTEGRITY;
+    }
+    mxtl::unique_ptr<blobstore_extent_t[]> extents(new (&ac) blobstore_extent_t[hdr.count]);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    memcpy(extents.get(), block + sizeof(hdr), hdr.count * sizeof(blobstore_extent_t));
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < hdr.count; i++) {
+        const blobstore_extent_t& e = extents[i];
+        if ((e.length == 0) || (e.start < data_start) || (e.start >= info.block_count) ||
+            (e.length > info.block_count - e.start)) {
+            return ERR_IO_DATA_INTEGRITY;
+        }
+        total += e.length;
+    }
+    if (total != inode.num_blocks) {
+        return ERR_IO_DATA_INTEGRITY;
+    }
+    *out = mxtl::move(extents);
+    *count_out = hdr.count;
+    return NO_ERROR;
+}
+
+bool blobstore_map_block(const blobstore_extent_t* extents, uint64_t count, uint64_t n,
+                         uint64_t* bno_out, uint64_t* run_out) {
+    for (uint64_t i = 0; i < count; i++) {
+        if (n < extents[i].length) {
+            *bno_out = extents[i].start + n;
+            *run_out = extents[i].length - n;
+            return true;
+        }
+        n -= extents[i].length;
+    }
+    return false;
+}
+
+mx_status_t blobstore_read_blocks(int fd, const blobstore_extent_t* extents, uint64_t count,
+                                  uint64_t n, uint64_t nblocks, void* out) {
+    uint8_t* dst = static_cast<uint8_t*>(out);
+    while (nblocks > 0) {
+        uint64_t bno, run;
+        if (!blobstore_map_block(extents, count, n, &bno, &run)) {
+            return ERR_IO_DATA_INTEGRITY;
+        }
+        run = mxtl::min(run, nblocks);
+        mx_status_t status = readblks(fd, bno, run, dst);
+        if (status != NO_ERROR) {
+            return status;
+        }
+        dst += run * kBlobstoreBlockSize;
+        n += run;
+        nblocks -= run;
+    }
+    return NO_ERROR;
+}
+
+int blobstore_mkfs(int fd) {
+    struct stat s;
+    if (fstat(fd, &s) < 0) {
+        fprintf(stderr, "blobstore: cannot find end of underlying device\n");
+        return ERR_BAD_STATE;
+    }
+
+    uint64_t blocks = s.st_size / kBlobstoreBlockSize;
+    uint64_t inodes = 32768;
+
+    blobstore_info_t info;
+    memset(&info, 0x00, sizeof(info));
+    info.magic0 = kBlobstoreMagic0;
+    info.magic1 = kBlobstoreMagic1;
+    info.version = kBlobstoreVersion;
+    info.flags = kBlobstoreFlagClean;
+    info.block_size = kBlobstoreBlockSize;
+    info.block_count = blocks;
+    info.inode_count = inodes;
+    info.blob_header_next = 0; // TODO(smklein): Allow chaining
+
+    xprintf("Blobstore Mkfs\n");
+    xprintf("Disk size  : %llu\n", (unsigned long long)s.st_size);
+    xprintf("Block Size : %u\n", kBlobstoreBlockSize);
+    xprintf("Block Count: %lu\n", blocks);
+    xprintf("Inode Count: %lu\n", inodes);
+
+    // Determine the number of blocks necessary for the block map and node map.
+    uint64_t bbm_blocks = BlockMapBlocks(info);
+    uint64_t nbm_blocks = NodeMapBlocks(info);
+    RawBitmap abm;
+    if (abm.Reset(bbm_blocks * kBlobstoreBlockBits)) {
+        fprintf(stderr, "Couldn't allocate blobstore block map\n");
+        return -1;
+    } else if (abm.Shrink(info.block_count)) {
+        fprintf(stderr, "Couldn't shrink blobstore block map\n");
+        return -1;
+    }
+
+    if (info.inode_count * sizeof(blobstore_inode_t) != nbm_blocks * kBlobstoreBlockSize) {
+        fprintf(stderr, "For simplicity, inode table block must be entirely filled\n");
+        return -1;
+    }
+
+    // update block bitmap:
+    // reserve all blocks before the data storage area.
+    abm.Set(0, DataStartBlock(info));
+
+    // All in-memory structures have been created successfully. Dump everything to disk.
+    char block[kBlobstoreBlockSize];
+    mx_status_t status;
+
+    // write the root block to disk
+    memset(block, 0, sizeof(block));
+    memcpy(block, &info, sizeof(info));
+    if ((status = writeblk(fd, 0, block)) != NO_ERROR) {
+        fprintf(stderr, "Failed to write root block\n");
+        return status;
+    }
+
+    // write allocation bitmap to disk
+    for (uint64_t n = 0; n < bbm_blocks; n++) {
+        void* bmdata = get_raw_bitmap_data(abm, n);
+        if ((status = writeblk(fd, BlockMapStartBlock() + n, bmdata)) < 0) {
+            fprintf(stderr, "Failed to write blockmap block %lu\n", n);
+            return status;
+        }
+    }
+
+    // write node map to disk
+    for (uint64_t n = 0; n < nbm_blocks; n++) {
+        memset(block, 0, sizeof(block));
+        if (writeblk(fd, NodeMapStartBlock(info) + n, block)) {
+            fprintf(stderr, "blobstore: failed writing inode map\n");
+            return ERR_IO;
+        }
+    }
+
+    xprintf("BLOBSTORE: mkfs success\n");
+    return 0;
+}
+
+} // namespace blobstore
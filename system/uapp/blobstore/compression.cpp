@@ -0,0 +1,94 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <string.h>
+
+#include <lz4/lz4.h>
+
+#include "compression.h"
+
+namespace blobstore {
+
+size_t CompressChunk(const void* data, size_t len, void* out) {
+    // Anything that would not come out shorter is left alone, which keeps
+    // the lengths of stored and compressed chunks apart.
+    int clen = 0;
+    if (len > 1) {
+        clen = LZ4_compress_default(static_cast<const char*>(data), static_cast<char*>(out),
+                                    static_cast<int>(len), static_cast<int>(len - 1));
+    }
+    if (clen <= 0) {
+        memcpy(out, data, len);
+        return len;
+    }
+    return clen;
+}
+
+mx_status_t CompressBlob(const void* data, size_t len, uint32_t chunk_size,
+                         void* out, size_t out_max, size_t* out_len) {
+    blobstore_lz4_header_t hdr;
+    hdr.magic = kBlobstoreLZ4Magic;
+    hdr.chunk_size = chunk_size;
+    hdr.chunk_count = static_cast<uint32_t>(LZ4ChunkCount(len, chunk_size));
+    uint64_t off = LZ4TableSize(hdr.chunk_count);
+    if (off >= out_max) {
+        return ERR_BUFFER_TOO_SMALL;
+    }
+
+    uint8_t* dst = static_cast<uint8_t*>(out);
+    memset(dst, 0, off);
+    memcpy(dst, &hdr, sizeof(hdr));
+    uint64_t* offsets = reinterpret_cast<uint64_t*>(dst + sizeof(hdr));
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+    for (uint64_t n = 0; n < hdr.chunk_count; n++) {
+        offsets[n] = off;
+        off += CompressChunk(src + n * chunk_size, LZ4ChunkLength(hdr, len, n), dst + off);
+        if (off > out_max) {
+            return ERR_BUFFER_TOO_SMALL;
+        }
+    }
+    offsets[hdr.chunk_count] = off;
+    *out_len = off;
+    return NO_ERROR;
+}
+
+mx_status_t DecompressChunk(const void* data, size_t clen, void* out, size_t len) {
+    if (clen == len) {
+        memcpy(out, data, len);
+        return NO_ERROR;
+    }
+    int r = LZ4_decompress_safe(static_cast<const char*>(data), static_cast<char*>(out),
+                                static_cast<int>(clen), static_cast<int>(len));
+    if ((r < 0) || (static_cast<size_t>(r) != len)) {
+        return ERR_IO_DATA_INTEGRITY;
+    }
+    return NO_ERROR;
+}
+
+mx_status_t CheckLZ4Header(const blobstore_lz4_header_t& hdr, uint64_t blob_size) {
+    if ((hdr.magic != kBlobstoreLZ4Magic) || (hdr.chunk_size == 0) ||
+        (hdr.chunk_size % kBlobstoreBlockSize != 0) ||
+        (hdr.chunk_size > kBlobstoreLZ4MaxChunk) ||
+        (hdr.chunk_count != LZ4ChunkCount(blob_size, hdr.chunk_size))) {
+        return ERR_IO_DATA_INTEGRITY;
+    }
+    return NO_ERROR;
+}
+
+mx_status_t CheckLZ4Table(const blobstore_lz4_header_t& hdr, const uint64_t* offsets,
+                          uint64_t blob_size, uint64_t data_len) {
+    if ((offsets[0] != LZ4TableSize(hdr.chunk_count)) ||
+        (offsets[hdr.chunk_count] > data_len)) {
+        return ERR_IO_DATA_INTEGRITY;
+    }
+    for (uint64_t n = 0; n < hdr.chunk_count; n++) {
+        if ((offsets[n + 1] <= offsets[n]) ||
+            (offsets[n + 1] - offsets[n] > LZ4ChunkLength(hdr, blob_size, n))) {
+            return ERR_IO_DATA_INTEGRITY;
+        }
+    }
+    return NO_ERROR;
+}
+
+} // namespace blobstore
@@ -0,0 +1,50 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <magenta/types.h>
+
+#include "blobstore.h"
+
+// Helpers for the chunked LZ4 format described in blobstore.h, shared by the
+// filesystem and the host tool.
+
+namespace blobstore {
+
+// Compresses one chunk of |len| bytes into |out|, which must have room for
+// |len| bytes, and returns the number of bytes used. A chunk which does not
+// shrink is copied as it is, so the result is never more than |len|.
+size_t CompressChunk(const void* data, size_t len, void* out);
+
+// Lays out all |len| bytes of |data| in the chunked format, in chunks of
+// |chunk_size|, if the result fits in |out_max| bytes at |out|; if not,
+// ERR_BUFFER_TOO_SMALL is returned. |out| needs room for |chunk_size| bytes
+// more than |out_max|.
+mx_status_t CompressBlob(const void* data, size_t len, uint32_t chunk_size,
+                         void* out, size_t out_max, size_t* out_len);
+
+// Undoes CompressChunk: |clen| bytes at |data| become |len| bytes at |out|.
+mx_status_t DecompressChunk(const void* data, size_t clen, void* out, size_t len);
+
+// Checks a header and table of offsets, read from the start of |data_len|
+// bytes of compressed data, against the size of the blob they belong to.
+// |offsets| must have room for the header's chunk_count + 1 entries; call
+// CheckLZ4Header first to be sure of that.
+mx_status_t CheckLZ4Header(const blobstore_lz4_header_t& hdr, uint64_t blob_size);
+mx_status_t CheckLZ4Table(const blobstore_lz4_header_t& hdr, const uint64_t* offsets,
+                          uint64_t blob_size, uint64_t data_len);
+
+// Uncompressed length of chunk |n|.
+inline size_t LZ4ChunkLength(const blobstore_lz4_header_t& hdr, uint64_t blob_size,
+                             uint64_t n) {
+    uint64_t off = n * hdr.chunk_size;
+    return static_cast<size_t>(mxtl::min(blob_size - off,
+                                         static_cast<uint64_t>(hdr.chunk_size)));
+}
+
+} // namespace blobstore
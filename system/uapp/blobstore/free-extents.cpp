@@ -0,0 +1,129 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <assert.h>
+
+#include <magenta/new.h>
+
+#include "free-extents.h"
+
+namespace blobstore {
+
+FreeExtentIndex::~FreeExtentIndex() {
+    Clear();
+}
+
+void FreeExtentIndex::Clear() {
+    by_length_.clear();
+    while (!by_start_.is_empty()) {
+        delete by_start_.pop_front();
+    }
+    free_blocks_ = 0;
+}
+
+mx_status_t FreeExtentIndex::Add(uint64_t start, uint64_t length) {
+    AllocChecker ac;
+    Run* run = new (&ac) Run();
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    run->start = start;
+    run->length = length;
+    by_start_.insert(run);
+    by_length_.insert(run);
+    free_blocks_ += length;
+    return NO_ERROR;
+}
+
+void FreeExtentIndex::Shorten(Run* run, uint64_t length) {
+    assert(length <= run->length);
+    by_start_.erase(*run);
+    by_length_.erase(*run);
+    free_blocks_ -= length;
+    if (length == run->length) {
+        delete run;
+        return;
+    }
+    run->start += length;
+    run->length -= length;
+    by_start_.insert(run);
+    by_length_.insert(run);
+}
+
+mx_status_t FreeExtentIndex::Load(const RawBitmap& map, uint64_t start, uint64_t end) {
+    Clear();
+    for (uint64_t n = start; n < end;) {
+        uint64_t first_free = map.Scan(n, end, true);
+        if (first_free == end) {
+            break;
+        }
+        uint64_t first_used = map.Scan(first_free, end, false);
+        mx_status_t status = Add(first_free, first_used - first_free);
+        if (status != NO_ERROR) {
+            Clear();
+            return status;
+        }
+        n = first_used;
+    }
+    return NO_ERROR;
+}
+
+mx_status_t FreeExtentIndex::TakeBestFit(uint64_t length, uint64_t* start_out) {
+    auto iter = by_length_.lower_bound({ .start = 0, .length = length });
+    if (!iter.IsValid()) {
+        return ERR_NO_SPACE;
+    }
+    Run* run = iter.CopyPointer();
+    *start_out = run->start;
+    Shorten(run, length);
+    return NO_ERROR;
+}
+
+mx_status_t FreeExtentIndex::TakeLongest(uint64_t* start_out, uint64_t* length_out) {
+    if (by_length_.is_empty()) {
+        return ERR_NO_SPACE;
+    }
+    Run* run = &by_length_.back();
+    *start_out = run->start;
+    *length_out = run->length;
+    Shorten(run, run->length);
+    return NO_ERROR;
+}
+
+void FreeExtentIndex::Give(uint64_t start, uint64_t length) {
+    auto before = by_start_.upper_bound(start);
+    auto after = before--;
+    Run* prev = (before.IsValid() && (before->start + before->length == start)) ?
+            before.CopyPointer() : nullptr;
+    Run* next = (after.IsValid() && (start + length == after->start)) ?
+            after.CopyPointer() : nullptr;
+
+    if (prev == nullptr && next == nullptr) {
+        Add(start, length);
+        return;
+    }
+
+    free_blocks_ += length;
+    if (next != nullptr) {
+        by_start_.erase(*next);
+        by_length_.erase(*next);
+    }
+    if (prev != nullptr) {
+        // Grow the run before; its start, and so its place by start, stays.
+        by_length_.erase(*prev);
+        prev->length += length;
+        if (next != nullptr) {
+            prev->length += next->length;
+            delete next;
+        }
+        by_length_.insert(prev);
+    } else {
+        next->start = start;
+        next->length += length;
+        by_start_.insert(next);
+        by_length_.insert(next);
+    }
+}
+
+} // namespace blobstore
@@ -0,0 +1,96 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <magenta/types.h>
+#include <mxtl/intrusive_wavl_tree.h>
+#include <mxtl/macros.h>
+
+#include "blobstore.h"
+
+namespace blobstore {
+
+// An index of the runs of free blocks in a blobstore, kept in step with the
+// block bitmap so that finding space does not mean scanning it. Each run is
+// in two trees: one sorted by start block, so that a run which is given back
+// can be merged with its neighbours, and one sorted by length, so that the
+// shortest run which is long enough can be found in O(log n).
+class FreeExtentIndex {
+public:
+    FreeExtentIndex() {}
+    ~FreeExtentIndex();
+    DISALLOW_COPY_ASSIGN_AND_MOVE(FreeExtentIndex);
+
+    // Forget all runs, then add each run of clear bits in [start, end) of
+    // |map|.
+    mx_status_t Load(const RawBitmap& map, uint64_t start, uint64_t end);
+
+    // Take |length| blocks from the front of the shortest run which holds
+    // them all. Returns ERR_NO_SPACE if there is none.
+    mx_status_t TakeBestFit(uint64_t length, uint64_t* start_out);
+
+    // Take the whole of the longest run. Returns ERR_NO_SPACE if there are
+    // no free blocks at all.
+    mx_status_t TakeLongest(uint64_t* start_out, uint64_t* length_out);
+
+    // Give back a run of blocks, merging it with the runs on either side.
+    // If no memory can be found to track it, the run is left out of the
+    // index, and so goes unused until the index is next loaded.
+    void Give(uint64_t start, uint64_t length);
+
+    uint64_t free_blocks() const { return free_blocks_; }
+    size_t run_count() const { return by_start_.size(); }
+
+private:
+    struct Run : public blobstore_extent_t {
+        using NodeState = mxtl::WAVLTreeNodeState<Run*>;
+
+        struct ByStartNodeTraits {
+            static NodeState& node_state(Run& r) { return r.by_start_state; }
+        };
+        struct ByStartKeyTraits {
+            static uint64_t GetKey(const Run& r) { return r.start; }
+            static bool LessThan(uint64_t k1, uint64_t k2) { return k1 < k2; }
+            static bool EqualTo(uint64_t k1, uint64_t k2) { return k1 == k2; }
+        };
+        struct ByLengthNodeTraits {
+            static NodeState& node_state(Run& r) { return r.by_length_state; }
+        };
+        struct ByLengthKeyTraits {
+            static const blobstore_extent_t& GetKey(const Run& r) { return r; }
+            static bool LessThan(const blobstore_extent_t& k1, const blobstore_extent_t& k2) {
+                return (k1.length < k2.length) ||
+                       ((k1.length == k2.length) && (k1.start < k2.start));
+            }
+            static bool EqualTo(const blobstore_extent_t& k1, const blobstore_extent_t& k2) {
+                return (k1.length == k2.length) && (k1.start == k2.start);
+            }
+        };
+
+        NodeState by_start_state;
+        NodeState by_length_state;
+    };
+
+    using ByStartTree = mxtl::WAVLTree<uint64_t, Run*, Run::ByStartKeyTraits,
+                                       Run::ByStartNodeTraits>;
+    using ByLengthTree = mxtl::WAVLTree<blobstore_extent_t, Run*, Run::ByLengthKeyTraits,
+                                        Run::ByLengthNodeTraits>;
+
+    void Clear();
+    mx_status_t Add(uint64_t start, uint64_t length);
+
+    // Cut the first |length| blocks off |run|, deleting it if that is all
+    // of it.
+    void Shorten(Run* run, uint64_t length);
+
+    ByStartTree by_start_;
+    ByLengthTree by_length_;
+    uint64_t free_blocks_ = 0;
+};
+
+} // namespace blobstore
@@ -0,0 +1,425 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <magenta/new.h>
+#include <merkle/digest.h>
+#include <merkle/tree.h>
+#include <mxtl/unique_ptr.h>
+
+#include "blobstore.h"
+#include "compression.h"
+#include "host.h"
+
+namespace blobstore {
+namespace {
+
+// The allocation maps of an image, held in memory while it is changed.
+class Image {
+public:
+    explicit Image(int fd) : fd_(fd) {}
+
+    mx_status_t Load();
+
+    // Write back both maps in full.
+    mx_status_t Flush();
+
+    mx_status_t AllocateNode(size_t* node_index_out);
+    mx_status_t AllocateBlocks(uint64_t nblocks, uint64_t* blkno_out);
+
+    // Returns the index of a blob already in the image, or -1.
+    ssize_t FindBlob(const merkle::Digest& digest) const;
+
+    mx_status_t ReadBlocks(uint64_t bno, uint64_t nblocks, uint8_t* out) const;
+    mx_status_t WriteBlocks(uint64_t bno, const uint8_t* data, uint64_t len) const;
+
+    int fd_;
+    blobstore_info_t info_;
+    RawBitmap block_map_;
+    mxtl::unique_ptr<blobstore_inode_t[]> node_map_;
+};
+
+mx_status_t Image::Load() {
+    char block[kBlobstoreBlockSize];
+    struct stat s;
+    mx_status_t status;
+    if ((status = readblk(fd_, 0, block)) != NO_ERROR) {
+        return status;
+    }
+    memcpy(&info_, block, sizeof(info_));
+    if (fstat(fd_, &s) < 0) {
+        fprintf(stderr, "blobstore: cannot find end of image\n");
+        return ERR_BAD_STATE;
+    }
+    if ((status = blobstore_check_info(&info_, s.st_size / kBlobstoreBlockSize)) != NO_ERROR) {
+        return status;
+    }
+
+    if (((status = block_map_.Reset(BlockMapBlocks(info_) * kBlobstoreBlockBits)) != NO_ERROR) ||
+        ((status = block_map_.Shrink(info_.block_count)) != NO_ERROR)) {
+        return status;
+    }
+    AllocChecker ac;
+    node_map_.reset(new (&ac) blobstore_inode_t[info_.inode_count]);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    for (uint64_t n = 0; n < BlockMapBlocks(info_); n++) {
+        if ((status = readblk(fd_, BlockMapStartBlock() + n,
+                              get_raw_bitmap_data(block_map_, n))) != NO_ERROR) {
+            return status;
+        }
+    }
+    return ReadBlocks(NodeMapStartBlock(info_), NodeMapBlocks(info_),
+                      reinterpret_cast<uint8_t*>(node_map_.get()));
+}
+
+mx_status_t Image::Flush() {
+    mx_status_t status;
+    for (uint64_t n = 0; n < BlockMapBlocks(info_); n++) {
+        if ((status = writeblk(fd_, BlockMapStartBlock() + n,
+                               get_raw_bitmap_data(block_map_, n))) != NO_ERROR) {
+            return status;
+        }
+    }
+    return WriteBlocks(NodeMapStartBlock(info_), reinterpret_cast<uint8_t*>(node_map_.get()),
+                       NodeMapBlocks(info_) * kBlobstoreBlockSize);
+}
+
+mx_status_t Image::AllocateNode(size_t* node_index_out) {
+    for (size_t i = 0; i < info_.inode_count; i++) {
+        if (node_map_[i].start_block == kStartBlockFree) {
+            *node_index_out = i;
+            return NO_ERROR;
+        }
+    }
+    return ERR_NO_RESOURCES;
+}
+
+mx_status_t Image::AllocateBlocks(uint64_t nblocks, uint64_t* blkno_out) {
+    size_t blkno;
+    if (block_map_.Find(false, 0, block_map_.size(), nblocks, &blkno) != NO_ERROR) {
+        return ERR_NO_SPACE;
+    }
+    *blkno_out = blkno;
+    return block_map_.Set(blkno, blkno + nblocks);
+}
+
+ssize_t Image::FindBlob(const merkle::Digest& digest) const {
+    for (size_t i = 0; i < info_.inode_count; i++) {
+        if ((node_map_[i].start_block >= kStartBlockMinimum) &&
+            (digest == node_map_[i].merkle_root_hash)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+mx_status_t Image::ReadBlocks(uint64_t bno, uint64_t nblocks, uint8_t* out) const {
+    return readblks(fd_, bno, nblocks, out);
+}
+
+mx_status_t Image::WriteBlocks(uint64_t bno, const uint8_t* data, uint64_t len) const {
+    char block[kBlobstoreBlockSize];
+    for (uint64_t off = 0; off < len; off += kBlobstoreBlockSize, bno++) {
+        const void* src = data + off;
+        if (len - off < kBlobstoreBlockSize) {
+            // Pad out the last block.
+            memset(block, 0, sizeof(block));
+            memcpy(block, data + off, len - off);
+            src = block;
+        }
+        mx_status_t status = writeblk(fd_, bno, src);
+        if (status != NO_ERROR) {
+            return status;
+        }
+    }
+    return NO_ERROR;
+}
+
+unsigned CpuCount() {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? static_cast<unsigned>(cpus) : 1;
+}
+
+int ReadFile(const char* path, mxtl::unique_ptr<uint8_t[]>* out, size_t* len_out) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "error: cannot open '%s'\n", path);
+        return -1;
+    }
+    struct stat s;
+    if (fstat(fd, &s) < 0) {
+        fprintf(stderr, "error: cannot stat '%s'\n", path);
+        close(fd);
+        return -1;
+    }
+    size_t len = s.st_size;
+    AllocChecker ac;
+    mxtl::unique_ptr<uint8_t[]> data(new (&ac) uint8_t[len]);
+    if (!ac.check()) {
+        fprintf(stderr, "error: cannot allocate %zu bytes for '%s'\n", len, path);
+        close(fd);
+        return -1;
+    }
+    for (size_t off = 0; off < len;) {
+        ssize_t r = read(fd, data.get() + off, len - off);
+        if (r <= 0) {
+            fprintf(stderr, "error: cannot read '%s'\n", path);
+            close(fd);
+            return -1;
+        }
+        off += r;
+    }
+    close(fd);
+    *out = mxtl::move(data);
+    *len_out = len;
+    return 0;
+}
+
+// Reads the data of blob |i|, which lies in |extents|, back into |out|,
+// which must have room for the blob rounded up to whole blocks.
+mx_status_t ReadBlob(const Image& image, size_t i, const blobstore_extent_t* extents,
+                     uint64_t count, uint8_t* out) {
+    const blobstore_inode_t& inode = image.node_map_[i];
+    uint64_t merkle_blocks = MerkleTreeBlocks(inode);
+    if (inode.num_blocks < merkle_blocks) {
+        return ERR_IO_DATA_INTEGRITY;
+    }
+    uint64_t data_blocks = inode.num_blocks - merkle_blocks;
+    if (!(inode.flags & kBlobstoreInodeLZ4)) {
+        if (data_blocks != BlobDataBlocks(inode)) {
+            return ERR_IO_DATA_INTEGRITY;
+        }
+        return blobstore_read_blocks(image.fd_, extents, count, merkle_blocks, data_blocks, out);
+    }
+
+    AllocChecker ac;
+    mxtl::unique_ptr<uint8_t[]> cdata(new (&ac) uint8_t[data_blocks * kBlobstoreBlockSize]);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    mx_status_t status;
+    if ((data_blocks == 0) ||
+        ((status = blobstore_read_blocks(image.fd_, extents, count, merkle_blocks, data_blocks,
+                                         cdata.get())) != NO_ERROR)) {
+        return ERR_IO_DATA_INTEGRITY;
+    }
+    blobstore_lz4_header_t hdr;
+    memcpy(&hdr, cdata.get(), sizeof(hdr));
+    if ((status = CheckLZ4Header(hdr, inode.blob_size)) != NO_ERROR) {
+        return status;
+    }
+    if (LZ4TableSize(hdr.chunk_count) > data_blocks * kBlobstoreBlockSize) {
+        return ERR_IO_DATA_INTEGRITY;
+    }
+    const uint64_t* offsets = reinterpret_cast<const uint64_t*>(cdata.get() + sizeof(hdr));
+    if ((status = CheckLZ4Table(hdr, offsets, inode.blob_size,
+                                data_blocks * kBlobstoreBlockSize)) != NO_ERROR) {
+        return status;
+    }
+    for (uint64_t n = 0; n < hdr.chunk_count; n++) {
+        if ((status = DecompressChunk(cdata.get() + offsets[n], offsets[n + 1] - offsets[n],
+                                      out + n * hdr.chunk_size,
+                                      LZ4ChunkLength(hdr, inode.blob_size, n))) != NO_ERROR) {
+            return status;
+        }
+    }
+    return NO_ERROR;
+}
+
+} // namespace
+
+int blobstore_add(int fd, const char* path, bool compress) {
+    Image image(fd);
+    if (image.Load() != NO_ERROR) {
+        fprintf(stderr, "error: cannot load blobstore image\n");
+        return -1;
+    }
+
+    mxtl::unique_ptr<uint8_t[]> data;
+    size_t len;
+    if (ReadFile(path, &data, &len)) {
+        return -1;
+    }
+    if (len == 0) {
+        fprintf(stderr, "error: '%s' is empty; blobs cannot be\n", path);
+        return -1;
+    }
+
+    AllocChecker ac;
+    size_t size_merkle = merkle::Tree::GetTreeLength(len);
+    mxtl::unique_ptr<uint8_t[]> tree;
+    if (size_merkle != 0) {
+        tree.reset(new (&ac) uint8_t[size_merkle]);
+        if (!ac.check()) {
+            return -1;
+        }
+    }
+    merkle::Tree mt;
+    merkle::Digest digest;
+    if (mt.Create(data.get(), len, tree.get(), size_merkle, &digest, CpuCount()) != NO_ERROR) {
+        fprintf(stderr, "error: cannot build Merkle tree for '%s'\n", path);
+        return -1;
+    }
+    char name[merkle::Digest::kLength * 2 + 1];
+    digest.ToString(name, sizeof(name));
+    if (image.FindBlob(digest) >= 0) {
+        printf("%s: already present as %s\n", path, name);
+        return 0;
+    }
+
+    blobstore_inode_t inode;
+    memset(&inode, 0, sizeof(inode));
+    digest.CopyTo(inode.merkle_root_hash, sizeof(inode.merkle_root_hash));
+    inode.blob_size = len;
+
+    // As in the filesystem, compression has to save at least a block.
+    const uint8_t* stored = data.get();
+    size_t stored_len = len;
+    uint64_t data_blocks = BlobDataBlocks(inode);
+    mxtl::unique_ptr<uint8_t[]> cdata;
+    if (compress && (data_blocks > 1)) {
+        size_t max = (data_blocks - 1) * kBlobstoreBlockSize;
+        cdata.reset(new (&ac) uint8_t[max + kBlobstoreLZ4ChunkSize]);
+        if (!ac.check()) {
+            return -1;
+        }
+        size_t clen;
+        if (CompressBlob(data.get(), len, kBlobstoreLZ4ChunkSize, cdata.get(), max,
+                         &clen) == NO_ERROR) {
+            stored = cdata.get();
+            stored_len = clen;
+            inode.flags |= kBlobstoreInodeLZ4;
+        }
+    }
+
+    size_t node_index;
+    uint64_t merkle_blocks = MerkleTreeBlocks(inode);
+    inode.num_blocks = merkle_blocks +
+            mxtl::roundup(stored_len, kBlobstoreBlockSize) / kBlobstoreBlockSize;
+    if ((image.AllocateNode(&node_index) != NO_ERROR) ||
+        (image.AllocateBlocks(inode.num_blocks, &inode.start_block) != NO_ERROR)) {
+        fprintf(stderr, "error: no room for '%s'\n", path);
+        return -1;
+    }
+    if ((image.WriteBlocks(inode.start_block, tree.get(), size_merkle) != NO_ERROR) ||
+        (image.WriteBlocks(inode.start_block + merkle_blocks, stored, stored_len) != NO_ERROR)) {
+        return -1;
+    }
+    image.node_map_[node_index] = inode;
+    if (image.Flush() != NO_ERROR) {
+        return -1;
+    }
+    printf("%s: added as %s\n", path, name);
+    return 0;
+}
+
+int blobstore_list(int fd) {
+    Image image(fd);
+    if (image.Load() != NO_ERROR) {
+        fprintf(stderr, "error: cannot load blobstore image\n");
+        return -1;
+    }
+
+    uint64_t blobs = 0;
+    uint64_t total_size = 0;
+    uint64_t total_stored = 0;
+    for (size_t i = 0; i < image.info_.inode_count; i++) {
+        const blobstore_inode_t& inode = image.node_map_[i];
+        if (inode.start_block < kStartBlockMinimum) {
+            continue;
+        }
+        merkle::Digest digest(inode.merkle_root_hash);
+        char name[merkle::Digest::kLength * 2 + 1];
+        digest.ToString(name, sizeof(name));
+        // Count the data as stored, without the Merkle tree.
+        uint64_t stored = (inode.num_blocks - MerkleTreeBlocks(inode)) * kBlobstoreBlockSize;
+        printf("%s %12ju %12ju %3ju%% %s\n", name, (uintmax_t)inode.blob_size,
+               (uintmax_t)stored, (uintmax_t)(inode.blob_size ? stored * 100 / inode.blob_size : 0),
+               (inode.flags & kBlobstoreInodeLZ4) ? "lz4" : "-");
+        blobs++;
+        total_size += inode.blob_size;
+        total_stored += stored;
+    }
+    printf("%ju blobs, %ju bytes in %ju bytes of data blocks\n", (uintmax_t)blobs,
+           (uintmax_t)total_size, (uintmax_t)total_stored);
+    return 0;
+}
+
+int blobstore_check(int fd) {
+    Image image(fd);
+    if (image.Load() != NO_ERROR) {
+        fprintf(stderr, "error: cannot load blobstore image\n");
+        return -1;
+    }
+
+    uint64_t blobs = 0;
+    uint64_t bad = 0;
+    for (size_t i = 0; i < image.info_.inode_count; i++) {
+        const blobstore_inode_t& inode = image.node_map_[i];
+        if (inode.start_block < kStartBlockMinimum) {
+            continue;
+        }
+        blobs++;
+        merkle::Digest digest(inode.merkle_root_hash);
+        char name[merkle::Digest::kLength * 2 + 1];
+        digest.ToString(name, sizeof(name));
+
+        // Every block the blob is in, and its extent table if it has one,
+        // must be marked as allocated.
+        mxtl::unique_ptr<blobstore_extent_t[]> extents;
+        uint64_t count = 0;
+        size_t first_free;
+        bool allocated = (inode.blob_size != 0) &&
+                (blobstore_load_extents(fd, image.info_, inode, &extents, &count) == NO_ERROR);
+        if (allocated && (inode.flags & kBlobstoreInodeExtents)) {
+            allocated = image.block_map_.Get(inode.start_block, inode.start_block + 1,
+                                             &first_free);
+        }
+        for (uint64_t e = 0; allocated && (e < count); e++) {
+            allocated = image.block_map_.Get(extents[e].start,
+                                             extents[e].start + extents[e].length, &first_free);
+        }
+        if (!allocated) {
+            fprintf(stderr, "%s: bad extent\n", name);
+            bad++;
+            continue;
+        }
+
+        AllocChecker ac;
+        uint64_t merkle_blocks = MerkleTreeBlocks(inode);
+        size_t size_merkle = merkle::Tree::GetTreeLength(inode.blob_size);
+        mxtl::unique_ptr<uint8_t[]> tree(
+                new (&ac) uint8_t[merkle_blocks * kBlobstoreBlockSize]);
+        if (!ac.check()) {
+            return -1;
+        }
+        mxtl::unique_ptr<uint8_t[]> data(new (&ac) uint8_t[BlobDataBlocks(inode) *
+                                                           kBlobstoreBlockSize]);
+        if (!ac.check()) {
+            return -1;
+        }
+        merkle::Tree mt;
+        mx_status_t status;
+        if (((status = blobstore_read_blocks(fd, extents.get(), count, 0, merkle_blocks,
+                                             tree.get())) != NO_ERROR) ||
+            ((status = ReadBlob(image, i, extents.get(), count, data.get())) != NO_ERROR) ||
+            ((status = mt.Verify(data.get(), inode.blob_size, tree.get(), size_merkle,
+                                 0, inode.blob_size, digest)) != NO_ERROR)) {
+            fprintf(stderr, "%s: corrupt (%d)\n", name, status);
+            bad++;
+        }
+    }
+    printf("%ju blobs checked, %ju bad\n", (uintmax_t)blobs, (uintmax_t)bad);
+    return bad ? -1 : 0;
+}
+
+} // namespace blobstore
@@ -0,0 +1,23 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+// Operations on blobstore images, for the host tool.
+
+namespace blobstore {
+
+// Adds the contents of |path| to the blobstore image on |fd|, named by its
+// Merkle root. Unless |compress| is false, the data is compressed when that
+// saves space. Blobs which are already present are left alone.
+int blobstore_add(int fd, const char* path, bool compress);
+
+// Lists the blobs in the image on |fd|, with how much space each takes.
+int blobstore_list(int fd);
+
+// Reads back every blob in the image on |fd|, decompressing as needed, and
+// checks it against its Merkle root.
+int blobstore_check(int fd);
+
+} // namespace blobstore
@@ -11,13 +11,19 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#ifdef __Fuchsia__
 #include "blobstore-private.h"
 #include "fs/vfs.h"
+#else
+#include "blobstore.h"
+#include "host.h"
+#endif
 
 // TODO(smklein): Implement fsck for blobstore
 
 namespace {
 
+#ifdef __Fuchsia__
 int do_blobstore_mount(int fd, int argc, char** argv) {
     blobstore::VnodeBlob* vn = 0;
     if (blobstore::blobstore_mount(&vn, fd) < 0) {
@@ -26,6 +32,30 @@ int do_blobstore_mount(int fd, int argc, char** argv) {
     vfs_rpc_server(vn);
     return 0;
 }
+#else
+bool compress = true;
+
+int do_blobstore_add(int fd, int argc, char** argv) {
+    if (argc < 1) {
+        fprintf(stderr, "add requires at least one argument\n");
+        return -1;
+    }
+    for (int i = 0; i < argc; i++) {
+        if (blobstore::blobstore_add(fd, argv[i], compress) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int do_blobstore_ls(int fd, int argc, char** argv) {
+    return blobstore::blobstore_list(fd);
+}
+
+int do_blobstore_check(int fd, int argc, char** argv) {
+    return blobstore::blobstore_check(fd);
+}
+#endif
 
 int do_blobstore_mkfs(int fd, int argc, char** argv) {
     return blobstore::blobstore_mkfs(fd);
@@ -34,20 +64,34 @@ int do_blobstore_mkfs(int fd, int argc, char** argv) {
 struct {
     const char* name;
     int (*func)(int fd, int argc, char**argv);
+    uint32_t flags;
     const char* help;
 } CMDS[] = {
-    {"create", do_blobstore_mkfs, "initialize filesystem"},
-    {"mkfs", do_blobstore_mkfs, "initialize filesystem"},
-    {"mount", do_blobstore_mount, "mount filesystem"},
+    {"create", do_blobstore_mkfs, O_RDWR | O_CREAT, "initialize filesystem"},
+    {"mkfs", do_blobstore_mkfs, O_RDWR | O_CREAT, "initialize filesystem"},
+#ifdef __Fuchsia__
+    {"mount", do_blobstore_mount, O_RDWR, "mount filesystem"},
+#else
+    {"add", do_blobstore_add, O_RDWR, "add files as blobs"},
+    {"ls", do_blobstore_ls, O_RDONLY, "list blobs and the space they take"},
+    {"check", do_blobstore_check, O_RDONLY, "check every blob against its name"},
+    {"fsck", do_blobstore_check, O_RDONLY, "check every blob against its name"},
+#endif
 };
 
 int usage() {
     fprintf(stderr,
+#ifdef __Fuchsia__
             "usage: blobstore <command> [ <arg>* ]\n"
             "\n"
             "On Fuchsia, blobstore takes the block device argument by handle.\n"
             "This can make 'blobstore' commands hard to invoke from command line.\n"
             "Try using the [mkfs,fsck,mount,umount] commands instead\n"
+#else
+            "usage: blobstore [ <option>* ] <file-or-device>[@<size>] <command> [ <arg>* ]\n"
+            "\n"
+            "options:  --no-compress  store added blobs uncompressed\n"
+#endif
             "\n");
     for (unsigned n = 0; n < (sizeof(CMDS) / sizeof(CMDS[0])); n++) {
         fprintf(stderr, "%9s %-10s %s\n", n ? "" : "commands:",
@@ -60,6 +104,7 @@ int usage() {
 } // namespace anonymous
 
 int main(int argc, char** argv) {
+#ifdef __Fuchsia__
     if (argc < 2) {
         return usage();
     }
@@ -74,4 +119,72 @@ int main(int argc, char** argv) {
         }
     }
     return usage();
+#else
+    // handle options
+    while (argc > 1) {
+        if (!strcmp(argv[1], "--no-compress")) {
+            compress = false;
+        } else {
+            break;
+        }
+        argc--;
+        argv++;
+    }
+
+    // Block device passed by path
+    if (argc < 3) {
+        return usage();
+    }
+    char* fn = argv[1];
+    char* cmd = argv[2];
+    off_t size = 0;
+    char* sizestr;
+    if ((sizestr = strchr(fn, '@')) != nullptr) {
+        *sizestr++ = 0;
+        char* end;
+        size = strtoull(sizestr, &end, 10);
+        if (end == sizestr) {
+            fprintf(stderr, "blobstore: bad size: %s\n", sizestr);
+            return usage();
+        }
+        switch (end[0]) {
+        case 'M':
+        case 'm':
+            size *= (1024 * 1024);
+            end++;
+            break;
+        case 'G':
+        case 'g':
+            size *= (1024 * 1024 * 1024);
+            end++;
+            break;
+        }
+        if (end[0]) {
+            fprintf(stderr, "blobstore: bad size: %s\n", sizestr);
+            return usage();
+        }
+    }
+
+    for (unsigned i = 0; i < sizeof(CMDS) / sizeof(CMDS[0]); i++) {
+        if (strcmp(cmd, CMDS[i].name)) {
+            continue;
+        }
+        int fd = open(fn, CMDS[i].flags, 0644);
+        if (fd < 0) {
+            fprintf(stderr, "error: cannot open '%s'\n", fn);
+            return -1;
+        }
+        // An image is given its size when it is formatted.
+        if ((size != 0) && (CMDS[i].flags & O_CREAT) && (ftruncate(fd, size) < 0)) {
+            fprintf(stderr, "error: cannot resize '%s'\n", fn);
+            close(fd);
+            return -1;
+        }
+        int r = CMDS[i].func(fd, argc - 3, argv + 3);
+        close(fd);
+        return r;
+    }
+    fprintf(stderr, "blobstore: unknown command: %s\n", cmd);
+    return usage();
+#endif
 }
@@ -14,13 +14,19 @@ MODULE_NAME := blobstore
 MODULE_SRCS := \
     $(LOCAL_DIR)/blobstore.cpp \
     $(LOCAL_DIR)/blobstore-ops.cpp \
+    $(LOCAL_DIR)/common.cpp \
+    $(LOCAL_DIR)/compression.cpp \
+    $(LOCAL_DIR)/free-extents.cpp \
     $(LOCAL_DIR)/main.cpp \
     $(LOCAL_DIR)/rpc.cpp \
+    $(LOCAL_DIR)/writeback.cpp \
 
 MODULE_STATIC_LIBS := \
     ulib/fs \
+    ulib/block-client \
+    ulib/lz4 \
     ulib/merkle \
-    ulib/cryptolib \
+    ulib/sync \
 
 MODULE_LIBS := \
     ulib/c \
@@ -31,3 +37,42 @@ MODULE_LIBS := \
     ulib/mxtl \
 
 include make/module.mk
+
+
+# host blobstore tool, for building and inspecting images
+
+LZ4_DIR := third_party/ulib/lz4
+
+MODULE := $(LOCAL_DIR)-host
+
+MODULE_NAME := blobstore
+
+MODULE_TYPE := hostapp
+
+MODULE_SRCS := \
+    $(LOCAL_DIR)/main.cpp \
+    $(LOCAL_DIR)/common.cpp \
+    $(LOCAL_DIR)/compression.cpp \
+    $(LOCAL_DIR)/host.cpp \
+    $(LZ4_DIR)/lz4.c \
+    system/ulib/bitmap/raw-bitmap.cpp \
+    system/ulib/merkle/digest.cpp \
+    system/ulib/merkle/sha256.cpp \
+    system/ulib/merkle/sha256-arm64.cpp \
+    system/ulib/merkle/sha256-x86.cpp \
+    system/ulib/merkle/tree.cpp \
+    system/ulib/mxcpp/new.cpp \
+
+MODULE_CFLAGS := -I$(LZ4_DIR)/include/lz4
+
+MODULE_COMPILEFLAGS := \
+    -I$(LZ4_DIR)/include \
+    -Isystem/ulib/bitmap/include \
+    -Isystem/ulib/merkle/include \
+    -Isystem/ulib/mxcpp/include \
+    -Isystem/ulib/mxio/include \
+    -Isystem/ulib/mxtl/include \
+
+MODULE_HOST_LIBS := -lpthread
+
+include make/module.mk
@@ -0,0 +1,453 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <magenta/device/block.h>
+#include <magenta/new.h>
+#include <magenta/process.h>
+#include <magenta/syscalls.h>
+#include <mxtl/algorithm.h>
+#include <mxtl/auto_lock.h>
+
+#include "writeback.h"
+
+namespace blobstore {
+
+// Size of the VMO shared with the block device. A batch is written in as
+// many FIFO transactions as it takes to move it through here.
+constexpr uint64_t kStageBlocks = 256;
+
+// Ops a txn has room for before it first grows.
+constexpr size_t kMinTxnOps = 8;
+
+WriteTxn::~WriteTxn() {
+    for (size_t i = 0; i < vmo_count_; i++) {
+        mx_handle_close(vmos_[i]);
+    }
+}
+
+mx_status_t WriteTxn::AddOp(const Op& op) {
+    if (op_count_ == op_capacity_) {
+        size_t capacity = mxtl::max(op_capacity_ * 2, kMinTxnOps);
+        AllocChecker ac;
+        mxtl::unique_ptr<Op[]> ops(new (&ac) Op[capacity]);
+        if (!ac.check()) {
+            return ERR_NO_MEMORY;
+        }
+        if (op_count_ != 0) {
+            memcpy(ops.get(), ops_.get(), op_count_ * sizeof(Op));
+        }
+        ops_ = mxtl::move(ops);
+        op_capacity_ = capacity;
+    }
+    ops_[op_count_++] = op;
+    return NO_ERROR;
+}
+
+mx_status_t WriteTxn::AddVmo(mx_handle_t vmo, uint64_t vmo_offset, uint64_t len,
+                             uint64_t dev_block) {
+    assert(vmo_offset % kBlobstoreBlockSize == 0);
+    size_t i = 0;
+    while ((i < vmo_count_) && (vmo_sources_[i] != vmo)) {
+        i++;
+    }
+    if (i == vmo_count_) {
+        if (vmo_count_ == kMaxVmos) {
+            return ERR_NO_RESOURCES;
+        }
+        mx_status_t status;
+        if ((status = mx_handle_duplicate(vmo, MX_RIGHT_READ, &vmos_[i])) != NO_ERROR) {
+            return status;
+        }
+        vmo_sources_[i] = vmo;
+        vmo_count_++;
+    }
+
+    Op op;
+    op.kind = kWriteData;
+    op.vmo = vmos_[i];
+    op.src_block = vmo_offset / kBlobstoreBlockSize;
+    op.dev_block = dev_block;
+    op.nblocks = mxtl::roundup(len, kBlobstoreBlockSize) / kBlobstoreBlockSize;
+    return AddOp(op);
+}
+
+mx_status_t WriteTxn::AddData(uint32_t kind, const void* data, uint64_t len,
+                              uint64_t dev_block) {
+    uint64_t nblocks = mxtl::roundup(len, kBlobstoreBlockSize) / kBlobstoreBlockSize;
+    if (buf_blocks_ + nblocks > buf_capacity_) {
+        uint64_t capacity = mxtl::max(buf_capacity_ * 2, buf_blocks_ + nblocks);
+        AllocChecker ac;
+        mxtl::unique_ptr<uint8_t[]> buf(new (&ac) uint8_t[capacity * kBlobstoreBlockSize]);
+        if (!ac.check()) {
+            return ERR_NO_MEMORY;
+        }
+        if (buf_blocks_ != 0) {
+            memcpy(buf.get(), buf_.get(), buf_blocks_ * kBlobstoreBlockSize);
+        }
+        buf_ = mxtl::move(buf);
+        buf_capacity_ = capacity;
+    }
+
+    Op op;
+    op.kind = kind;
+    op.vmo = MX_HANDLE_INVALID;
+    op.src_block = buf_blocks_;
+    op.dev_block = dev_block;
+    op.nblocks = nblocks;
+    mx_status_t status;
+    if ((status = AddOp(op)) != NO_ERROR) {
+        return status;
+    }
+    uint8_t* dst = buf_.get() + buf_blocks_ * kBlobstoreBlockSize;
+    memcpy(dst, data, len);
+    memset(dst + len, 0, nblocks * kBlobstoreBlockSize - len);
+    buf_blocks_ += nblocks;
+    return NO_ERROR;
+}
+
+void WriteTxn::Truncate(size_t op_count) {
+    assert(op_count <= op_count_);
+    op_count_ = op_count;
+    buf_blocks_ = 0;
+    for (size_t i = 0; i < op_count_; i++) {
+        if (ops_[i].vmo == MX_HANDLE_INVALID) {
+            buf_blocks_ = mxtl::max(buf_blocks_, ops_[i].src_block + ops_[i].nblocks);
+        }
+    }
+}
+
+void WriteTxn::SetFreed(mxtl::unique_ptr<blobstore_extent_t[]> extents, uint64_t count) {
+    freed_ = mxtl::move(extents);
+    freed_count_ = count;
+}
+
+Writeback::Writeback(int fd) : fd_(fd) {
+    cnd_init(&work_cnd_);
+    cnd_init(&done_cnd_);
+}
+
+Writeback::~Writeback() {
+    Stop();
+    DetachFifo();
+    if (stage_addr_ != 0) {
+        mx_vmar_unmap(mx_vmar_root_self(), stage_addr_, kStageBlocks * kBlobstoreBlockSize);
+    }
+    if (stage_vmo_ != MX_HANDLE_INVALID) {
+        mx_handle_close(stage_vmo_);
+    }
+    cnd_destroy(&work_cnd_);
+    cnd_destroy(&done_cnd_);
+}
+
+mx_status_t Writeback::Start() {
+    mx_status_t status;
+    if ((status = mx_vmo_create(kStageBlocks * kBlobstoreBlockSize, 0,
+                                &stage_vmo_)) != NO_ERROR) {
+        return status;
+    } else if ((status = mx_vmar_map(mx_vmar_root_self(), 0, stage_vmo_, 0,
+                                     kStageBlocks * kBlobstoreBlockSize,
+                                     MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE,
+                                     &stage_addr_)) != NO_ERROR) {
+        return status;
+    }
+    // Without a FIFO, the staged blocks are written with pwrite().
+    AttachFifo();
+    if (thrd_create_with_name(&thread_, WritebackThread, this,
+                              "blobstore-writeback") != thrd_success) {
+        fprintf(stderr, "blobstore: cannot start write-back thread\n");
+        return ERR_NO_RESOURCES;
+    }
+    running_ = true;
+    return NO_ERROR;
+}
+
+void Writeback::Stop() {
+    if (!running_) {
+        return;
+    }
+    {
+        mxtl::AutoLock lock(&lock_);
+        stop_ = true;
+        cnd_signal(&work_cnd_);
+    }
+    thrd_join(thread_, nullptr);
+    running_ = false;
+}
+
+mx_status_t Writeback::AttachFifo() {
+    mx_handle_t fifo;
+    if (ioctl_block_get_fifos(fd_, &fifo) != sizeof(fifo)) {
+        return ERR_NOT_SUPPORTED;
+    }
+
+    mx_status_t status;
+    txnid_t txnid;
+    vmoid_t vmoid;
+    mx_handle_t xfer_vmo;
+    if (ioctl_block_alloc_txn(fd_, &txnid) != sizeof(txnid)) {
+        status = ERR_IO;
+        goto fail;
+    }
+    if ((status = mx_handle_duplicate(stage_vmo_, MX_RIGHT_SAME_RIGHTS,
+                                      &xfer_vmo)) != NO_ERROR) {
+        goto fail;
+    }
+    if (ioctl_block_attach_vmo(fd_, &xfer_vmo, &vmoid) != sizeof(vmoid)) {
+        status = ERR_IO;
+        goto fail;
+    }
+    if ((status = block_fifo_create_client(fifo, &fifo_client_)) != NO_ERROR) {
+        goto fail;
+    }
+    fifo_txnid_ = txnid;
+    fifo_vmoid_ = vmoid;
+    return NO_ERROR;
+
+fail:
+    // Closing the FIFO server also drops any VMO or txn we registered.
+    mx_handle_close(fifo);
+    ioctl_block_fifo_close(fd_);
+    return status;
+}
+
+void Writeback::DetachFifo() {
+    if (fifo_client_ == nullptr) {
+        return;
+    }
+    block_fifo_request_t request;
+    request.txnid = fifo_txnid_;
+    request.vmoid = fifo_vmoid_;
+    request.opcode = BLOCKIO_CLOSE_VMO;
+    block_fifo_txn(fifo_client_, &request, 1);
+    block_fifo_release_client(fifo_client_);
+    fifo_client_ = nullptr;
+    ioctl_block_fifo_close(fd_);
+}
+
+uint64_t Writeback::Enqueue(mxtl::unique_ptr<WriteTxn> txn) {
+    assert(running_);
+    mxtl::AutoLock lock(&lock_);
+    uint64_t seq = next_seq_++;
+    txn->seq_ = seq;
+    if (txn->freed_count_ != 0) {
+        frees_pending_++;
+    }
+    queue_.push_back(mxtl::move(txn));
+    cnd_signal(&work_cnd_);
+    return seq;
+}
+
+mx_status_t Writeback::Wait(uint64_t seq) {
+    mxtl::AutoLock lock(&lock_);
+    while (written_seq_ < seq) {
+        cnd_wait(&done_cnd_, lock_.GetInternal());
+    }
+    return status_;
+}
+
+mx_status_t Writeback::Sync() {
+    uint64_t seq;
+    {
+        mxtl::AutoLock lock(&lock_);
+        seq = next_seq_ - 1;
+    }
+    return Wait(seq);
+}
+
+bool Writeback::FreesPending() {
+    mxtl::AutoLock lock(&lock_);
+    return frees_pending_ != 0;
+}
+
+mxtl::unique_ptr<WriteTxn> Writeback::TakeFreed() {
+    mxtl::AutoLock lock(&lock_);
+    if (freed_.is_empty()) {
+        return nullptr;
+    }
+    frees_pending_--;
+    return freed_.pop_front();
+}
+
+int Writeback::WritebackThread(void* arg) {
+    Writeback* wb = static_cast<Writeback*>(arg);
+    wb->lock_.Acquire();
+    while (true) {
+        while (wb->queue_.is_empty() && !wb->stop_) {
+            cnd_wait(&wb->work_cnd_, wb->lock_.GetInternal());
+        }
+        if (wb->queue_.is_empty()) {
+            break;
+        }
+
+        // Everything queued so far goes in one batch; what is queued while
+        // it is written waits for the next.
+        TxnList batch;
+        while (!wb->queue_.is_empty()) {
+            batch.push_back(wb->queue_.pop_front());
+        }
+        uint64_t seq = batch.back().seq_;
+        wb->lock_.Release();
+        mx_status_t status = wb->WriteBatch(&batch);
+        // A batch which failed part way may have left blocks staged.
+        wb->staged_blocks_ = 0;
+        wb->request_count_ = 0;
+        wb->lock_.Acquire();
+
+        if ((status != NO_ERROR) && (wb->status_ == NO_ERROR)) {
+            wb->status_ = status;
+        }
+        wb->written_seq_ = seq;
+        while (!batch.is_empty()) {
+            mxtl::unique_ptr<WriteTxn> txn = batch.pop_front();
+            if (txn->freed_count_ == 0) {
+                continue;
+            } else if (status != NO_ERROR) {
+                // The nodes which let go of these blocks may still name them
+                // on disk, so they stay reserved until the next mount.
+                wb->frees_pending_--;
+            } else {
+                wb->freed_.push_back(mxtl::move(txn));
+            }
+        }
+        cnd_broadcast(&wb->done_cnd_);
+    }
+    wb->lock_.Release();
+    return 0;
+}
+
+bool Writeback::Superseded(TxnList* batch, const WriteTxn* txn, size_t i) {
+    const WriteTxn::Op& op = txn->ops_[i];
+    for (const auto& later : *batch) {
+        if (later.seq_ < txn->seq_) {
+            continue;
+        }
+        for (size_t j = (later.seq_ == txn->seq_) ? i + 1 : 0; j < later.op_count_; j++) {
+            if ((later.ops_[j].kind == op.kind) && (later.ops_[j].dev_block == op.dev_block)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+mx_status_t Writeback::WriteBatch(TxnList* batch) {
+    // The data of every txn goes first...
+    mx_status_t status;
+    for (const auto& txn : *batch) {
+        for (size_t i = 0; i < txn.op_count_; i++) {
+            if ((txn.ops_[i].kind == kWriteData) &&
+                ((status = Stage(txn, txn.ops_[i])) != NO_ERROR)) {
+                return status;
+            }
+        }
+    }
+
+    // ... then the bitmap and the nodes, each block once, as the last txn to
+    // touch it left it. The bitmap has to be on disk before any node which
+    // names the blocks it allocates.
+    const uint32_t kinds[] = { kWriteBitmap, kWriteNode };
+    for (uint32_t kind : kinds) {
+        for (const auto& txn : *batch) {
+            for (size_t i = 0; i < txn.op_count_; i++) {
+                if ((txn.ops_[i].kind == kind) && !Superseded(batch, &txn, i) &&
+                    ((status = Stage(txn, txn.ops_[i])) != NO_ERROR)) {
+                    return status;
+                }
+            }
+        }
+        if ((status = Issue()) != NO_ERROR) {
+            return status;
+        }
+        Flush();
+    }
+    return NO_ERROR;
+}
+
+mx_status_t Writeback::Stage(const WriteTxn& txn, const WriteTxn::Op& op) {
+    mx_status_t status;
+    for (uint64_t done = 0; done < op.nblocks;) {
+        if ((staged_blocks_ == kStageBlocks) && ((status = Issue()) != NO_ERROR)) {
+            return status;
+        }
+        uint64_t dev_block = op.dev_block + done;
+        bool extend = (request_count_ != 0) &&
+                (requests_[request_count_ - 1].dev_block +
+                 requests_[request_count_ - 1].nblocks == dev_block);
+        if (!extend && (request_count_ == MAX_TXN_MESSAGES) &&
+            ((status = Issue()) != NO_ERROR)) {
+            return status;
+        }
+
+        uint64_t n = mxtl::min(op.nblocks - done, kStageBlocks - staged_blocks_);
+        uint8_t* dst = reinterpret_cast<uint8_t*>(stage_addr_) +
+                staged_blocks_ * kBlobstoreBlockSize;
+        if (op.vmo != MX_HANDLE_INVALID) {
+            size_t actual;
+            if ((status = mx_vmo_read(op.vmo, dst, (op.src_block + done) * kBlobstoreBlockSize,
+                                      n * kBlobstoreBlockSize, &actual)) != NO_ERROR) {
+                return status;
+            } else if (actual != n * kBlobstoreBlockSize) {
+                return ERR_IO;
+            }
+        } else {
+            memcpy(dst, txn.buf_.get() + (op.src_block + done) * kBlobstoreBlockSize,
+                   n * kBlobstoreBlockSize);
+        }
+
+        if (extend) {
+            requests_[request_count_ - 1].nblocks += n;
+        } else {
+            requests_[request_count_].stage_block = staged_blocks_;
+            requests_[request_count_].dev_block = dev_block;
+            requests_[request_count_].nblocks = n;
+            request_count_++;
+        }
+        staged_blocks_ += n;
+        done += n;
+    }
+    return NO_ERROR;
+}
+
+mx_status_t Writeback::Issue() {
+    mx_status_t status = NO_ERROR;
+    if (fifo_client_ != nullptr) {
+        block_fifo_request_t requests[MAX_TXN_MESSAGES];
+        for (size_t i = 0; i < request_count_; i++) {
+            requests[i].txnid = fifo_txnid_;
+            requests[i].vmoid = fifo_vmoid_;
+            requests[i].opcode = BLOCKIO_WRITE;
+            requests[i].length = requests_[i].nblocks * kBlobstoreBlockSize;
+            requests[i].vmo_offset = requests_[i].stage_block * kBlobstoreBlockSize;
+            requests[i].dev_offset = requests_[i].dev_block * kBlobstoreBlockSize;
+        }
+        if ((request_count_ != 0) &&
+            (block_fifo_txn(fifo_client_, requests, request_count_) != NO_ERROR)) {
+            fprintf(stderr, "blobstore: FIFO write of %zu runs failed\n", request_count_);
+            status = ERR_IO;
+        }
+    } else {
+        for (size_t i = 0; i < request_count_; i++) {
+            const uint8_t* src = reinterpret_cast<const uint8_t*>(stage_addr_) +
+                    requests_[i].stage_block * kBlobstoreBlockSize;
+            if ((status = writeblks(fd_, requests_[i].dev_block, requests_[i].nblocks,
+                                    src)) != NO_ERROR) {
+                break;
+            }
+        }
+    }
+    staged_blocks_ = 0;
+    request_count_ = 0;
+    return status;
+}
+
+void Writeback::Flush() {
+    fsync(fd_);
+}
+
+} // namespace blobstore
@@ -0,0 +1,186 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <threads.h>
+
+#include <block-client/client.h>
+#include <magenta/types.h>
+#include <mxtl/intrusive_double_list.h>
+#include <mxtl/macros.h>
+#include <mxtl/mutex.h>
+#include <mxtl/unique_ptr.h>
+
+#include "blobstore.h"
+
+namespace blobstore {
+
+// What a write is for, which decides when in a batch it is issued.
+constexpr uint32_t kWriteData   = 0; // Merkle trees, blob data and extent tables
+constexpr uint32_t kWriteBitmap = 1; // Blocks of the block bitmap
+constexpr uint32_t kWriteNode   = 2; // Blocks of the node map
+
+// The disk writes which make up one change to the blobstore, such as adding
+// a blob or removing one. Data is written straight from the VMO it is in, or
+// copied into the txn; bitmap and node blocks are always copied, so that they
+// are written as they were when the txn was put together.
+class WriteTxn : public mxtl::DoublyLinkedListable<mxtl::unique_ptr<WriteTxn>> {
+public:
+    WriteTxn() {}
+    ~WriteTxn();
+    DISALLOW_COPY_ASSIGN_AND_MOVE(WriteTxn);
+
+    // Write |len| bytes of |vmo|, from the block-aligned |vmo_offset|, to
+    // the device at |dev_block|. A partial last block is written whole, so
+    // the VMO must reach to the end of it. The txn keeps its own handle to
+    // the VMO, of which there may be at most kMaxVmos.
+    mx_status_t AddVmo(mx_handle_t vmo, uint64_t vmo_offset, uint64_t len, uint64_t dev_block);
+
+    // Copy |len| bytes of |data| into the txn, padded with zeroes to whole
+    // blocks, to be written to the device at |dev_block|.
+    mx_status_t AddData(uint32_t kind, const void* data, uint64_t len, uint64_t dev_block);
+
+    // Drop every write added since there were |op_count| of them.
+    size_t op_count() const { return op_count_; }
+    void Truncate(size_t op_count);
+
+    // Blocks which may be reused once the txn is on disk. They are handed
+    // back by Writeback::TakeFreed, and not before.
+    void SetFreed(mxtl::unique_ptr<blobstore_extent_t[]> extents, uint64_t count);
+    const blobstore_extent_t* freed() const { return freed_.get(); }
+    uint64_t freed_count() const { return freed_count_; }
+
+    // A blob's writes come from its Merkle tree and its data.
+    static constexpr size_t kMaxVmos = 2;
+
+private:
+    friend class Writeback;
+
+    struct Op {
+        uint32_t kind;
+        mx_handle_t vmo;    // One of |vmos_|, or MX_HANDLE_INVALID for |buf_|.
+        uint64_t src_block;
+        uint64_t dev_block;
+        uint64_t nblocks;
+    };
+
+    mx_status_t AddOp(const Op& op);
+
+    mxtl::unique_ptr<Op[]> ops_;
+    size_t op_count_ = 0;
+    size_t op_capacity_ = 0;
+
+    mxtl::unique_ptr<uint8_t[]> buf_;
+    uint64_t buf_blocks_ = 0;
+    uint64_t buf_capacity_ = 0;
+
+    // Our duplicates of the VMOs written from, and the handles they were
+    // duplicated from.
+    mx_handle_t vmos_[kMaxVmos];
+    mx_handle_t vmo_sources_[kMaxVmos];
+    size_t vmo_count_ = 0;
+
+    mxtl::unique_ptr<blobstore_extent_t[]> freed_;
+    uint64_t freed_count_ = 0;
+
+    uint64_t seq_ = 0;
+};
+
+// Writes txns to disk on a thread of its own, so that the next blob can be
+// hashed while the last one is written. Every txn which is waiting when the
+// thread wakes is written as one batch: first the data of all of them, then
+// the newest copy of each bitmap block, then (once those are flushed) the
+// newest copy of each node block, so that a node never names blocks which
+// are not yet on disk. Writes are staged in a VMO shared with the block
+// device, and sent through its FIFO as runs of contiguous blocks, sixteen to
+// a transaction; devices without a FIFO are written with pwrite().
+class Writeback {
+public:
+    explicit Writeback(int fd);
+    ~Writeback();
+    DISALLOW_COPY_ASSIGN_AND_MOVE(Writeback);
+
+    mx_status_t Start();
+
+    // Write out everything queued, then stop the thread.
+    void Stop();
+
+    // Queue |txn| to be written after every txn queued before it, and
+    // return its sequence number.
+    uint64_t Enqueue(mxtl::unique_ptr<WriteTxn> txn);
+
+    // Wait until txn |seq|, and every one before it, is on disk. Returns
+    // the first error seen writing any txn, if there has been one.
+    mx_status_t Wait(uint64_t seq);
+    mx_status_t Sync();
+
+    // Whether some queued txn has blocks to free, or some written one has
+    // blocks which have not been taken yet.
+    bool FreesPending();
+
+    // Hand back a txn which is on disk and has blocks to free, or null.
+    mxtl::unique_ptr<WriteTxn> TakeFreed();
+
+private:
+    using TxnList = mxtl::DoublyLinkedList<mxtl::unique_ptr<WriteTxn>>;
+
+    // A run of blocks staged for writing, starting |stage_block| blocks
+    // into the staging VMO.
+    struct Request {
+        uint64_t stage_block;
+        uint64_t dev_block;
+        uint64_t nblocks;
+    };
+
+    static int WritebackThread(void* arg);
+
+    mx_status_t AttachFifo();
+    void DetachFifo();
+
+    // Write |batch| in the order described above.
+    mx_status_t WriteBatch(TxnList* batch);
+
+    // Whether a later txn in the batch, or a later op of |txn|, writes a
+    // newer copy of the metadata block written by op |i| of |txn|.
+    static bool Superseded(TxnList* batch, const WriteTxn* txn, size_t i);
+
+    // Copy an op into the staging VMO, issuing what is staged when the VMO
+    // or the request list fills up. Runs of blocks which follow on from one
+    // another on disk become one request.
+    mx_status_t Stage(const WriteTxn& txn, const WriteTxn::Op& op);
+    mx_status_t Issue();
+    void Flush();
+
+    const int fd_;
+
+    mxtl::Mutex lock_;
+    cnd_t work_cnd_;  // Signaled when a txn is queued, or the thread should stop.
+    cnd_t done_cnd_;  // Signaled when a batch has been written.
+    TxnList queue_;
+    TxnList freed_;
+    uint64_t next_seq_ = 1;
+    uint64_t written_seq_ = 0;
+    size_t frees_pending_ = 0;
+    mx_status_t status_ = NO_ERROR;
+    bool stop_ = false;
+
+    thrd_t thread_;
+    bool running_ = false;
+
+    // Used only by the thread, once it has started.
+    mx_handle_t stage_vmo_ = MX_HANDLE_INVALID;
+    uintptr_t stage_addr_ = 0;
+    uint64_t staged_blocks_ = 0;
+    Request requests_[MAX_TXN_MESSAGES];
+    size_t request_count_ = 0;
+
+    fifo_client_t* fifo_client_ = nullptr;  // Non-null once AttachFifo() succeeds.
+    txnid_t fifo_txnid_ = 0;
+    vmoid_t fifo_vmoid_ = 0;
+};
+
+} // namespace blobstore
@@ -6,12 +6,14 @@
 #include <errno.h>
 #include <getopt.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include <magenta/compiler.h>
 #include <magenta/syscalls.h>
+#include <mxtl/atomic.h>
 #include <mxtl/unique_ptr.h>
 
 namespace {
@@ -111,6 +113,238 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
            test_args.size, test_args.handles, test_args.queue, its_per_second);
 }
 
+struct CallServerArgs {
+    mx_handle_t channel;
+    uint32_t size;
+};
+
+// Echoes every message it receives on the channel back to the sender until
+// the peer goes away.
+void* call_server(void* arg) {
+    auto server_args = static_cast<CallServerArgs*>(arg);
+    mx_handle_t h = server_args->channel;
+    mxtl::unique_ptr<uint8_t[]> buf(new uint8_t[server_args->size]);
+
+    for (;;) {
+        mx_signals_t pending;
+        mx_status_t status = mx_object_wait_one(h, MX_CHANNEL_READABLE | MX_CHANNEL_PEER_CLOSED,
+                                                MX_TIME_INFINITE, &pending);
+        if (status != NO_ERROR || !(pending & MX_CHANNEL_READABLE))
+            break;
+
+        uint32_t r_size;
+        uint32_t r_handles;
+        status = mx_channel_read(h, 0u, buf.get(), server_args->size, &r_size,
+                                 nullptr, 0u, &r_handles);
+        if (status != NO_ERROR)
+            break;
+        // The txid leads the message, so sending it back makes it the reply.
+        status = mx_channel_write(h, 0u, buf.get(), r_size, nullptr, 0u);
+        if (status != NO_ERROR)
+            break;
+    }
+    return nullptr;
+}
+
+// Measures mx_channel_call() round trips against a server thread blocked in
+// mx_object_wait_one().
+void do_call_test(uint32_t duration, uint32_t size) {
+    __UNUSED mx_status_t status;
+
+    uint64_t duration_ns = duration * 1000000000ull;
+
+    // The txid takes up the first bytes of every message.
+    if (size < sizeof(mx_txid_t))
+        size = sizeof(mx_txid_t);
+
+    mx_handle_t mp[2] = {MX_HANDLE_INVALID, MX_HANDLE_INVALID};
+    status = mx_channel_create(0u, &mp[0], &mp[1]);
+    assert(status == NO_ERROR);
+
+    CallServerArgs server_args = {mp[1], size};
+    pthread_t server;
+    __UNUSED int r = pthread_create(&server, nullptr, call_server, &server_args);
+    assert(r == 0);
+
+    mxtl::unique_ptr<uint8_t[]> wr_data(new uint8_t[size]);
+    mxtl::unique_ptr<uint8_t[]> rd_data(new uint8_t[size]);
+    for (uint32_t i = 0; i < size; i++)
+        wr_data[i] = static_cast<uint8_t>(i);
+
+    mx_channel_call_args_t args = {};
+    args.wr_bytes = wr_data.get();
+    args.wr_num_bytes = size;
+    args.rd_bytes = rd_data.get();
+    args.rd_num_bytes = size;
+
+    static constexpr uint32_t big_it_size = 1000;
+    uint64_t big_its = 0;
+    uint64_t start_ns = mx_time_get(MX_CLOCK_MONOTONIC);
+    uint64_t end_ns;
+    for (;;) {
+        big_its++;
+        for (uint32_t i = 0; i < big_it_size; i++) {
+            uint32_t actual_bytes, actual_handles;
+            mx_status_t read_status;
+            status = mx_channel_call(mp[0], 0u, MX_TIME_INFINITE, &args,
+                                     &actual_bytes, &actual_handles, &read_status);
+            assert(status == NO_ERROR);
+            assert(actual_bytes == size);
+        }
+
+        end_ns = mx_time_get(MX_CLOCK_MONOTONIC);
+        if ((end_ns - start_ns) >= duration_ns)
+            break;
+    }
+
+    // Closing our end makes the server exit.
+    status = mx_handle_close(mp[0]);
+    assert(status == NO_ERROR);
+    pthread_join(server, nullptr);
+    status = mx_handle_close(mp[1]);
+    assert(status == NO_ERROR);
+
+    uint64_t calls = big_its * big_it_size;
+    double real_duration = static_cast<double>(end_ns - start_ns) / 1000000000.0;
+    double calls_per_second = static_cast<double>(calls) / real_duration;
+    double ns_per_call = static_cast<double>(end_ns - start_ns) / static_cast<double>(calls);
+    printf("call %" PRIu32 " bytes: %.0f round trips/second, %.0f ns/round trip\n",
+           size, calls_per_second, ns_per_call);
+}
+
+// Parks in mx_object_wait_one() on a signal that never changes, as a
+// bystander to the traffic on the channel.
+void* idle_waiter(void* arg) {
+    mx_handle_t h = *static_cast<mx_handle_t*>(arg);
+    mx_object_wait_one(h, MX_CHANNEL_PEER_CLOSED, MX_TIME_INFINITE, nullptr);
+    return nullptr;
+}
+
+struct FanoutArgs {
+    mx_handle_t go;    // Raises MX_USER_SIGNAL_0/1 alternately to start a round.
+    mx_handle_t done;  // Signaled by the last waiter to finish a round.
+    uint32_t waiters;
+    mxtl::atomic<uint32_t> acks;
+    mxtl::atomic<uint32_t> stop;
+};
+
+// Waits for every round on |go| and acks it; the last one in wakes the writer.
+void* fanout_waiter(void* arg) {
+    auto fanout = static_cast<FanoutArgs*>(arg);
+    for (uint32_t round = 0;; round++) {
+        mx_signals_t signal = (round & 1) ? MX_USER_SIGNAL_1 : MX_USER_SIGNAL_0;
+        mx_status_t status = mx_object_wait_one(fanout->go, signal, MX_TIME_INFINITE, nullptr);
+        if (status != NO_ERROR || fanout->stop.load())
+            break;
+        if (fanout->acks.fetch_add(1u) + 1u == fanout->waiters)
+            mx_object_signal(fanout->done, 0u, MX_EVENT_SIGNALED);
+    }
+    return nullptr;
+}
+
+// One writer, |waiters| waiters. First measures write/read throughput on a
+// channel while |waiters| threads wait on it for a signal that never changes,
+// then how fast one thread can wake all of them, round after round.
+void do_waiters_test(uint32_t duration, uint32_t waiters) {
+    __UNUSED mx_status_t status;
+    __UNUSED int r;
+
+    uint64_t duration_ns = duration * 1000000000ull;
+
+    mx_handle_t mp[2] = {MX_HANDLE_INVALID, MX_HANDLE_INVALID};
+    status = mx_channel_create(0u, &mp[0], &mp[1]);
+    assert(status == NO_ERROR);
+
+    mxtl::unique_ptr<pthread_t[]> threads(new pthread_t[waiters]);
+    for (uint32_t i = 0; i < waiters; i++) {
+        r = pthread_create(&threads[i], nullptr, idle_waiter, &mp[1]);
+        assert(r == 0);
+    }
+
+    uint8_t data[10] = {};
+    static constexpr uint32_t big_it_size = 10000;
+    uint64_t big_its = 0;
+    uint64_t start_ns = mx_time_get(MX_CLOCK_MONOTONIC);
+    uint64_t end_ns;
+    for (;;) {
+        big_its++;
+        for (uint32_t i = 0; i < big_it_size; i++) {
+            status = mx_channel_write(mp[0], 0u, data, sizeof(data), nullptr, 0u);
+            assert(status == NO_ERROR);
+            uint32_t r_size;
+            status = mx_channel_read(mp[1], 0u, data, sizeof(data), &r_size, nullptr, 0u, nullptr);
+            assert(status == NO_ERROR);
+        }
+
+        end_ns = mx_time_get(MX_CLOCK_MONOTONIC);
+        if ((end_ns - start_ns) >= duration_ns)
+            break;
+    }
+
+    // Closing the writing end releases the idle waiters.
+    status = mx_handle_close(mp[0]);
+    assert(status == NO_ERROR);
+    for (uint32_t i = 0; i < waiters; i++)
+        pthread_join(threads[i], nullptr);
+    status = mx_handle_close(mp[1]);
+    assert(status == NO_ERROR);
+
+    double real_duration = static_cast<double>(end_ns - start_ns) / 1000000000.0;
+    double its_per_second = static_cast<double>(big_its) * big_it_size / real_duration;
+    printf("write/read with %" PRIu32 " idle waiters: %.0f iterations/second\n",
+           waiters, its_per_second);
+
+    FanoutArgs fanout;
+    fanout.waiters = waiters;
+    fanout.acks.store(0u);
+    fanout.stop.store(0u);
+    status = mx_event_create(0u, &fanout.go);
+    assert(status == NO_ERROR);
+    status = mx_event_create(0u, &fanout.done);
+    assert(status == NO_ERROR);
+
+    for (uint32_t i = 0; i < waiters; i++) {
+        r = pthread_create(&threads[i], nullptr, fanout_waiter, &fanout);
+        assert(r == 0);
+    }
+
+    uint64_t rounds = 0;
+    start_ns = mx_time_get(MX_CLOCK_MONOTONIC);
+    for (;;) {
+        mx_signals_t signal = (rounds & 1) ? MX_USER_SIGNAL_1 : MX_USER_SIGNAL_0;
+        mx_signals_t other = (rounds & 1) ? MX_USER_SIGNAL_0 : MX_USER_SIGNAL_1;
+        fanout.acks.store(0u);
+        status = mx_object_signal(fanout.go, other, signal);
+        assert(status == NO_ERROR);
+        status = mx_object_wait_one(fanout.done, MX_EVENT_SIGNALED, MX_TIME_INFINITE, nullptr);
+        assert(status == NO_ERROR);
+        status = mx_object_signal(fanout.done, MX_EVENT_SIGNALED, 0u);
+        assert(status == NO_ERROR);
+        rounds++;
+
+        end_ns = mx_time_get(MX_CLOCK_MONOTONIC);
+        if ((end_ns - start_ns) >= duration_ns)
+            break;
+    }
+
+    // Everyone is waiting on the next round's signal; raise both to let them out.
+    fanout.stop.store(1u);
+    status = mx_object_signal(fanout.go, 0u, MX_USER_SIGNAL_0 | MX_USER_SIGNAL_1);
+    assert(status == NO_ERROR);
+    for (uint32_t i = 0; i < waiters; i++)
+        pthread_join(threads[i], nullptr);
+    status = mx_handle_close(fanout.go);
+    assert(status == NO_ERROR);
+    status = mx_handle_close(fanout.done);
+    assert(status == NO_ERROR);
+
+    real_duration = static_cast<double>(end_ns - start_ns) / 1000000000.0;
+    double rounds_per_second = static_cast<double>(rounds) / real_duration;
+    double ns_per_round = static_cast<double>(end_ns - start_ns) / static_cast<double>(rounds);
+    printf("wake %" PRIu32 " waiters: %.0f rounds/second, %.0f ns/round\n",
+           waiters, rounds_per_second, ns_per_round);
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
@@ -121,6 +355,8 @@ int main(int argc, char** argv) {
         "  -h    show help (this)\n"
         "  -o    run single test (default)\n"
         "  -s    run suite (ignores -S/-H/-Q)\n"
+        "  -c    measure mx_channel_call round trips to a server thread (uses -S)\n"
+        "  -W N  measure channel traffic with, and wakeups of, N waiting threads\n"
         "  -n N  set test repetition count to N (default: 1)\n"
         "  -d N  set test duration to N seconds (default: 5)\n"
         "  -S N  set message size to N bytes (default: 10)\n"
@@ -128,6 +364,8 @@ int main(int argc, char** argv) {
         "  -Q N  set message pre-queue count to N messages (default: 0)\n";
 
     bool run_suite = false;  // -o/-s
+    bool run_call = false;   // -c
+    uint32_t waiters = 0;    // -W
     uint32_t duration = 5;   // -d
     uint32_t repeats = 1;    // -n
     // Ignored when running a suite:
@@ -138,7 +376,7 @@ int main(int argc, char** argv) {
     };
 
     int opt;
-    while ((opt = getopt(argc, argv, "+hosn:d:S:H:Q:")) != -1) {
+    while ((opt = getopt(argc, argv, "+hoscn:d:S:H:Q:W:")) != -1) {
         // Our option values are always unsigned numbers.
         uint32_t value = 0;
         if (optarg) {
@@ -160,6 +398,9 @@ int main(int argc, char** argv) {
             case 's':
                 run_suite = true;
                 break;
+            case 'c':
+                run_call = true;
+                break;
             case 'n':
                 assert(optarg);
                 repeats = value;
@@ -180,6 +421,10 @@ int main(int argc, char** argv) {
                 assert(optarg);
                 test_args.queue = value;
                 break;
+            case 'W':
+                assert(optarg);
+                waiters = value;
+                break;
             default:  // '?'
                 argument_error(argv[0], "invalid option");
                 break;
@@ -216,6 +461,14 @@ int main(int argc, char** argv) {
             };
             for (size_t i = 0; i < countof(suite); i++)
                 do_test(duration, suite[i]);
+            static constexpr uint32_t call_suite[] = {16, 100, 1000};
+            for (size_t i = 0; i < countof(call_suite); i++)
+                do_call_test(duration, call_suite[i]);
+            do_waiters_test(duration, 100u);
+        } else if (waiters > 0u) {
+            do_waiters_test(duration, waiters);
+        } else if (run_call) {
+            do_call_test(duration, test_args.size);
         } else {
             do_test(duration, test_args);
         }
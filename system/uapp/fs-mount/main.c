@@ -22,6 +22,7 @@ int usage(void) {
     fprintf(stderr, "usage: mount [ <option>* ] devicepath mountpath\n");
     fprintf(stderr, " -v  : Verbose mode\n");
     fprintf(stderr, " -r  : Open the filesystem as read-only\n");
+    fprintf(stderr, " -w  : Write modified blocks through to disk immediately (minfs)\n");
     return -1;
 }
 
@@ -32,6 +33,8 @@ int parse_args(int argc, char** argv, mount_options_t* options,
             options->verbose_mount = true;
         } else if (!strcmp(argv[1], "-r")) {
             options->readonly = true;
+        } else if (!strcmp(argv[1], "-w")) {
+            options->writethrough = true;
         } else {
             break;
         }
@@ -9,7 +9,14 @@
 
 #include <fs/trace.h>
 
+#ifdef __Fuchsia__
+#include <magenta/device/block.h>
+#include <magenta/syscalls.h>
+#endif
+
 #include <magenta/new.h>
+#include <mxtl/algorithm.h>
+#include <mxtl/auto_lock.h>
 #include <mxtl/ref_ptr.h>
 #include <mxtl/unique_ptr.h>
 
@@ -18,34 +25,481 @@
 
 namespace minfs {
 
-mx_status_t Bcache::Readblk(uint32_t bno, void* data) {
-    off_t off = bno * kMinfsBlockSize;
-    trace(IO, "readblk() bno=%u off=%#llx\n", bno, (unsigned long long)off);
-    if (lseek(fd_, off, SEEK_SET) < 0) {
-        error("minfs: cannot seek to block %u\n", bno);
-        return ERR_IO;
+// In write-back mode, a flush is forced once this many blocks are dirty.
+constexpr uint32_t kDirtyHighWater = kMinfsBlockCacheSize / 2;
+// Most dirty blocks coalesced into a single device write by a flush.
+constexpr uint32_t kFlushRunBlocks = 16;
+
+#ifdef __Fuchsia__
+// Interval at which the write-back thread flushes dirty blocks.
+constexpr mx_time_t kWritebackInterval = MX_SEC(5);
+
+// Size of the VMO shared with the block device, and so the most blocks moved
+// by one FIFO request.
+constexpr uint32_t kFifoVmoBlocks = 64;
+
+mx_status_t Bcache::AttachFifo() {
+    mxtl::AutoLock lock(&fifo_lock_);
+    if (fifo_client_ != nullptr) {
+        return NO_ERROR;
+    }
+
+    mx_handle_t fifo;
+    if (ioctl_block_get_fifos(fd_, &fifo) != sizeof(fifo)) {
+        return ERR_NOT_SUPPORTED;
+    }
+
+    mx_status_t status;
+    txnid_t txnid;
+    vmoid_t vmoid;
+    mx_handle_t xfer_vmo;
+    mxtl::unique_ptr<MappedVmo> vmo;
+    if ((status = MappedVmo::Create(kFifoVmoBlocks * kMinfsBlockSize, &vmo)) != NO_ERROR) {
+        goto fail;
+    }
+    if (ioctl_block_alloc_txn(fd_, &txnid) != sizeof(txnid)) {
+        status = ERR_IO;
+        goto fail;
     }
-    if (read(fd_, data, kMinfsBlockSize) != kMinfsBlockSize) {
-        error("minfs: cannot read block %u\n", bno);
+    if ((status = mx_handle_duplicate(vmo->GetVmo(), MX_RIGHT_SAME_RIGHTS,
+                                      &xfer_vmo)) != NO_ERROR) {
+        goto fail;
+    }
+    if (ioctl_block_attach_vmo(fd_, &xfer_vmo, &vmoid) != sizeof(vmoid)) {
+        status = ERR_IO;
+        goto fail;
+    }
+    if ((status = block_fifo_create_client(fifo, &fifo_client_)) != NO_ERROR) {
+        goto fail;
+    }
+
+    trace(IO, "minfs: block I/O using FIFO (txnid %u, vmoid %u)\n", txnid, vmoid);
+    fifo_txnid_ = txnid;
+    fifo_vmoid_ = vmoid;
+    fifo_vmo_ = mxtl::move(vmo);
+    return NO_ERROR;
+
+fail:
+    // Closing the FIFO server also drops any VMO or txn we registered.
+    mx_handle_close(fifo);
+    ioctl_block_fifo_close(fd_);
+    return status;
+}
+
+void Bcache::DetachFifo() {
+    // Readers and writers check |fifo_client_| under the lock too, so none
+    // is left using the client once it is released.
+    mxtl::AutoLock lock(&fifo_lock_);
+    if (fifo_client_ == nullptr) {
+        return;
+    }
+    block_fifo_request_t request;
+    request.txnid = fifo_txnid_;
+    request.vmoid = fifo_vmoid_;
+    request.opcode = BLOCKIO_CLOSE_VMO;
+    block_fifo_txn(fifo_client_, &request, 1);
+    block_fifo_release_client(fifo_client_);
+    fifo_client_ = nullptr;
+    ioctl_block_fifo_close(fd_);
+    fifo_vmo_.reset();
+}
+
+mx_status_t Bcache::FifoTxn(uint16_t opcode, uint32_t bno, uint32_t count) {
+    assert(count <= kFifoVmoBlocks);
+    // The blocks are contiguous on disk and in the VMO, so they go to the
+    // device as a single request.
+    block_fifo_request_t request;
+    request.txnid = fifo_txnid_;
+    request.vmoid = fifo_vmoid_;
+    request.opcode = opcode;
+    request.length = count * kMinfsBlockSize;
+    request.vmo_offset = 0;
+    request.dev_offset = static_cast<uint64_t>(bno) * kMinfsBlockSize;
+    mx_status_t status = block_fifo_txn(fifo_client_, &request, 1);
+    if (status != NO_ERROR) {
+        error("minfs: FIFO %s of blocks %u-%u failed: %d\n",
+              opcode == BLOCKIO_READ ? "read" : "write", bno, bno + count - 1, status);
         return ERR_IO;
     }
     return NO_ERROR;
 }
+#endif
+
+mx_status_t Bcache::DevRead(uint32_t bno, uint32_t count, void* data) {
+    uint8_t* out = static_cast<uint8_t*>(data);
+#ifdef __Fuchsia__
+    {
+        mxtl::AutoLock lock(&fifo_lock_);
+        while ((fifo_client_ != nullptr) && (count > 0)) {
+            uint32_t blocks = mxtl::min(count, kFifoVmoBlocks);
+            mx_status_t status;
+            if ((status = FifoTxn(BLOCKIO_READ, bno, blocks)) != NO_ERROR) {
+                return status;
+            }
+            memcpy(out, fifo_vmo_->GetData(), blocks * kMinfsBlockSize);
+            out += blocks * kMinfsBlockSize;
+            bno += blocks;
+            count -= blocks;
+        }
+        if (fifo_client_ != nullptr) {
+            return NO_ERROR;
+        }
+    }
+#endif
+    off_t off = static_cast<off_t>(bno) * kMinfsBlockSize;
+    trace(IO, "readblk() bno=%u count=%u off=%#llx\n", bno, count, (unsigned long long)off);
+    // pread() leaves the file offset alone, so it needs no lock.
+    for (uint32_t n = 0; n < count; n++) {
+        if (pread(fd_, out + n * kMinfsBlockSize, kMinfsBlockSize,
+                  off + n * kMinfsBlockSize) != kMinfsBlockSize) {
+            error("minfs: cannot read block %u\n", bno + n);
+            return ERR_IO;
+        }
+    }
+    return NO_ERROR;
+}
+
+mx_status_t Bcache::DevWrite(uint32_t bno, uint32_t count, const void* data) {
+    const uint8_t* in = static_cast<const uint8_t*>(data);
+    DevWriteRecord& record = dev_writes_[dev_write_seq_++ % kDevWriteLog];
+    record.bno = bno;
+    record.count = count;
+#ifdef __Fuchsia__
+    {
+        mxtl::AutoLock lock(&fifo_lock_);
+        while ((fifo_client_ != nullptr) && (count > 0)) {
+            uint32_t blocks = mxtl::min(count, kFifoVmoBlocks);
+            memcpy(fifo_vmo_->GetData(), in, blocks * kMinfsBlockSize);
+            mx_status_t status;
+            if ((status = FifoTxn(BLOCKIO_WRITE, bno, blocks)) != NO_ERROR) {
+                return status;
+            }
+            in += blocks * kMinfsBlockSize;
+            bno += blocks;
+            count -= blocks;
+        }
+        if (fifo_client_ != nullptr) {
+            return NO_ERROR;
+        }
+    }
+#endif
+    off_t off = static_cast<off_t>(bno) * kMinfsBlockSize;
+    trace(IO, "writeblk() bno=%u count=%u off=%#llx\n", bno, count, (unsigned long long)off);
+    for (uint32_t n = 0; n < count; n++) {
+        if (pwrite(fd_, in + n * kMinfsBlockSize, kMinfsBlockSize,
+                   off + n * kMinfsBlockSize) != kMinfsBlockSize) {
+            error("minfs: cannot write block %u\n", bno + n);
+            return ERR_IO;
+        }
+    }
+    return NO_ERROR;
+}
+
+bool Bcache::WrittenSince(uint64_t seq, uint32_t bno, uint32_t count) const {
+    if (dev_write_seq_ - seq > kDevWriteLog) {
+        // Too many writes to tell.
+        return true;
+    }
+    for (; seq < dev_write_seq_; seq++) {
+        const DevWriteRecord& w = dev_writes_[seq % kDevWriteLog];
+        if ((w.bno < bno + count) && (bno < w.bno + w.count)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+mx_status_t Bcache::Readblk(uint32_t bno, void* data) {
+    return Readblks(bno, 1, data);
+}
 
 mx_status_t Bcache::Writeblk(uint32_t bno, const void* data) {
-    off_t off = bno * kMinfsBlockSize;
-    trace(IO, "writeblk() bno=%u off=%#llx\n", bno, (unsigned long long)off);
-    if (lseek(fd_, off, SEEK_SET) < 0) {
-        error("minfs: cannot seek to block %u\n", bno);
-        return ERR_IO;
+    return Writeblks(bno, 1, data);
+}
+
+mx_status_t Bcache::Readblks(uint32_t bno, uint32_t count, void* data) {
+    trace(IO, "readblks() bno=%u count=%u\n", bno, count);
+    // The device read is done without |lock_|, so that reads of different
+    // files overlap. One that raced a write to the same blocks is redone.
+    uint64_t seq;
+    {
+        mxtl::AutoLock lock(&lock_);
+        seq = dev_write_seq_;
     }
-    if (write(fd_, data, kMinfsBlockSize) != kMinfsBlockSize) {
-        error("minfs: cannot write block %u\n", bno);
-        return ERR_IO;
+    mx_status_t status = DevRead(bno, count, data);
+    mxtl::AutoLock lock(&lock_);
+    if ((status == NO_ERROR) && WrittenSince(seq, bno, count)) {
+        status = DevRead(bno, count, data);
+    }
+    if (status != NO_ERROR) {
+        return status;
+    }
+    // A dirty cached copy is newer than the one on disk.
+    if (dirty_count_ != 0) {
+        uint8_t* out = static_cast<uint8_t*>(data);
+        for (uint32_t n = 0; n < count; n++) {
+            mxtl::RefPtr<BlockNode> blk = hash_.find(bno + n).CopyPointer();
+            if ((blk != nullptr) && (blk->flags_ & kBlockDirty)) {
+                memcpy(out + n * kMinfsBlockSize, blk->data(), kMinfsBlockSize);
+            }
+        }
+    }
+    return NO_ERROR;
+}
+
+mx_status_t Bcache::Writeblks(uint32_t bno, uint32_t count, const void* data) {
+    trace(IO, "writeblks() bno=%u count=%u\n", bno, count);
+    mxtl::AutoLock lock(&lock_);
+    mx_status_t status;
+    if ((status = DevWrite(bno, count, data)) != NO_ERROR) {
+        return status;
+    }
+    // Keep cached copies in step, so a later flush cannot overwrite this data
+    // with a stale block.
+    const uint8_t* in = static_cast<const uint8_t*>(data);
+    for (uint32_t n = 0; n < count; n++) {
+        mxtl::RefPtr<BlockNode> blk = hash_.find(bno + n).CopyPointer();
+        if (blk != nullptr) {
+            memcpy(blk->data(), in + n * kMinfsBlockSize, kMinfsBlockSize);
+            MarkClean(blk.get());
+        }
+    }
+    return NO_ERROR;
+}
+
+mx_status_t Bcache::DevSync() {
+#ifdef __Fuchsia__
+    // Block FIFO and fd writes have reached the device once they complete.
+    return NO_ERROR;
+#else
+    return (fsync(fd_) < 0) ? ERR_IO : NO_ERROR;
+#endif
+}
+
+void Bcache::MarkDirty(BlockNode* blk) {
+    if (!(blk->flags_ & kBlockDirty)) {
+        blk->flags_ |= kBlockDirty;
+        dirty_count_++;
+    }
+}
+
+void Bcache::MarkClean(BlockNode* blk) {
+    if (blk->flags_ & kBlockDirty) {
+        blk->flags_ &= ~kBlockDirty;
+        dirty_count_--;
+    }
+}
+
+static int CompareBno(const void* a, const void* b) {
+    uint32_t bno_a = (*static_cast<BlockNode* const*>(a))->GetKey();
+    uint32_t bno_b = (*static_cast<BlockNode* const*>(b))->GetKey();
+    return (bno_a > bno_b) - (bno_a < bno_b);
+}
+
+mx_status_t Bcache::FlushLocked() {
+    if (dirty_count_ == 0) {
+        return NO_ERROR;
+    }
+
+    // Busy blocks may be mid-update; they are flushed once released.
+    BlockNode* dirty[kMinfsBlockCacheSize];
+    size_t count = 0;
+    for (auto& blk : hash_) {
+        if ((blk.flags_ & kBlockDirty) && !(blk.flags_ & kBlockBusy)) {
+            assert(count < kMinfsBlockCacheSize);
+            dirty[count++] = &blk;
+        }
+    }
+    if (count == 0) {
+        return NO_ERROR;
+    }
+    qsort(dirty, count, sizeof(dirty[0]), CompareBno);
+    trace(BCACHE, "bcache_flush() %zu blocks\n", count);
+
+    // Group commit: everything dirty goes to the journal as one sequential
+    // write before any of it is written in place.
+    mx_status_t status;
+    if (journal_ != nullptr) {
+        if ((status = journal_->Commit(dirty, static_cast<uint32_t>(count))) != NO_ERROR) {
+            error("minfs: journal commit failed: %d\n", status);
+            return status;
+        }
+        if (crash_after_commit_) {
+            for (size_t i = 0; i < count; i++) {
+                MarkClean(dirty[i]);
+            }
+            return NO_ERROR;
+        }
+    }
+
+    if (flush_buf_ == nullptr) {
+        // Without a staging buffer, blocks are simply written one at a time.
+        AllocChecker ac;
+        flush_buf_.reset(new (&ac) uint8_t[kFlushRunBlocks * kMinfsBlockSize]);
+        if (!ac.check()) {
+            flush_buf_.reset();
+        }
+    }
+
+    status = NO_ERROR;
+    for (size_t i = 0; i < count;) {
+        uint32_t bno = dirty[i]->bno_;
+        uint32_t run = 1;
+        while ((flush_buf_ != nullptr) && (run < kFlushRunBlocks) && (i + run < count) &&
+               (dirty[i + run]->bno_ == bno + run)) {
+            run++;
+        }
+
+        const void* src = dirty[i]->data();
+        if (run > 1) {
+            for (uint32_t n = 0; n < run; n++) {
+                memcpy(flush_buf_.get() + n * kMinfsBlockSize, dirty[i + n]->data(),
+                       kMinfsBlockSize);
+            }
+            src = flush_buf_.get();
+        }
+        if (DevWrite(bno, run, src) != NO_ERROR) {
+            error("minfs: cannot flush blocks %u-%u\n", bno, bno + run - 1);
+            status = ERR_IO;
+        } else {
+            for (uint32_t n = 0; n < run; n++) {
+                MarkClean(dirty[i + n]);
+            }
+        }
+        i += run;
     }
+    if ((status == NO_ERROR) && (journal_ != nullptr)) {
+        status = journal_->Checkpoint();
+    }
+    return status;
+}
+
+mx_status_t Bcache::Flush() {
+    mxtl::AutoLock lock(&lock_);
+    return FlushLocked();
+}
+
+void Bcache::TxnBegin() {
+    thrd_t self = thrd_current();
+    {
+        mxtl::AutoLock lock(&lock_);
+        if ((txn_depth_ > 0) && thrd_equal(txn_owner_, self)) {
+            txn_depth_++;
+            return;
+        }
+    }
+    txn_lock_.Acquire();
+    mxtl::AutoLock lock(&lock_);
+    assert(txn_depth_ == 0);
+    txn_owner_ = self;
+    txn_depth_ = 1;
+}
+
+void Bcache::TxnEnd() {
+    bool done;
+    {
+        mxtl::AutoLock lock(&lock_);
+        assert((txn_depth_ > 0) && thrd_equal(txn_owner_, thrd_current()));
+        done = (--txn_depth_ == 0);
+        if (done && writeback_ && (dirty_count_ >= kDirtyHighWater)) {
+            FlushLocked();
+        }
+        if (done) {
+            // Get() may be waiting to flush.
+            cnd_broadcast(&busy_cnd_);
+        }
+    }
+    if (done) {
+        txn_lock_.Release();
+    }
+}
+
+mx_status_t Bcache::AttachJournal(uint32_t start, uint32_t blocks) {
+    mxtl::AutoLock lock(&lock_);
+    if (journal_ != nullptr) {
+        return ERR_BAD_STATE;
+    }
+    // A flush may commit every block in the cache at once.
+    if (blocks < kMinfsBlockCacheSize + 3) {
+        error("minfs: journal of %u blocks is too small\n", blocks);
+        return ERR_INVALID_ARGS;
+    }
+    mx_status_t status;
+    mxtl::unique_ptr<Journal> journal;
+    if ((status = Journal::Create(&journal, this, start, blocks)) != NO_ERROR) {
+        return status;
+    }
+    // Anything cached predates the replay, so drop it.
+    FlushLocked();
+    uint32_t txns;
+    if ((status = journal->Replay(true, false, &txns)) != NO_ERROR) {
+        return status;
+    }
+    if (txns != 0) {
+        printf("minfs: replayed %u journal transaction(s)\n", txns);
+    }
+    InvalidateLocked();
+    journal_ = mxtl::move(journal);
     return NO_ERROR;
 }
 
+mx_status_t Bcache::SetWriteback(bool enable) {
+#ifdef __Fuchsia__
+    if (!enable) {
+        StopWriteback();
+    }
+#endif
+    mx_status_t status = NO_ERROR;
+    {
+        mxtl::AutoLock lock(&lock_);
+        writeback_ = enable;
+        if (!enable) {
+            status = FlushLocked();
+        }
+    }
+#ifdef __Fuchsia__
+    if (enable && !writeback_thread_running_) {
+        // Without the thread, dirty blocks are still flushed on Sync() and
+        // under pressure.
+        if (mx_event_create(0, &writeback_stop_) != NO_ERROR) {
+            error("minfs: cannot start write-back thread\n");
+        } else if (thrd_create_with_name(&writeback_thread_, WritebackThread, this,
+                                         "minfs-writeback") != thrd_success) {
+            error("minfs: cannot start write-back thread\n");
+            mx_handle_close(writeback_stop_);
+        } else {
+            writeback_thread_running_ = true;
+        }
+    }
+#endif
+    return status;
+}
+
+#ifdef __Fuchsia__
+int Bcache::WritebackThread(void* arg) {
+    Bcache* bc = static_cast<Bcache*>(arg);
+    while (mx_object_wait_one(bc->writeback_stop_, MX_EVENT_SIGNALED, kWritebackInterval,
+                              nullptr) == ERR_TIMED_OUT) {
+        mxtl::AutoLock lock(&bc->lock_);
+        // Leave a half-done operation for the next tick.
+        if (bc->txn_depth_ == 0) {
+            bc->FlushLocked();
+        }
+    }
+    return 0;
+}
+
+void Bcache::StopWriteback() {
+    if (!writeback_thread_running_) {
+        return;
+    }
+    mx_object_signal(writeback_stop_, 0u, MX_EVENT_SIGNALED);
+    thrd_join(writeback_thread_, nullptr);
+    mx_handle_close(writeback_stop_);
+    writeback_thread_running_ = false;
+}
+#endif
+
 constexpr uint32_t kModeFind = 0;
 constexpr uint32_t kModeLoad = 1;
 constexpr uint32_t kModeZero = 2;
@@ -60,6 +514,12 @@ static const char* modestr(uint32_t mode) {
 }
 
 void Bcache::Invalidate() {
+    mxtl::AutoLock lock(&lock_);
+    FlushLocked();
+    InvalidateLocked();
+}
+
+void Bcache::InvalidateLocked() {
     mxtl::RefPtr<BlockNode> blk;
     uint32_t n = 0;
     while ((blk = lists_.PopFront(kBlockLRU)) != nullptr) {
@@ -77,14 +537,19 @@ mxtl::RefPtr<BlockNode> Bcache::Get(uint32_t bno, uint32_t mode) {
     if (bno >= blockmax_) {
         return nullptr;
     }
-    mxtl::RefPtr<BlockNode> blk = hash_.find(bno).CopyPointer();
+    mxtl::AutoLock lock(&lock_);
+    mxtl::RefPtr<BlockNode> blk;
+    while (((blk = hash_.find(bno).CopyPointer()) != nullptr) && (blk->flags_ & kBlockBusy)) {
+        // Held by another thread; it may even be reassigned by the time
+        // we wake, so look it up again.
+        cnd_wait(&busy_cnd_, lock_.GetInternal());
+    }
     if (blk != nullptr) {
         // remove from lru
         assert(blk->flags_ & kBlockLRU);
-        assert(!(blk->flags_ & kBlockBusy));
         lists_.Erase(blk, kBlockLRU);
         if (mode == kModeZero) {
-            blk->flags_ |= kBlockDirty;
+            MarkDirty(blk.get());
             memset(blk->data(), 0, blocksize_);
         }
         goto done;
@@ -94,19 +559,16 @@ mxtl::RefPtr<BlockNode> Bcache::Get(uint32_t bno, uint32_t mode) {
     } else {
         if ((blk = lists_.PopFront(kBlockFree)) != nullptr) {
             // nothing extra to do
-        } else if ((blk = lists_.PopFront(kBlockLRU)) != nullptr) {
-            // remove from hash, bno to be reassigned
-            hash_.erase(*blk);
-        } else {
-            panic("bcache: out of blocks\n");
+        } else if ((blk = EvictLocked()) == nullptr) {
+            return nullptr;
         }
         blk->bno_ = bno;
         hash_.insert(blk);
         assert(hash_.size() <= kMinfsBlockCacheSize);
         if (mode == kModeZero) {
-            blk->flags_ |= kBlockDirty;
+            MarkDirty(blk.get());
             memset(blk->data(), 0, blocksize_);
-        } else if (Readblk(bno, blk->data()) < 0) {
+        } else if (DevRead(bno, 1, blk->data()) < 0) {
             panic("bcache: bno %u read error!\n", bno);
         }
     }
@@ -118,6 +580,40 @@ done:
     return blk;
 }
 
+mxtl::RefPtr<BlockNode> Bcache::EvictLocked() {
+    // The least recently used clean block goes first. If every block is
+    // dirty, make room by writing them all back in one batch, rather than
+    // just one of them.
+    mxtl::RefPtr<BlockNode> blk;
+    while (((blk = lists_.PopFrontClean(kBlockLRU)) == nullptr) && (dirty_count_ != 0)) {
+        // With a journal, a flush commits everything dirty as one journal
+        // transaction, so it must not happen in the middle of a minfs
+        // transaction. Another thread's will end; our own cannot.
+        if ((journal_ != nullptr) && (txn_depth_ > 0)) {
+            if (thrd_equal(txn_owner_, thrd_current())) {
+                error("minfs: transaction does not fit in the block cache\n");
+                return nullptr;
+            }
+            cnd_wait(&busy_cnd_, lock_.GetInternal());
+            continue;
+        }
+        mx_status_t status;
+        if ((status = FlushLocked()) != NO_ERROR) {
+            error("minfs: cannot flush the block cache to make room: %d\n", status);
+        }
+        // A block whose write failed stays dirty, and is not given up.
+        blk = lists_.PopFrontClean(kBlockLRU);
+        break;
+    }
+    if (blk == nullptr) {
+        error("minfs: no block cache entry can be reused\n");
+        return nullptr;
+    }
+    // remove from hash, bno to be reassigned
+    hash_.erase(*blk);
+    return blk;
+}
+
 mxtl::RefPtr<BlockNode> Bcache::Get(uint32_t bno) {
     return Get(bno, kModeLoad);
 }
@@ -128,16 +624,24 @@ mxtl::RefPtr<BlockNode> Bcache::GetZero(uint32_t bno) {
 
 void Bcache::Put(mxtl::RefPtr<BlockNode> blk, uint32_t flags) {
     trace(BCACHE, "bcache_put() bno=%u%s\n", blk->bno_, (flags & kBlockDirty) ? " DIRTY" : "");
+    mxtl::AutoLock lock(&lock_);
     assert(blk->flags_ & kBlockBusy);
     // remove from busy list
     lists_.Erase(blk, kBlockBusy);
-    if ((flags | blk->flags_) & kBlockDirty) {
-        if (Writeblk(blk->bno_, blk->data()) < 0) {
+    if (flags & kBlockDirty) {
+        MarkDirty(blk.get());
+    }
+    if (!writeback_ && (blk->flags_ & kBlockDirty)) {
+        if (DevWrite(blk->bno_, 1, blk->data()) < 0) {
             error("block write error!\n");
         }
-        blk->flags_ &= ~kBlockDirty;
+        MarkClean(blk.get());
     }
     lists_.PushBack(mxtl::move(blk), kBlockLRU);
+    cnd_broadcast(&busy_cnd_);
+    if (writeback_ && (txn_depth_ == 0) && (dirty_count_ >= kDirtyHighWater)) {
+        FlushLocked();
+    }
 }
 
 mx_status_t Bcache::Read(uint32_t bno, void* data, uint32_t off, uint32_t len) {
@@ -172,7 +676,25 @@ mx_status_t Bcache::Write(uint32_t bno, const void* data, uint32_t off, uint32_t
     }
 }
 
+mx_status_t Bcache::WriteCached(uint32_t bno, const void* data) {
+    trace(BCACHE, "bcache_write_cached() bno=%u\n", bno);
+    mxtl::RefPtr<BlockNode> blk = GetZero(bno);
+    if (blk == nullptr) {
+        return ERR_IO;
+    }
+    memcpy(blk->data(), data, blocksize_);
+    Put(mxtl::move(blk), kBlockDirty);
+    return NO_ERROR;
+}
+
 int Bcache::Sync() {
+    // Wait out any transaction in progress, rather than commit half of it.
+    TxnBegin();
+    mx_status_t status = Flush();
+    TxnEnd();
+    if (status != NO_ERROR) {
+        return ERR_IO;
+    }
     return fsync(fd_);
 }
 
@@ -190,17 +712,44 @@ mx_status_t Bcache::Create(Bcache** out, int fd, uint32_t blockmax, uint32_t blo
         }
         num--;
     }
+#ifdef __Fuchsia__
+    // Not every block device speaks the FIFO protocol; fall back to the fd.
+    if (bc->AttachFifo() != NO_ERROR) {
+        trace(IO, "minfs: block FIFO unavailable, using fd I/O\n");
+    }
+#endif
     *out = bc.release();
     return NO_ERROR;
 }
 
 int Bcache::Close() {
+#ifdef __Fuchsia__
+    StopWriteback();
+#endif
+    // Like Sync(), wait out any transaction in progress.
+    TxnBegin();
+    mx_status_t status = Flush();
+    TxnEnd();
+    if (status != NO_ERROR) {
+        error("minfs: dirty blocks lost on close\n");
+    }
+#ifdef __Fuchsia__
+    DetachFifo();
+#endif
     return close(fd_);
 }
 
 Bcache::Bcache(int fd, uint32_t blockmax, uint32_t blocksize) :
-    fd_(fd), blockmax_(blockmax), blocksize_(blocksize) {}
-Bcache::~Bcache() {}
+    fd_(fd), blockmax_(blockmax), blocksize_(blocksize) {
+    cnd_init(&busy_cnd_);
+}
+Bcache::~Bcache() {
+#ifdef __Fuchsia__
+    StopWriteback();
+    DetachFifo();
+#endif
+    cnd_destroy(&busy_cnd_);
+}
 
 size_t BcacheLists::SizeAllSlow() const {
     return list_busy_.size_slow() + list_lru_.size_slow() + list_free_.size_slow();
@@ -224,6 +773,19 @@ mxtl::RefPtr<BlockNode> BcacheLists::PopFront(uint32_t block_type) {
     return blk;
 }
 
+mxtl::RefPtr<BlockNode> BcacheLists::PopFrontClean(uint32_t block_type) {
+    assert(SizeAllSlow() == kMinfsBlockCacheSize);
+    block_type &= kBlockLLFlags;
+    auto ll = GetList(block_type);
+    for (auto& blk : *ll) {
+        if (!(blk.flags_ & kBlockDirty)) {
+            blk.flags_ &= ~block_type;
+            return ll->erase(blk);
+        }
+    }
+    return nullptr;
+}
+
 mxtl::RefPtr<BlockNode> BcacheLists::Erase(mxtl::RefPtr<BlockNode> blk, uint32_t block_type) {
     assert(SizeAllSlow() == kMinfsBlockCacheSize);
     block_type &= kBlockLLFlags;
@@ -0,0 +1,226 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Converts version 2 volumes, whose inodes map blocks through direct and
+// indirect block tables, to extent-mapped inodes. Data blocks stay where
+// they are; indirect blocks are released, and extent leaf blocks allocated
+// for files which need them.
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <fs/trace.h>
+#include <magenta/new.h>
+#include <mxtl/algorithm.h>
+#include <mxtl/unique_ptr.h>
+
+#include "minfs.h"
+#include "minfs-private.h"
+
+namespace minfs {
+namespace {
+
+constexpr uint32_t kPerIndirect = kMinfsBlockSize / sizeof(uint32_t);
+constexpr uint32_t kMaxExtents = kMinfsInlineExtents * kMinfsExtentsPerBlock;
+
+// Appends logical block 'n' at 'bno' to the extents in 'ext'.
+bool extent_append(minfs_extent_t* ext, uint32_t* count, uint32_t n, uint32_t bno) {
+    if (*count > 0) {
+        minfs_extent_t* last = &ext[*count - 1];
+        if ((last->start + last->length == n) && (last->bno + last->length == bno)) {
+            last->length++;
+            return true;
+        }
+    }
+    if (*count == kMaxExtents) {
+        return false;
+    }
+    ext[*count].start = n;
+    ext[*count].bno = bno;
+    ext[*count].length = 1;
+    (*count)++;
+    return true;
+}
+
+// Builds the extents for a version 2 inode, and counts its indirect blocks.
+mx_status_t extents_from_v2(Bcache* bc, const minfs_inode_v2_t* inode, minfs_extent_t* ext,
+                            uint32_t* count, uint32_t* indirect_count) {
+    *count = 0;
+    *indirect_count = 0;
+    for (uint32_t n = 0; n < kMinfsDirect; n++) {
+        if ((inode->dnum[n] != 0) && !extent_append(ext, count, n, inode->dnum[n])) {
+            return ERR_NO_RESOURCES;
+        }
+    }
+    uint32_t entry[kPerIndirect];
+    for (uint32_t i = 0; i < kMinfsIndirect; i++) {
+        if (inode->inum[i] == 0) {
+            continue;
+        }
+        (*indirect_count)++;
+        if (bc->Readblk(inode->inum[i], entry) != NO_ERROR) {
+            return ERR_IO;
+        }
+        for (uint32_t j = 0; j < kPerIndirect; j++) {
+            uint32_t n = kMinfsDirect + i * kPerIndirect + j;
+            if ((entry[j] != 0) && !extent_append(ext, count, n, entry[j])) {
+                return ERR_NO_RESOURCES;
+            }
+        }
+    }
+    return NO_ERROR;
+}
+
+} // namespace anonymous
+
+int minfs_convert(Bcache* bc) {
+    minfs_info_t info;
+    if (bc->Read(0, &info, 0, sizeof(info)) != NO_ERROR) {
+        error("convert: could not read info block\n");
+        return -1;
+    }
+    if (info.version == kMinfsVersion) {
+        fprintf(stderr, "convert: filesystem is already version %u\n", kMinfsVersion);
+        return 0;
+    }
+    if (info.version != kMinfsVersionBlockMap) {
+        error("convert: cannot convert version %u\n", info.version);
+        return -1;
+    }
+    info.version = kMinfsVersion;
+    if (minfs_check_info(&info, bc->Maxblk()) != NO_ERROR) {
+        return -1;
+    }
+    if ((info.jnl_blocks != 0) &&
+        (bc->AttachJournal(info.jnl_block, info.jnl_blocks) != NO_ERROR)) {
+        return -1;
+    }
+
+    uint32_t abmblks = (info.block_count + kMinfsBlockBits - 1) / kMinfsBlockBits;
+    uint32_t ibmblks = (info.inode_count + kMinfsBlockBits - 1) / kMinfsBlockBits;
+    uint32_t inoblks = (info.inode_count + kMinfsInodesPerBlock - 1) / kMinfsInodesPerBlock;
+    RawBitmap abm;
+    RawBitmap ibm;
+    mx_status_t status;
+    if (((status = abm.Reset(abmblks * kMinfsBlockBits)) != NO_ERROR) ||
+        ((status = ibm.Reset(ibmblks * kMinfsBlockBits)) != NO_ERROR) ||
+        ((status = abm.Shrink(info.block_count)) != NO_ERROR) ||
+        ((status = ibm.Shrink(info.inode_count)) != NO_ERROR)) {
+        return status;
+    }
+    if ((bc->Readblks(info.abm_block, abmblks, GetBlock(abm, 0)) != NO_ERROR) ||
+        (bc->Readblks(info.ibm_block, ibmblks, GetBlock(ibm, 0)) != NO_ERROR)) {
+        error("convert: could not read bitmaps\n");
+        return -1;
+    }
+
+    AllocChecker ac;
+    mxtl::unique_ptr<minfs_extent_t[]> ext(new (&ac) minfs_extent_t[kMaxExtents]);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    uint8_t idata[kMinfsBlockSize];
+
+    // Nothing is written until every inode is known to fit.
+    for (int pass = 0; pass < 2; pass++) {
+        uint32_t converted = 0;
+        uint32_t extents = 0;
+        for (uint32_t ib = 0; ib < inoblks; ib++) {
+            if (bc->Readblk(info.ino_block + ib, idata) != NO_ERROR) {
+                error("convert: could not read inode table\n");
+                return -1;
+            }
+            bool dirty = false;
+            for (uint32_t k = 0; k < kMinfsInodesPerBlock; k++) {
+                uint32_t ino = ib * kMinfsInodesPerBlock + k;
+                if ((ino == 0) || (ino >= info.inode_count) || !ibm.Get(ino, ino + 1)) {
+                    continue;
+                }
+                auto old_inode = reinterpret_cast<minfs_inode_v2_t*>(idata + k * kMinfsInodeSize);
+                if ((old_inode->magic != kMinfsMagicFile) && (old_inode->magic != kMinfsMagicDir)) {
+                    continue;
+                }
+                uint32_t count;
+                uint32_t indirect_count;
+                status = extents_from_v2(bc, old_inode, ext.get(), &count, &indirect_count);
+                if (status == ERR_NO_RESOURCES) {
+                    error("convert: ino#%u is too fragmented to convert\n", ino);
+                    return -1;
+                } else if (status != NO_ERROR) {
+                    return status;
+                }
+                converted++;
+                extents += count;
+                if (pass == 0) {
+                    continue;
+                }
+
+                for (uint32_t i = 0; i < kMinfsIndirect; i++) {
+                    if (old_inode->inum[i] != 0) {
+                        abm.Clear(old_inode->inum[i], old_inode->inum[i] + 1);
+                    }
+                }
+                minfs_inode_t inode;
+                memcpy(&inode, old_inode, kMinfsInodeSize);
+                memset(&inode.ext_count, 0,
+                       kMinfsInodeSize - offsetof(minfs_inode_t, ext_count));
+                inode.dir_index = 0;
+                inode.dir_index_blocks = 0;
+                inode.block_count -= indirect_count;
+                if (count <= kMinfsInlineExtents) {
+                    memcpy(inode.ext, ext.get(), count * sizeof(minfs_extent_t));
+                    inode.ext_count = static_cast<uint16_t>(count);
+                } else {
+                    inode.ext_depth = 1;
+                    uint8_t leaf[kMinfsBlockSize];
+                    for (uint32_t e = 0; e < count; e += kMinfsExtentsPerBlock) {
+                        uint32_t length = mxtl::min(count - e, kMinfsExtentsPerBlock);
+                        size_t bno;
+                        if (abm.Find(false, info.dat_block, abm.size(), 1, &bno) != NO_ERROR) {
+                            error("convert: no space for extent leaf of ino#%u\n", ino);
+                            return -1;
+                        }
+                        abm.Set(bno, bno + 1);
+                        memset(leaf, 0, sizeof(leaf));
+                        memcpy(leaf, &ext[e], length * sizeof(minfs_extent_t));
+                        if (bc->Writeblk(static_cast<uint32_t>(bno), leaf) != NO_ERROR) {
+                            return -1;
+                        }
+                        minfs_extent_t& index = inode.ext[inode.ext_count++];
+                        index.start = ext[e].start;
+                        index.bno = static_cast<uint32_t>(bno);
+                        index.length = length;
+                        inode.block_count++;
+                    }
+                }
+                memcpy(old_inode, &inode, kMinfsInodeSize);
+                dirty = true;
+            }
+            if (dirty && (bc->Writeblk(info.ino_block + ib, idata) != NO_ERROR)) {
+                return -1;
+            }
+        }
+        if (pass == 1) {
+            printf("convert: %u inodes, %u extents\n", converted, extents);
+        }
+    }
+
+    if (bc->Writeblks(info.abm_block, abmblks, GetBlock(abm, 0)) != NO_ERROR) {
+        error("convert: could not write block bitmap\n");
+        return -1;
+    }
+    // Only now does the volume claim the new format.
+    uint8_t data[kMinfsBlockSize];
+    if (bc->Readblk(0, data) != NO_ERROR) {
+        return -1;
+    }
+    memcpy(data, &info, sizeof(info));
+    if (bc->Writeblk(0, data) != NO_ERROR) {
+        return -1;
+    }
+    return 0;
+}
+
+} // namespace minfs
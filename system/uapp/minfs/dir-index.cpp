@@ -0,0 +1,423 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// The directory entry cache maps the names in a directory to the offsets of
+// their dirents, so lookups need not scan the directory. Large directories
+// keep the same table on disk as their directory index (see minfs.h).
+
+#include <string.h>
+
+#include <fs/trace.h>
+#include <magenta/new.h>
+#include <mxtl/algorithm.h>
+#include <mxtl/unique_ptr.h>
+
+#include "minfs.h"
+#include "minfs-private.h"
+
+namespace minfs {
+namespace {
+
+constexpr uint32_t kDirCacheMinSlots = 64;
+// Enough for a directory of kMinfsMaxDirectorySize filled with the smallest
+// possible dirents.
+constexpr uint32_t kDirIndexMaxBlocks = 128;
+// The largest index written. It is written whole within the transaction of
+// the insertion which grows it, so with a journal it must fit in the block
+// cache alongside the rest of that transaction and whatever earlier ones
+// left dirty (up to half the cache). Larger directories keep their entry
+// cache in memory only.
+constexpr uint32_t kDirIndexWriteMaxBlocks = kMinfsBlockCacheSize / 4;
+// Directory bytes read at a time while building the cache.
+constexpr size_t kDirScanChunk = 4 * kMinfsBlockSize;
+
+static_assert(kDirScanChunk >= kMinfsMaxDirentSize, "dirent scan chunk too small");
+static_assert(kDirCacheMinSlots <= kMinfsDirSlotsPerBlock, "cache smaller than one block");
+
+bool is_dot_name(const char* name, size_t len) {
+    return ((len == 1) && (name[0] == '.')) ||
+           ((len == 2) && (name[0] == '.') && (name[1] == '.'));
+}
+
+// The smallest table which holds 'entries' while staying under three
+// quarters full.
+uint32_t dir_cache_slots(uint32_t entries) {
+    uint32_t slots = kDirCacheMinSlots;
+    while (entries >= slots / 4 * 3) {
+        slots *= 2;
+    }
+    return slots;
+}
+
+uint32_t dir_slot_insert(minfs_dir_slot_t* slots, uint32_t count, uint32_t hash, uint32_t off) {
+    uint32_t mask = count - 1;
+    uint32_t n = hash & mask;
+    while (slots[n].off != 0) {
+        n = (n + 1) & mask;
+    }
+    slots[n].hash = hash;
+    slots[n].off = off;
+    return n;
+}
+
+} // namespace anonymous
+
+mx_status_t VnodeMinfs::DirCacheLoad() {
+    if (dir_slots_ != nullptr) {
+        return NO_ERROR;
+    }
+    if (inode_.dir_index != 0) {
+        return DirIndexRead();
+    }
+    return DirCacheScan();
+}
+
+mx_status_t VnodeMinfs::DirIndexRead() {
+    uint32_t blocks = inode_.dir_index_blocks;
+    if ((blocks == 0) || (blocks > kDirIndexMaxBlocks) || (blocks & (blocks - 1))) {
+        error("minfs: ino#%u: bad directory index length %u\n", ino_, blocks);
+        return ERR_IO_DATA_INTEGRITY;
+    }
+    uint32_t count = blocks * kMinfsDirSlotsPerBlock;
+    AllocChecker ac;
+    mxtl::unique_ptr<minfs_dir_slot_t[]> slots(new (&ac) minfs_dir_slot_t[count]);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    mx_status_t status;
+    if ((status = fs_->bc_->Readblks(inode_.dir_index, blocks, slots.get())) != NO_ERROR) {
+        return status;
+    }
+    uint32_t used = 0;
+    for (uint32_t n = 0; n < count; n++) {
+        if (slots[n].off != 0) {
+            used++;
+        }
+    }
+    trace(MINFS, "DirIndexRead() ino=%u slots=%u used=%u\n", ino_, count, used);
+    dir_slots_ = mxtl::move(slots);
+    dir_slot_count_ = count;
+    dir_slot_used_ = used;
+    return NO_ERROR;
+}
+
+mx_status_t VnodeMinfs::DirCacheScan() {
+    uint32_t count = dir_cache_slots(inode_.dirent_count);
+    AllocChecker ac;
+    mxtl::unique_ptr<minfs_dir_slot_t[]> slots(new (&ac) minfs_dir_slot_t[count]);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    memset(slots.get(), 0, count * sizeof(minfs_dir_slot_t));
+    mxtl::unique_ptr<uint8_t[]> buf(new (&ac) uint8_t[kDirScanChunk]);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+
+    // Walk the dirents a chunk at a time; 'buf' holds the directory from
+    // 'base' to 'base + avail'.
+    size_t base = 0;
+    size_t avail = 0;
+    bool eof = false;
+    size_t off = 0;
+    size_t append_off = 0;
+    bool found_room = false;
+    uint32_t used = 0;
+    mx_status_t status;
+    for (;;) {
+        if ((off + kMinfsMaxDirentSize > base + avail) && !eof) {
+            if ((status = ReadInternal(buf.get(), kDirScanChunk, off, &avail)) != NO_ERROR) {
+                return status;
+            }
+            base = off;
+            eof = (avail < kDirScanChunk);
+        }
+        auto de = reinterpret_cast<minfs_dirent_t*>(buf.get() + (off - base));
+        size_t bytes = (base + avail > off) ? base + avail - off : 0;
+        if ((status = validate_dirent(de, bytes, off)) != NO_ERROR) {
+            return status;
+        }
+        uint32_t reclen = MinfsReclen(de, off);
+        uint32_t room = reclen;
+        if (de->ino != 0) {
+            room -= DirentSize(de->namelen);
+            if (!is_dot_name(de->name, de->namelen)) {
+                if (used >= count / 4 * 3) {
+                    // The inode's dirent count was low; rehash into more slots.
+                    uint32_t grown = count * 2;
+                    mxtl::unique_ptr<minfs_dir_slot_t[]> next(new (&ac) minfs_dir_slot_t[grown]);
+                    if (!ac.check()) {
+                        return ERR_NO_MEMORY;
+                    }
+                    memset(next.get(), 0, grown * sizeof(minfs_dir_slot_t));
+                    for (uint32_t n = 0; n < count; n++) {
+                        if (slots[n].off != 0) {
+                            dir_slot_insert(next.get(), grown, slots[n].hash, slots[n].off);
+                        }
+                    }
+                    slots = mxtl::move(next);
+                    count = grown;
+                }
+                dir_slot_insert(slots.get(), count, fnv1a32(de->name, de->namelen),
+                                static_cast<uint32_t>(off));
+                used++;
+            }
+        }
+        if (!found_room && (room >= DirentSize(1))) {
+            append_off = off;
+            found_room = true;
+        }
+        if (de->reclen & kMinfsReclenLast) {
+            if (!found_room) {
+                append_off = off;
+            }
+            break;
+        }
+        off += reclen;
+    }
+
+    trace(MINFS, "DirCacheScan() ino=%u slots=%u used=%u\n", ino_, count, used);
+    dir_slots_ = mxtl::move(slots);
+    dir_slot_count_ = count;
+    dir_slot_used_ = used;
+    dir_append_off_ = append_off;
+    return NO_ERROR;
+}
+
+mx_status_t VnodeMinfs::DirCacheResize(uint32_t count) {
+    AllocChecker ac;
+    mxtl::unique_ptr<minfs_dir_slot_t[]> slots(new (&ac) minfs_dir_slot_t[count]);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    memset(slots.get(), 0, count * sizeof(minfs_dir_slot_t));
+    for (uint32_t n = 0; n < dir_slot_count_; n++) {
+        if (dir_slots_[n].off != 0) {
+            dir_slot_insert(slots.get(), count, dir_slots_[n].hash, dir_slots_[n].off);
+        }
+    }
+    dir_slots_ = mxtl::move(slots);
+    dir_slot_count_ = count;
+    return NO_ERROR;
+}
+
+void VnodeMinfs::DirCacheDrop() {
+    DirIndexFree();
+    dir_slots_.reset();
+    dir_slot_count_ = 0;
+    dir_slot_used_ = 0;
+}
+
+mx_status_t VnodeMinfs::DirIndexWrite() {
+    uint32_t blocks = dir_slot_count_ / kMinfsDirSlotsPerBlock;
+    if ((blocks == 0) || (blocks > kDirIndexWriteMaxBlocks)) {
+        return ERR_OUT_OF_RANGE;
+    }
+    // The index must be contiguous; without a long enough run, go without.
+    uint32_t bno;
+    uint32_t run;
+    mx_status_t status;
+    if ((status = fs_->BlocksNew(inode_.dir_index, blocks, &bno, &run)) != NO_ERROR) {
+        return status;
+    }
+    if (run < blocks) {
+        fs_->BlocksMark(bno, run, false);
+        return ERR_NO_SPACE;
+    }
+    for (uint32_t n = 0; n < blocks; n++) {
+        if ((status = fs_->bc_->WriteCached(bno + n,
+                                            &dir_slots_[n * kMinfsDirSlotsPerBlock])) != NO_ERROR) {
+            fs_->BlocksMark(bno, blocks, false);
+            return status;
+        }
+    }
+    DirIndexFree();
+    inode_.dir_index = bno;
+    inode_.dir_index_blocks = blocks;
+    inode_.block_count += blocks;
+    trace(MINFS, "DirIndexWrite() ino=%u index=%u blocks=%u\n", ino_, bno, blocks);
+    return NO_ERROR;
+}
+
+mx_status_t VnodeMinfs::DirIndexWriteSlots(uint32_t first, uint32_t last) {
+    if (inode_.dir_index == 0) {
+        return NO_ERROR;
+    }
+    uint32_t blocks = dir_slot_count_ / kMinfsDirSlotsPerBlock;
+    uint32_t b = first / kMinfsDirSlotsPerBlock;
+    uint32_t end = last / kMinfsDirSlotsPerBlock;
+    if ((last < first) && (b == end)) {
+        // Wrapped all the way around.
+        b = 0;
+        end = blocks - 1;
+    }
+    mx_status_t status;
+    for (;;) {
+        if ((status = fs_->bc_->WriteCached(inode_.dir_index + b,
+                                            &dir_slots_[b * kMinfsDirSlotsPerBlock])) != NO_ERROR) {
+            return status;
+        }
+        if (b == end) {
+            return NO_ERROR;
+        }
+        b = (b + 1) % blocks;
+    }
+}
+
+void VnodeMinfs::DirIndexFree() {
+    if (inode_.dir_index == 0) {
+        return;
+    }
+    fs_->BlocksMark(inode_.dir_index, inode_.dir_index_blocks, false);
+    inode_.block_count -= inode_.dir_index_blocks;
+    inode_.dir_index = 0;
+    inode_.dir_index_blocks = 0;
+}
+
+mx_status_t VnodeMinfs::ForNamedDirent(DirArgs* args,
+                                       mx_status_t (*func)(VnodeMinfs*, minfs_dirent_t*,
+                                                           DirArgs*, DirectoryOffset*)) {
+    if (is_dot_name(args->name, args->len) || (DirCacheLoad() != NO_ERROR)) {
+        return ForEachDirent(args, func);
+    }
+
+    char data[kMinfsMaxDirentSize];
+    minfs_dirent_t* de = (minfs_dirent_t*) data;
+    uint32_t hash = fnv1a32(args->name, args->len);
+    uint32_t mask = dir_slot_count_ - 1;
+    for (uint32_t n = hash & mask; dir_slots_[n].off != 0; n = (n + 1) & mask) {
+        if (dir_slots_[n].hash != hash) {
+            continue;
+        }
+        // Without the previous dirent at hand, an unlink here will not
+        // coalesce backwards; the free space is merged when the previous
+        // dirent is unlinked instead.
+        DirectoryOffset offs = {
+            .off = dir_slots_[n].off,
+            .off_prev = dir_slots_[n].off,
+        };
+        trace(MINFS, "Reading dirent at offset %zd\n", offs.off);
+        size_t r;
+        mx_status_t status = ReadInternal(data, kMinfsMaxDirentSize, offs.off, &r);
+        if (status != NO_ERROR) {
+            return status;
+        } else if ((status = validate_dirent(de, r, offs.off)) != NO_ERROR) {
+            return status;
+        }
+
+        switch ((status = func(this, de, args, &offs))) {
+        case DIR_CB_NEXT:
+            // A hash collision.
+            break;
+        case DIR_CB_SAVE_SYNC:
+            inode_.seq_num++;
+            InodeSync(kMxFsSyncMtime);
+            return NO_ERROR;
+        case DIR_CB_DONE:
+        default:
+            return status;
+        }
+    }
+    return ERR_NOT_FOUND;
+}
+
+void VnodeMinfs::DirCacheInsert(const char* name, size_t len, size_t off) {
+    if (is_dot_name(name, len) || ((dir_slots_ == nullptr) && (inode_.dir_index == 0))) {
+        // Without an index, the cache is built when first needed.
+        return;
+    }
+    mx_status_t status;
+    if ((status = DirCacheLoad()) != NO_ERROR) {
+        goto fail;
+    }
+    {
+        bool resized = false;
+        if (dir_slot_used_ + 1 >= dir_slot_count_ / 4 * 3) {
+            if ((status = DirCacheResize(dir_slot_count_ * 2)) != NO_ERROR) {
+                goto fail;
+            }
+            resized = true;
+        }
+        // Directories get an index as they grow past the threshold; those
+        // which could not (say, for lack of contiguous space) try again only
+        // when the cache doubles, rather than on each insertion. Those which
+        // outgrow the largest index give it up.
+        bool index = (inode_.dir_index == 0) &&
+                     (inode_.dirent_count > kMinfsDirIndexMinDirents) &&
+                     (dir_slot_count_ <= kDirIndexWriteMaxBlocks * kMinfsDirSlotsPerBlock) &&
+                     (!dir_index_deferred_ || resized);
+        if (index && (dir_slot_count_ < kMinfsDirSlotsPerBlock)) {
+            if ((status = DirCacheResize(kMinfsDirSlotsPerBlock)) != NO_ERROR) {
+                goto fail;
+            }
+        }
+        uint32_t n = dir_slot_insert(dir_slots_.get(), dir_slot_count_,
+                                     fnv1a32(name, len), static_cast<uint32_t>(off));
+        dir_slot_used_++;
+        if (index || (resized && (inode_.dir_index != 0))) {
+            status = DirIndexWrite();
+            dir_index_deferred_ = (status == ERR_NO_SPACE);
+            if ((status == ERR_NO_SPACE) || (status == ERR_OUT_OF_RANGE)) {
+                // The cache still works; only the index is missing.
+                DirIndexFree();
+                return;
+            }
+        } else {
+            status = DirIndexWriteSlots(n, n);
+        }
+        if (status != NO_ERROR) {
+            goto fail;
+        }
+        return;
+    }
+
+fail:
+    warn("minfs: ino#%u: dropping directory index: %d\n", ino_, status);
+    DirCacheDrop();
+}
+
+void VnodeMinfs::DirCacheRemove(const char* name, size_t len, size_t off) {
+    if (is_dot_name(name, len) || ((dir_slots_ == nullptr) && (inode_.dir_index == 0))) {
+        return;
+    }
+    mx_status_t status;
+    if ((status = DirCacheLoad()) != NO_ERROR) {
+        goto fail;
+    }
+    {
+        uint32_t hash = fnv1a32(name, len);
+        uint32_t mask = dir_slot_count_ - 1;
+        uint32_t hole = hash & mask;
+        while ((dir_slots_[hole].hash != hash) || (dir_slots_[hole].off != off)) {
+            if (dir_slots_[hole].off == 0) {
+                status = ERR_NOT_FOUND;
+                goto fail;
+            }
+            hole = (hole + 1) & mask;
+        }
+        // Shift back any entries which probed past the hole, so no probe
+        // sequence is broken by it.
+        uint32_t first = hole;
+        for (uint32_t n = (hole + 1) & mask; dir_slots_[n].off != 0; n = (n + 1) & mask) {
+            uint32_t home = dir_slots_[n].hash & mask;
+            if (((n - home) & mask) >= ((n - hole) & mask)) {
+                dir_slots_[hole] = dir_slots_[n];
+                hole = n;
+            }
+        }
+        dir_slots_[hole].hash = 0;
+        dir_slots_[hole].off = 0;
+        dir_slot_used_--;
+        if ((status = DirIndexWriteSlots(first, hole)) != NO_ERROR) {
+            goto fail;
+        }
+        return;
+    }
+
+fail:
+    warn("minfs: ino#%u: dropping directory index: %d\n", ino_, status);
+    DirCacheDrop();
+}
+
+} // namespace minfs
@@ -0,0 +1,411 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <string.h>
+
+#include <fs/trace.h>
+#include <mxtl/algorithm.h>
+
+#ifdef __Fuchsia__
+#include <magenta/syscalls.h>
+#endif
+
+#include "minfs.h"
+#include "minfs-private.h"
+
+namespace minfs {
+namespace {
+
+// Returns the index of the last extent starting at or before logical block
+// 'n', or -1 if there is none.
+int ExtentSearch(const minfs_extent_t* ext, uint32_t count, uint32_t n) {
+    int lo = 0;
+    int hi = static_cast<int>(count);
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (ext[mid].start <= n) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo - 1;
+}
+
+} // namespace anonymous
+
+mx_status_t minfs_extent_map(Bcache* bc, const minfs_inode_t* inode, uint32_t n,
+                             uint32_t* bno, uint32_t* run) {
+    if (n >= kMinfsMaxFileBlock) {
+        return ERR_OUT_OF_RANGE;
+    }
+    if ((inode->ext_depth > 1) || (inode->ext_count > kMinfsInlineExtents)) {
+        return ERR_IO_DATA_INTEGRITY;
+    }
+
+    const minfs_extent_t* ext = inode->ext;
+    uint32_t count = inode->ext_count;
+    // Where a hole at 'n' ends if no extent follows it in 'ext'.
+    uint32_t limit = kMinfsMaxFileBlock;
+    mxtl::RefPtr<BlockNode> leaf;
+    if ((inode->ext_depth == 1) && (count > 0)) {
+        int i = mxtl::max(ExtentSearch(ext, count, n), 0);
+        if (static_cast<uint32_t>(i) + 1 < count) {
+            limit = ext[i + 1].start;
+        }
+        if (ext[i].length > kMinfsExtentsPerBlock) {
+            return ERR_IO_DATA_INTEGRITY;
+        }
+        if ((leaf = bc->Get(ext[i].bno)) == nullptr) {
+            return ERR_IO;
+        }
+        count = ext[i].length;
+        ext = static_cast<const minfs_extent_t*>(leaf->data());
+    }
+
+    int i = ExtentSearch(ext, count, n);
+    if ((i >= 0) && (n - ext[i].start < ext[i].length)) {
+        *bno = ext[i].bno + (n - ext[i].start);
+        *run = ext[i].length - (n - ext[i].start);
+    } else {
+        if (static_cast<uint32_t>(i + 1) < count) {
+            limit = ext[i + 1].start;
+        }
+        *bno = 0;
+        *run = limit - n;
+    }
+    if (leaf != nullptr) {
+        bc->Put(mxtl::move(leaf), 0);
+    }
+    return NO_ERROR;
+}
+
+mx_status_t Minfs::BlocksMark(uint32_t bno, uint32_t count, bool allocated) {
+    mxtl::RefPtr<BlockNode> bitmap_blk;
+    const uint32_t start = bno;
+    while (count > 0) {
+        uint32_t run = mxtl::min(count, kMinfsBlockBits - (bno % kMinfsBlockBits));
+        if ((bitmap_blk = BitmapBlockGet(bitmap_blk, bno)) == nullptr) {
+            // Undo the runs already marked, so that the bitmap and the
+            // per-group counts agree with the caller's view of the blocks.
+            if (bno != start) {
+                BlocksMark(start, bno - start, !allocated);
+            }
+            return ERR_IO;
+        }
+        if (allocated) {
+            block_map_.Set(bno, bno + run);
+        } else {
+            block_map_.Clear(bno, bno + run);
+        }
+        for (uint32_t b = bno; b < bno + run;) {
+            uint32_t g = b / kMinfsBlocksPerGroup;
+            uint32_t n = mxtl::min(bno + run, (g + 1) * kMinfsBlocksPerGroup) - b;
+            if (allocated) {
+                group_free_[g] -= mxtl::min(group_free_[g], n);
+            } else {
+                group_free_[g] = mxtl::min(group_free_[g] + n, kMinfsBlocksPerGroup);
+            }
+            b += n;
+        }
+        bno += run;
+        count -= run;
+    }
+    BitmapBlockPut(bitmap_blk);
+    return NO_ERROR;
+}
+
+// Allocate a run of free blocks from the block bitmap, searching from 'hint'
+// first. If no run of 'want' blocks is free, settle for a shorter one.
+mx_status_t Minfs::BlocksNew(uint32_t hint, uint32_t want, uint32_t* out_bno,
+                             uint32_t* out_count) {
+    size_t bitoff_start;
+    uint32_t count = mxtl::max(want, 1u);
+    for (;;) {
+        if ((block_map_.Find(false, hint, block_map_.size(), count, &bitoff_start) == NO_ERROR) ||
+            (block_map_.Find(false, 0, hint, count, &bitoff_start) == NO_ERROR)) {
+            break;
+        }
+        if (count == 1) {
+            return ERR_NO_SPACE;
+        }
+        count /= 2;
+    }
+    uint32_t bno = static_cast<uint32_t>(bitoff_start);
+    assert(bno != 0); // Cannot allocate root block
+
+    mx_status_t status;
+    if ((status = BlocksMark(bno, count, true)) != NO_ERROR) {
+        return status;
+    }
+    *out_bno = bno;
+    *out_count = count;
+    return NO_ERROR;
+}
+
+mx_status_t Minfs::ExtentsFree(minfs_extent_t* ext, uint32_t* count, uint32_t start,
+                               uint32_t* freed) {
+    uint32_t n = *count;
+    mx_status_t status = NO_ERROR;
+    while (n > 0) {
+        minfs_extent_t* e = &ext[n - 1];
+        if (e->start + e->length <= start) {
+            break;
+        }
+        uint32_t keep = (e->start < start) ? start - e->start : 0;
+        if ((status = BlocksMark(e->bno + keep, e->length - keep, false)) != NO_ERROR) {
+            break;
+        }
+        *freed += e->length - keep;
+        if (keep != 0) {
+            e->length = keep;
+            break;
+        }
+        n--;
+    }
+    *count = n;
+    return status;
+}
+
+mx_status_t VnodeMinfs::GetBno(uint32_t n, uint32_t* bno, bool alloc) {
+    uint32_t run;
+    return GetBnoRun(n, 1, alloc, bno, &run);
+}
+
+mx_status_t VnodeMinfs::GetBnoRun(uint32_t n, uint32_t count, bool alloc, uint32_t* bno,
+                                  uint32_t* run) {
+    mx_status_t status;
+    if ((status = minfs_extent_map(fs_->bc_, &inode_, n, bno, run)) != NO_ERROR) {
+        return status;
+    }
+    if ((*bno != 0) || !alloc) {
+        return NO_ERROR;
+    }
+    return ExtentAlloc(n, mxtl::max(mxtl::min(count, *run), 1u), bno, run);
+}
+
+mx_status_t VnodeMinfs::ExtentReserve(uint32_t n) {
+    mx_status_t status;
+    uint32_t count;
+    if (inode_.ext_depth == 0) {
+        if (inode_.ext_count < kMinfsInlineExtents) {
+            return NO_ERROR;
+        }
+        // Move the inline extents out to a leaf, and index it instead.
+        uint32_t lbno;
+        if ((status = fs_->BlocksNew(inode_.ext[0].bno, 1, &lbno, &count)) != NO_ERROR) {
+            return status;
+        }
+        mxtl::RefPtr<BlockNode> leaf;
+        if ((leaf = fs_->bc_->GetZero(lbno)) == nullptr) {
+            fs_->BlocksMark(lbno, 1, false);
+            return ERR_IO;
+        }
+        memcpy(leaf->data(), inode_.ext, inode_.ext_count * sizeof(minfs_extent_t));
+        fs_->bc_->Put(mxtl::move(leaf), kBlockDirty);
+
+        minfs_extent_t index = { inode_.ext[0].start, lbno, inode_.ext_count };
+        memset(inode_.ext, 0, sizeof(inode_.ext));
+        inode_.ext[0] = index;
+        inode_.ext_count = 1;
+        inode_.ext_depth = 1;
+        inode_.block_count++;
+        InodeSync(kMxFsSyncDefault);
+        return NO_ERROR;
+    }
+
+    int i = mxtl::max(ExtentSearch(inode_.ext, inode_.ext_count, n), 0);
+    if (inode_.ext[i].length < kMinfsExtentsPerBlock) {
+        return NO_ERROR;
+    }
+    if (inode_.ext_count == kMinfsInlineExtents) {
+        // The file is too fragmented to map any more extents.
+        return ERR_NO_SPACE;
+    }
+
+    // Split the full leaf, moving its upper half to a new one.
+    uint32_t nbno;
+    if ((status = fs_->BlocksNew(inode_.ext[i].bno, 1, &nbno, &count)) != NO_ERROR) {
+        return status;
+    }
+    mxtl::RefPtr<BlockNode> leaf;
+    mxtl::RefPtr<BlockNode> next;
+    if (((leaf = fs_->bc_->Get(inode_.ext[i].bno)) == nullptr) ||
+        ((next = fs_->bc_->GetZero(nbno)) == nullptr)) {
+        if (leaf != nullptr) {
+            fs_->bc_->Put(mxtl::move(leaf), 0);
+        }
+        fs_->BlocksMark(nbno, 1, false);
+        return ERR_IO;
+    }
+    constexpr uint32_t kKeep = kMinfsExtentsPerBlock / 2;
+    const minfs_extent_t* ext = static_cast<const minfs_extent_t*>(leaf->data());
+    memcpy(next->data(), &ext[kKeep], (kMinfsExtentsPerBlock - kKeep) * sizeof(minfs_extent_t));
+    minfs_extent_t index = { ext[kKeep].start, nbno, kMinfsExtentsPerBlock - kKeep };
+    fs_->bc_->Put(mxtl::move(next), kBlockDirty);
+    fs_->bc_->Put(mxtl::move(leaf), kBlockDirty);
+
+    memmove(&inode_.ext[i + 2], &inode_.ext[i + 1],
+            (inode_.ext_count - i - 1) * sizeof(minfs_extent_t));
+    inode_.ext[i].length = kKeep;
+    inode_.ext[i + 1] = index;
+    inode_.ext_count++;
+    inode_.block_count++;
+    InodeSync(kMxFsSyncDefault);
+    return NO_ERROR;
+}
+
+mx_status_t VnodeMinfs::ExtentAlloc(uint32_t n, uint32_t want, uint32_t* bno, uint32_t* run) {
+    mx_status_t status;
+    if ((status = ExtentReserve(n)) != NO_ERROR) {
+        return status;
+    }
+
+    // Locate the extents among which 'n' falls: inline, or in a leaf.
+    minfs_extent_t* ext = inode_.ext;
+    uint32_t count = inode_.ext_count;
+    int leaf_index = -1;
+    mxtl::RefPtr<BlockNode> leaf;
+    if (inode_.ext_depth != 0) {
+        leaf_index = mxtl::max(ExtentSearch(ext, count, n), 0);
+        if ((leaf = fs_->bc_->Get(ext[leaf_index].bno)) == nullptr) {
+            return ERR_IO;
+        }
+        count = ext[leaf_index].length;
+        ext = static_cast<minfs_extent_t*>(leaf->data());
+    }
+
+    int i = ExtentSearch(ext, count, n);
+    // With nothing before 'n' to stay close to, start in the inode's group.
+    uint32_t hint = fs_->BlockGoal(ino_);
+    uint32_t got = 0;
+    if (i >= 0) {
+        // Prefer growing the preceding extent, when it ends right at 'n' and
+        // the blocks following it on disk are free.
+        minfs_extent_t* prev = &ext[i];
+        uint32_t end = prev->bno + prev->length;
+        hint = end;
+        if ((prev->start + prev->length == n) && (end < fs_->block_map_.size())) {
+            size_t limit = mxtl::min(static_cast<size_t>(end) + want, fs_->block_map_.size());
+            got = static_cast<uint32_t>(fs_->block_map_.Scan(end, limit, false) - end);
+            if (got != 0) {
+                if (fs_->BlocksMark(end, got, true) == NO_ERROR) {
+                    prev->length += got;
+                    *bno = end;
+                } else {
+                    got = 0;
+                }
+            }
+        }
+    }
+    if (got == 0) {
+        if ((status = fs_->BlocksNew(hint, want, bno, &got)) != NO_ERROR) {
+            if (leaf != nullptr) {
+                fs_->bc_->Put(mxtl::move(leaf), 0);
+            }
+            return status;
+        }
+        memmove(&ext[i + 2], &ext[i + 1], (count - i - 1) * sizeof(minfs_extent_t));
+        ext[i + 1].start = n;
+        ext[i + 1].bno = *bno;
+        ext[i + 1].length = got;
+        count++;
+    }
+
+    if (leaf != nullptr) {
+        inode_.ext[leaf_index].start = ext[0].start;
+        inode_.ext[leaf_index].length = count;
+        fs_->bc_->Put(mxtl::move(leaf), kBlockDirty);
+    } else {
+        inode_.ext_count = static_cast<uint16_t>(count);
+    }
+    inode_.block_count += got;
+    InodeSync(kMxFsSyncDefault);
+    *run = got;
+    return NO_ERROR;
+}
+
+// Delete all blocks (relative to a file) from "start" (inclusive) to the end of
+// the file. Does not update mtime/atime.
+mx_status_t VnodeMinfs::BlocksShrink(uint32_t start) {
+    mx_status_t status = NO_ERROR;
+    uint32_t freed = 0;
+    uint32_t count = inode_.ext_count;
+
+    if (inode_.ext_depth == 0) {
+        status = fs_->ExtentsFree(inode_.ext, &count, start, &freed);
+        memset(&inode_.ext[count], 0, (inode_.ext_count - count) * sizeof(minfs_extent_t));
+    } else {
+        while (count > 0) {
+            minfs_extent_t* index = &inode_.ext[count - 1];
+            mxtl::RefPtr<BlockNode> leaf;
+            if ((leaf = fs_->bc_->Get(index->bno)) == nullptr) {
+                status = ERR_IO;
+                break;
+            }
+            uint32_t length = index->length;
+            uint32_t leaf_freed = freed;
+            status = fs_->ExtentsFree(static_cast<minfs_extent_t*>(leaf->data()), &length,
+                                      start, &freed);
+            index->length = length;
+            bool changed = (freed != leaf_freed) && (length != 0);
+            fs_->bc_->Put(mxtl::move(leaf), changed ? kBlockDirty : 0);
+            if ((status != NO_ERROR) || (length != 0)) {
+                break;
+            }
+            // The leaf is empty; release it too.
+            if ((status = fs_->BlocksMark(index->bno, 1, false)) != NO_ERROR) {
+                break;
+            }
+            memset(index, 0, sizeof(*index));
+            inode_.block_count--;
+            count--;
+        }
+        if (count == 0) {
+            inode_.ext_depth = 0;
+        }
+    }
+
+    bool doSync = (freed != 0) || (count != inode_.ext_count);
+    inode_.ext_count = static_cast<uint16_t>(count);
+    inode_.block_count -= freed;
+    if (doSync) {
+        InodeSync(kMxFsSyncDefault);
+    }
+    return status;
+}
+
+mx_status_t VnodeMinfs::PreallocTrim() {
+    if (!prealloc_) {
+        return NO_ERROR;
+    }
+    prealloc_ = false;
+    uint64_t blocks = (static_cast<uint64_t>(inode_.size) + kMinfsBlockSize - 1) / kMinfsBlockSize;
+    return BlocksShrink(static_cast<uint32_t>(blocks));
+}
+
+bool VnodeMinfs::MapsPastEnd() const {
+    if (inode_.ext_count == 0) {
+        return false;
+    } else if (inode_.ext_depth != 0) {
+        return true;
+    }
+    const minfs_extent_t* last = &inode_.ext[inode_.ext_count - 1];
+    uint64_t blocks = (static_cast<uint64_t>(inode_.size) + kMinfsBlockSize - 1) / kMinfsBlockSize;
+    return static_cast<uint64_t>(last->start) + last->length > blocks;
+}
+
+void VnodeMinfs::WriteUnwind(size_t old_size, size_t end) {
+    end = mxtl::max(old_size, end);
+    if (inode_.size > end) {
+        inode_.size = static_cast<uint32_t>(end);
+#ifdef __Fuchsia__
+        mx_vmo_set_size(vmo_, mxtl::roundup(end, kMinfsBlockSize));
+#endif
+    }
+    prealloc_ = true;
+    PreallocTrim();
+}
+
+} // namespace minfs
@@ -214,7 +214,7 @@ int emu_unlink(const char* path) {
     fs::Vnode* vn;
     mx_status_t status = fs::Vfs::Walk(fake_root, &vn, path + PREFIX_SIZE, &path);
     if (status == NO_ERROR) {
-        status = vn->Unlink(path, strlen(path), false);
+        status = fs::Vfs::Unlink(vn, path, strlen(path));
         fs::Vfs::Close(vn);
     }
     STATUS(status);
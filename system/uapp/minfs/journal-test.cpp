@@ -0,0 +1,327 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Crash tests for the metadata journal. Each step runs in its own process,
+// so that a step which "crashes" simply exits, leaving the image exactly as
+// a power loss right after the last journal commit would. The next mount
+// must replay the journal, and fsck must then pass.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "host.h"
+#include "minfs-private.h"
+
+extern minfs::VnodeMinfs* fake_root;
+
+namespace {
+
+constexpr uint32_t kImageBlocks = 8192;  // 64MB
+constexpr size_t kFileSize = 3000;
+
+char image_path[] = "/tmp/minfs-journal-test-XXXXXX";
+
+#define EXPECT(cond) ({ \
+    if (!(cond)) { \
+        printf("%s:%d:error: expected %s\n", __FILE__, __LINE__, #cond); \
+        return -1; \
+    } })
+
+// Runs |fn| in a child process, and returns whether it succeeded.
+bool RunStep(int (*fn)(void)) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        int r = fn();
+        fflush(stdout);
+        _exit(r == 0 ? 0 : 1);
+    }
+    int status;
+    return (pid > 0) && (waitpid(pid, &status, 0) == pid) &&
+           WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+}
+
+int OpenImage(minfs::Bcache** out) {
+    int fd;
+    if ((fd = open(image_path, O_RDWR)) < 0) {
+        return -1;
+    }
+    return minfs::Bcache::Create(out, fd, kImageBlocks, minfs::kMinfsBlockSize,
+                                 minfs::kMinfsBlockCacheSize);
+}
+
+// Mounts the image the way the minfs tool does, replaying the journal.
+int MountImage(minfs::Bcache** out) {
+    if (OpenImage(out) < 0) {
+        return -1;
+    }
+    minfs::VnodeMinfs* vn;
+    if (minfs_mount(&vn, *out) < 0) {
+        return -1;
+    }
+    EXPECT((*out)->HasJournal());
+    (*out)->SetWriteback(true);
+    fake_root = vn;
+    return 0;
+}
+
+// Leaves the next flush committed to the journal but not written in place,
+// and stops as if the system went down right then.
+int Crash(minfs::Bcache* bc) {
+    bc->SimulateCrashAfterCommit();
+    EXPECT(bc->Sync() == 0);
+    fflush(stdout);
+    _exit(0);
+}
+
+int CreateFile(const char* path) {
+    uint8_t data[kFileSize];
+    for (size_t n = 0; n < sizeof(data); n++) {
+        data[n] = static_cast<uint8_t>(n * 7 + strlen(path));
+    }
+    int fd;
+    EXPECT((fd = emu_open(path, O_RDWR | O_CREAT | O_EXCL, 0644)) >= 0);
+    EXPECT(emu_write(fd, data, sizeof(data)) == sizeof(data));
+    EXPECT(emu_close(fd) == 0);
+    return 0;
+}
+
+int CheckFile(const char* path) {
+    uint8_t data[kFileSize];
+    int fd;
+    EXPECT((fd = emu_open(path, O_RDONLY, 0)) >= 0);
+    EXPECT(emu_read(fd, data, sizeof(data)) == sizeof(data));
+    EXPECT(emu_close(fd) == 0);
+    for (size_t n = 0; n < sizeof(data); n++) {
+        EXPECT(data[n] == static_cast<uint8_t>(n * 7 + strlen(path)));
+    }
+    return 0;
+}
+
+bool Exists(const char* path) {
+    struct stat s;
+    return emu_stat(path, &s) == 0;
+}
+
+// Reads the journal's info block straight from the image.
+int ReadJournalInfo(minfs::minfs_journal_info_t* out, uint32_t* jnl_block,
+                    uint32_t* jnl_blocks) {
+    int fd;
+    EXPECT((fd = open(image_path, O_RDONLY)) >= 0);
+    uint8_t data[minfs::kMinfsBlockSize];
+    EXPECT(pread(fd, data, sizeof(data), 0) == sizeof(data));
+    auto info = reinterpret_cast<minfs::minfs_info_t*>(data);
+    *jnl_block = info->jnl_block;
+    *jnl_blocks = info->jnl_blocks;
+    EXPECT(pread(fd, data, sizeof(data), (off_t)*jnl_block * minfs::kMinfsBlockSize) ==
+           sizeof(data));
+    memcpy(out, data, sizeof(*out));
+    close(fd);
+    return 0;
+}
+
+// Returns the number of committed transactions a mount would replay.
+int PendingTxns() {
+    minfs::minfs_journal_info_t jinfo;
+    uint32_t jnl_block, jnl_blocks;
+    if (ReadJournalInfo(&jinfo, &jnl_block, &jnl_blocks) < 0) {
+        return -1;
+    }
+    minfs::Bcache* bc;
+    if (OpenImage(&bc) < 0) {
+        return -1;
+    }
+    mxtl::unique_ptr<minfs::Journal> journal;
+    uint32_t count;
+    int txns = -1;
+    if ((minfs::Journal::Create(&journal, bc, jnl_block, jnl_blocks) == NO_ERROR) &&
+        (journal->Replay(false, false, &count) == NO_ERROR)) {
+        txns = count;
+    }
+    bc->Close();
+    delete bc;
+    return txns;
+}
+
+int Mkfs() {
+    minfs::Bcache* bc;
+    EXPECT(OpenImage(&bc) == 0);
+    EXPECT(minfs::minfs_mkfs(bc) == 0);
+    return bc->Close();
+}
+
+int Fsck() {
+    minfs::Bcache* bc;
+    EXPECT(OpenImage(&bc) == 0);
+    EXPECT(minfs::minfs_check(bc) == NO_ERROR);
+    return bc->Close();
+}
+
+// Replay: a committed transaction which never went in place comes back.
+
+int ReplayCrash() {
+    minfs::Bcache* bc;
+    EXPECT(MountImage(&bc) == 0);
+    EXPECT(emu_mkdir("::a", 0755) == 0);
+    EXPECT(CreateFile("::a/f1") == 0);
+    EXPECT(bc->Sync() == 0);
+    EXPECT(CreateFile("::a/f2") == 0);
+    return Crash(bc);
+}
+
+int ReplayCheck() {
+    minfs::Bcache* bc;
+    EXPECT(MountImage(&bc) == 0);
+    EXPECT(CheckFile("::a/f1") == 0);
+    EXPECT(CheckFile("::a/f2") == 0);
+    return bc->Close();
+}
+
+bool TestReplay() {
+    return RunStep(Mkfs) && RunStep(ReplayCrash) && (PendingTxns() == 1) &&
+           RunStep(ReplayCheck) && (PendingTxns() == 0) && RunStep(Fsck);
+}
+
+// Torn commit: a transaction whose commit block does not match is as if it
+// was never written.
+
+int TornCrash() {
+    minfs::Bcache* bc;
+    EXPECT(MountImage(&bc) == 0);
+    EXPECT(emu_mkdir("::a", 0755) == 0);
+    EXPECT(bc->Sync() == 0);
+    EXPECT(emu_mkdir("::b", 0755) == 0);
+    return Crash(bc);
+}
+
+int TearCommit() {
+    minfs::minfs_journal_info_t jinfo;
+    uint32_t jnl_block, jnl_blocks;
+    EXPECT(ReadJournalInfo(&jinfo, &jnl_block, &jnl_blocks) == 0);
+
+    int fd;
+    EXPECT((fd = open(image_path, O_RDWR)) >= 0);
+    uint8_t data[minfs::kMinfsBlockSize];
+    off_t off = (off_t)(jnl_block + jinfo.start) * minfs::kMinfsBlockSize;
+    EXPECT(pread(fd, data, sizeof(data), off) == sizeof(data));
+    auto header = reinterpret_cast<minfs::minfs_journal_header_t*>(data);
+    EXPECT(header->magic == minfs::kMinfsJournalHeaderMagic);
+    off += (off_t)(header->count + 1) * minfs::kMinfsBlockSize;
+    EXPECT(pread(fd, data, sizeof(data), off) == sizeof(data));
+    auto commit = reinterpret_cast<minfs::minfs_journal_commit_t*>(data);
+    EXPECT(commit->magic == minfs::kMinfsJournalCommitMagic);
+    commit->checksum ^= 1;
+    EXPECT(pwrite(fd, data, sizeof(data), off) == sizeof(data));
+    close(fd);
+    return 0;
+}
+
+int TornCheck() {
+    minfs::Bcache* bc;
+    EXPECT(MountImage(&bc) == 0);
+    EXPECT(Exists("::a"));
+    EXPECT(!Exists("::b"));
+    return bc->Close();
+}
+
+bool TestTornCommit() {
+    return RunStep(Mkfs) && RunStep(TornCrash) && (PendingTxns() == 1) &&
+           (TearCommit() == 0) && (PendingTxns() == 0) && RunStep(TornCheck) &&
+           RunStep(Fsck);
+}
+
+// Wrap-around: a transaction which does not fit before the end of the journal
+// is written at its front instead, and is still found by replay.
+
+constexpr uint32_t kWrapDirs = 16;
+
+int WrapCrash() {
+    minfs::Bcache* bc;
+    EXPECT(MountImage(&bc) == 0);
+    EXPECT(emu_mkdir("::w", 0755) == 0);
+    EXPECT(bc->Sync() == 0);
+
+    // Commit small transactions until fewer blocks are left at the end of
+    // the journal than the last one will need.
+    char path[64];
+    minfs::minfs_journal_info_t jinfo;
+    uint32_t jnl_block, jnl_blocks;
+    for (uint32_t n = 0;; n++) {
+        EXPECT(n < 1000);
+        snprintf(path, sizeof(path), "::w/f%u", n);
+        EXPECT(CreateFile(path) == 0);
+        EXPECT(bc->Sync() == 0);
+        EXPECT(ReadJournalInfo(&jinfo, &jnl_block, &jnl_blocks) == 0);
+        if ((jinfo.start > 1) && (jnl_blocks - jinfo.start <= kWrapDirs + 4)) {
+            break;
+        }
+    }
+
+    // Each new directory dirties a block of its own.
+    for (uint32_t n = 0; n < kWrapDirs; n++) {
+        snprintf(path, sizeof(path), "::d%u", n);
+        EXPECT(emu_mkdir(path, 0755) == 0);
+    }
+    return Crash(bc);
+}
+
+int WrapCheck() {
+    minfs::minfs_journal_info_t jinfo;
+    uint32_t jnl_block, jnl_blocks;
+    EXPECT(ReadJournalInfo(&jinfo, &jnl_block, &jnl_blocks) == 0);
+    EXPECT(jinfo.start == 1);
+
+    minfs::Bcache* bc;
+    EXPECT(MountImage(&bc) == 0);
+    char path[64];
+    for (uint32_t n = 0; n < kWrapDirs; n++) {
+        snprintf(path, sizeof(path), "::d%u", n);
+        EXPECT(Exists(path));
+    }
+    EXPECT(CheckFile("::w/f0") == 0);
+    return bc->Close();
+}
+
+bool TestWrap() {
+    return RunStep(Mkfs) && RunStep(WrapCrash) && (PendingTxns() == 1) &&
+           RunStep(WrapCheck) && RunStep(Fsck);
+}
+
+} // namespace anonymous
+
+int main(int argc, char** argv) {
+    int fd;
+    if ((fd = mkstemp(image_path)) < 0) {
+        fprintf(stderr, "error: cannot create image\n");
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)kImageBlocks * minfs::kMinfsBlockSize) < 0) {
+        fprintf(stderr, "error: cannot size image\n");
+        unlink(image_path);
+        return -1;
+    }
+    close(fd);
+
+    struct {
+        const char* name;
+        bool (*func)(void);
+    } tests[] = {
+        {"replay", TestReplay},
+        {"torn commit", TestTornCommit},
+        {"wrap-around", TestWrap},
+    };
+    int failed = 0;
+    for (unsigned n = 0; n < countof(tests); n++) {
+        bool ok = tests[n].func();
+        printf("journal: %s: %s\n", tests[n].name, ok ? "PASSED" : "FAILED");
+        failed += ok ? 0 : 1;
+    }
+    unlink(image_path);
+    return failed ? -1 : 0;
+}
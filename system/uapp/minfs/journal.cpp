@@ -0,0 +1,231 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <fs/trace.h>
+#include <magenta/new.h>
+#include <mxtl/unique_ptr.h>
+
+#include "minfs.h"
+#include "minfs-private.h"
+
+namespace minfs {
+
+// Blocks in a transaction besides its images: the header and commit block.
+constexpr uint32_t kTxnOverhead = 2;
+
+Journal::Journal(Bcache* bc, uint32_t start, uint32_t blocks) :
+    bc_(bc), start_(start), blocks_(blocks), seq_(0), head_(1) {}
+
+mx_status_t Journal::Create(mxtl::unique_ptr<Journal>* out, Bcache* bc,
+                            uint32_t start, uint32_t blocks) {
+    AllocChecker ac;
+    mxtl::unique_ptr<Journal> journal(new (&ac) Journal(bc, start, blocks));
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    // A flush commits at most every block in the cache.
+    journal->buf_.reset(new (&ac) uint8_t[(kMinfsBlockCacheSize + kTxnOverhead) *
+                                          kMinfsBlockSize]);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+
+    mx_status_t status;
+    auto info = reinterpret_cast<minfs_journal_info_t*>(journal->buf_.get());
+    if ((status = bc->DevRead(start, 1, info)) != NO_ERROR) {
+        return status;
+    }
+    if ((info->magic != kMinfsJournalMagic) || (info->start == 0) ||
+        (info->start >= blocks)) {
+        error("minfs: bad journal info block\n");
+        return ERR_IO;
+    }
+    journal->seq_ = info->seq;
+    journal->head_ = info->start;
+    *out = mxtl::move(journal);
+    return NO_ERROR;
+}
+
+mx_status_t Journal::Format(Bcache* bc, uint32_t start, uint32_t blocks) {
+    if (blocks < 2) {
+        return ERR_INVALID_ARGS;
+    }
+    uint8_t data[kMinfsBlockSize];
+    memset(data, 0, sizeof(data));
+    auto info = reinterpret_cast<minfs_journal_info_t*>(data);
+    info->magic = kMinfsJournalMagic;
+    info->seq = 1;
+    info->start = 1;
+    if (bc->Writeblk(start, data) != NO_ERROR) {
+        return ERR_IO;
+    }
+    // Nothing left on the device may pass for the first transaction.
+    memset(data, 0, sizeof(data));
+    return bc->Writeblk(start + 1, data);
+}
+
+mx_status_t Journal::WriteInfo(uint64_t seq, uint32_t start) {
+    uint8_t data[kMinfsBlockSize];
+    memset(data, 0, sizeof(data));
+    auto info = reinterpret_cast<minfs_journal_info_t*>(data);
+    info->magic = kMinfsJournalMagic;
+    info->seq = seq;
+    info->start = start;
+    return bc_->DevWrite(start_, 1, data);
+}
+
+mx_status_t Journal::Commit(BlockNode* const* blocks, uint32_t count) {
+    assert(count <= kMinfsBlockCacheSize);
+    uint32_t len = count + kTxnOverhead;
+    mx_status_t status;
+    if (head_ + len > blocks_) {
+        // Start over at the front of the journal. The info block must say
+        // so before the old transactions there are overwritten, which is
+        // only safe once every one of them is in place.
+        if (!in_place_) {
+            error("minfs: journal is full of transactions not yet in place\n");
+            return ERR_IO;
+        }
+        if ((status = WriteInfo(seq_, 1)) != NO_ERROR) {
+            return status;
+        }
+        if ((status = bc_->DevSync()) != NO_ERROR) {
+            return status;
+        }
+        head_ = 1;
+    }
+
+    uint8_t* buf = buf_.get();
+    auto header = reinterpret_cast<minfs_journal_header_t*>(buf);
+    memset(header, 0, kMinfsBlockSize);
+    header->magic = kMinfsJournalHeaderMagic;
+    header->seq = seq_;
+    header->count = count;
+    for (uint32_t n = 0; n < count; n++) {
+        header->bno[n] = blocks[n]->GetKey();
+        memcpy(buf + (n + 1) * kMinfsBlockSize, blocks[n]->data(), kMinfsBlockSize);
+    }
+    auto commit = reinterpret_cast<minfs_journal_commit_t*>(buf + (count + 1) * kMinfsBlockSize);
+    memset(commit, 0, kMinfsBlockSize);
+    commit->magic = kMinfsJournalCommitMagic;
+    commit->seq = seq_;
+    commit->count = count;
+    commit->checksum = fnv1a32(buf, (count + 1) * kMinfsBlockSize);
+
+    if ((status = bc_->DevWrite(start_ + head_, len, buf)) != NO_ERROR) {
+        return status;
+    }
+    if ((status = bc_->DevSync()) != NO_ERROR) {
+        return status;
+    }
+    trace(IO, "journal: committed txn %" PRIu64 " (%u blocks) at %u\n", seq_, count, head_);
+    head_ += len;
+    seq_++;
+    in_place_ = false;
+    return NO_ERROR;
+}
+
+mx_status_t Journal::Checkpoint() {
+    // The in-place writes must be durable before the journal forgets them.
+    mx_status_t status;
+    if ((status = bc_->DevSync()) != NO_ERROR) {
+        return status;
+    }
+    if (head_ + kTxnOverhead >= blocks_) {
+        head_ = 1;
+    }
+    if ((status = WriteInfo(seq_, head_)) != NO_ERROR) {
+        return status;
+    }
+    in_place_ = true;
+    return NO_ERROR;
+}
+
+mx_status_t Journal::Replay(bool apply, bool verbose, uint32_t* txns_out) {
+    uint8_t* buf = buf_.get();
+    auto header = reinterpret_cast<minfs_journal_header_t*>(buf);
+    uint64_t seq = seq_;
+    uint32_t off = head_;
+    uint32_t txns = 0;
+    mx_status_t status;
+
+    while (off + kTxnOverhead <= blocks_) {
+        if ((status = bc_->DevRead(start_ + off, 1, buf)) != NO_ERROR) {
+            return status;
+        }
+        if ((header->magic != kMinfsJournalHeaderMagic) || (header->seq != seq)) {
+            break;
+        }
+        uint32_t count = header->count;
+        if ((count > kMinfsBlockCacheSize) || (off + count + kTxnOverhead > blocks_)) {
+            error("minfs: journal transaction %" PRIu64 " has a bad header\n", seq);
+            break;
+        }
+        if ((status = bc_->DevRead(start_ + off + 1, count + 1,
+                                   buf + kMinfsBlockSize)) != NO_ERROR) {
+            return status;
+        }
+        auto commit = reinterpret_cast<minfs_journal_commit_t*>(buf + (count + 1) *
+                                                                kMinfsBlockSize);
+        if ((commit->magic != kMinfsJournalCommitMagic) || (commit->seq != seq) ||
+            (commit->count != count) ||
+            (commit->checksum != fnv1a32(buf, (count + 1) * kMinfsBlockSize))) {
+            // Torn write: the transaction never committed.
+            if (verbose) {
+                printf("journal: transaction %" PRIu64 " at %u is incomplete; ignored\n",
+                       seq, off);
+            }
+            break;
+        }
+        for (uint32_t n = 0; n < count; n++) {
+            uint32_t bno = header->bno[n];
+            if ((bno == 0) || (bno >= bc_->Maxblk()) ||
+                ((bno >= start_) && (bno < start_ + blocks_))) {
+                error("minfs: journal transaction %" PRIu64 " targets bad block %u\n",
+                      seq, bno);
+                return ERR_IO;
+            }
+        }
+        if (verbose) {
+            printf("journal: transaction %" PRIu64 " at %u: %u blocks\n", seq, off, count);
+        }
+
+        if (apply) {
+            // Images are sorted by home location; write contiguous runs at once.
+            for (uint32_t n = 0; n < count;) {
+                uint32_t run = 1;
+                while ((n + run < count) && (header->bno[n + run] == header->bno[n] + run)) {
+                    run++;
+                }
+                if ((status = bc_->DevWrite(header->bno[n], run,
+                                            buf + (n + 1) * kMinfsBlockSize)) != NO_ERROR) {
+                    return status;
+                }
+                n += run;
+            }
+        }
+        txns++;
+        seq++;
+        off += count + kTxnOverhead;
+    }
+
+    if (apply) {
+        if ((status = bc_->DevSync()) != NO_ERROR) {
+            return status;
+        }
+        seq_ = seq;
+        head_ = 1;
+        if ((status = WriteInfo(seq_, head_)) != NO_ERROR) {
+            return status;
+        }
+    }
+    *txns_out = txns;
+    return NO_ERROR;
+}
+
+} // namespace minfs
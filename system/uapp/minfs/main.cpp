@@ -39,25 +39,66 @@ int do_minfs_check(minfs::Bcache* bc, int argc, char** argv) {
 }
 
 #ifdef __Fuchsia__
+bool writethrough = false;
+
 int do_minfs_mount(minfs::Bcache* bc, int argc, char** argv) {
     minfs::VnodeMinfs* vn = 0;
     if (minfs_mount(&vn, bc) < 0) {
         return -1;
     }
+    // Without a journal, deferred writes could leave the volume
+    // inconsistent after a crash.
+    if (!writethrough && bc->HasJournal()) {
+        bc->SetWriteback(true);
+    }
     vfs_rpc_server(vn);
     return 0;
 }
 #else
+bool crash_after_commit = false;
+
 int io_setup(minfs::Bcache* bc) {
     minfs::VnodeMinfs* vn = 0;
     if (minfs_mount(&vn, bc) < 0) {
         return -1;
     }
+    if (bc->HasJournal()) {
+        bc->SetWriteback(true);
+    }
     fake_root = vn;
     the_block_cache = bc;
     return 0;
 }
 
+int do_journal(minfs::Bcache* bc, int argc, char** argv) {
+    minfs::minfs_info_t info;
+    if (bc->Read(0, &info, 0, sizeof(info)) < 0) {
+        fprintf(stderr, "error: could not read info block\n");
+        return -1;
+    }
+    if (minfs_check_info(&info, bc->Maxblk()) < 0) {
+        return -1;
+    }
+    if (info.jnl_blocks == 0) {
+        fprintf(stderr, "minfs: filesystem has no journal\n");
+        return -1;
+    }
+    mxtl::unique_ptr<minfs::Journal> journal;
+    uint32_t txns;
+    if ((minfs::Journal::Create(&journal, bc, info.jnl_block, info.jnl_blocks) < 0) ||
+        (journal->Replay(false, true, &txns) < 0)) {
+        fprintf(stderr, "error: journal is corrupt\n");
+        return -1;
+    }
+    printf("journal: %u transaction(s) to replay\n", txns);
+    return 0;
+}
+
+int do_replay(minfs::Bcache* bc, int argc, char** argv) {
+    // Mounting replays the journal.
+    return io_setup(bc);
+}
+
 int do_minfs_test(minfs::Bcache* bc, int argc, char** argv) {
     if (io_setup(bc)) {
         return -1;
@@ -222,6 +263,12 @@ int do_minfs_mkfs(minfs::Bcache* bc, int argc, char** argv) {
     return minfs_mkfs(bc);
 }
 
+#ifndef __Fuchsia__
+int do_minfs_convert(minfs::Bcache* bc, int argc, char** argv) {
+    return minfs_convert(bc);
+}
+#endif
+
 struct {
     const char* name;
     int (*func)(minfs::Bcache* bc, int argc, char** argv);
@@ -243,6 +290,9 @@ struct {
     {"mv", do_rename, O_RDWR, "rename file or directory"},
     {"rename", do_rename, O_RDWR, "rename file or directory"},
     {"ls", do_ls, O_RDWR, "list content of directory"},
+    {"journal", do_journal, O_RDONLY, "list journal transactions to replay"},
+    {"replay", do_replay, O_RDWR, "replay the journal"},
+    {"convert", do_minfs_convert, O_RDWR, "convert to the current format"},
 #endif
 };
 
@@ -253,6 +303,10 @@ int usage() {
             "options:  -v         some debug messages\n"
             "          -vv        all debug messages\n"
 #ifdef __Fuchsia__
+            "          --writethrough  write each modified block to disk immediately\n"
+#else
+            "          --crash-after-commit  exit without writing the last\n"
+            "                     journal transaction in place\n"
             "\n"
             "On Fuchsia, MinFS takes the block device argument by handle.\n"
             "This can make 'minfs' commands hard to invoke from command line.\n"
@@ -287,6 +341,13 @@ int main(int argc, char** argv) {
             trace_on(TRACE_SOME);
         } else if (!strcmp(argv[1], "-vv")) {
             trace_on(TRACE_ALL);
+#ifdef __Fuchsia__
+        } else if (!strcmp(argv[1], "--writethrough")) {
+            writethrough = true;
+#else
+        } else if (!strcmp(argv[1], "--crash-after-commit")) {
+            crash_after_commit = true;
+#endif
         } else {
             break;
         }
@@ -377,7 +438,17 @@ found:
 
     for (unsigned i = 0; i < countof(CMDS); i++) {
         if (!strcmp(cmd, CMDS[i].name)) {
+#ifdef __Fuchsia__
             return CMDS[i].func(bc, argc - 3, argv + 3);
+#else
+            int r = CMDS[i].func(bc, argc - 3, argv + 3);
+            // Write back whatever the command left in the cache.
+            if (crash_after_commit) {
+                bc->SimulateCrashAfterCommit();
+            }
+            bc->Close();
+            return r;
+#endif
         }
     }
     return -1;
@@ -7,6 +7,10 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <magenta/new.h>
+#include <mxtl/algorithm.h>
+#include <mxtl/unique_ptr.h>
+
 #include "minfs.h"
 #include "minfs-private.h"
 
@@ -37,31 +41,8 @@ mx_status_t get_inode(const Minfs* fs, minfs_inode_t* inode, uint32_t ino) {
 
 mx_status_t get_inode_nth_bno(const Minfs* fs, minfs_inode_t* inode, uint32_t n,
                               uint32_t* bno_out) {
-    if (n < kMinfsDirect) {
-        *bno_out = inode->dnum[n];
-        return NO_ERROR;
-    }
-    n -= kMinfsDirect;
-    uint32_t i = static_cast<uint32_t>(n / (kMinfsBlockSize / sizeof(uint32_t)));
-    uint32_t j = n % (kMinfsBlockSize / sizeof(uint32_t));
-
-    if (i >= kMinfsIndirect) {
-        return ERR_OUT_OF_RANGE;
-    }
-
-    uint32_t ibno;
-    if ((ibno = inode->inum[i]) == 0) {
-        *bno_out = 0;
-        return NO_ERROR;
-    }
-    mxtl::RefPtr<BlockNode> iblk;
-    if ((iblk = fs->bc_->Get(ibno)) == nullptr) {
-        return ERR_NOT_FOUND;
-    }
-    uint32_t* ientry = static_cast<uint32_t*>(iblk->data());
-    *bno_out = ientry[j];
-    fs->bc_->Put(mxtl::move(iblk), 0);
-    return NO_ERROR;
+    uint32_t run;
+    return minfs_extent_map(fs->bc_, inode, n, bno_out, &run);
 }
 
 // Convert 'single-block-reads' to generic reads, which may cross block
@@ -149,6 +130,28 @@ mx_status_t file_write(const Minfs* fs, minfs_inode_t* inode, const void* data,
     return static_cast<mx_status_t>((uintptr_t) data - (uintptr_t) start);
 }
 
+// Reads the directory index of 'inode', if it has a sane one.
+mx_status_t read_dir_index(const Minfs* fs, minfs_inode_t* inode, uint32_t ino,
+                           mxtl::unique_ptr<minfs_dir_slot_t[]>* out) {
+    uint32_t blocks = inode->dir_index_blocks;
+    if ((blocks == 0) || (blocks & (blocks - 1))) {
+        error("check: ino#%u: bad directory index length %u\n", ino, blocks);
+        return ERR_IO_DATA_INTEGRITY;
+    }
+    AllocChecker ac;
+    mxtl::unique_ptr<minfs_dir_slot_t[]> slots(
+        new (&ac) minfs_dir_slot_t[blocks * kMinfsDirSlotsPerBlock]);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    mx_status_t status;
+    if ((status = fs->bc_->Readblks(inode->dir_index, blocks, slots.get())) != NO_ERROR) {
+        return status;
+    }
+    *out = mxtl::move(slots);
+    return NO_ERROR;
+}
+
 mx_status_t check_directory(CheckMaps* chk, const Minfs* fs, minfs_inode_t* inode,
                             uint32_t ino, uint32_t parent, uint32_t flags) {
     unsigned eno = 0;
@@ -156,6 +159,15 @@ mx_status_t check_directory(CheckMaps* chk, const Minfs* fs, minfs_inode_t* inod
     bool dotdot = false;
     uint32_t dirent_count = 0;
 
+    // Every dirent but "." and ".." must be found in the directory index.
+    mxtl::unique_ptr<minfs_dir_slot_t[]> index;
+    uint32_t index_mask = 0;
+    uint32_t indexed = 0;
+    if ((inode->dir_index != 0) && (flags & CD_DUMP) &&
+        (read_dir_index(fs, inode, ino, &index) == NO_ERROR)) {
+        index_mask = inode->dir_index_blocks * kMinfsDirSlotsPerBlock - 1;
+    }
+
     size_t prev_off = 0;
     size_t off = 0;
     while (true) {
@@ -237,6 +249,22 @@ mx_status_t check_directory(CheckMaps* chk, const Minfs* fs, minfs_inode_t* inod
                     error("check: ino#%u: de[%u]: '..' ino=%u (not parent!)\n", ino, eno, de->ino);
                 }
             }
+            bool is_dot = ((de->namelen == 1) && (de->name[0] == '.')) ||
+                          ((de->namelen == 2) && (de->name[0] == '.') && (de->name[1] == '.'));
+            if ((index != nullptr) && !is_dot) {
+                uint32_t hash = fnv1a32(de->name, de->namelen);
+                uint32_t n = hash & index_mask;
+                while ((index[n].off != 0) &&
+                       ((index[n].hash != hash) || (index[n].off != off))) {
+                    n = (n + 1) & index_mask;
+                }
+                if (index[n].off == 0) {
+                    error("check: ino#%u: de[%u]: '%.*s' missing from directory index\n",
+                          ino, eno, de->namelen, de->name);
+                } else {
+                    indexed++;
+                }
+            }
             //TODO: check for cycles (non-dot/dotdot dir ref already in checked bitmap)
             if (flags & CD_DUMP) {
                 info("ino#%u: de[%u]: ino=%u type=%u '%.*s' %s\n",
@@ -261,6 +289,18 @@ mx_status_t check_directory(CheckMaps* chk, const Minfs* fs, minfs_inode_t* inod
         error("check: ino#%u: dirent_count of %u != %u (actual)\n",
               ino, inode->dirent_count, dirent_count);
     }
+    if (index != nullptr) {
+        uint32_t used = 0;
+        for (uint32_t n = 0; n <= index_mask; n++) {
+            if (index[n].off != 0) {
+                used++;
+            }
+        }
+        if (used != indexed) {
+            error("check: ino#%u: directory index has %u entries, %u expected\n",
+                  ino, used, indexed);
+        }
+    }
     if (dot == false) {
         error("check: ino#%u: directory missing '.'\n", ino);
     }
@@ -287,56 +327,101 @@ const char* check_data_block(CheckMaps* chk, const Minfs* fs, uint32_t bno) {
     return nullptr;
 }
 
+// Checks the sorted extents 'ext', counting their blocks into 'blocks' and
+// advancing 'next' past the last logical block they map.
+void check_extents(CheckMaps* chk, const Minfs* fs, uint32_t ino, const minfs_extent_t* ext,
+                   uint32_t count, uint32_t* blocks, uint32_t* next) {
+    for (uint32_t n = 0; n < count; n++) {
+        const minfs_extent_t& e = ext[n];
+        info(" [%u,+%u)@%u,", e.start, e.length, e.bno);
+        if ((e.length == 0) || (e.start < *next) ||
+            (e.length > kMinfsMaxFileBlock - e.start)) {
+            warn("check: ino#%u: bad extent [%u,+%u)@%u\n", ino, e.start, e.length, e.bno);
+            continue;
+        }
+        for (uint32_t b = 0; b < e.length; b++) {
+            const char* msg;
+            if ((msg = check_data_block(chk, fs, e.bno + b)) != nullptr) {
+                warn("check: ino#%u: block %u(@%u): %s\n", ino, e.start + b, e.bno + b, msg);
+            }
+        }
+        if (e.bno != chk->file_frag_end) {
+            chk->file_fragments++;
+        }
+        chk->file_frag_end = e.bno + e.length;
+        *blocks += e.length;
+        *next = e.start + e.length;
+    }
+}
+
 mx_status_t check_file(CheckMaps* chk, const Minfs* fs,
                        minfs_inode_t* inode, uint32_t ino) {
-    info("Direct blocks: \n");
-    for (unsigned n = 0; n < kMinfsDirect; n++) {
-        info(" %d,", inode->dnum[n]);
+    if ((inode->ext_depth > 1) || (inode->ext_count > kMinfsInlineExtents)) {
+        warn("check: ino#%u: bad extent tree (depth %u, count %u)\n",
+             ino, inode->ext_depth, inode->ext_count);
+        return NO_ERROR;
     }
-    info(" ...\n");
 
+    info("Extents: \n");
     uint32_t blocks = 0;
-
-    // count and sanity-check indirect blocks
-    for (unsigned n = 0; n < kMinfsIndirect; n++) {
-        if (inode->inum[n]) {
+    uint32_t max = 0;
+    chk->file_fragments = 0;
+    chk->file_frag_end = 0;
+    if (inode->ext_depth == 0) {
+        check_extents(chk, fs, ino, inode->ext, inode->ext_count, &blocks, &max);
+    } else {
+        // count and sanity-check extent leaf blocks
+        for (unsigned n = 0; n < inode->ext_count; n++) {
+            const minfs_extent_t& index = inode->ext[n];
             const char* msg;
-            if ((msg = check_data_block(chk, fs, inode->inum[n])) != nullptr) {
-                warn("check: ino#%u: indirect block %u(@%u): %s\n",
-                     ino, n, inode->inum[n], msg);
+            if ((msg = check_data_block(chk, fs, index.bno)) != nullptr) {
+                warn("check: ino#%u: extent leaf %u(@%u): %s\n", ino, n, index.bno, msg);
+                continue;
             }
             blocks++;
+            if ((index.length == 0) || (index.length > kMinfsExtentsPerBlock)) {
+                warn("check: ino#%u: extent leaf %u(@%u): bad length %u\n",
+                     ino, n, index.bno, index.length);
+                continue;
+            }
+            mxtl::RefPtr<BlockNode> leaf;
+            if ((leaf = fs->bc_->Get(index.bno)) == nullptr) {
+                return ERR_IO;
+            }
+            auto ext = static_cast<const minfs_extent_t*>(leaf->data());
+            if (ext[0].start != index.start) {
+                warn("check: ino#%u: extent leaf %u(@%u): index start %u, leaf start %u\n",
+                     ino, n, index.bno, index.start, ext[0].start);
+            }
+            check_extents(chk, fs, ino, ext, index.length, &blocks, &max);
+            fs->bc_->Put(mxtl::move(leaf), 0);
         }
     }
-
-    // count and sanity-check data blocks
-
-    unsigned max = 0;
-    for (unsigned n = 0;;n++) {
-        mx_status_t status;
-        uint32_t bno;
-        if ((status = get_inode_nth_bno(fs, inode, n, &bno)) < 0) {
-            if (status == ERR_OUT_OF_RANGE) {
-                break;
-            } else {
-                return status;
-            }
+    info(" ...\n");
+    if (chk->file_fragments != 0) {
+        chk->files++;
+        chk->fragments += chk->file_fragments;
+        if (chk->file_fragments > 1) {
+            chk->fragmented_files++;
         }
-        if (bno) {
-            blocks++;
+        chk->max_fragments = mxtl::max(chk->max_fragments, chk->file_fragments);
+    }
+
+    if ((inode->magic == kMinfsMagicDir) && (inode->dir_index != 0)) {
+        for (uint32_t n = 0; n < inode->dir_index_blocks; n++) {
             const char* msg;
-            if ((msg = check_data_block(chk, fs, bno)) != nullptr) {
-                warn("check: ino#%u: block %u(@%u): %s\n", ino, n, bno, msg);
+            if ((msg = check_data_block(chk, fs, inode->dir_index + n)) != nullptr) {
+                warn("check: ino#%u: directory index block %u(@%u): %s\n",
+                     ino, n, inode->dir_index + n, msg);
             }
-            max = n + 1;
         }
+        blocks += inode->dir_index_blocks;
     }
+
     if (max) {
         unsigned sizeblocks = inode->size / kMinfsBlockSize;
         if (sizeblocks > max) {
             warn("check: ino#%u: filesize too large\n", ino);
-        } else if (sizeblocks < (max - 1)) {
-            warn("check: ino#%u: filesize too small\n", ino);
         }
     } else {
         if (inode->size) {
@@ -350,6 +435,41 @@ mx_status_t check_file(CheckMaps* chk, const Minfs* fs,
     return NO_ERROR;
 }
 
+#ifndef __Fuchsia__
+// Reports how fragmented the files and the free space of the volume are.
+void check_report_fragmentation(const CheckMaps* chk, const Minfs* fs) {
+    printf("fragmentation: %u file%s in %u fragment%s (%u.%02u per file), %u fragmented,"
+           " at most %u in one\n",
+           chk->files, chk->files == 1 ? "" : "s", chk->fragments, chk->fragments == 1 ? "" : "s",
+           chk->files ? chk->fragments / chk->files : 0,
+           chk->files ? (chk->fragments % chk->files) * 100 / chk->files : 0,
+           chk->fragmented_files, chk->max_fragments);
+
+    // Free runs by length: 1, 2-7, 8-63, 64-511, and 512 blocks or more.
+    constexpr uint32_t kBucketLimits[] = {2, 8, 64, 512};
+    uint32_t runs[countof(kBucketLimits) + 1] = {};
+    uint32_t free = 0;
+    uint32_t largest = 0;
+    size_t end = fs->info_.block_count;
+    size_t n = fs->info_.dat_block;
+    while ((n = fs->block_map_.Scan(n, end, true)) < end) {
+        size_t run_end = fs->block_map_.Scan(n, end, false);
+        uint32_t len = static_cast<uint32_t>(run_end - n);
+        uint32_t bucket = 0;
+        while ((bucket < countof(kBucketLimits)) && (len >= kBucketLimits[bucket])) {
+            bucket++;
+        }
+        runs[bucket]++;
+        free += len;
+        largest = mxtl::max(largest, len);
+        n = run_end;
+    }
+    printf("free space: %u block%s, largest run %u; runs of 1: %u, 2-7: %u, 8-63: %u,"
+           " 64-511: %u, 512+: %u\n",
+           free, free == 1 ? "" : "s", largest, runs[0], runs[1], runs[2], runs[3], runs[4]);
+}
+#endif
+
 } // namespace anonymous
 
 mx_status_t check_inode(CheckMaps* chk, const Minfs* fs, uint32_t ino, uint32_t parent) {
@@ -401,6 +521,20 @@ mx_status_t minfs_check(Bcache* bc) {
     if (minfs_check_info(&info, bc->Maxblk())) {
         return -1;
     }
+    if (info.jnl_blocks != 0) {
+        mxtl::unique_ptr<Journal> journal;
+        uint32_t txns;
+        if ((status = Journal::Create(&journal, bc, info.jnl_block, info.jnl_blocks)) < 0) {
+            return status;
+        }
+        if ((status = journal->Replay(false, false, &txns)) < 0) {
+            return status;
+        }
+        if (txns != 0) {
+            warn("check: %u journal transaction%s not replayed; mount first\n",
+                 txns, txns > 1 ? "s" : "");
+        }
+    }
 
     CheckMaps chk;
     if ((status = chk.checked_inodes.Reset(info.inode_count)) < 0) {
@@ -445,6 +579,10 @@ mx_status_t minfs_check(Bcache* bc) {
               missing, missing > 1 ? "s" : "");
     }
 
+#ifndef __Fuchsia__
+    check_report_fragmentation(&chk, fs);
+#endif
+
     //TODO: check allocated inodes that were abandoned
     //TODO: check allocated blocks that were not accounted for
     //TODO: check unallocated inodes where magic != 0
@@ -12,6 +12,7 @@
 #include <sys/stat.h>
 
 #include <mxtl/algorithm.h>
+#include <mxtl/auto_lock.h>
 #include <magenta/device/devmgr.h>
 
 #ifdef __Fuchsia__
@@ -123,119 +124,11 @@ void VnodeMinfs::InodeSync(uint32_t flags) {
     fs_->InodeSync(ino_, &inode_);
 }
 
-// Delete all blocks (relative to a file) from "start" (inclusive) to the end of
-// the file. Does not update mtime/atime.
-mx_status_t VnodeMinfs::BlocksShrink(uint32_t start) {
-    mxtl::RefPtr<BlockNode> bitmap_blk = nullptr;
-
-    bool doSync = false;
-
-    // release direct blocks
-    for (unsigned bno = start; bno < kMinfsDirect; bno++) {
-        if (inode_.dnum[bno] == 0) {
-            continue;
-        }
-        if ((bitmap_blk = fs_->BitmapBlockGet(bitmap_blk, inode_.dnum[bno])) == nullptr) {
-            return ERR_IO;
-        }
-
-        fs_->block_map_.Clear(inode_.dnum[bno], inode_.dnum[bno] + 1);
-        inode_.dnum[bno] = 0;
-        inode_.block_count--;
-        doSync = true;
-    }
-
-    const unsigned direct_per_indirect = kMinfsBlockSize / sizeof(uint32_t);
-
-    // release indirect blocks
-    for (unsigned indirect = 0; indirect < kMinfsIndirect; indirect++) {
-        if (inode_.inum[indirect] == 0) {
-            continue;
-        }
-        unsigned bno = kMinfsDirect + (indirect + 1) * direct_per_indirect;
-        if (start > bno) {
-            continue;
-        }
-        mxtl::RefPtr<BlockNode> blk = nullptr;
-        if ((blk = fs_->bc_->Get(inode_.inum[indirect])) == nullptr) {
-            fs_->BitmapBlockPut(bitmap_blk);
-            return ERR_IO;
-        }
-        uint32_t* entry = static_cast<uint32_t*>(blk->data());
-        uint32_t iflags = 0;
-        bool delete_indirect = true; // can we delete the indirect block?
-        // release the blocks pointed at by the entries in the indirect block
-        for (unsigned direct = 0; direct < direct_per_indirect; direct++) {
-            if (entry[direct] == 0) {
-                continue;
-            }
-            unsigned bno = kMinfsDirect + indirect * direct_per_indirect + direct;
-            if (start > bno) {
-                // This is a valid entry which exists in the indirect block
-                // BEFORE our truncation point. Don't delete it, and don't
-                // delete the indirect block.
-                delete_indirect = false;
-                continue;
-            }
-
-            if ((bitmap_blk = fs_->BitmapBlockGet(bitmap_blk, entry[direct])) == nullptr) {
-                fs_->bc_->Put(blk, iflags);
-                return ERR_IO;
-            }
-            fs_->block_map_.Clear(entry[direct], entry[direct] + 1);
-            entry[direct] = 0;
-            iflags = kBlockDirty;
-            inode_.block_count--;
-        }
-        // only update the indirect block if an entry was deleted
-        if (iflags & kBlockDirty) {
-            doSync = true;
-        }
-        fs_->bc_->Put(blk, iflags);
-
-        if (delete_indirect)  {
-            // release the direct block itself
-            bitmap_blk = fs_->BitmapBlockGet(bitmap_blk, inode_.inum[indirect]);
-            if (bitmap_blk == nullptr) {
-                return ERR_IO;
-            }
-            fs_->block_map_.Clear(inode_.inum[indirect], inode_.inum[indirect] + 1);
-            inode_.inum[indirect] = 0;
-            inode_.block_count--;
-            doSync = true;
-        }
-    }
-
-    if (doSync) {
-        InodeSync(kMxFsSyncDefault);
-    }
-    fs_->BitmapBlockPut(bitmap_blk);
-    return NO_ERROR;
-}
-
 #ifdef __Fuchsia__
-// Read data from disk at block 'bno', into the 'nth' logical block of the file.
-mx_status_t VnodeMinfs::FillBlock(uint32_t n, uint32_t bno) {
-    // TODO(smklein): read directly from block device into vmo; no need to copy
-    // into an intermediate buffer.
-    char bdata[kMinfsBlockSize];
-    if (fs_->bc_->Readblk(bno, bdata)) {
-        return ERR_IO;
-    }
-    mx_status_t status = vmo_write_exact(vmo_, bdata, n * kMinfsBlockSize, kMinfsBlockSize);
-    if (status != NO_ERROR) {
-        return status;
-    }
-    return NO_ERROR;
-}
-
 // Since we cannot yet register the filesystem as a paging service (and cleanly
-// fault on pages when they are actually needed), we currently read an entire
-// file to a VMO when a file's data block are accessed.
-//
-// TODO(smklein): Even this hack can be optimized; a bitmap could be used to
-// track all 'empty/read/dirty' blocks for each vnode, rather than reading
-// the entire file.
+// fault on pages when they are actually needed), file contents are copied into
+// a VMO. The VMO is created empty; blocks are read into it on first access,
+// and |vmo_populated_| records which blocks are already present.
 mx_status_t VnodeMinfs::InitVmo() {
     if (vmo_ != MX_HANDLE_INVALID) {
         return NO_ERROR;
@@ -246,130 +139,127 @@ mx_status_t VnodeMinfs::InitVmo() {
         error("Failed to initialize vmo; error: %d\n", status);
         return status;
     }
-
-    // Initialize all direct blocks
-    uint32_t bno;
-    for (uint32_t d = 0; d < kMinfsDirect; d++) {
-        if ((bno = inode_.dnum[d]) != 0) {
-            if ((status = FillBlock(d, bno)) != NO_ERROR) {
-                error("Failed to fill bno %u; error: %d\n", bno, status);
-                return status;
-            }
-        }
-    }
-
-    // Initialize all indirect blocks
-    for (uint32_t i = 0; i < kMinfsIndirect; i++) {
-        uint32_t ibno;
-        mxtl::RefPtr<BlockNode> iblk;
-        if ((ibno = inode_.inum[i]) != 0) {
-            // TODO(smklein): Should there be a separate vmo for indirect blocks?
-            if ((iblk = fs_->bc_->Get(ibno)) == nullptr) {
-                return ERR_IO;
-            }
-            uint32_t* ientry = static_cast<uint32_t*>(iblk->data());
-
-            const uint32_t direct_per_indirect = kMinfsBlockSize / sizeof(uint32_t);
-            for (uint32_t j = 0; j < direct_per_indirect; j++) {
-                if ((bno = ientry[j]) != 0) {
-                    uint32_t n = kMinfsDirect + i * direct_per_indirect + j;
-                    if ((status = FillBlock(n, bno)) != NO_ERROR) {
-                        fs_->bc_->Put(iblk, 0);
-                        return status;
-                    }
-                }
-            }
-            fs_->bc_->Put(iblk, 0);
-        }
+    if ((status = vmo_populated_.Reset(0)) != NO_ERROR) {
+        return status;
     }
-
+    readahead_off_ = 0;
+    readahead_window_ = 0;
     return NO_ERROR;
 }
-#endif
 
-// Get the bno corresponding to the nth logical block within the file.
-mx_status_t VnodeMinfs::GetBno(uint32_t n, uint32_t* bno, bool alloc) {
-    uint32_t hint = 0;
-    // direct blocks are simple... is there an entry in dnum[]?
-    if (n < kMinfsDirect) {
-        if (((*bno = inode_.dnum[n]) == 0) && alloc) {
-            mx_status_t status = fs_->BlockNew(hint, bno, nullptr);
-            if (status != NO_ERROR) {
-                return status;
-            }
-            inode_.dnum[n] = *bno;
-            inode_.block_count++;
-            InodeSync(kMxFsSyncDefault);
-        }
+mx_status_t VnodeMinfs::VmoPopulatedReserve(uint32_t blocks) {
+    constexpr size_t kPopulatedGranule = 256;
+    size_t old_size = vmo_populated_.size();
+    if (blocks <= old_size) {
         return NO_ERROR;
     }
 
-    // for indirect blocks, adjust past the direct blocks
-    n -= kMinfsDirect;
-
-    // determine indices into the indirect block list and into
-    // the block list in the indirect block
-    uint32_t i = static_cast<uint32_t>(n / (kMinfsBlockSize / sizeof(uint32_t)));
-    uint32_t j = n % (kMinfsBlockSize / sizeof(uint32_t));
-
-    if (i >= kMinfsIndirect) {
-        return ERR_OUT_OF_RANGE;
+    // Grow geometrically, preserving the bits which are already set. The
+    // bitmap cannot be moved, so stash them in a copy while it is reset.
+    size_t size = mxtl::max(mxtl::roundup(static_cast<size_t>(blocks), kPopulatedGranule),
+                            old_size * 2);
+    bitmap::RawBitmapGeneric<bitmap::DefaultStorage> saved;
+    mx_status_t status;
+    if ((status = saved.Reset(old_size)) != NO_ERROR) {
+        return status;
     }
+    size_t n = 0;
+    while ((n = vmo_populated_.Scan(n, old_size, false)) < old_size) {
+        size_t run_end = vmo_populated_.Scan(n, old_size, true);
+        saved.Set(n, run_end);
+        n = run_end;
+    }
+    if ((status = vmo_populated_.Reset(size)) != NO_ERROR) {
+        return status;
+    }
+    n = 0;
+    while ((n = saved.Scan(n, old_size, false)) < old_size) {
+        size_t run_end = saved.Scan(n, old_size, true);
+        vmo_populated_.Set(n, run_end);
+        n = run_end;
+    }
+    return NO_ERROR;
+}
 
-    uint32_t ibno;
-    mxtl::RefPtr<BlockNode> iblk;
-    uint32_t iflags = 0;
+mx_status_t VnodeMinfs::VmoPopulate(uint32_t start, uint32_t end) {
+    mx_status_t status;
+    if ((status = VmoPopulatedReserve(end)) != NO_ERROR) {
+        return status;
+    }
 
-    // look up the indirect bno
-    if ((ibno = inode_.inum[i]) == 0) {
-        if (!alloc) {
-            *bno = 0;
-            return NO_ERROR;
-        }
-        // allocate a new indirect block
-        mx_status_t status = fs_->BlockNew(0, &ibno, &iblk);
-        if (status != NO_ERROR) {
+    mxtl::unique_ptr<uint8_t[]> bdata;
+    uint32_t n = start;
+    while ((n = static_cast<uint32_t>(vmo_populated_.Scan(n, end, true))) < end) {
+        // One lookup yields the whole run which is contiguous on disk; read
+        // as much of it as is missing in a single request.
+        uint32_t bno;
+        uint32_t run;
+        if ((status = GetBnoRun(n, 0, false, &bno, &run)) != NO_ERROR) {
             return status;
         }
-        // record new indirect block in inode, note that we need to update
-        inode_.block_count++;
-        inode_.inum[i] = ibno;
-        iflags = kBlockDirty;
-    } else {
-        if ((iblk = fs_->bc_->Get(ibno)) == nullptr) {
+        uint32_t limit = n + mxtl::min(run, end - n);
+        if (bno == 0) {
+            // Sparse blocks read as zero, which the VMO already does.
+            vmo_populated_.Set(n, limit);
+            n = limit;
+            continue;
+        }
+        limit = mxtl::min(limit, n + kMinfsMaxReadRun);
+        uint32_t count = static_cast<uint32_t>(vmo_populated_.Scan(n, limit, false)) - n;
+
+        if (bdata == nullptr) {
+            AllocChecker ac;
+            bdata.reset(new (&ac) uint8_t[kMinfsMaxReadRun * kMinfsBlockSize]);
+            if (!ac.check()) {
+                return ERR_NO_MEMORY;
+            }
+        }
+        // TODO(smklein): read directly from block device into vmo; no need to
+        // copy into an intermediate buffer.
+        if (fs_->bc_->Readblks(bno, count, bdata.get()) != NO_ERROR) {
             return ERR_IO;
         }
-    }
-    uint32_t* ientry = static_cast<uint32_t*>(iblk->data());
-
-    if (((*bno = ientry[j]) == 0) && alloc) {
-        // allocate a new block
-        mx_status_t status = fs_->BlockNew(hint, bno, nullptr);
-        if (status != NO_ERROR) {
-            fs_->bc_->Put(iblk, iflags);
+        if ((status = vmo_write_exact(vmo_, bdata.get(), n * kMinfsBlockSize,
+                                      count * kMinfsBlockSize)) != NO_ERROR) {
             return status;
         }
-        inode_.block_count++;
-        ientry[j] = *bno;
-        iflags = kBlockDirty;
+        vmo_populated_.Set(n, n + count);
+        n += count;
     }
+    return NO_ERROR;
+}
 
-    // release indirect block, updating if necessary
-    // and update the inode as well if we changed it
-    fs_->bc_->Put(iblk, iflags);
-    if (iflags & kBlockDirty) {
-        InodeSync(kMxFsSyncDefault);
+mx_status_t VnodeMinfs::VmoReadAhead(size_t off, size_t len) {
+    uint32_t start = static_cast<uint32_t>(off / kMinfsBlockSize);
+    uint32_t end = static_cast<uint32_t>(mxtl::roundup(off + len, kMinfsBlockSize) /
+                                         kMinfsBlockSize);
+    uint32_t file_end = static_cast<uint32_t>(mxtl::roundup(inode_.size, kMinfsBlockSize) /
+                                              kMinfsBlockSize);
+
+    bool sequential = (off == readahead_off_);
+    readahead_off_ = off + len;
+    if (!sequential) {
+        readahead_window_ = 0;
     }
 
-    return NO_ERROR;
-}
+    mx_status_t status;
+    if ((status = VmoPopulatedReserve(end)) != NO_ERROR) {
+        return status;
+    }
+    if (vmo_populated_.Get(start, end)) {
+        return NO_ERROR;
+    }
 
-// Immediately stop iterating over the directory.
-#define DIR_CB_DONE 0
-// Access the next direntry in the directory. Offsets updated.
-#define DIR_CB_NEXT 1
-// Identify that the direntry record was modified. Stop iterating.
-#define DIR_CB_SAVE_SYNC 2
+    // Only extend the read when it misses, so that a sequential reader sees
+    // one large disk read per window rather than one block per call.
+    if (sequential) {
+        readahead_window_ = mxtl::min(mxtl::max(readahead_window_ * 2, kMinfsReadAheadMin),
+                                      kMinfsReadAheadMax);
+        end = mxtl::min(end + readahead_window_, file_end);
+    }
+    return VmoPopulate(start, end);
+}
+#endif
 
 mx_status_t VnodeMinfs::ReadExactInternal(void* data, size_t len, size_t off) {
     size_t actual;
@@ -393,7 +283,7 @@ mx_status_t VnodeMinfs::WriteExactInternal(const void* data, size_t len, size_t
     return NO_ERROR;
 }
 
-static mx_status_t validate_dirent(minfs_dirent_t* de, size_t bytes_read, size_t off) {
+mx_status_t validate_dirent(minfs_dirent_t* de, size_t bytes_read, size_t off) {
     uint32_t reclen = static_cast<uint32_t>(MinfsReclen(de, off));
     if ((bytes_read < MINFS_DIRENT_SIZE) || (reclen < MINFS_DIRENT_SIZE)) {
         error("vn_dir: Could not read dirent at offset: %zd\n", off);
@@ -499,6 +389,10 @@ mx_status_t VnodeMinfs::UnlinkChild(VnodeMinfs* childvn, minfs_dirent_t* de, Dir
     if ((status = WriteExactInternal(de, MINFS_DIRENT_SIZE, off)) != NO_ERROR) {
         goto fail;
     }
+    DirCacheRemove(de->name, de->namelen, offs->off);
+    if (off < dir_append_off_) {
+        dir_append_off_ = off;
+    }
 
     if (de->reclen & kMinfsReclenLast) {
         // Truncating the directory merely removed unused space; if it fails,
@@ -643,6 +537,7 @@ static mx_status_t add_dirent(VnodeMinfs* vndir, minfs_dirent_t* de, DirArgs* ar
         return status;
     }
     vndir->inode_.dirent_count++;
+    vndir->DirCacheInsert(args->name, args->len, off);
     if (args->type == kMinfsTypeDir) {
         // Child directory has '..' which will point to parent directory
         vndir->inode_.link_count++;
@@ -653,6 +548,17 @@ static mx_status_t add_dirent(VnodeMinfs* vndir, minfs_dirent_t* de, DirArgs* ar
 static mx_status_t cb_dir_append(VnodeMinfs* vndir, minfs_dirent_t* de,
                                  DirArgs* args, DirectoryOffset* offs) {
     uint32_t reclen = static_cast<uint32_t>(MinfsReclen(de, offs->off));
+    if (offs->off == vndir->dir_append_off_) {
+        // Nothing will ever fit in a record without room for the shortest
+        // name, so later searches may start past it.
+        uint32_t room = reclen;
+        if (de->ino != 0) {
+            room = (reclen > DirentSize(de->namelen)) ? reclen - DirentSize(de->namelen) : 0;
+        }
+        if ((room < DirentSize(1)) && !(de->reclen & kMinfsReclenLast)) {
+            vndir->dir_append_off_ += reclen;
+        }
+    }
     if (de->ino == 0) {
         // empty entry, do we fit?
         if (args->reclen > reclen) {
@@ -701,12 +607,13 @@ static mx_status_t cb_dir_append(VnodeMinfs* vndir, minfs_dirent_t* de,
 //          updating the offset information to access the next dirent.
 mx_status_t VnodeMinfs::ForEachDirent(DirArgs* args,
                                       mx_status_t (*func)(VnodeMinfs*, minfs_dirent_t*, DirArgs*,
-                                                          DirectoryOffset*)) {
+                                                          DirectoryOffset*),
+                                      size_t off) {
     char data[kMinfsMaxDirentSize];
     minfs_dirent_t* de = (minfs_dirent_t*) data;
     DirectoryOffset offs = {
-        .off = 0,
-        .off_prev = 0,
+        .off = off,
+        .off_prev = off,
     };
     while (offs.off + MINFS_DIRENT_SIZE < kMinfsMaxDirectorySize) {
         trace(MINFS, "Reading dirent at offset %zd\n", offs.off);
@@ -733,11 +640,19 @@ mx_status_t VnodeMinfs::ForEachDirent(DirArgs* args,
     return ERR_NOT_FOUND;
 }
 
+mx_status_t VnodeMinfs::AppendDirent(DirArgs* args) {
+    return ForEachDirent(args, cb_dir_append, dir_append_off_);
+}
+
 void VnodeMinfs::Release() {
     trace(MINFS, "minfs_release() vn=%p(#%u)%s\n", this, ino_,
           inode_.link_count ? "" : " link-count is zero");
     if (inode_.link_count == 0) {
+        Transaction txn(fs_->bc_);
         InodeDestroy();
+    } else if (prealloc_) {
+        Transaction txn(fs_->bc_);
+        PreallocTrim();
     }
 
     fs_->VnodeRelease(this);
@@ -758,6 +673,13 @@ mx_status_t VnodeMinfs::Open(uint32_t flags) {
 
 mx_status_t VnodeMinfs::Close() {
     trace(MINFS, "minfs_close() vn=%p(#%u)\n", this, ino_);
+    {
+        mxtl::AutoLock lock(&lock_);
+        if (prealloc_) {
+            Transaction txn(fs_->bc_);
+            PreallocTrim();
+        }
+    }
     RefRelease();
     return NO_ERROR;
 }
@@ -767,6 +689,7 @@ ssize_t VnodeMinfs::Read(void* data, size_t len, size_t off) {
     if (IsDirectory()) {
         return ERR_NOT_FILE;
     }
+    mxtl::AutoLock lock(&lock_);
     size_t r;
     mx_status_t status = ReadInternal(data, len, off, &r);
     if (status != NO_ERROR) {
@@ -790,6 +713,8 @@ mx_status_t VnodeMinfs::ReadInternal(void* data, size_t len, size_t off, size_t*
 #ifdef __Fuchsia__
     if ((status = InitVmo()) != NO_ERROR) {
         return status;
+    } else if ((status = VmoReadAhead(off, len)) != NO_ERROR) {
+        return status;
     } else if ((status = mx_vmo_read(vmo_, data, off, len, actual)) != NO_ERROR) {
         return status;
     }
@@ -836,12 +761,16 @@ ssize_t VnodeMinfs::Write(const void* data, size_t len, size_t off) {
     if (IsDirectory()) {
         return ERR_NOT_FILE;
     }
+    mxtl::AutoLock lock(&lock_);
+    // WriteInternal() brackets only its metadata updates in transactions, so
+    // that other operations are not held up behind the data I/O.
     size_t actual;
     mx_status_t status = WriteInternal(data, len, off, &actual);
     if (status != NO_ERROR) {
         return status;
     }
     if (actual != 0) {
+        Transaction txn(fs_->bc_);
         InodeSync(kMxFsSyncMtime);  // Successful writes updates mtime
     }
     return actual;
@@ -860,6 +789,25 @@ mx_status_t VnodeMinfs::WriteInternal(const void* data, size_t len, size_t off,
         return status;
     }
 #endif
+    // An appending write also maps blocks past its end, so that the next
+    // append continues the same run on disk even if other files allocate in
+    // between. Blocks left past the end by an earlier append would show
+    // through the gap before a write beyond the end of file; drop them.
+    const size_t old_size = inode_.size;
+    uint32_t prealloc = 0;
+    if (!IsDirectory() && (off + len > old_size)) {
+        if (off > old_size) {
+            Transaction txn(fs_->bc_);
+            if ((status = PreallocTrim()) != NO_ERROR) {
+                return status;
+            }
+        }
+        uint64_t blocks = mxtl::roundup(off + len, kMinfsBlockSize) / kMinfsBlockSize;
+        prealloc = static_cast<uint32_t>(mxtl::min(blocks,
+                                                   static_cast<uint64_t>(kMinfsPreallocMax)));
+        prealloc_ = true;
+    }
+
     const void* const start = data;
     uint32_t n = static_cast<uint32_t>(off / kMinfsBlockSize);
     size_t adjust = off % kMinfsBlockSize;
@@ -871,6 +819,17 @@ mx_status_t VnodeMinfs::WriteInternal(const void* data, size_t len, size_t off,
         } else {
             xfer = len;
         }
+        // Allocate what the rest of this write needs as a single run.
+        // Holes within the old end of file are filled a block at a time, so
+        // that a failure leaves none of them mapped over stale contents.
+        uint64_t blocks_left = mxtl::roundup(adjust + len, kMinfsBlockSize) / kMinfsBlockSize;
+        uint32_t want = static_cast<uint32_t>(mxtl::min(blocks_left + prealloc,
+                                                        kMinfsMaxFileBlock));
+        if (static_cast<size_t>(n) * kMinfsBlockSize < old_size) {
+            want = 1;
+        }
+        uint32_t bno;
+        uint32_t run;
 
 #ifdef __Fuchsia__
         size_t xfer_off = n * kMinfsBlockSize + adjust;
@@ -882,6 +841,18 @@ mx_status_t VnodeMinfs::WriteInternal(const void* data, size_t len, size_t off,
             inode_.size = static_cast<uint32_t>(new_size);
         }
 
+        // A partial write must merge with the existing contents of the block;
+        // a full one replaces them. Past the old end of file there are none,
+        // even if the block was preallocated, and the VMO already reads zero.
+        if ((xfer != kMinfsBlockSize) &&
+            (static_cast<size_t>(n) * kMinfsBlockSize < old_size)) {
+            if ((status = VmoPopulate(n, n + 1)) != NO_ERROR) {
+                goto fail;
+            }
+        } else if ((status = VmoPopulatedReserve(n + 1)) != NO_ERROR) {
+            goto fail;
+        }
+
         // TODO(smklein): If a failure occurs after writing to the VMO, but
         // before updating the data to disk, then our in-memory representation
         // of the file may not be consistent with the on-disk representation of
@@ -890,8 +861,10 @@ mx_status_t VnodeMinfs::WriteInternal(const void* data, size_t len, size_t off,
 
         // Update this block of the in-memory VMO
         if ((status = vmo_write_exact(vmo_, data, xfer_off, xfer)) != NO_ERROR) {
-            return ERR_IO;
+            status = ERR_IO;
+            goto fail;
         }
+        vmo_populated_.Set(n, n + 1);
 
         // Update this block on-disk
         char bdata[kMinfsBlockSize];
@@ -899,31 +872,56 @@ mx_status_t VnodeMinfs::WriteInternal(const void* data, size_t len, size_t off,
         // preventing the need for a 'bdata' variable?
         if (xfer != kMinfsBlockSize) {
             if (vmo_read_exact(vmo_, bdata, n * kMinfsBlockSize, kMinfsBlockSize) != NO_ERROR) {
-                return ERR_IO;
+                status = ERR_IO;
+                goto fail;
             }
         }
         const void* wdata = (xfer != kMinfsBlockSize) ? bdata : data;
-        uint32_t bno;
-        if ((status = GetBno(n, &bno, true)) != NO_ERROR) {
-            return status;
+        {
+            Transaction txn(fs_->bc_);
+            status = GetBnoRun(n, want, true, &bno, &run);
+        }
+        if (status != NO_ERROR) {
+            goto fail;
         }
         assert(bno != 0);
-        if (fs_->bc_->Writeblk(bno, wdata)) {
-            return ERR_IO;
+        // Directory blocks are metadata, and are rewritten often enough to be
+        // worth keeping in the block cache.
+        if (IsDirectory()) {
+            status = fs_->bc_->WriteCached(bno, wdata);
+        } else {
+            status = fs_->bc_->Writeblk(bno, wdata);
+        }
+        if (status != NO_ERROR) {
+            status = ERR_IO;
+            goto fail;
         }
 #else
-        uint32_t bno;
-        if ((status = GetBno(n, &bno, true)) != NO_ERROR) {
+        {
+            Transaction txn(fs_->bc_);
+            status = GetBnoRun(n, want, true, &bno, &run);
+        }
+        if (status != NO_ERROR) {
             goto done;
         }
         assert(bno != 0);
         char wdata[kMinfsBlockSize];
-        if (fs_->bc_->Readblk(bno, wdata)) {
-            return ERR_IO;
+        if (static_cast<size_t>(n) * kMinfsBlockSize >= old_size) {
+            // Past the old end of file, the block holds nothing of the file's.
+            memset(wdata, 0, sizeof(wdata));
+        } else if (fs_->bc_->Readblk(bno, wdata)) {
+            status = ERR_IO;
+            goto fail;
         }
         memcpy(wdata + adjust, data, xfer);
-        if (fs_->bc_->Writeblk(bno, wdata)) {
-            return ERR_IO;
+        if (IsDirectory()) {
+            status = fs_->bc_->WriteCached(bno, wdata);
+        } else {
+            status = fs_->bc_->Writeblk(bno, wdata);
+        }
+        if (status != NO_ERROR) {
+            status = ERR_IO;
+            goto fail;
         }
 #endif
 
@@ -950,6 +948,15 @@ done:
 
     *actual = len;
     return NO_ERROR;
+
+fail:
+    // Give back what this write allocated past the data it managed to write,
+    // rather than leave those blocks mapped with stale contents.
+    {
+        Transaction txn(fs_->bc_);
+        WriteUnwind(old_size, off + ((uintptr_t)data - (uintptr_t)start));
+    }
+    return status;
 }
 
 mx_status_t VnodeMinfs::Lookup(fs::Vnode** out, const char* name, size_t len) {
@@ -965,7 +972,7 @@ mx_status_t VnodeMinfs::Lookup(fs::Vnode** out, const char* name, size_t len) {
     args.name = name;
     args.len = len;
     mx_status_t status;
-    if ((status = ForEachDirent(&args, cb_dir_find)) < 0) {
+    if ((status = ForNamedDirent(&args, cb_dir_find)) < 0) {
         return status;
     }
     VnodeMinfs* vn;
@@ -978,6 +985,7 @@ mx_status_t VnodeMinfs::Lookup(fs::Vnode** out, const char* name, size_t len) {
 
 mx_status_t VnodeMinfs::Getattr(vnattr_t* a) {
     trace(MINFS, "minfs_getattr() vn=%p(#%u)\n", this, ino_);
+    mxtl::AutoLock lock(&lock_);
     a->mode = DTYPE_TO_VTYPE(MinfsMagicType(inode_.magic));
     a->inode = ino_;
     a->size = inode_.size;
@@ -993,6 +1001,8 @@ mx_status_t VnodeMinfs::Setattr(vnattr_t* a) {
     if ((a->valid & ~(ATTR_CTIME|ATTR_MTIME)) != 0) {
         return ERR_NOT_SUPPORTED;
     }
+    mxtl::AutoLock lock(&lock_);
+    Transaction txn(fs_->bc_);
     if ((a->valid & ATTR_CTIME) != 0) {
         inode_.create_time = a->create_time;
         dirty = 1;
@@ -1086,9 +1096,12 @@ fail:
 }
 
 #ifdef __Fuchsia__
-VnodeMinfs::VnodeMinfs(Minfs* fs) : fs_(fs), vmo_(MX_HANDLE_INVALID) {}
+VnodeMinfs::VnodeMinfs(Minfs* fs) : fs_(fs), dir_append_off_(0), dir_slot_count_(0),
+    dir_slot_used_(0), dir_index_deferred_(false), prealloc_(false), vmo_(MX_HANDLE_INVALID), readahead_off_(0),
+    readahead_window_(0) {}
 #else
-VnodeMinfs::VnodeMinfs(Minfs* fs) : fs_(fs) {}
+VnodeMinfs::VnodeMinfs(Minfs* fs) : fs_(fs), dir_append_off_(0), dir_slot_count_(0),
+    dir_slot_used_(0), dir_index_deferred_(false), prealloc_(false) {}
 #endif
 
 mx_status_t VnodeMinfs::Allocate(Minfs* fs, uint32_t type, VnodeMinfs** out) {
@@ -1115,6 +1128,7 @@ mx_status_t VnodeMinfs::AllocateHollow(Minfs* fs, VnodeMinfs** out) {
 mx_status_t VnodeMinfs::Create(fs::Vnode** out, const char* name, size_t len, uint32_t mode) {
     trace(MINFS, "minfs_create() vn=%p(#%u) name='%.*s' mode=%#x\n",
           this, ino_, (int)len, name, mode);
+    Transaction txn(fs_->bc_);
     assert(len <= kMinfsMaxNameSize);
     assert(memchr(name, '/', len) == NULL);
     if (!IsDirectory()) {
@@ -1129,7 +1143,7 @@ mx_status_t VnodeMinfs::Create(fs::Vnode** out, const char* name, size_t len, ui
     args.len = len;
     // ensure file does not exist
     mx_status_t status;
-    if ((status = ForEachDirent(&args, cb_dir_find)) != ERR_NOT_FOUND) {
+    if ((status = ForNamedDirent(&args, cb_dir_find)) != ERR_NOT_FOUND) {
         return ERR_ALREADY_EXISTS;
     }
 
@@ -1138,7 +1152,7 @@ mx_status_t VnodeMinfs::Create(fs::Vnode** out, const char* name, size_t len, ui
 
     // mint a new inode and vnode for it
     VnodeMinfs* vn;
-    if ((status = fs_->VnodeNew(&vn, type)) < 0) { // vn refcount +1
+    if ((status = fs_->VnodeNew(&vn, type, ino_)) < 0) { // vn refcount +1
         return status;
     }
 
@@ -1159,7 +1173,7 @@ mx_status_t VnodeMinfs::Create(fs::Vnode** out, const char* name, size_t len, ui
     args.ino = vn->ino_;
     args.type = type;
     args.reclen = static_cast<uint32_t>(DirentSize(static_cast<uint8_t>(len)));
-    if ((status = ForEachDirent(&args, cb_dir_append)) < 0) {
+    if ((status = AppendDirent(&args)) < 0) {
         vn->Release(); // vn refcount +0
         return status;
     }
@@ -1195,6 +1209,7 @@ ssize_t VnodeMinfs::Ioctl(uint32_t op, const void* in_buf, size_t in_len, void*
 
 mx_status_t VnodeMinfs::Unlink(const char* name, size_t len, bool must_be_dir) {
     trace(MINFS, "minfs_unlink() vn=%p(#%u) name='%.*s'\n", this, ino_, (int)len, name);
+    Transaction txn(fs_->bc_);
     assert(len <= kMinfsMaxNameSize);
     assert(memchr(name, '/', len) == NULL);
     if (!IsDirectory()) {
@@ -1210,7 +1225,7 @@ mx_status_t VnodeMinfs::Unlink(const char* name, size_t len, bool must_be_dir) {
     args.name = name;
     args.len = len;
     args.type = must_be_dir ? kMinfsTypeDir : 0;
-    return ForEachDirent(&args, cb_dir_unlink);
+    return ForNamedDirent(&args, cb_dir_unlink);
 }
 
 mx_status_t VnodeMinfs::Truncate(size_t len) {
@@ -1218,6 +1233,8 @@ mx_status_t VnodeMinfs::Truncate(size_t len) {
         return ERR_NOT_FILE;
     }
 
+    mxtl::AutoLock lock(&lock_);
+    Transaction txn(fs_->bc_);
     mx_status_t status = TruncateInternal(len);
     if (status != NO_ERROR) {
         // Successful truncates update inode
@@ -1262,6 +1279,10 @@ mx_status_t VnodeMinfs::TruncateInternal(size_t len) {
             if (bno != 0) {
                 size_t adjust = len % kMinfsBlockSize;
 #ifdef __Fuchsia__
+                uint32_t n = static_cast<uint32_t>(len / kMinfsBlockSize);
+                if ((r = VmoPopulate(n, n + 1)) != NO_ERROR) {
+                    return ERR_IO;
+                }
                 if ((r = vmo_read_exact(vmo_, bdata, len - adjust, adjust)) != NO_ERROR) {
                     return ERR_IO;
                 }
@@ -1279,7 +1300,14 @@ mx_status_t VnodeMinfs::TruncateInternal(size_t len) {
                 memset(bdata + adjust, 0, kMinfsBlockSize - adjust);
 #endif
 
-                if (fs_->bc_->Writeblk(bno, bdata)) {
+                // Like WriteInternal, keep directory blocks ordered with
+                // the inode updates which reference them.
+                if (IsDirectory()) {
+                    r = fs_->bc_->WriteCached(bno, bdata);
+                } else {
+                    r = fs_->bc_->Writeblk(bno, bdata);
+                }
+                if (r != NO_ERROR) {
                     return ERR_IO;
                 }
             }
@@ -1300,6 +1328,11 @@ mx_status_t VnodeMinfs::TruncateInternal(size_t len) {
     if ((r = mx_vmo_set_size(vmo_, mxtl::roundup(len, kMinfsBlockSize))) != NO_ERROR) {
         return r;
     }
+    // Blocks past the new end of the VMO no longer hold data.
+    size_t vmo_blocks = mxtl::roundup(len, kMinfsBlockSize) / kMinfsBlockSize;
+    if (vmo_blocks < vmo_populated_.size()) {
+        vmo_populated_.Clear(vmo_blocks, vmo_populated_.size());
+    }
 #endif
 
     return NO_ERROR;
@@ -1336,6 +1369,7 @@ mx_status_t VnodeMinfs::Rename(fs::Vnode* _newdir, const char* oldname, size_t o
     VnodeMinfs* newdir = static_cast<VnodeMinfs*>(_newdir);
     trace(MINFS, "minfs_rename() olddir=%p(#%u) newdir=%p(#%u) oldname='%.*s' newname='%.*s'\n",
           this, ino_, newdir, newdir->ino_, (int)oldlen, oldname, (int)newlen, newname);
+    Transaction txn(fs_->bc_);
     assert(oldlen <= kMinfsMaxNameSize);
     assert(memchr(oldname, '/', oldlen) == NULL);
     assert(newlen <= kMinfsMaxNameSize);
@@ -1360,7 +1394,7 @@ mx_status_t VnodeMinfs::Rename(fs::Vnode* _newdir, const char* oldname, size_t o
     DirArgs args = DirArgs();
     args.name = oldname;
     args.len = oldlen;
-    if ((status = ForEachDirent(&args, cb_dir_find)) < 0) {
+    if ((status = ForNamedDirent(&args, cb_dir_find)) < 0) {
         return status;
     } else if ((status = fs_->VnodeGet(&oldvn, args.ino)) < 0) {
         return status;
@@ -1380,11 +1414,11 @@ mx_status_t VnodeMinfs::Rename(fs::Vnode* _newdir, const char* oldname, size_t o
     args.len = newlen;
     args.ino = oldvn->ino_;
     args.type = oldvn->IsDirectory() ? kMinfsTypeDir : kMinfsTypeFile;
-    status = newdir->ForEachDirent(&args, cb_dir_attempt_rename);
+    status = newdir->ForNamedDirent(&args, cb_dir_attempt_rename);
     if (status == ERR_NOT_FOUND) {
         // if 'newname' does not exist, create it
         args.reclen = static_cast<uint32_t>(DirentSize(static_cast<uint8_t>(newlen)));
-        if ((status = newdir->ForEachDirent(&args, cb_dir_append)) < 0) {
+        if ((status = newdir->AppendDirent(&args)) < 0) {
             goto done;
         }
         status = NO_ERROR;
@@ -1403,7 +1437,7 @@ mx_status_t VnodeMinfs::Rename(fs::Vnode* _newdir, const char* oldname, size_t o
         args.name = "..";
         args.len = 2;
         args.ino = newdir->ino_;
-        if ((status = vn->ForEachDirent(&args, cb_dir_update_inode)) < 0) {
+        if ((status = vn->ForNamedDirent(&args, cb_dir_update_inode)) < 0) {
             vn->RefRelease();
             goto done;
         }
@@ -1417,7 +1451,7 @@ mx_status_t VnodeMinfs::Rename(fs::Vnode* _newdir, const char* oldname, size_t o
     // finally, remove oldname from its original position
     args.name = oldname;
     args.len = oldlen;
-    status = ForEachDirent(&args, cb_dir_force_unlink);
+    status = ForNamedDirent(&args, cb_dir_force_unlink);
 done:
     oldvn->RefRelease();
     return status;
@@ -1425,6 +1459,7 @@ done:
 
 mx_status_t VnodeMinfs::Link(const char* name, size_t len, fs::Vnode* _target) {
     trace(MINFS, "minfs_link() vndir=%p(#%u) name='%.*s'\n", this, ino_, (int)len, name);
+    Transaction txn(fs_->bc_);
     assert(len <= kMinfsMaxNameSize);
     assert(memchr(name, '/', len) == NULL);
     if (!IsDirectory()) {
@@ -1450,14 +1485,14 @@ mx_status_t VnodeMinfs::Link(const char* name, size_t len, fs::Vnode* _target) {
     args.name = name;
     args.len = len;
     mx_status_t status;
-    if ((status = ForEachDirent(&args, cb_dir_find)) != ERR_NOT_FOUND) {
+    if ((status = ForNamedDirent(&args, cb_dir_find)) != ERR_NOT_FOUND) {
         return (status == NO_ERROR) ? ERR_ALREADY_EXISTS : status;
     }
 
     args.ino = target->ino_;
     args.type = kMinfsTypeFile; // We can't hard link directories
     args.reclen = static_cast<uint32_t>(DirentSize(static_cast<uint8_t>(len)));
-    if ((status = ForEachDirent(&args, cb_dir_append)) < 0) {
+    if ((status = AppendDirent(&args)) < 0) {
         return status;
     }
 
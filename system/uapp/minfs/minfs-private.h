@@ -5,9 +5,11 @@
 #pragma once
 
 #include <mxtl/algorithm.h>
+#include <mxtl/array.h>
 #include <mxtl/intrusive_hash_table.h>
 #include <mxtl/intrusive_single_list.h>
 #include <mxtl/macros.h>
+#include <mxtl/mutex.h>
 #include <mxtl/ref_counted.h>
 #include <mxtl/ref_ptr.h>
 #include <mxtl/unique_ptr.h>
@@ -29,10 +31,35 @@ constexpr uint32_t kMxFsSyncCtime   = (1<<1);
 
 constexpr uint32_t kMinfsBlockCacheSize = 64;
 
+// Bounds of the read-ahead window used for sequential reads, in blocks.
+constexpr uint32_t kMinfsReadAheadMin = 4;
+constexpr uint32_t kMinfsReadAheadMax = 64;
+// Most blocks fetched by a single disk read when populating a vnode's VMO.
+constexpr uint32_t kMinfsMaxReadRun = 32;
+
+// Allocation groups divide the volume into runs of this many blocks, and the
+// inodes into as many equal runs. A file's inode is placed in its directory's
+// group, and its data in the same group as its inode. Groups are only an
+// allocation policy: nothing about them is stored on disk.
+constexpr uint32_t kMinfsBlocksPerGroup = 8192;
+// Most blocks a file is given past the end of an appending write, so that the
+// next append continues its run on disk. Trimmed when the file is closed.
+constexpr uint32_t kMinfsPreallocMax = 64;
+
 // Used by fsck
 struct CheckMaps {
     RawBitmap checked_inodes;
     RawBitmap checked_blocks;
+
+    // Fragmentation statistics: a fragment is a run of a file's blocks which
+    // is contiguous on disk.
+    uint32_t files = 0;
+    uint32_t fragments = 0;
+    uint32_t fragmented_files = 0;
+    uint32_t max_fragments = 0;
+    // The file being checked: its fragments, and where on disk the last ended.
+    uint32_t file_fragments = 0;
+    uint32_t file_frag_end = 0;
 };
 
 class VnodeMinfs;
@@ -49,15 +76,32 @@ public:
     // the inode must exist in the file system
     mx_status_t VnodeGet(VnodeMinfs** out, uint32_t ino);
 
-    // instantiate a vnode with a new inode
-    mx_status_t VnodeNew(VnodeMinfs** out, uint32_t type);
+    // instantiate a vnode with a new inode, placed near the directory
+    // 'parent_ino' which will hold it
+    mx_status_t VnodeNew(VnodeMinfs** out, uint32_t type, uint32_t parent_ino);
 
     // remove a vnode from the hash map
     void VnodeRelease(VnodeMinfs* vn);
 
-    // Allocate a new data block and bcache_get_zero() it.
-    // Acquires the block if out_block is not null.
-    mx_status_t BlockNew(uint32_t hint, uint32_t* out_bno, mxtl::RefPtr<BlockNode>* out_block);
+    // Allocate up to 'want' contiguous data blocks, preferring a run at or
+    // after 'hint'. Fewer are allocated if no run of that length is free.
+    mx_status_t BlocksNew(uint32_t hint, uint32_t want, uint32_t* out_bno, uint32_t* out_count);
+
+    // Mark 'count' blocks from 'bno' as allocated or free, in memory and on disk.
+    // On failure, none of them are marked.
+    mx_status_t BlocksMark(uint32_t bno, uint32_t count, bool allocated);
+
+    // Where allocation of the first data block of inode 'ino' should start:
+    // the beginning of its allocation group.
+    uint32_t BlockGoal(uint32_t ino) const {
+        return (ino / inodes_per_group_) * kMinfsBlocksPerGroup;
+    }
+
+    // Free the blocks mapped by the sorted extents 'ext' from logical block
+    // 'start' onward, shortening or dropping extents and updating 'count'.
+    // Adds the number of blocks freed to 'freed'.
+    mx_status_t ExtentsFree(minfs_extent_t* ext, uint32_t* count, uint32_t start,
+                            uint32_t* freed);
 
     // free ino in inode bitmap, release all blocks held by inode
     mx_status_t InoFree(const minfs_inode_t& inode, uint32_t ino);
@@ -86,13 +130,24 @@ private:
     friend mx_status_t check_inode(CheckMaps*, const Minfs*, uint32_t, uint32_t);
     friend mx_status_t minfs_check(Bcache*);
     Minfs(Bcache* bc_, minfs_info_t* info_);
-    // Find a free inode, allocate it in the inode bitmap, and write it back to disk
-    mx_status_t InoNew(const minfs_inode_t* inode, uint32_t* ino_out);
+    // Find a free inode, searching from 'hint' first, allocate it in the
+    // inode bitmap, and write it back to disk
+    mx_status_t InoNew(const minfs_inode_t* inode, uint32_t hint, uint32_t* ino_out);
     mx_status_t LoadBitmaps();
+    // Counts the free blocks of each allocation group.
+    mx_status_t LoadGroups();
+    // Picks the group for a new directory: the one with the most free blocks,
+    // preferring those after 'parent_group' so that siblings spread out.
+    uint32_t DirGroup(uint32_t parent_group) const;
 
     uint32_t abmblks_;
     uint32_t ibmblks_;
     RawBitmap inode_map_;
+    uint32_t group_count_;
+    uint32_t inodes_per_group_;
+    // Free blocks in each allocation group. Only steers placement, so it need
+    // not be exact.
+    mxtl::Array<uint32_t> group_free_;
 #ifdef __Fuchsia__
     mxtl::unique_ptr<MappedVmo> inode_table_;
 #endif
@@ -113,6 +168,26 @@ struct DirectoryOffset {
     size_t off_prev; // Offset in directory of previous record
 };
 
+// Return values of the ForEachDirent callbacks:
+// Immediately stop iterating over the directory.
+#define DIR_CB_DONE 0
+// Access the next direntry in the directory. Offsets updated.
+#define DIR_CB_NEXT 1
+// Identify that the direntry record was modified. Stop iterating.
+#define DIR_CB_SAVE_SYNC 2
+
+// Brackets the metadata updates of a single operation, so that the block
+// cache commits them to the journal together.
+class Transaction {
+public:
+    DISALLOW_COPY_ASSIGN_AND_MOVE(Transaction);
+    explicit Transaction(Bcache* bc) : bc_(bc) { bc_->TxnBegin(); }
+    ~Transaction() { bc_->TxnEnd(); }
+
+private:
+    Bcache* bc_;
+};
+
 #define INO_HASH(ino) fnv1a_tiny(ino, kMinfsHashBits)
 
 constexpr uint32_t kMinfsFlagDeletedDirectory = 0x00010000;
@@ -137,6 +212,10 @@ public:
     static size_t GetHash(uint32_t key) { return INO_HASH(key); }
 
     mx_status_t UnlinkChild(VnodeMinfs* child, minfs_dirent_t* de, DirectoryOffset* offs);
+    // Keep the directory entry cache, and the directory index, in step with
+    // the dirent for 'name' being added or removed at offset 'off'.
+    void DirCacheInsert(const char* name, size_t len, size_t off);
+    void DirCacheRemove(const char* name, size_t len, size_t off);
     mx_status_t ReadInternal(void* data, size_t len, size_t off, size_t* actual);
     mx_status_t ReadExactInternal(void* data, size_t len, size_t off);
     mx_status_t WriteInternal(const void* data, size_t len, size_t off, size_t* actual);
@@ -149,6 +228,8 @@ public:
     Minfs* fs_;
     uint32_t ino_;
     minfs_inode_t inode_;
+    // Directories only: no dirent before this offset has room for another.
+    size_t dir_append_off_;
 
 private:
     VnodeMinfs(Minfs* fs);
@@ -174,18 +255,46 @@ private:
     mx_status_t Sync() final;
     mx_status_t AttachRemote(mx_handle_t) final;
 
+#ifdef __Fuchsia__
     mx_status_t InitVmo();
 
-    // Read data from disk at block 'bno', into the 'nth' logical block of the file.
-    mx_status_t FillBlock(uint32_t n, uint32_t bno);
+    // Ensures logical blocks [start, end) of the file hold valid data in the
+    // VMO, reading any which are not yet present from disk.
+    mx_status_t VmoPopulate(uint32_t start, uint32_t end);
+    // Populates the VMO for a read of [off, off + len), extending the range
+    // by the read-ahead window when access is sequential.
+    mx_status_t VmoReadAhead(size_t off, size_t len);
+    // Grows the populated-block map to cover at least 'blocks' blocks.
+    mx_status_t VmoPopulatedReserve(uint32_t blocks);
+#endif
 
     // Get the disk block 'bno' corresponding to the 'nth' logical block of the file.
     // Allocate the block if reqeusted.
     mx_status_t GetBno(uint32_t n, uint32_t* bno, bool alloc);
 
+    // As GetBno, but also sets 'run' to the number of blocks from 'n' which
+    // continue the mapping: contiguous on disk, or all holes. When allocating,
+    // reserves up to 'count' contiguous blocks at once.
+    mx_status_t GetBnoRun(uint32_t n, uint32_t count, bool alloc, uint32_t* bno, uint32_t* run);
+
+    // Fills the hole at logical block 'n' with up to 'want' blocks, growing
+    // the preceding extent when the blocks after it are free.
+    mx_status_t ExtentAlloc(uint32_t n, uint32_t want, uint32_t* bno, uint32_t* run);
+    // Makes room in the extent tree for one more extent near 'n'.
+    mx_status_t ExtentReserve(uint32_t n);
+
     // Deletes all blocks (relateive to a file) from "start" (inclusive) to the end
     // of the file. Does not update mtime/atime.
     mx_status_t BlocksShrink(uint32_t start);
+    // Releases the blocks preallocated past the end of the file, if any.
+    mx_status_t PreallocTrim();
+    // Whether blocks may be mapped past the end of the file. Exact for inline
+    // extents; assumed for a tree, whose last leaf would need to be read.
+    bool MapsPastEnd() const;
+    // Undoes a failed write which began at a file size of 'old_size' and
+    // wrote up to 'end': shrinks the file back to whichever is larger, and
+    // releases the blocks mapped past it.
+    void WriteUnwind(size_t old_size, size_t end);
 
     // Update the vnode's inode and write it to disk
     void InodeSync(uint32_t flags);
@@ -195,7 +304,52 @@ private:
     // Directories only
     mx_status_t ForEachDirent(DirArgs* args,
                               mx_status_t (*func)(VnodeMinfs*, minfs_dirent_t*, DirArgs*,
-                                                  DirectoryOffset*));
+                                                  DirectoryOffset*),
+                              size_t off = 0);
+    // As ForEachDirent, but only calls 'func' on dirents which may be named
+    // 'args->name', found through the directory entry cache.
+    mx_status_t ForNamedDirent(DirArgs* args,
+                               mx_status_t (*func)(VnodeMinfs*, minfs_dirent_t*, DirArgs*,
+                                                   DirectoryOffset*));
+    // Adds the dirent described by 'args' in the first free space which fits.
+    mx_status_t AppendDirent(DirArgs* args);
+
+    // Directory entry cache (dir-index.cpp)
+    // Loads the cache from the directory index, or builds it in one pass over
+    // the directory if it has none.
+    mx_status_t DirCacheLoad();
+    mx_status_t DirCacheScan();
+    mx_status_t DirIndexRead();
+    // Rehashes the cache into 'slots' slots, a power of two.
+    mx_status_t DirCacheResize(uint32_t slots);
+    // Forgets the cache, and releases the directory index.
+    void DirCacheDrop();
+    // Writes the whole cache to newly allocated blocks as the directory index,
+    // then releases the old index.
+    mx_status_t DirIndexWrite();
+    // Writes the index blocks holding slots 'first' through 'last', which
+    // may wrap around the end of the table.
+    mx_status_t DirIndexWriteSlots(uint32_t first, uint32_t last);
+    void DirIndexFree();
+
+    // The (hash, offset) of each dirent but "." and "..", in a linear-probing
+    // hash table. Mirrors the directory index, when there is one.
+    mxtl::unique_ptr<minfs_dir_slot_t[]> dir_slots_;
+    uint32_t dir_slot_count_;
+    uint32_t dir_slot_used_;
+    // Set when writing the index failed for lack of contiguous space, so
+    // that it is only tried again once the cache has grown.
+    bool dir_index_deferred_;
+
+    // Files only: blocks may be mapped past the end of the file, preallocated
+    // by an appending write, either since the vnode was loaded or before.
+    bool prealloc_;
+
+    // Serializes reads, writes, truncation and attribute updates of this
+    // vnode, so that those of different files proceed in parallel. Directory
+    // operations are serialized by vfs_lock instead. Taken before the block
+    // cache's transaction lock.
+    mxtl::Mutex lock_;
 
 #ifdef __Fuchsia__
     // The following functionality interacts with handles directly, and are not applicable outside
@@ -205,9 +359,15 @@ private:
 
     // TODO(smklein): When we have can register MinFS as a pager service, and
     // it can properly handle pages faults on a vnode's contents, then we can
-    // avoid reading the entire file up-front. Until then, read the contents of
-    // a VMO into memory when it is read/written.
+    // let the kernel fault pages in. Until then, blocks are read into the VMO
+    // on first access, and |vmo_populated_| tracks which ones are present.
     mx_handle_t vmo_;
+    bitmap::RawBitmapGeneric<bitmap::DefaultStorage> vmo_populated_;
+
+    // Sequential read detection: the offset following the previous read, and
+    // the number of blocks to read ahead past the next read which misses.
+    size_t readahead_off_;
+    uint32_t readahead_window_;
 #endif
 };
 
@@ -219,11 +379,23 @@ void minfs_dump_info(minfs_info_t* info);
 
 int minfs_mkfs(Bcache* bc);
 
+// Rewrites a version 2 volume in the current format.
+int minfs_convert(Bcache* bc);
+
 mx_status_t check_inode(CheckMaps*, const Minfs*, uint32_t, uint32_t);
 mx_status_t minfs_check(Bcache* bc);
 
+// Maps logical block 'n' of 'inode' to 'bno' (0 for a hole) and sets 'run' to
+// the number of blocks from 'n' which continue the mapping.
+mx_status_t minfs_extent_map(Bcache* bc, const minfs_inode_t* inode, uint32_t n,
+                             uint32_t* bno, uint32_t* run);
+
 mx_status_t minfs_mount(VnodeMinfs** root_out, Bcache* bc);
 
+// Checks that the dirent at 'off', of which 'bytes_read' bytes were read, is
+// well formed.
+mx_status_t validate_dirent(minfs_dirent_t* de, size_t bytes_read, size_t off);
+
 void minfs_dir_init(void* bdata, uint32_t ino_self, uint32_t ino_parent);
 
 // vfs dispatch
@@ -37,6 +37,9 @@ void minfs_dump_info(minfs_info_t* info) {
     printf("minfs: inode bitmap @ %10u\n", info->ibm_block);
     printf("minfs: alloc bitmap @ %10u\n", info->abm_block);
     printf("minfs: inode table  @ %10u\n", info->ino_block);
+    if (info->jnl_blocks != 0) {
+        printf("minfs: journal      @ %10u (%u blocks)\n", info->jnl_block, info->jnl_blocks);
+    }
     printf("minfs: data blocks  @ %10u\n", info->dat_block);
 }
 
@@ -49,6 +52,9 @@ mx_status_t minfs_check_info(minfs_info_t* info, uint32_t max) {
     if (info->version != kMinfsVersion) {
         error("minfs: FS Version: %08x. Driver version: %08x\n", info->version,
               kMinfsVersion);
+        if (info->version == kMinfsVersionBlockMap) {
+            error("minfs: mount the filesystem to convert it\n");
+        }
         return ERR_INVALID_ARGS;
     }
     if ((info->block_size != kMinfsBlockSize) ||
@@ -60,6 +66,14 @@ mx_status_t minfs_check_info(minfs_info_t* info, uint32_t max) {
         error("minfs: too large for device\n");
         return ERR_INVALID_ARGS;
     }
+    if (info->jnl_blocks != 0) {
+        uint32_t inoblks = (info->inode_count + kMinfsInodesPerBlock - 1) / kMinfsInodesPerBlock;
+        if ((info->jnl_block < info->ino_block + inoblks) ||
+            (info->jnl_block + info->jnl_blocks > info->dat_block)) {
+            error("minfs: journal overlaps inode table or data\n");
+            return ERR_INVALID_ARGS;
+        }
+    }
     //TODO: validate layout
     return 0;
 }
@@ -76,13 +90,12 @@ mx_status_t Minfs::InodeSync(uint32_t ino, const minfs_inode_t* inode) {
 #endif
     memcpy((void*)((uintptr_t)inodata + off_of_ino), inode, kMinfsInodeSize);
 
-    // commit blocks to disk
+    // commit blocks to disk (or to the block cache, in write-back mode)
     uint32_t bno_of_ino = info_.ino_block + (ino / kMinfsInodesPerBlock);
-    bc_->Writeblk(bno_of_ino, inodata);
-    return NO_ERROR;
+    return bc_->WriteCached(bno_of_ino, inodata);
 }
 
-Minfs::Minfs(Bcache* bc, minfs_info_t* info) : bc_(bc) {
+Minfs::Minfs(Bcache* bc, minfs_info_t* info) : bc_(bc), group_count_(0), inodes_per_group_(1) {
     memcpy(&info_, info, sizeof(minfs_info_t));
 }
 
@@ -105,57 +118,47 @@ mx_status_t Minfs::InoFree(const minfs_inode_t& inode, uint32_t ino) {
     memcpy(block_ibm->data(), bmdata, kMinfsBlockSize);
     bc_->Put(block_ibm, kBlockDirty);
 
-    mxtl::RefPtr<BlockNode> bitmap_blk;
-
-    // release all direct blocks
-    for (unsigned n = 0; n < kMinfsDirect; n++) {
-        if (inode.dnum[n] == 0) {
-            continue;
-        }
-        if ((bitmap_blk = BitmapBlockGet(bitmap_blk, inode.dnum[n])) == nullptr) {
-            return ERR_IO;
-        }
-        block_map_.Clear(inode.dnum[n], inode.dnum[n] + 1);
+    // release the directory index, all data blocks, then the leaves which
+    // mapped them
+    mx_status_t status;
+    if ((inode.dir_index != 0) &&
+        ((status = BlocksMark(inode.dir_index, inode.dir_index_blocks, false)) != NO_ERROR)) {
+        return status;
     }
-
-    // release all indirect blocks
-    for (unsigned n = 0; n < kMinfsIndirect; n++) {
-        if (inode.inum[n] == 0) {
-            continue;
-        }
-        mxtl::RefPtr<BlockNode> blk;
-        if ((blk = bc_->Get(inode.inum[n])) == nullptr) {
-            BitmapBlockPut(bitmap_blk);
+    uint32_t freed = 0;
+    uint32_t count = inode.ext_count;
+    minfs_extent_t ext[kMinfsInlineExtents];
+    memcpy(ext, inode.ext, sizeof(ext));
+    if (inode.ext_depth == 0) {
+        return ExtentsFree(ext, &count, 0, &freed);
+    }
+    for (uint32_t n = 0; n < count; n++) {
+        mxtl::RefPtr<BlockNode> leaf;
+        if ((leaf = bc_->Get(ext[n].bno)) == nullptr) {
             return ERR_IO;
         }
-        uint32_t* entry = static_cast<uint32_t*>(blk->data());
-        // release the blocks pointed at by the entries in the indirect block
-        for (unsigned m = 0; m < (kMinfsBlockSize / sizeof(uint32_t)); m++) {
-            if (entry[m] == 0) {
-                continue;
-            }
-            if ((bitmap_blk = BitmapBlockGet(bitmap_blk, entry[m])) == nullptr) {
-                bc_->Put(blk, 0);
-                return ERR_IO;
-            }
-            block_map_.Clear(entry[m], entry[m] + 1);
+        // Freeing everything leaves the extents themselves untouched.
+        uint32_t length = ext[n].length;
+        status = ExtentsFree(static_cast<minfs_extent_t*>(leaf->data()), &length, 0, &freed);
+        bc_->Put(mxtl::move(leaf), 0);
+        if (status != NO_ERROR) {
+            return status;
         }
-        bc_->Put(blk, 0);
-        // release the direct block itself
-        if ((bitmap_blk = BitmapBlockGet(bitmap_blk, inode.inum[n])) == nullptr) {
-            return ERR_IO;
+        if ((status = BlocksMark(ext[n].bno, 1, false)) != NO_ERROR) {
+            return status;
         }
-        block_map_.Clear(inode.inum[n], inode.inum[n] + 1);
     }
-    BitmapBlockPut(bitmap_blk);
-
     return NO_ERROR;
 }
 
-mx_status_t Minfs::InoNew(const minfs_inode_t* inode, uint32_t* ino_out) {
+mx_status_t Minfs::InoNew(const minfs_inode_t* inode, uint32_t hint, uint32_t* ino_out) {
     size_t bitoff_start;
-    mx_status_t status = inode_map_.Find(false, 0, inode_map_.size(), 1, &bitoff_start);
-    if (status != NO_ERROR) {
+    hint = mxtl::min(hint, static_cast<uint32_t>(inode_map_.size()) - 1);
+    mx_status_t status;
+    if (((status = inode_map_.Find(false, hint, inode_map_.size(), 1,
+                                   &bitoff_start)) != NO_ERROR) &&
+        ((hint == 0) ||
+         ((status = inode_map_.Find(false, 0, hint, 1, &bitoff_start)) != NO_ERROR))) {
         return status;
     }
     status = inode_map_.Set(bitoff_start, bitoff_start + 1);
@@ -194,7 +197,18 @@ mx_status_t Minfs::InoNew(const minfs_inode_t* inode, uint32_t* ino_out) {
     return NO_ERROR;
 }
 
-mx_status_t Minfs::VnodeNew(VnodeMinfs** out, uint32_t type) {
+uint32_t Minfs::DirGroup(uint32_t parent_group) const {
+    uint32_t best = (parent_group + 1) % group_count_;
+    for (uint32_t n = 2; n <= group_count_; n++) {
+        uint32_t g = (parent_group + n) % group_count_;
+        if (group_free_[g] > group_free_[best]) {
+            best = g;
+        }
+    }
+    return best;
+}
+
+mx_status_t Minfs::VnodeNew(VnodeMinfs** out, uint32_t type, uint32_t parent_ino) {
     if ((type != kMinfsTypeFile) && (type != kMinfsTypeDir)) {
         return ERR_INVALID_ARGS;
     }
@@ -207,8 +221,13 @@ mx_status_t Minfs::VnodeNew(VnodeMinfs** out, uint32_t type) {
         return status;
     }
 
-    // Allocate the on-disk inode
-    if ((status = InoNew(&vn->inode_, &vn->ino_)) != NO_ERROR) {
+    // Allocate the on-disk inode: files next to their directory, directories
+    // wherever there is the most room for them to grow.
+    uint32_t group = parent_ino / inodes_per_group_;
+    if ((type == kMinfsTypeDir) && (group_count_ > 1)) {
+        group = DirGroup(group);
+    }
+    if ((status = InoNew(&vn->inode_, group * inodes_per_group_, &vn->ino_)) != NO_ERROR) {
         delete vn;
         return status;
     }
@@ -254,58 +273,15 @@ mx_status_t Minfs::VnodeGet(VnodeMinfs** out, uint32_t ino) {
 
     vn->fs_ = this;
     vn->ino_ = ino;
+    // Blocks preallocated before the vnode was last released (or before a
+    // crash) are not recorded as such on disk; find them from the extents.
+    vn->prealloc_ = !vn->IsDirectory() && vn->MapsPastEnd();
     vnode_hash_.insert(vn);
 
     *out = vn;
     return NO_ERROR;
 }
 
-// Allocate a new data block from the block bitmap.
-// Return the underlying block (obtained via Bcache::Get()), if 'out_block' is not nullptr.
-//
-// If hint is nonzero it indicates which block number to start the search for
-// free blocks from.
-mx_status_t Minfs::BlockNew(uint32_t hint, uint32_t* out_bno, mxtl::RefPtr<BlockNode> *out_block) {
-    size_t bitoff_start;
-    mx_status_t status;
-    if ((status = block_map_.Find(false, hint, block_map_.size(), 1, &bitoff_start)) != NO_ERROR) {
-        if ((status = block_map_.Find(false, 0, hint, 1, &bitoff_start)) != NO_ERROR) {
-            return ERR_NO_SPACE;
-        }
-    }
-    status = block_map_.Set(bitoff_start, bitoff_start + 1);
-    assert(status == NO_ERROR);
-    uint32_t bno = static_cast<uint32_t>(bitoff_start);
-    assert(bno != 0); // Cannot allocate root block
-
-    // obtain the in-memory bitmap block
-    uint32_t bmbno;
-    void *bmdata = GetBitBlock(block_map_, &bmbno, bno); // bmbno relative to bitmap
-    bmbno += info_.abm_block;                            // bmbno relative to block device
-
-    // obtain the block of the alloc bitmap we need
-    mxtl::RefPtr<BlockNode> block_abm;
-    if ((block_abm = bc_->Get(bmbno)) == nullptr) {
-        block_map_.Clear(bno, bno + 1);
-        return ERR_IO;
-    }
-
-    // obtain the block we're allocating, if requested.
-    if (out_block != nullptr) {
-        if ((*out_block = bc_->GetZero(bno)) == nullptr) {
-            block_map_.Clear(bno, bno + 1);
-            bc_->Put(block_abm, 0);
-            return ERR_IO;
-        }
-    }
-
-    // commit the bitmap
-    memcpy(block_abm->data(), bmdata, kMinfsBlockSize);
-    bc_->Put(block_abm, kBlockDirty);
-    *out_bno = bno;
-    return NO_ERROR;
-}
-
 void minfs_dir_init(void* bdata, uint32_t ino_self, uint32_t ino_parent) {
 #define DE0_SIZE DirentSize(1)
 
@@ -365,6 +341,9 @@ mx_status_t Minfs::Create(Minfs** out, Bcache* bc, minfs_info_t* info) {
     if ((status = fs->LoadBitmaps()) < 0) {
         return status;
     }
+    if ((status = fs->LoadGroups()) < 0) {
+        return status;
+    }
 
 #ifdef __Fuchsia__
     // Create the inode table.
@@ -375,12 +354,8 @@ mx_status_t Minfs::Create(Minfs** out, Bcache* bc, minfs_info_t* info) {
         return status;
     }
 
-    for (uint32_t n = 0; n < inoblks; n++) {
-        void* bmdata = (void*)((uintptr_t)(fs->inode_table_->GetData()) +
-                               (uintptr_t)(kMinfsBlockSize * n));
-        if (fs->bc_->Readblk(fs->info_.ino_block + n, bmdata)) {
-            error("minfs: failed reading inode table\n");
-        }
+    if (fs->bc_->Readblks(fs->info_.ino_block, inoblks, fs->inode_table_->GetData())) {
+        error("minfs: failed reading inode table\n");
     }
 #endif
 
@@ -389,17 +364,41 @@ mx_status_t Minfs::Create(Minfs** out, Bcache* bc, minfs_info_t* info) {
 }
 
 mx_status_t Minfs::LoadBitmaps() {
-    for (uint32_t n = 0; n < abmblks_; n++) {
-        void* bmdata = GetBlock(block_map_, n);
-        if (bc_->Readblk(info_.abm_block + n, bmdata)) {
-            error("minfs: failed reading alloc bitmap\n");
-        }
+    // Each bitmap is contiguous both on disk and in memory.
+    if (bc_->Readblks(info_.abm_block, abmblks_, GetBlock(block_map_, 0))) {
+        error("minfs: failed reading alloc bitmap\n");
+    }
+    if (bc_->Readblks(info_.ibm_block, ibmblks_, GetBlock(inode_map_, 0))) {
+        error("minfs: failed reading inode bitmap\n");
+    }
+    // The bitmaps were filled behind their backs; summarize them afresh.
+    mx_status_t status;
+    if (((status = block_map_.BuildSummary()) != NO_ERROR) ||
+        ((status = inode_map_.BuildSummary()) != NO_ERROR)) {
+        return status;
     }
-    for (uint32_t n = 0; n < ibmblks_; n++) {
-        void* bmdata = GetBlock(inode_map_, n);
-        if (bc_->Readblk(info_.ibm_block + n, bmdata)) {
-            error("minfs: failed reading inode bitmap\n");
+    return NO_ERROR;
+}
+
+mx_status_t Minfs::LoadGroups() {
+    group_count_ = (info_.block_count + kMinfsBlocksPerGroup - 1) / kMinfsBlocksPerGroup;
+    inodes_per_group_ = (info_.inode_count + group_count_ - 1) / group_count_;
+    AllocChecker ac;
+    uint32_t* group_free = new (&ac) uint32_t[group_count_];
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    group_free_.reset(group_free, group_count_);
+    for (uint32_t g = 0; g < group_count_; g++) {
+        size_t start = g * kMinfsBlocksPerGroup;
+        size_t end = mxtl::min(start + kMinfsBlocksPerGroup, block_map_.size());
+        uint32_t free = 0;
+        while ((start = block_map_.Scan(start, end, true)) < end) {
+            size_t run_end = block_map_.Scan(start, end, false);
+            free += static_cast<uint32_t>(run_end - start);
+            start = run_end;
         }
+        group_free_[g] = free;
     }
     return NO_ERROR;
 }
@@ -413,6 +412,32 @@ mx_status_t minfs_mount(VnodeMinfs** out, Bcache* bc) {
         return status;
     }
 
+    if ((info.magic0 == kMinfsMagic0) && (info.magic1 == kMinfsMagic1) &&
+        (info.version == kMinfsVersionBlockMap)) {
+        // Volumes from before extents are converted in place, once. This
+        // replays the journal, if there is one.
+        printf("minfs: converting filesystem to version %u\n", kMinfsVersion);
+        if (minfs_convert(bc) != 0) {
+            error("minfs: could not convert filesystem\n");
+            return ERR_IO;
+        }
+        if ((status = bc->Read(0, &info, 0, sizeof(info))) != NO_ERROR) {
+            error("minfs: could not read info block\n");
+            return status;
+        }
+    }
+
+    // Replay before anything is read from the rest of the volume.
+    if ((info.jnl_blocks != 0) && !bc->HasJournal()) {
+        if ((status = minfs_check_info(&info, bc->Maxblk())) != NO_ERROR) {
+            return status;
+        }
+        if ((status = bc->AttachJournal(info.jnl_block, info.jnl_blocks)) != NO_ERROR) {
+            error("minfs: could not replay journal\n");
+            return status;
+        }
+    }
+
     Minfs* fs;
     if ((status = Minfs::Create(&fs, bc, &info)) != NO_ERROR) {
         error("minfs: mount failed\n");
@@ -458,11 +483,14 @@ int minfs_mkfs(Bcache* bc) {
     //  - Inode bitmap
     //  - Block bitmap
     //  - Inode table
+    //  - Journal
     // To an 8-block boundary on disk, allowing for future expansion.
     info.ibm_block = 8;
     info.abm_block = info.ibm_block + mxtl::roundup(ibmblks, 8u);
     info.ino_block = info.abm_block + mxtl::roundup(abmblks, 8u);
-    info.dat_block = info.ino_block + inoblks;
+    info.jnl_block = info.ino_block + mxtl::roundup(inoblks, 8u);
+    info.jnl_blocks = kMinfsJournalBlocks;
+    info.dat_block = info.jnl_block + info.jnl_blocks;
     minfs_dump_info(&info);
 
     RawBitmap abm;
@@ -507,26 +535,34 @@ int minfs_mkfs(Bcache* bc) {
     // reserve the first data block (for root directory)
     abm.Set(0, info.dat_block + 1);
 
-    // write allocation bitmap
-    for (uint32_t n = 0; n < abmblks; n++) {
-        void* bmdata = GetBlock(abm, n);
-        blk = bc->GetZero(info.abm_block + n);
-        memcpy(blk->data(), bmdata, kMinfsBlockSize);
-        bc->Put(blk, kBlockDirty);
+    // write allocation and inode bitmaps
+    if (bc->Writeblks(info.abm_block, abmblks, GetBlock(abm, 0)) != NO_ERROR) {
+        error("mkfs: Failed to write block bitmap\n");
+        return ERR_IO;
+    }
+    if (bc->Writeblks(info.ibm_block, ibmblks, GetBlock(ibm, 0)) != NO_ERROR) {
+        error("mkfs: Failed to write inode bitmap\n");
+        return ERR_IO;
     }
 
-    // write inode bitmap
-    for (uint32_t n = 0; n < ibmblks; n++) {
-        void* bmdata = GetBlock(ibm, n);
-        blk = bc->GetZero(info.ibm_block + n);
-        memcpy(blk->data(), bmdata, kMinfsBlockSize);
-        bc->Put(blk, kBlockDirty);
+    // write inodes, a chunk of zeroed blocks at a time
+    constexpr uint32_t kZeroBlocks = 16;
+    AllocChecker ac;
+    mxtl::unique_ptr<uint8_t[]> zero(new (&ac) uint8_t[kZeroBlocks * kMinfsBlockSize]());
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    for (uint32_t n = 0; n < inoblks; n += kZeroBlocks) {
+        uint32_t count = mxtl::min(inoblks - n, kZeroBlocks);
+        if (bc->Writeblks(info.ino_block + n, count, zero.get()) != NO_ERROR) {
+            error("mkfs: Failed to write inode table\n");
+            return ERR_IO;
+        }
     }
 
-    // write inodes
-    for (uint32_t n = 0; n < inoblks; n++) {
-        blk = bc->GetZero(info.ino_block + n);
-        bc->Put(blk, kBlockDirty);
+    if (Journal::Format(bc, info.jnl_block, info.jnl_blocks) != NO_ERROR) {
+        error("mkfs: Failed to write journal\n");
+        return ERR_IO;
     }
 
     // setup root inode
@@ -537,7 +573,9 @@ int minfs_mkfs(Bcache* bc) {
     ino[kMinfsRootIno].block_count = 1;
     ino[kMinfsRootIno].link_count = 1;
     ino[kMinfsRootIno].dirent_count = 2;
-    ino[kMinfsRootIno].dnum[0] = info.dat_block;
+    ino[kMinfsRootIno].ext_count = 1;
+    ino[kMinfsRootIno].ext[0].bno = info.dat_block;
+    ino[kMinfsRootIno].ext[0].length = 1;
     bc->Put(blk, kBlockDirty);
 
     blk = bc->GetZero(0);
@@ -9,9 +9,11 @@
 #include <mxtl/intrusive_double_list.h>
 #include <mxtl/intrusive_hash_table.h>
 #include <mxtl/macros.h>
+#include <mxtl/mutex.h>
 #include <mxtl/ref_counted.h>
 #include <mxtl/ref_ptr.h>
 #include <mxtl/unique_free_ptr.h>
+#include <mxtl/unique_ptr.h>
 
 #include <magenta/types.h>
 
@@ -19,9 +21,15 @@
 #include <limits.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <threads.h>
 
 #include "misc.h"
 
+#ifdef __Fuchsia__
+#include <block-client/client.h>
+#include <fs/mapped-vmo.h>
+#endif
+
 #ifdef __Fuchsia__
 using RawBitmap = bitmap::RawBitmapGeneric<bitmap::VmoStorage>;
 #else
@@ -34,7 +42,10 @@ namespace minfs {
 
 constexpr uint64_t kMinfsMagic0 = (0x002153466e694d21ULL);
 constexpr uint64_t kMinfsMagic1 = (0x385000d3d3d3d304ULL);
-constexpr uint32_t kMinfsVersion = 0x00000002;
+constexpr uint32_t kMinfsVersion = 0x00000003;
+// Inodes map blocks through direct and indirect block tables
+// (minfs_inode_v2_t). Such volumes are converted when they are mounted.
+constexpr uint32_t kMinfsVersionBlockMap = 0x00000002;
 
 constexpr uint32_t kMinfsRootIno        = 1;
 constexpr uint32_t kMinfsFlagClean      = 1;
@@ -43,12 +54,11 @@ constexpr uint32_t kMinfsBlockBits      = (kMinfsBlockSize * 8);
 constexpr uint32_t kMinfsInodeSize      = 256;
 constexpr uint32_t kMinfsInodesPerBlock = (kMinfsBlockSize / kMinfsInodeSize);
 
-constexpr uint32_t kMinfsDirect   = 16;
-constexpr uint32_t kMinfsIndirect = 32;
+constexpr uint32_t kMinfsInlineExtents = 15;
 
 // not possible to have a block at or past this one
-// due to the limitations of the inode and indirect blocks
-constexpr uint64_t kMinfsMaxFileBlock = (kMinfsDirect + kMinfsIndirect * (kMinfsBlockSize / sizeof(uint32_t)));
+// due to the 32-bit inode size
+constexpr uint64_t kMinfsMaxFileBlock = (UINT32_MAX / kMinfsBlockSize);
 constexpr uint64_t kMinfsMaxFileSize  = kMinfsMaxFileBlock * kMinfsBlockSize;
 
 constexpr uint32_t kMinfsTypeFile = 8;
@@ -72,14 +82,16 @@ typedef struct {
     uint32_t abm_block;     // first blockno of block allocation bitmap
     uint32_t ino_block;     // first blockno of inode table
     uint32_t dat_block;     // first blockno available for file data
+    uint32_t jnl_block;     // first blockno of metadata journal
+    uint32_t jnl_blocks;    // size of metadata journal (0 if none)
 } minfs_info_t;
 
 // Notes:
-// - the ibm, abm, ino, and dat regions must be in that order
-//   and may not overlap
+// - the ibm, abm, ino, jnl (if present), and dat regions must be in
+//   that order and may not overlap
 // - the abm has an entry for every block on the volume, including
 //   the info block (0), the bitmaps, etc
-// - data blocks referenced from direct and indirect block tables
+// - data blocks referenced from extents (and extent leaf blocks)
 //   in inodes are also relative to (0), but it is not legal for
 //   a block number of less than dat_block (start of data blocks)
 //   to be used
@@ -88,6 +100,12 @@ typedef struct {
 //   at offset: ino % kMinfsInodesPerBlock
 // - inode 0 is never used, should be marked allocated but ignored
 
+typedef struct {
+    uint32_t start;                 // first logical block
+    uint32_t bno;                   // first device block
+    uint32_t length;                // in blocks
+} minfs_extent_t;
+
 typedef struct {
     uint32_t magic;
     uint32_t size;
@@ -98,14 +116,53 @@ typedef struct {
     uint32_t seq_num;               // bumped when modified
     uint32_t gen_num;               // bumped when deleted
     uint32_t dirent_count;          // for directories
-    uint32_t rsvd[5];
-    uint32_t dnum[kMinfsDirect];    // direct blocks
-    uint32_t inum[kMinfsIndirect];  // indirect blocks
+    uint32_t dir_index;             // directories: first block of the hash index, or 0
+    uint32_t dir_index_blocks;      // directories: length of the hash index
+    uint32_t rsvd[3];
+    uint16_t ext_count;             // entries used in ext[]
+    uint16_t ext_depth;             // 0: ext[] maps data; 1: ext[] indexes leaves
+    minfs_extent_t ext[kMinfsInlineExtents];
+    uint32_t rsvd2[2];
 } minfs_inode_t;
 
 static_assert(sizeof(minfs_inode_t) == kMinfsInodeSize,
               "minfs inode size is wrong");
 
+// Extent tree
+//
+// With ext_depth 0, ext[] holds up to kMinfsInlineExtents extents, sorted by
+// logical block and not overlapping. Logical blocks not covered by an extent
+// are holes. With ext_depth 1, each entry of ext[] instead describes a leaf
+// block: 'bno' is its location, 'length' is the number of extents it holds
+// (packed at the start of the block, sorted), and 'start' is the logical
+// start of its first extent. Leaves are sorted and do not overlap either.
+// Blocks may be allocated past the end of the file, but are freed with it.
+
+constexpr uint32_t kMinfsExtentsPerBlock = (kMinfsBlockSize / sizeof(minfs_extent_t));
+
+// Version 2 inode, as read when converting a volume.
+
+constexpr uint32_t kMinfsDirect   = 16;
+constexpr uint32_t kMinfsIndirect = 32;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t size;
+    uint32_t block_count;
+    uint32_t link_count;
+    uint64_t create_time;
+    uint64_t modify_time;
+    uint32_t seq_num;
+    uint32_t gen_num;
+    uint32_t dirent_count;
+    uint32_t rsvd[5];
+    uint32_t dnum[kMinfsDirect];    // direct blocks
+    uint32_t inum[kMinfsIndirect];  // indirect blocks
+} minfs_inode_v2_t;
+
+static_assert(sizeof(minfs_inode_v2_t) == kMinfsInodeSize,
+              "minfs v2 inode size is wrong");
+
 typedef struct {
     uint32_t ino;                   // inode number
     uint32_t reclen;                // Low 28 bits: Length of record
@@ -140,6 +197,26 @@ constexpr uint32_t MinfsReclen(minfs_dirent_t* de, size_t off) {
 static_assert(kMinfsMaxDirectorySize <= kMinfsReclenMask,
               "MinFS directory size must be smaller than reclen mask");
 
+// Directory index
+//
+// A directory holding more than kMinfsDirIndexMinDirents entries also keeps
+// a hash table of its entries, in dir_index_blocks contiguous blocks starting
+// at dir_index. Each slot holds the fnv1a32 hash of a name and the offset of
+// its dirent; a slot with an offset of zero is empty. "." (at offset zero) and
+// ".." are not indexed. Collisions are resolved by linear probing over the
+// whole table, whose size is a power of two. The index is metadata, updated
+// in the same transaction as the dirents it describes, so very large
+// directories, whose index would not fit in one, go without. Directories
+// without one are searched linearly.
+
+typedef struct {
+    uint32_t hash;
+    uint32_t off;
+} minfs_dir_slot_t;
+
+constexpr uint32_t kMinfsDirSlotsPerBlock   = (kMinfsBlockSize / sizeof(minfs_dir_slot_t));
+constexpr uint32_t kMinfsDirIndexMinDirents = 256;
+
 // Notes:
 // - dirents with ino of 0 are free, and skipped over on lookup
 // - reclen must be a multiple of 4
@@ -149,9 +226,52 @@ static_assert(kMinfsMaxDirectorySize <= kMinfsReclenMask,
 //   also increase in size.
 
 
-// blocksize   8K    16K    32K
-// 16 dir =  128K   256K   512K
-// 32 ind =  512M  1024M  2048M
+// Metadata journal
+//
+// Metadata blocks (inode table, bitmaps, extent leaf and directory blocks) are
+// written to the journal before being written in place. Each transaction is
+// a header block listing the home location of every block image that
+// follows it, the images themselves, and a commit block whose checksum covers
+// the header and images. Block 0 of the journal records the sequence number
+// and position of the first transaction which may not yet be in place;
+// transactions are replayed from there for as long as sequence numbers
+// increase and commit blocks are intact.
+
+constexpr uint64_t kMinfsJournalMagic       = (0x6c6e724a73666e4dULL); // "MnfsJrnl"
+constexpr uint64_t kMinfsJournalHeaderMagic = (0x7264684a73666e4dULL); // "MnfsJhdr"
+constexpr uint64_t kMinfsJournalCommitMagic = (0x746d634a73666e4dULL); // "MnfsJcmt"
+constexpr uint32_t kMinfsJournalBlocks      = 256;
+
+constexpr uint32_t kMinfsJournalMaxEntries  = (kMinfsBlockSize - 24) / sizeof(uint32_t);
+
+typedef struct {
+    uint64_t magic;
+    uint64_t seq;           // sequence number of the first transaction to replay
+    uint32_t start;         // journal block holding that transaction
+    uint32_t reserved;
+} minfs_journal_info_t;
+
+typedef struct {
+    uint64_t magic;
+    uint64_t seq;
+    uint32_t count;         // number of block images following the header
+    uint32_t reserved;
+    uint32_t bno[kMinfsJournalMaxEntries];  // home location of each image
+} minfs_journal_header_t;
+
+static_assert(sizeof(minfs_journal_header_t) == kMinfsBlockSize,
+              "minfs journal header must fill a block");
+
+typedef struct {
+    uint64_t magic;
+    uint64_t seq;
+    uint32_t count;
+    uint32_t checksum;      // fnv1a32 of the header and block images
+} minfs_journal_commit_t;
+
+// blocksize        8K     16K     32K
+// extents/leaf =   682    1365    2730
+// max extents  = 10230   20475   40950
 
 //  1GB ->  128K blocks ->  16K bitmap (2K qword)
 //  4GB ->  512K blocks ->  64K bitmap (8K qword)
@@ -217,6 +337,8 @@ class BcacheLists {
 public:
     void PushBack(mxtl::RefPtr<BlockNode> blk, uint32_t block_type);
     mxtl::RefPtr<BlockNode> PopFront(uint32_t block_type);
+    // Like PopFront(), but passes over dirty blocks.
+    mxtl::RefPtr<BlockNode> PopFrontClean(uint32_t block_type);
     mxtl::RefPtr<BlockNode> Erase(mxtl::RefPtr<BlockNode> blk, uint32_t block_type);
 
 private:
@@ -229,10 +351,52 @@ private:
     LinkedList list_free_;  // Never been used. Not in hash.
 };
 
+// Write-ahead log of metadata blocks (journal.cpp). Owned by the Bcache,
+// which commits each flush of dirty blocks as one transaction.
+class Journal {
+public:
+    DISALLOW_COPY_ASSIGN_AND_MOVE(Journal);
+
+    // Opens the journal occupying 'blocks' blocks from 'start'. Does not
+    // replay it.
+    static mx_status_t Create(mxtl::unique_ptr<Journal>* out, Bcache* bc,
+                              uint32_t start, uint32_t blocks);
+
+    // Writes an empty journal.
+    static mx_status_t Format(Bcache* bc, uint32_t start, uint32_t blocks);
+
+    // Walks the transactions which may not be in place yet, verifying each.
+    // With 'apply', writes them in place and empties the journal.
+    mx_status_t Replay(bool apply, bool verbose, uint32_t* txns_out);
+
+    // Durably appends a transaction holding the given blocks.
+    mx_status_t Commit(BlockNode* const* blocks, uint32_t count);
+
+    // Records that every committed transaction is now in place.
+    mx_status_t Checkpoint();
+
+private:
+    Journal(Bcache* bc, uint32_t start, uint32_t blocks);
+
+    mx_status_t WriteInfo(uint64_t seq, uint32_t start);
+
+    Bcache* bc_;
+    uint32_t start_;   // First device block of the journal.
+    uint32_t blocks_;  // Size of the journal, including the info block.
+    uint64_t seq_;     // Sequence number of the next transaction.
+    uint32_t head_;    // Journal block at which it will be written.
+    // Whether every committed transaction has been checkpointed. A failed
+    // in-place write leaves its transaction needed until a later one that
+    // rewrites the same blocks is checkpointed.
+    bool in_place_ = true;
+    mxtl::unique_ptr<uint8_t[]> buf_;  // Staging for one whole transaction.
+};
+
 class Bcache {
 public:
     DISALLOW_COPY_ASSIGN_AND_MOVE(Bcache);
     friend class BlockNode;
+    friend class Journal;
 
     static mx_status_t Create(Bcache** out, int fd, uint32_t blockmax, uint32_t blocksize,
                               uint32_t num);
@@ -242,10 +406,54 @@ public:
     mx_status_t Readblk(uint32_t bno, void* data);
     mx_status_t Writeblk(uint32_t bno, const void* data);
 
+    // Raw read/write of |count| consecutive blocks starting at 'bno'.
+    mx_status_t Readblks(uint32_t bno, uint32_t count, void* data);
+    mx_status_t Writeblks(uint32_t bno, uint32_t count, const void* data);
+
+#ifdef __Fuchsia__
+    // Move raw block I/O off read()/write() on the fd and onto the block
+    // device's FIFO, staging data through a VMO shared with the device.
+    // On failure (e.g. the device already has a FIFO client) the fd path
+    // stays in use.
+    mx_status_t AttachFifo();
+#endif
+
+    // In write-back mode, dirty blocks released by Put() stay in the cache
+    // and are written out later, sorted by block number and coalesced into
+    // multi-block writes. A flush happens on Sync(), when too many blocks are
+    // dirty or a dirty block must be evicted, and (on Fuchsia) periodically
+    // from a background thread. Write-through, the default, writes every dirty
+    // block as it is released.
+    mx_status_t SetWriteback(bool enable);
+
+    // Write all dirty, non-busy blocks to disk.
+    mx_status_t Flush();
+
+    // Journal the metadata region at [start, start + blocks), replaying any
+    // transactions left by an unclean shutdown. Once attached, each flush
+    // commits its blocks to the journal before writing them in place.
+    mx_status_t AttachJournal(uint32_t start, uint32_t blocks);
+    bool HasJournal() const { return journal_ != nullptr; }
+
+    // Operations bracket their metadata updates with TxnBegin() and
+    // TxnEnd(), so that a flush (and so a journal transaction) only happens
+    // between operations. The exception is evicting a dirty block, which
+    // cannot wait.
+    //
+    // Only one thread at a time may be inside a transaction; others block in
+    // TxnBegin(). Transactions nest within a thread.
+    void TxnBegin();
+    void TxnEnd();
+
+    // For testing: the next flush commits to the journal, but leaves the
+    // blocks out of place, as if the system crashed right after the commit.
+    void SimulateCrashAfterCommit() { crash_after_commit_ = true; }
+
     uint32_t Maxblk() const { return blockmax_; };
 
     // acquire a block, reading from disk if necessary,
-    // returning a handle and a pointer to the data
+    // returning a handle and a pointer to the data.
+    // If another thread holds the block, waits for it to be released.
     mxtl::RefPtr<BlockNode> Get(uint32_t bno);
     // acquire a block, not reading from disk, marking dirty,
     // and clearing to all 0s
@@ -258,6 +466,9 @@ public:
     // Helper functions which combine 'Get' and 'Put'.
     mx_status_t Read(uint32_t bno, void* data, uint32_t off, uint32_t len);
     mx_status_t Write(uint32_t bno, const void* data, uint32_t off, uint32_t len);
+    // Replaces the whole of block 'bno' through the cache, without reading
+    // its old contents.
+    mx_status_t WriteCached(uint32_t bno, const void* data);
 
     // drop all non-busy, non-dirty blocks
     void Invalidate();
@@ -272,13 +483,79 @@ private:
 
     mxtl::RefPtr<BlockNode> Get(uint32_t bno, uint32_t mode);
 
+    // Device I/O, bypassing the cache. DevWrite() is called with |lock_|
+    // held; DevRead() may be called without it.
+    mx_status_t DevRead(uint32_t bno, uint32_t count, void* data);
+    mx_status_t DevWrite(uint32_t bno, uint32_t count, const void* data);
+
+    // True if a device write since |dev_write_seq_| was |seq| may have
+    // touched [bno, bno + count). Called with |lock_| held.
+    bool WrittenSince(uint64_t seq, uint32_t bno, uint32_t count) const;
+
+    // Makes prior device writes durable.
+    mx_status_t DevSync();
+
+    void MarkDirty(BlockNode* blk);
+    void MarkClean(BlockNode* blk);
+    mx_status_t FlushLocked();
+    void InvalidateLocked();
+    // Takes a cached block to reuse for another bno, or returns null if
+    // there is none that can be given up.
+    mxtl::RefPtr<BlockNode> EvictLocked();
+
+#ifdef __Fuchsia__
+    static int WritebackThread(void* arg);
+    void StopWriteback();
+
+    // Moves |count| blocks starting at 'bno' between the device and the start
+    // of |fifo_vmo_|, as a single FIFO transaction.
+    mx_status_t FifoTxn(uint16_t opcode, uint32_t bno, uint32_t count);
+    void DetachFifo();
+#endif
+
     using HashTableBucket = mxtl::DoublyLinkedList<mxtl::RefPtr<BlockNode>, BlockNode::TypeHashTraits>;
     using HashTable = mxtl::HashTable<uint32_t, mxtl::RefPtr<BlockNode>, HashTableBucket>;
+    // Lock order: |txn_lock_|, then |lock_|, then |fifo_lock_|.
+    //
+    // Held by the thread inside a transaction, for all of it.
+    mxtl::Mutex txn_lock_;
+    // Serializes the cache lists, the dirty state and device writes. The
+    // contents of a busy block belong to whoever holds it, and are never
+    // written by a flush; Get() waits on |busy_cnd_| for a busy block.
+    mxtl::Mutex lock_;
+    cnd_t busy_cnd_;
     HashTable hash_; // Map of all 'in use' blocks, accessible by bno
     BcacheLists lists_;
     int fd_;
     uint32_t blockmax_;
     uint32_t blocksize_;
+    bool writeback_ = false;
+    uint32_t dirty_count_ = 0;
+    uint32_t txn_depth_ = 0;
+    thrd_t txn_owner_ = {};  // Valid while |txn_depth_| is nonzero.
+    bool crash_after_commit_ = false;
+    // The extents of the most recent device writes, by sequence number, so
+    // that a raw read done without |lock_| can tell whether it raced one.
+    struct DevWriteRecord {
+        uint32_t bno;
+        uint32_t count;
+    };
+    static constexpr uint32_t kDevWriteLog = 16;
+    DevWriteRecord dev_writes_[kDevWriteLog];
+    uint64_t dev_write_seq_ = 0;
+    mxtl::unique_ptr<uint8_t[]> flush_buf_;  // Staging for coalesced flushes.
+    mxtl::unique_ptr<Journal> journal_;
+#ifdef __Fuchsia__
+    thrd_t writeback_thread_;
+    bool writeback_thread_running_ = false;
+    mx_handle_t writeback_stop_ = MX_HANDLE_INVALID;  // Event signaled to stop the thread.
+
+    mxtl::Mutex fifo_lock_;  // Guards the FIFO client and the staging VMO.
+    fifo_client_t* fifo_client_ = nullptr;  // Non-null once AttachFifo() succeeds.
+    txnid_t fifo_txnid_ = 0;
+    vmoid_t fifo_vmoid_ = 0;
+    mxtl::unique_ptr<MappedVmo> fifo_vmo_;
+#endif
 };
 
 void* GetBlock(const RawBitmap& bitmap, uint32_t blkno);
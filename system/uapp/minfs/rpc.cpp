@@ -28,6 +28,10 @@ mxio_dispatcher_t* vfs_dispatcher;
 
 namespace minfs {
 
+// Requests on different channels are serviced by this many threads at once,
+// so that clients of different files do not queue behind each other's I/O.
+constexpr uint32_t kDispatchThreads = 4;
+
 mx_status_t VnodeMinfs::GetHandles(uint32_t flags, mx_handle_t* hnds,
                                    uint32_t* type, void* extra, uint32_t* esize) {
     // local vnode or device as a directory, we will create the handles
@@ -72,7 +76,7 @@ mx_handle_t vfs_rpc_server(VnodeMinfs* vn) {
     }
     //TODO: ref count
     //vn_acquire(vn);
-    mxio_dispatcher_run(vfs_dispatcher);
+    mxio_dispatcher_run_workers(vfs_dispatcher, "minfs-worker", kDispatchThreads);
     return NO_ERROR;
 }
 
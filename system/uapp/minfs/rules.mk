@@ -15,6 +15,7 @@ MODULE_SRCS := \
 # "libfs"
 MODULE_SRCS += \
     $(LOCAL_DIR)/bcache.cpp \
+    $(LOCAL_DIR)/journal.cpp \
     $(LOCAL_DIR)/rpc.cpp \
 
 # minfs implementation
@@ -22,9 +23,14 @@ MODULE_SRCS += \
     $(LOCAL_DIR)/minfs.cpp \
     $(LOCAL_DIR)/minfs-ops.cpp \
     $(LOCAL_DIR)/minfs-check.cpp \
+    $(LOCAL_DIR)/extent.cpp \
+    $(LOCAL_DIR)/dir-index.cpp \
+    $(LOCAL_DIR)/convert.cpp \
 
 MODULE_STATIC_LIBS := \
     ulib/fs \
+    ulib/block-client \
+    ulib/sync \
 
 MODULE_LIBS := \
     ulib/bitmap \
@@ -51,9 +57,57 @@ MODULE_SRCS := \
     $(LOCAL_DIR)/test.cpp \
     $(LOCAL_DIR)/host.cpp \
     $(LOCAL_DIR)/bcache.cpp \
+    $(LOCAL_DIR)/journal.cpp \
     $(LOCAL_DIR)/minfs.cpp \
     $(LOCAL_DIR)/minfs-ops.cpp \
     $(LOCAL_DIR)/minfs-check.cpp \
+    $(LOCAL_DIR)/extent.cpp \
+    $(LOCAL_DIR)/dir-index.cpp \
+    $(LOCAL_DIR)/convert.cpp \
+    system/ulib/fs/dcache.cpp \
+    system/ulib/fs/vfs.cpp \
+    system/ulib/mxcpp/new.cpp \
+    system/ulib/mxcpp/pure_virtual.cpp \
+    system/ulib/bitmap/raw-bitmap.cpp \
+
+MODULE_COMPILEFLAGS := \
+    -Werror-implicit-function-declaration \
+    -Wstrict-prototypes -Wwrite-strings \
+    -Isystem/ulib/bitmap/include \
+    -Isystem/ulib/mxcpp/include \
+    -Isystem/ulib/mxio/include \
+    -Isystem/ulib/mxtl/include \
+    -Isystem/ulib/fs/include \
+
+ifeq ($(HOST_PLATFORM),darwin)
+MODULE_DEFINES := O_DIRECTORY=0200000
+else
+MODULE_DEFINES := _POSIX_C_SOURCE=200809L
+endif
+
+include make/module.mk
+
+
+# host crash tests of the minfs journal
+
+MODULE := $(LOCAL_DIR)-journal-test
+
+MODULE_NAME := minfs-journal-test
+
+MODULE_TYPE := hostapp
+
+MODULE_SRCS := \
+    $(LOCAL_DIR)/journal-test.cpp \
+    $(LOCAL_DIR)/host.cpp \
+    $(LOCAL_DIR)/bcache.cpp \
+    $(LOCAL_DIR)/journal.cpp \
+    $(LOCAL_DIR)/minfs.cpp \
+    $(LOCAL_DIR)/minfs-ops.cpp \
+    $(LOCAL_DIR)/minfs-check.cpp \
+    $(LOCAL_DIR)/extent.cpp \
+    $(LOCAL_DIR)/dir-index.cpp \
+    $(LOCAL_DIR)/convert.cpp \
+    system/ulib/fs/dcache.cpp \
     system/ulib/fs/vfs.cpp \
     system/ulib/mxcpp/new.cpp \
     system/ulib/mxcpp/pure_virtual.cpp \
@@ -0,0 +1,223 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <magenta/compiler.h>
+#include <magenta/syscalls.h>
+#include <mxtl/unique_ptr.h>
+
+namespace {
+
+void argument_error(const char* argv0, const char* message) {
+    fprintf(stderr, "%s: error: %s\nRun with -h for help.\n", argv0, message);
+    exit(EXIT_FAILURE);
+}
+
+enum class Mode {
+    // Moves data between vmos and the socket through a userspace buffer, the
+    // way it has to be done with mx_vmo_read/mx_socket_write.
+    kBounce,
+    // Moves data between vmos and the socket with mx_socket_{write,read}_vmo.
+    kSplice,
+};
+
+// Keep each transfer well under the default socket capacity.
+constexpr size_t kMaxChunk = 64 * 1024;
+
+struct TestArgs {
+    uint32_t size;
+    Mode mode;
+};
+
+const char* mode_name(Mode mode) {
+    return mode == Mode::kSplice ? "splice" : "bounce";
+}
+
+void do_test(uint32_t duration, const TestArgs& test_args) {
+    __UNUSED mx_status_t status;
+
+    uint64_t duration_ns = duration * 1000000000ull;
+
+    // We'll write to sp[0] (and read from sp[1]).
+    mx_handle_t sp[2] = {MX_HANDLE_INVALID, MX_HANDLE_INVALID};
+    status = mx_socket_create(0u, &sp[0], &sp[1]);
+    assert(status == NO_ERROR);
+
+    // The "file" we send from and the one we receive into.
+    mx_handle_t src_vmo, dst_vmo;
+    status = mx_vmo_create(test_args.size, 0u, &src_vmo);
+    assert(status == NO_ERROR);
+    status = mx_vmo_create(test_args.size, 0u, &dst_vmo);
+    assert(status == NO_ERROR);
+
+    mxtl::unique_ptr<uint8_t[]> data(new uint8_t[test_args.size]);
+    for (uint32_t i = 0; i < test_args.size; i++)
+        data[i] = static_cast<uint8_t>(i);
+    size_t actual;
+    status = mx_vmo_write(src_vmo, data.get(), 0u, test_args.size, &actual);
+    assert(status == NO_ERROR);
+
+    static constexpr uint32_t big_it_size = 1000;
+    uint64_t big_its = 0;
+    uint64_t start_ns = mx_time_get(MX_CLOCK_MONOTONIC);
+    uint64_t end_ns;
+    for (;;) {
+        big_its++;
+        for (uint32_t i = 0; i < big_it_size; i++) {
+            // Move the whole vmo through the socket, a buffer-full at a time.
+            size_t offset = 0;
+            while (offset < test_args.size) {
+                size_t chunk = test_args.size - offset;
+                if (chunk > kMaxChunk)
+                    chunk = kMaxChunk;
+                size_t written, nread;
+                if (test_args.mode == Mode::kSplice) {
+                    status = mx_socket_write_vmo(sp[0], 0u, src_vmo, offset, chunk, &written);
+                    assert(status == NO_ERROR);
+                    status = mx_socket_read_vmo(sp[1], 0u, dst_vmo, offset, written, &nread);
+                    assert(status == NO_ERROR);
+                } else {
+                    status = mx_vmo_read(src_vmo, data.get(), offset, chunk, &actual);
+                    assert(status == NO_ERROR);
+                    status = mx_socket_write(sp[0], 0u, data.get(), chunk, &written);
+                    assert(status == NO_ERROR);
+                    status = mx_socket_read(sp[1], 0u, data.get(), written, &nread);
+                    assert(status == NO_ERROR);
+                    status = mx_vmo_write(dst_vmo, data.get(), offset, nread, &actual);
+                    assert(status == NO_ERROR);
+                }
+                assert(nread == written);
+                offset += written;
+            }
+        }
+
+        end_ns = mx_time_get(MX_CLOCK_MONOTONIC);
+        if ((end_ns - start_ns) >= duration_ns)
+            break;
+    }
+
+    status = mx_handle_close(src_vmo);
+    assert(status == NO_ERROR);
+    status = mx_handle_close(dst_vmo);
+    assert(status == NO_ERROR);
+    status = mx_handle_close(sp[0]);
+    assert(status == NO_ERROR);
+    status = mx_handle_close(sp[1]);
+    assert(status == NO_ERROR);
+
+    double real_duration = static_cast<double>(end_ns - start_ns) / 1000000000.0;
+    double its_per_second = static_cast<double>(big_its) * big_it_size / real_duration;
+    double mb_per_second = its_per_second * test_args.size / (1024.0 * 1024.0);
+    printf("%s %" PRIu32 " bytes vmo->socket->vmo: "
+               "%.0f iterations/second, %.1f MB/second\n",
+           mode_name(test_args.mode), test_args.size, its_per_second, mb_per_second);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    static constexpr char help[] =
+        "Usage: %s [options ...]\n"
+        "\n"
+        "Options:\n"
+        "  -h    show help (this)\n"
+        "  -o    run single test (default)\n"
+        "  -s    run suite (ignores -S/-v)\n"
+        "  -n N  set test repetition count to N (default: 1)\n"
+        "  -d N  set test duration to N seconds (default: 5)\n"
+        "  -S N  set transfer size to N bytes (default: 65536)\n"
+        "  -v    splice with mx_socket_{write,read}_vmo (default: bounce through a buffer)\n";
+
+    bool run_suite = false;  // -o/-s
+    uint32_t duration = 5;   // -d
+    uint32_t repeats = 1;    // -n
+    // Ignored when running a suite:
+    TestArgs test_args = {
+        65536,               // -S (size)
+        Mode::kBounce        // -v (mode)
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "+hosvn:d:S:")) != -1) {
+        // Our option values are always unsigned numbers.
+        uint32_t value = 0;
+        if (optarg) {
+            errno = 0;
+            char* endptr = nullptr;
+            unsigned long long v = strtoull(optarg, &endptr, 10);
+            if (errno != 0 || *endptr != '\0' || v > UINT32_MAX)
+                argument_error(argv[0], "invalid numeric optional value");
+            value = static_cast<uint32_t>(v);
+        }
+
+        switch (opt) {
+            case 'h':
+                printf(help, argv[0]);
+                return EXIT_SUCCESS;
+            case 'o':
+                run_suite = false;
+                break;
+            case 's':
+                run_suite = true;
+                break;
+            case 'v':
+                test_args.mode = Mode::kSplice;
+                break;
+            case 'n':
+                assert(optarg);
+                repeats = value;
+                break;
+            case 'd':
+                assert(optarg);
+                duration = value;
+                break;
+            case 'S':
+                assert(optarg);
+                if (value == 0)
+                    argument_error(argv[0], "transfer size must be positive");
+                test_args.size = value;
+                break;
+            default:  // '?'
+                argument_error(argv[0], "invalid option");
+                break;
+        }
+    }
+    if (optind < argc)
+        argument_error(argv[0], "unexpected positional argument");
+
+    for (uint32_t i = 0; i < repeats; i++) {
+        if (repeats > 1u) {
+            if (i > 0u)
+                printf("\n");
+            printf("Test iteration #%" PRIu32 " (of %" PRIu32 "):\n", i + 1,
+                   repeats);
+        }
+
+        if (run_suite) {
+            static constexpr TestArgs suite[] = {
+                {100, Mode::kBounce},
+                {100, Mode::kSplice},
+                {4096, Mode::kBounce},
+                {4096, Mode::kSplice},
+                {65536, Mode::kBounce},
+                {65536, Mode::kSplice},
+                {1048576, Mode::kBounce},
+                {1048576, Mode::kSplice},
+            };
+            for (size_t i = 0; i < countof(suite); i++)
+                do_test(duration, suite[i]);
+        } else {
+            do_test(duration, test_args);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -11,6 +11,7 @@
 #include <stdint.h>
 
 #include <magenta/types.h>
+#include <mxtl/array.h>
 #include <mxtl/macros.h>
 
 namespace bitmap {
@@ -33,10 +34,19 @@ public:
     // Returns the size of this bitmap.
     size_t size(void) const { return size_; }
 
-    // Resets the bitmap; clearing and resizing it.
+    // Resets the bitmap; clearing and resizing it, and dropping any summary.
     // Allocates memory, and can fail.
     mx_status_t Reset(size_t size);
 
+    // Builds a summary of which words of the bitmap are entirely set or
+    // entirely clear, from the current contents of the storage. While a
+    // summary exists, Scan and Find skip over such words a summary word
+    // (64 storage words) at a time, and Set, Clear, and ClearAll keep it up
+    // to date. Writes made directly to the storage are not tracked: call this
+    // again after making them.
+    // Allocates memory, and can fail.
+    mx_status_t BuildSummary();
+
     // Shrinks the accessible portion of the bitmap, without re-allocating
     // the underlying storage.
     //
@@ -78,6 +88,13 @@ public:
     const Storage* StorageUnsafe() const { return &bits_; }
 
 private:
+    // Refreshes the summary bits of storage words [first_idx, last_idx].
+    void UpdateSummary(size_t first_idx, size_t last_idx);
+
+    // Returns the first index in [idx, end) whose word is not entirely
+    // set (if *is_set*) or entirely clear, or end if there is none.
+    size_t SkipUniform(size_t idx, size_t end, bool is_set) const;
+
     // The size of this bitmap, in bits.
     size_t size_;
 
@@ -85,6 +102,11 @@ private:
     Storage bits_;
     // Owned by bits_, cached
     size_t* data_;
+
+    // One bit per word of data_: set if that word is all ones (full_) or all
+    // zeros (empty_). Empty unless BuildSummary has been called.
+    mxtl::Array<size_t> full_;
+    mxtl::Array<size_t> empty_;
 };
 
 } // namespace bitmap
@@ -8,6 +8,7 @@
 #include <limits.h>
 #include <stddef.h>
 
+#include <magenta/new.h>
 #include <magenta/types.h>
 #include <mxtl/algorithm.h>
 #include <mxtl/macros.h>
@@ -62,6 +63,11 @@ constexpr size_t LastIdx(size_t bitmax) {
 size_t CountZeros(size_t idx, size_t value) {
     return idx * kBits + CTZ(value);
 }
+
+// Counts the trailing zeros of |value|, or kBits if it has none set.
+size_t TrailingZeros(size_t value) {
+    return CTZ(value);
+}
 #undef CTZ
 
 } // namespace
@@ -75,6 +81,8 @@ RawBitmapGeneric<Storage>::RawBitmapGeneric() : size_(0), data_(nullptr) {}
 template <typename Storage>
 mx_status_t RawBitmapGeneric<Storage>::Reset(size_t size) {
     size_ = size;
+    full_.reset();
+    empty_.reset();
     if (size_ == 0) {
         data_ = nullptr;
         return NO_ERROR;
@@ -89,6 +97,65 @@ mx_status_t RawBitmapGeneric<Storage>::Reset(size_t size) {
     return NO_ERROR;
 }
 
+template <typename Storage>
+mx_status_t RawBitmapGeneric<Storage>::BuildSummary() {
+    if (size_ == 0) {
+        return NO_ERROR;
+    }
+    size_t words = LastIdx(size_) / kBits + 1;
+    AllocChecker ac;
+    size_t* full = new (&ac) size_t[words]();
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    full_.reset(full, words);
+    size_t* empty = new (&ac) size_t[words]();
+    if (!ac.check()) {
+        full_.reset();
+        return ERR_NO_MEMORY;
+    }
+    empty_.reset(empty, words);
+    UpdateSummary(0, LastIdx(size_));
+    return NO_ERROR;
+}
+
+template <typename Storage>
+void RawBitmapGeneric<Storage>::UpdateSummary(size_t first_idx, size_t last_idx) {
+    if (!full_) {
+        return;
+    }
+    for (size_t i = first_idx; i <= last_idx; ++i) {
+        size_t bit = static_cast<size_t>(1) << (i % kBits);
+        if (data_[i] == ~static_cast<size_t>(0)) {
+            full_[i / kBits] |= bit;
+        } else {
+            full_[i / kBits] &= ~bit;
+        }
+        if (data_[i] == 0) {
+            empty_[i / kBits] |= bit;
+        } else {
+            empty_[i / kBits] &= ~bit;
+        }
+    }
+}
+
+template <typename Storage>
+size_t RawBitmapGeneric<Storage>::SkipUniform(size_t idx, size_t end, bool is_set) const {
+    const mxtl::Array<size_t>& summary = is_set ? full_ : empty_;
+    while (idx < end) {
+        // Bits of |uniform| from 0 up correspond to words from idx up; the
+        // bits shifted in above them are clear, so the count stops there.
+        size_t shift = idx % kBits;
+        size_t uniform = summary[idx / kBits] >> shift;
+        size_t run = TrailingZeros(~uniform);
+        if (run < kBits - shift) {
+            return mxtl::min(idx + run, end);
+        }
+        idx += kBits - shift;
+    }
+    return end;
+}
+
 template <typename Storage>
 mx_status_t RawBitmapGeneric<Storage>::Shrink(size_t size) {
     if (size > size_) {
@@ -109,6 +176,11 @@ size_t RawBitmapGeneric<Storage>::Scan(size_t bitoff, size_t bitmax, bool is_set
     size_t i = first_idx;
     size_t value = 0;
     for (i = first_idx; i <= last_idx; ++i) {
+        if (full_ && (i != first_idx) && (i < last_idx)) {
+            // Words strictly between the first and last are compared whole,
+            // so the summary can vouch for them.
+            i = SkipUniform(i, last_idx, is_set);
+        }
         value = GetMask(i == first_idx, i == last_idx, bitoff, bitmax);
         if (is_set) {
             // If is_set=true, invert the mask, OR it with the value, and invert
@@ -169,6 +241,7 @@ mx_status_t RawBitmapGeneric<Storage>::Set(size_t bitoff, size_t bitmax) {
         data_[i] |=
                 GetMask(i == first_idx, i == last_idx, bitoff, bitmax);
     }
+    UpdateSummary(first_idx, last_idx);
     return NO_ERROR;
 }
 
@@ -186,6 +259,7 @@ mx_status_t RawBitmapGeneric<Storage>::Clear(size_t bitoff, size_t bitmax) {
         data_[i] &=
                 ~(GetMask(i == first_idx, i == last_idx, bitoff, bitmax));
     }
+    UpdateSummary(first_idx, last_idx);
     return NO_ERROR;
 }
 
@@ -198,6 +272,7 @@ void RawBitmapGeneric<Storage>::ClearAll() {
     for (size_t i = 0; i <= last_idx; ++i) {
         data_[i] = 0;
     }
+    UpdateSummary(0, last_idx);
 }
 
 #ifdef __Fuchsia__
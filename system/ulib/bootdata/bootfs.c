@@ -0,0 +1,151 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <bootdata/bootfs.h>
+
+#include <string.h>
+
+#include <magenta/boot/bootdata.h>
+
+// This works only on memory, so that userboot, mxio and mkbootfs can all use
+// it.
+
+#define NLEN 0
+#define FSIZ 1
+#define FOFF 2
+#define FSENTRYSZ 12
+
+size_t bootfs_index_size(size_t count) {
+    // Keep the table at most half full, so that probes stay short.
+    size_t slots = 1;
+    while (slots < count * 2) {
+        slots *= 2;
+    }
+    return sizeof(bootfs_index_t) + slots * sizeof(bootfs_index_slot_t);
+}
+
+void bootfs_index_init(void* index, size_t count) {
+    size_t size = bootfs_index_size(count);
+    memset(index, 0, size);
+    bootfs_index_t hdr = {
+        .magic = BOOTFS_INDEX_MAGIC,
+        .slots = (size - sizeof(bootfs_index_t)) / sizeof(bootfs_index_slot_t),
+    };
+    memcpy(index, &hdr, sizeof(hdr));
+}
+
+void bootfs_index_add(void* index, const char* name, size_t len, uint32_t dirent) {
+    bootfs_index_t hdr;
+    memcpy(&hdr, index, sizeof(hdr));
+    bootfs_index_slot_t* slots = (bootfs_index_slot_t*)((uint8_t*)index + sizeof(hdr));
+    uint32_t hash = bootfs_hash(name, len);
+    uint32_t n = hash & (hdr.slots - 1);
+    while (slots[n].dirent != 0) {
+        n = (n + 1) & (hdr.slots - 1);
+    }
+    slots[n].hash = hash;
+    slots[n].dirent = dirent;
+}
+
+// Reads the directory record at 'off', checking it lies within the image.
+// 'name' is only set if the record is not the end marker.
+static mx_status_t read_dirent(const uint8_t* image, size_t len, size_t off,
+                               uint32_t hdr[3], const char** name) {
+    if ((off > len) || (len - off < FSENTRYSZ)) {
+        return ERR_IO;
+    }
+    memcpy(hdr, image + off, FSENTRYSZ);
+    if (hdr[NLEN] == 0) {
+        return NO_ERROR;
+    }
+    if (hdr[NLEN] > len - off - FSENTRYSZ) {
+        return ERR_IO;
+    }
+    *name = (const char*)image + off + FSENTRYSZ;
+    return NO_ERROR;
+}
+
+static mx_status_t index_find(const uint8_t* image, size_t len,
+                              uint32_t index_off, uint32_t index_size,
+                              const char* name, size_t namelen,
+                              uint32_t* off, uint32_t* size) {
+    bootfs_index_t hdr;
+    if ((index_off > len) || (index_size > len - index_off) ||
+        (index_size < sizeof(hdr))) {
+        return ERR_IO;
+    }
+    memcpy(&hdr, image + index_off, sizeof(hdr));
+    if ((hdr.magic != BOOTFS_INDEX_MAGIC) || (hdr.slots == 0) ||
+        (hdr.slots & (hdr.slots - 1)) ||
+        (hdr.slots > (index_size - sizeof(hdr)) / sizeof(bootfs_index_slot_t))) {
+        return ERR_IO;
+    }
+
+    const uint8_t* slots = image + index_off + sizeof(hdr);
+    uint32_t hash = bootfs_hash(name, namelen - 1);
+    uint32_t n = hash & (hdr.slots - 1);
+    for (uint32_t probes = 0; probes < hdr.slots; probes++) {
+        bootfs_index_slot_t slot;
+        memcpy(&slot, slots + n * sizeof(slot), sizeof(slot));
+        if (slot.dirent == 0) {
+            return ERR_NOT_FOUND;
+        }
+        if (slot.hash == hash) {
+            uint32_t dirent[3];
+            const char* candidate;
+            if ((read_dirent(image, len, slot.dirent, dirent, &candidate) != NO_ERROR) ||
+                (dirent[NLEN] == 0)) {
+                return ERR_IO;
+            }
+            if ((dirent[NLEN] == namelen) && !memcmp(candidate, name, namelen)) {
+                *off = dirent[FOFF];
+                *size = dirent[FSIZ];
+                return NO_ERROR;
+            }
+        }
+        n = (n + 1) & (hdr.slots - 1);
+    }
+    return ERR_NOT_FOUND;
+}
+
+mx_status_t bootfs_find(const uint8_t* image, size_t len, const char* name,
+                        uint32_t* off, uint32_t* size) {
+    // Older images carry this (now obsolete) magic after the bootdata header.
+    static const char FSMAGIC[16] = "[BOOTFS]\0\0\0\0\0\0\0\0";
+    size_t dir = sizeof(bootdata_t);
+    if (len < dir) {
+        return ERR_IO;
+    }
+    if ((len - dir >= sizeof(FSMAGIC)) && !memcmp(image + dir, FSMAGIC, sizeof(FSMAGIC))) {
+        dir += sizeof(FSMAGIC);
+    }
+    size_t namelen = strlen(name) + 1;
+
+    uint32_t hdr[3];
+    const char* entry;
+    mx_status_t status = read_dirent(image, len, dir, hdr, &entry);
+    if ((status == NO_ERROR) && (hdr[NLEN] == sizeof(BOOTFS_INDEX_NAME)) &&
+        !memcmp(entry, BOOTFS_INDEX_NAME, sizeof(BOOTFS_INDEX_NAME))) {
+        status = index_find(image, len, hdr[FOFF], hdr[FSIZ], name, namelen, off, size);
+        if (status != ERR_IO) {
+            return status;
+        }
+        // A damaged index is no reason to give up on the directory.
+    }
+
+    for (size_t p = dir;;) {
+        if ((status = read_dirent(image, len, p, hdr, &entry)) != NO_ERROR) {
+            return status;
+        }
+        if (hdr[NLEN] == 0) {
+            return ERR_NOT_FOUND;
+        }
+        if ((hdr[NLEN] == namelen) && !memcmp(entry, name, namelen)) {
+            *off = hdr[FOFF];
+            *size = hdr[FSIZ];
+            return NO_ERROR;
+        }
+        p += FSENTRYSZ + hdr[NLEN];
+    }
+}
@@ -0,0 +1,14 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <bootdata/decompress.h>
+
+#include "decompress-private.h"
+
+mx_status_t decompress_bootdata_parallel(mx_handle_t vmar, mx_handle_t vmo,
+                                         size_t offset, size_t length, unsigned threads,
+                                         mx_handle_t* out, const char** err) {
+    return decompress_bootdata_with(vmar, vmo, offset, length,
+                                    lz4_frame_decompress_parallel, threads, out, err);
+}
@@ -0,0 +1,49 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <magenta/compiler.h>
+#include <magenta/types.h>
+
+__BEGIN_CDECLS
+
+// The LZ4 Frame functions below only work on memory, so that they may be used
+// in userboot, and built for the host to be benchmarked.
+
+// Checks the LZ4 frame whose descriptor is at 'data' (just past the magic
+// number) holds 'expected' bytes, in a form we can decompress. On success,
+// 'blocks' points at the header of the first block, and 'block_max' is the
+// most data a block holds once decompressed (64kB to 4MB). Every block but
+// the last is normally filled, so block n decompresses to n * block_max.
+mx_status_t lz4_frame_check(const uint8_t* data, size_t expected,
+                            const uint8_t** blocks, size_t* block_max,
+                            const char** err);
+
+// Decompresses the blocks starting at 'blocks' into dst, which has room for
+// 'dstlen' bytes. 'actual' is set to the number of bytes produced.
+mx_status_t lz4_frame_decompress(const uint8_t* blocks, uint8_t* dst, size_t dstlen,
+                                 size_t* actual, const char** err);
+
+// As lz4_frame_decompress, but spreads the blocks, of 'block_max' bytes,
+// across 'threads' threads (the caller's included).
+mx_status_t lz4_frame_decompress_parallel(const uint8_t* blocks, size_t block_max,
+                                          uint8_t* dst, size_t dstlen, unsigned threads,
+                                          size_t* actual, const char** err);
+
+typedef mx_status_t (*lz4_frame_parallel_fn)(const uint8_t* blocks, size_t block_max,
+                                             uint8_t* dst, size_t dstlen, unsigned threads,
+                                             size_t* actual, const char** err);
+
+// Implements decompress_bootdata. If 'parallel' is not NULL, it is used to
+// decompress bootfs images, with 'threads' threads.
+mx_status_t decompress_bootdata_with(mx_handle_t vmar, mx_handle_t vmo,
+                                     size_t offset, size_t length,
+                                     lz4_frame_parallel_fn parallel, unsigned threads,
+                                     mx_handle_t* out, const char** err);
+
+__END_CDECLS
@@ -5,89 +5,18 @@
 #include <bootdata/decompress.h>
 
 #include <limits.h>
-#include <string.h>
 
 #include <magenta/boot/bootdata.h>
 #include <magenta/compiler.h>
 #include <magenta/syscalls.h>
 
-#include <lz4/lz4.h>
-
-// The LZ4 Frame format is used to compress a bootfs image, but we cannot use
-// the LZ4 library's decompression functions in userboot. The following
-// definitions are used in the reimplementation of LZ4 Frame decompression, with
-// a few restrictions on the frame options:
-//  - Blocks must be independent
-//  - No block checksums
-//  - Final content size must be included in frame header
-//  - Max block size is 64kB
-//
-//  See https://github.com/lz4/lz4/blob/dev/lz4_Frame_format.md for details.
-#define MX_LZ4_MAGIC 0x184D2204
-#define MX_LZ4_VERSION (1 << 6)
-
-typedef struct {
-    uint8_t flag;
-    uint8_t block_desc;
-    uint64_t content_size;
-    uint8_t header_cksum;
-} __PACKED lz4_frame_desc;
-
-#define MX_LZ4_FLAG_VERSION       (1 << 6)
-#define MX_LZ4_FLAG_BLOCK_DEP     (1 << 5)
-#define MX_LZ4_FLAG_BLOCK_CKSUM   (1 << 4)
-#define MX_LZ4_FLAG_CONTENT_SZ    (1 << 3)
-#define MX_LZ4_FLAG_CONTENT_CKSUM (1 << 2)
-#define MX_LZ4_FLAG_RESERVED      0x03
-
-#define MX_LZ4_BLOCK_MAX_MASK     (7 << 4)
-#define MX_LZ4_BLOCK_64KB         (4 << 4)
-#define MX_LZ4_BLOCK_256KB        (5 << 4)
-#define MX_LZ4_BLOCK_1MB          (6 << 4)
-#define MX_LZ4_BLOCK_4MB          (7 << 4)
-
-static mx_status_t check_lz4_frame(const lz4_frame_desc* fd,
-                                   size_t expected, const char** err) {
-    if ((fd->flag & MX_LZ4_FLAG_VERSION) != MX_LZ4_VERSION) {
-        *err = "bad lz4 version for bootfs";
-        return ERR_INVALID_ARGS;
-    }
-    if ((fd->flag & MX_LZ4_FLAG_BLOCK_DEP) == 0) {
-        *err = "bad lz4 flag (blocks must be independent)";
-        return ERR_INVALID_ARGS;
-    }
-    if (fd->flag & MX_LZ4_FLAG_BLOCK_CKSUM) {
-        *err = "bad lz4 flag (block checksum must be disabled)";
-        return ERR_INVALID_ARGS;
-    }
-    if ((fd->flag & MX_LZ4_FLAG_CONTENT_SZ) == 0) {
-        *err = "bad lz4 flag (content size must be included)";
-        return ERR_INVALID_ARGS;
-    }
-    if (fd->flag & MX_LZ4_FLAG_RESERVED) {
-        *err = "bad lz4 flag (reserved bits in flg must be zero)";
-        return ERR_INVALID_ARGS;
-    }
-    if ((fd->block_desc & MX_LZ4_BLOCK_MAX_MASK) != MX_LZ4_BLOCK_64KB) {
-        *err = "bad lz4 flag (max block size must be 64k)";
-        return ERR_INVALID_ARGS;
-    }
-    if (fd->block_desc & ~MX_LZ4_BLOCK_MAX_MASK) {
-        *err = "bad lz4 flag (reserved bits in bd must be zero)";
-        return ERR_INVALID_ARGS;
-    }
-    if (fd->content_size != expected) {
-        *err = "lz4 content size does not match bootdata outsize";
-        return ERR_INVALID_ARGS;
-    }
+#include "decompress-private.h"
 
-    // TODO: header checksum
-    return NO_ERROR;
-}
+#define MX_LZ4_MAGIC 0x184D2204
 
-static mx_status_t decompress_bootfs_vmo(mx_handle_t vmar,
-                                         const uint8_t* data, mx_handle_t* out,
-                                         const char** err) {
+static mx_status_t decompress_bootfs_vmo(mx_handle_t vmar, const uint8_t* data,
+                                         lz4_frame_parallel_fn parallel, unsigned threads,
+                                         mx_handle_t* out, const char** err) {
     const bootdata_t* hdr = (bootdata_t*)data;
 
     // Skip past the bootdata header
@@ -100,8 +29,16 @@ static mx_status_t decompress_bootfs_vmo(mx_handle_t vmar,
     data += sizeof(uint32_t);
 
     size_t newsize = hdr->extra;
-    check_lz4_frame((const lz4_frame_desc*)data, newsize - sizeof(bootdata_t), err);
-    data += sizeof(lz4_frame_desc);
+    if (newsize < sizeof(bootdata_t)) {
+        *err = "bootdata outsize too small for lz4 decompression";
+        return ERR_INVALID_ARGS;
+    }
+    size_t block_max;
+    mx_status_t status = lz4_frame_check(data, newsize - sizeof(bootdata_t), &data,
+                                         &block_max, err);
+    if (status < 0) {
+        return status;
+    }
 
     newsize = (newsize + 4095) & ~4095;
     if (newsize < hdr->extra) {
@@ -110,7 +47,7 @@ static mx_status_t decompress_bootfs_vmo(mx_handle_t vmar,
         return ERR_NO_MEMORY;
     }
     mx_handle_t dst_vmo;
-    mx_status_t status = mx_vmo_create((uint64_t)newsize, 0, &dst_vmo);
+    status = mx_vmo_create((uint64_t)newsize, 0, &dst_vmo);
     if (status < 0) {
         *err = "mx_vmo_create failed for decompressing bootfs";
         return status;
@@ -121,6 +58,7 @@ static mx_status_t decompress_bootfs_vmo(mx_handle_t vmar,
             MX_VM_FLAG_PERM_READ|MX_VM_FLAG_PERM_WRITE, &dst_addr);
     if (status < 0) {
         *err = "mx_vmar_map failed on bootfs vmo during decompression";
+        mx_handle_close(dst_vmo);
         return status;
     }
 
@@ -135,62 +73,37 @@ static mx_status_t decompress_bootfs_vmo(mx_handle_t vmar,
     dst += sizeof(bootdata_t);
     remaining -= sizeof(bootdata_t);
 
-    // Read each LZ4 block and decompress it. Block sizes are 32 bits.
-    uint32_t blocksize = *(const uint32_t*)data;
-    data += sizeof(uint32_t);
-    while (blocksize) {
-        // If the data is uncompressed, the high bit is 1.
-        if (blocksize >> 31) {
-            uint32_t actual = blocksize & 0x7fffffff;
-            memcpy(dst, data, actual);
-            dst += actual;
-            data += actual;
-            if (remaining - actual > remaining) {
-                // Remaining wrapped around (would be negative if signed)
-                *err = "bootdata outsize too small for lz4 decompression";
-                return ERR_INVALID_ARGS;
-            }
-            remaining -= actual;
-        } else {
-            int dcmp = LZ4_decompress_safe((const char*)data, (char*)dst, blocksize, remaining);
-            if (dcmp < 0) {
-                *err = "lz4 decompression failed";
-                return ERR_BAD_STATE;
-            }
-            dst += dcmp;
-            data += blocksize;
-            if (remaining - dcmp > remaining) {
-                // Remaining wrapped around (would be negative if signed)
-                *err = "bootdata outsize too small for lz4 decompression";
-                return ERR_INVALID_ARGS;
-            }
-            remaining -= dcmp;
-        }
-
-        blocksize = *(uint32_t*)data;
-        data += sizeof(uint32_t);
+    size_t actual;
+    if (parallel != NULL) {
+        status = parallel(data, block_max, dst, remaining, threads, &actual, err);
+    } else {
+        status = lz4_frame_decompress(data, dst, remaining, &actual, err);
     }
-
     // Sanity check: verify that we didn't have more than one page leftover.
     // The bootdata header should have specified the exact outsize needed, which
     // we rounded up to the next full page.
-    if (remaining > 4095) {
+    if ((status == NO_ERROR) && (remaining - actual > 4095)) {
         *err = "bootdata size error; outsize does not match decompressed size";
-        return ERR_INVALID_ARGS;
+        status = ERR_INVALID_ARGS;
     }
 
-    status = mx_vmar_unmap(vmar, dst_addr, newsize);
-    if (status < 0) {
+    mx_status_t unmap_status = mx_vmar_unmap(vmar, dst_addr, newsize);
+    if ((status == NO_ERROR) && (unmap_status < 0)) {
         *err = "mx_vmar_unmap after decompress failed";
+        status = unmap_status;
+    }
+    if (status < 0) {
+        mx_handle_close(dst_vmo);
         return status;
     }
     *out = dst_vmo;
     return NO_ERROR;
 }
 
-mx_status_t decompress_bootdata(mx_handle_t vmar, mx_handle_t vmo,
-                                size_t offset, size_t length,
-                                mx_handle_t* out, const char** err) {
+mx_status_t decompress_bootdata_with(mx_handle_t vmar, mx_handle_t vmo,
+                                     size_t offset, size_t length,
+                                     lz4_frame_parallel_fn parallel, unsigned threads,
+                                     mx_handle_t* out, const char** err) {
     *err = "none";
 
     if (length > SIZE_MAX) {
@@ -214,7 +127,7 @@ mx_status_t decompress_bootdata(mx_handle_t vmar, mx_handle_t vmo,
     case BOOTDATA_BOOTFS_BOOT:
     case BOOTDATA_BOOTFS_SYSTEM:
         if (hdr->flags & BOOTDATA_BOOTFS_FLAG_COMPRESSED) {
-            status = decompress_bootfs_vmo(vmar, (const uint8_t*)addr, out, err);
+            status = decompress_bootfs_vmo(vmar, (const uint8_t*)addr, parallel, threads, out, err);
         }
         break;
     default:
@@ -222,7 +135,13 @@ mx_status_t decompress_bootdata(mx_handle_t vmar, mx_handle_t vmo,
         status = ERR_NOT_SUPPORTED;
         break;
     }
-    mx_vmar_unmap(vmar, addr, length);
+    mx_vmar_unmap(vmar, addr - align_shift, length);
 
     return status;
 }
+
+mx_status_t decompress_bootdata(mx_handle_t vmar, mx_handle_t vmo,
+                                size_t offset, size_t length,
+                                mx_handle_t* out, const char** err) {
+    return decompress_bootdata_with(vmar, vmo, offset, length, NULL, 1, out, err);
+}
@@ -0,0 +1,83 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <magenta/compiler.h>
+#include <magenta/types.h>
+
+__BEGIN_CDECLS
+
+#pragma GCC visibility push(hidden)
+
+// BOOTFS is a trivial "filesystem" format
+//
+// It has a bootdata item header
+// Followed by a series of records of:
+//   namelength (32bit le)
+//   filesize   (32bit le)
+//   fileoffset (32bit le)
+//   namedata   (namelength bytes, includes \0)
+// Followed by a record with a namelength of zero.
+//
+// - fileoffsets must be page aligned (multiple of 4096), and count from the
+//   start of the bootdata item header, as do the offsets in the index
+//
+// An image may be indexed, so that names can be found without walking the
+// whole directory. The index is then the data of the first record, which is
+// named BOOTFS_INDEX_NAME: a bootfs_index_t, followed by an open addressed
+// hash table of bootfs_index_slot_t. A name's search starts at the slot
+// (hash & (slots - 1)), and moves on a slot at a time until it finds the
+// name, or an empty slot. Readers which know nothing of the index just see
+// one more file.
+
+#define BOOTFS_INDEX_NAME ".bootfs-index"
+#define BOOTFS_INDEX_MAGIC (0x58444946) // FIDX
+
+typedef struct {
+    uint32_t magic;
+    // The number of slots; a power of two.
+    uint32_t slots;
+} bootfs_index_t;
+
+typedef struct {
+    // bootfs_hash() of the name.
+    uint32_t hash;
+    // Offset of the name's directory record, or 0 if the slot is empty.
+    uint32_t dirent;
+} bootfs_index_slot_t;
+
+// FNV-1a, over the name without its terminating \0.
+static inline uint32_t bootfs_hash(const char* name, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// The size of an index for 'count' names.
+size_t bootfs_index_size(size_t count);
+
+// Sets up an empty index for 'count' names in 'index', which must be
+// bootfs_index_size(count) bytes.
+void bootfs_index_init(void* index, size_t count);
+
+// Adds 'name' (of 'len' bytes, without its \0), whose directory record
+// is at offset 'dirent', to 'index'.
+void bootfs_index_add(void* index, const char* name, size_t len, uint32_t dirent);
+
+// Looks up 'name' in the bootfs image of 'len' bytes at 'image' (which
+// begins with the bootdata item header), using the index if there is one.
+// Returns NO_ERROR and the offset and size of the file's data,
+// ERR_NOT_FOUND, or ERR_IO if the image is malformed.
+mx_status_t bootfs_find(const uint8_t* image, size_t len, const char* name,
+                        uint32_t* off, uint32_t* size);
+
+#pragma GCC visibility pop
+
+__END_CDECLS
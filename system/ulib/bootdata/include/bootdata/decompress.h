@@ -16,4 +16,10 @@ mx_status_t decompress_bootdata(mx_handle_t vmar, mx_handle_t vmo,
                                 size_t offset, size_t length,
                                 mx_handle_t* out, const char** errmsg);
 
+// As decompress_bootdata, but decompresses with up to 'threads' threads.
+// Not available in userboot, which has no threads.
+mx_status_t decompress_bootdata_parallel(mx_handle_t vmar, mx_handle_t vmo,
+                                         size_t offset, size_t length, unsigned threads,
+                                         mx_handle_t* out, const char** errmsg);
+
 #pragma GCC visibility pop
@@ -0,0 +1,134 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "decompress-private.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <lz4/lz4.h>
+
+// Blocks are independent, and every block but the last decompresses to
+// exactly block_max bytes, so once the block headers have been
+// walked, each block's place in the output is known and blocks may be
+// decompressed in any order.
+//
+// pthreads rather than C11 threads, so that this also builds for the host.
+
+typedef struct {
+    const uint8_t* data;
+    // As stored: the high bit is set if the block is not compressed.
+    uint32_t size;
+    // Bytes produced, or a negative status.
+    int32_t actual;
+} lz4_block_t;
+
+typedef struct {
+    lz4_block_t* blocks;
+    size_t count;
+    size_t block_max;
+    uint8_t* dst;
+    size_t dstlen;
+    atomic_size_t next;
+} lz4_job_t;
+
+static void* lz4_worker(void* arg) {
+    lz4_job_t* job = arg;
+    size_t n;
+    while ((n = atomic_fetch_add(&job->next, 1)) < job->count) {
+        lz4_block_t* b = &job->blocks[n];
+        size_t off = n * job->block_max;
+        size_t room = job->dstlen - off;
+        if (room > job->block_max) {
+            room = job->block_max;
+        }
+        if (b->size >> 31) {
+            uint32_t raw = b->size & 0x7fffffff;
+            if (raw > room) {
+                b->actual = ERR_INVALID_ARGS;
+            } else {
+                memcpy(job->dst + off, b->data, raw);
+                b->actual = raw;
+            }
+        } else {
+            int dcmp = LZ4_decompress_safe((const char*)b->data, (char*)job->dst + off,
+                                           b->size, room);
+            b->actual = (dcmp < 0) ? ERR_BAD_STATE : dcmp;
+        }
+    }
+    return NULL;
+}
+
+mx_status_t lz4_frame_decompress_parallel(const uint8_t* start, size_t block_max,
+                                          uint8_t* dst, size_t dstlen, unsigned threads,
+                                          size_t* actual, const char** err) {
+    // Index the blocks.
+    size_t count = 0;
+    for (const uint8_t* p = start; *(const uint32_t*)p; ) {
+        p += sizeof(uint32_t) + (*(const uint32_t*)p & 0x7fffffff);
+        count++;
+    }
+    // Too many blocks to be full ones means some are not, and then only the
+    // serial path knows where they go.
+    if ((threads < 2) || (count < 2) || ((count - 1) * block_max >= dstlen)) {
+        return lz4_frame_decompress(start, dst, dstlen, actual, err);
+    }
+    lz4_block_t* blocks = malloc(count * sizeof(lz4_block_t));
+    if (blocks == NULL) {
+        return lz4_frame_decompress(start, dst, dstlen, actual, err);
+    }
+    const uint8_t* data = start;
+    for (size_t n = 0; n < count; n++) {
+        blocks[n].size = *(const uint32_t*)data;
+        blocks[n].data = data + sizeof(uint32_t);
+        data = blocks[n].data + (blocks[n].size & 0x7fffffff);
+    }
+
+    lz4_job_t job = {
+        .blocks = blocks,
+        .count = count,
+        .block_max = block_max,
+        .dst = dst,
+        .dstlen = dstlen,
+    };
+    atomic_init(&job.next, 0);
+    if (threads > count) {
+        threads = count;
+    }
+    pthread_t workers[threads - 1];
+    unsigned started = 0;
+    while (started < threads - 1) {
+        if (pthread_create(&workers[started], NULL, lz4_worker, &job) != 0) {
+            // Make do with the threads we have.
+            break;
+        }
+        started++;
+    }
+    lz4_worker(&job);
+    for (unsigned n = 0; n < started; n++) {
+        pthread_join(workers[n], NULL);
+    }
+
+    mx_status_t status = NO_ERROR;
+    for (size_t n = 0; n < count; n++) {
+        if (blocks[n].actual < 0) {
+            status = blocks[n].actual;
+            *err = (status == ERR_BAD_STATE) ? "lz4 decompression failed" :
+                   "bootdata outsize too small for lz4 decompression";
+            break;
+        } else if ((n + 1 < count) && (blocks[n].actual != (int32_t)block_max)) {
+            // The frame was flushed before a block was full, so the blocks
+            // which follow are in the wrong place.
+            free(blocks);
+            return lz4_frame_decompress(start, dst, dstlen, actual, err);
+        }
+    }
+    if (status == NO_ERROR) {
+        *actual = (count - 1) * block_max + blocks[count - 1].actual;
+    }
+    free(blocks);
+    return status;
+}
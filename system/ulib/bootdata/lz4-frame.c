@@ -0,0 +1,122 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "decompress-private.h"
+
+#include <string.h>
+
+#include <lz4/lz4.h>
+
+// The LZ4 Frame format is used to compress a bootfs image, but we cannot use
+// the LZ4 library's decompression functions in userboot. The following
+// definitions are used in the reimplementation of LZ4 Frame decompression, with
+// a few restrictions on the frame options:
+//  - Blocks must be independent
+//  - No block checksums
+//  - Final content size must be included in frame header
+//
+//  See https://github.com/lz4/lz4/blob/dev/lz4_Frame_format.md for details.
+#define MX_LZ4_VERSION (1 << 6)
+
+typedef struct {
+    uint8_t flag;
+    uint8_t block_desc;
+    uint64_t content_size;
+    uint8_t header_cksum;
+} __PACKED lz4_frame_desc;
+
+#define MX_LZ4_FLAG_VERSION       (1 << 6)
+#define MX_LZ4_FLAG_BLOCK_DEP     (1 << 5)
+#define MX_LZ4_FLAG_BLOCK_CKSUM   (1 << 4)
+#define MX_LZ4_FLAG_CONTENT_SZ    (1 << 3)
+#define MX_LZ4_FLAG_CONTENT_CKSUM (1 << 2)
+#define MX_LZ4_FLAG_RESERVED      0x03
+
+#define MX_LZ4_BLOCK_MAX_MASK     (7 << 4)
+#define MX_LZ4_BLOCK_64KB         (4 << 4)
+#define MX_LZ4_BLOCK_256KB        (5 << 4)
+#define MX_LZ4_BLOCK_1MB          (6 << 4)
+#define MX_LZ4_BLOCK_4MB          (7 << 4)
+
+mx_status_t lz4_frame_check(const uint8_t* data, size_t expected,
+                            const uint8_t** blocks, size_t* block_max,
+                            const char** err) {
+    const lz4_frame_desc* fd = (const lz4_frame_desc*)data;
+    if ((fd->flag & MX_LZ4_FLAG_VERSION) != MX_LZ4_VERSION) {
+        *err = "bad lz4 version for bootfs";
+        return ERR_INVALID_ARGS;
+    }
+    if ((fd->flag & MX_LZ4_FLAG_BLOCK_DEP) == 0) {
+        *err = "bad lz4 flag (blocks must be independent)";
+        return ERR_INVALID_ARGS;
+    }
+    if (fd->flag & MX_LZ4_FLAG_BLOCK_CKSUM) {
+        *err = "bad lz4 flag (block checksum must be disabled)";
+        return ERR_INVALID_ARGS;
+    }
+    if ((fd->flag & MX_LZ4_FLAG_CONTENT_SZ) == 0) {
+        *err = "bad lz4 flag (content size must be included)";
+        return ERR_INVALID_ARGS;
+    }
+    if (fd->flag & MX_LZ4_FLAG_RESERVED) {
+        *err = "bad lz4 flag (reserved bits in flg must be zero)";
+        return ERR_INVALID_ARGS;
+    }
+    if ((fd->block_desc & MX_LZ4_BLOCK_MAX_MASK) < MX_LZ4_BLOCK_64KB) {
+        *err = "bad lz4 flag (max block size must be at least 64k)";
+        return ERR_INVALID_ARGS;
+    }
+    if (fd->block_desc & ~MX_LZ4_BLOCK_MAX_MASK) {
+        *err = "bad lz4 flag (reserved bits in bd must be zero)";
+        return ERR_INVALID_ARGS;
+    }
+    if (fd->content_size != expected) {
+        *err = "lz4 content size does not match bootdata outsize";
+        return ERR_INVALID_ARGS;
+    }
+
+    // TODO: header checksum
+    *blocks = data + sizeof(lz4_frame_desc);
+    // 64kB, 256kB, 1MB or 4MB
+    *block_max = (size_t)1 << (8 + 2 * ((fd->block_desc & MX_LZ4_BLOCK_MAX_MASK) >> 4));
+    return NO_ERROR;
+}
+
+mx_status_t lz4_frame_decompress(const uint8_t* data, uint8_t* dst, size_t dstlen,
+                                 size_t* actual, const char** err) {
+    size_t remaining = dstlen;
+
+    // Read each LZ4 block and decompress it. Block sizes are 32 bits.
+    uint32_t blocksize = *(const uint32_t*)data;
+    data += sizeof(uint32_t);
+    while (blocksize) {
+        // If the data is uncompressed, the high bit is 1.
+        if (blocksize >> 31) {
+            uint32_t raw = blocksize & 0x7fffffff;
+            if (raw > remaining) {
+                *err = "bootdata outsize too small for lz4 decompression";
+                return ERR_INVALID_ARGS;
+            }
+            memcpy(dst, data, raw);
+            dst += raw;
+            data += raw;
+            remaining -= raw;
+        } else {
+            int dcmp = LZ4_decompress_safe((const char*)data, (char*)dst, blocksize, remaining);
+            if (dcmp < 0) {
+                *err = "lz4 decompression failed";
+                return ERR_BAD_STATE;
+            }
+            dst += dcmp;
+            data += blocksize;
+            remaining -= dcmp;
+        }
+
+        blocksize = *(const uint32_t*)data;
+        data += sizeof(uint32_t);
+    }
+
+    *actual = dstlen - remaining;
+    return NO_ERROR;
+}
@@ -8,7 +8,12 @@ MODULE := $(LOCAL_DIR)
 
 MODULE_TYPE := userlib
 
-MODULE_SRCS += $(LOCAL_DIR)/decompress.c
+MODULE_SRCS += \
+    $(LOCAL_DIR)/bootfs.c \
+    $(LOCAL_DIR)/decompress.c \
+    $(LOCAL_DIR)/decompress-parallel.c \
+    $(LOCAL_DIR)/lz4-frame.c \
+    $(LOCAL_DIR)/lz4-frame-parallel.c \
 
 MODULE_LIBS := \
     ulib/lz4 \
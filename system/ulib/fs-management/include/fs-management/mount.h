@@ -29,12 +29,15 @@ typedef struct mount_options {
     bool verbose_mount;
     // Ensures that requests to the mountpoint will be propagated to the underlying FS
     bool wait_until_ready;
+    // Write modified blocks to disk immediately rather than caching them (minfs only)
+    bool writethrough;
 } mount_options_t;
 
 static const mount_options_t default_mount_options = {
     .readonly = false,
     .verbose_mount = false,
     .wait_until_ready = true,
+    .writethrough = false,
 };
 
 typedef struct fsck_options {
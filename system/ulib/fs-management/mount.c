@@ -141,6 +141,11 @@ static mx_status_t mount_mxfs(const char* binary, int devicefd, int mountfd,
         printf("fs_mount: Launching %s\n", binary);
     }
     const char* argv[] = { binary, "mount" };
+    const char* argv_writethrough[] = { binary, "--writethrough", "mount" };
+    if (options->writethrough) {
+        return launch_and_mount(cb, options, argv_writethrough, countof(argv_writethrough),
+                                hnd, ids, n, mountfd, mountpoint);
+    }
     return launch_and_mount(cb, options, argv, countof(argv), hnd, ids, n, mountfd, mountpoint);
 }
 
@@ -175,6 +180,11 @@ static mx_status_t mount_fat(int devicefd, int mountfd, const mount_options_t* o
 
 mx_status_t fmount(int devicefd, int mountfd, disk_format_t df, const mount_options_t* options,
                    LaunchCallback cb) {
+    if (options->writethrough && (df != DISK_FORMAT_MINFS)) {
+        // Only minfs has a write-back cache to turn off.
+        close(devicefd);
+        return ERR_NOT_SUPPORTED;
+    }
     switch (df) {
     case DISK_FORMAT_MINFS:
         return mount_mxfs("/boot/bin/minfs", devicefd, mountfd, options, cb);
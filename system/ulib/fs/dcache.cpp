@@ -0,0 +1,234 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdint.h>
+#include <string.h>
+
+#include <fs/vfs.h>
+#include <magenta/new.h>
+#include <magenta/thread_annotations.h>
+#include <mxtl/auto_lock.h>
+#include <mxtl/intrusive_double_list.h>
+#include <mxtl/mutex.h>
+
+#include "vfs-internal.h"
+
+namespace fs {
+namespace {
+
+// Lookups remembered at once. Each positive entry holds a reference to its
+// vnode, so this also bounds the vnodes kept alive by the cache.
+constexpr size_t kDcacheEntries = 256;
+constexpr size_t kDcacheBuckets = 128;
+static_assert((kDcacheBuckets & (kDcacheBuckets - 1)) == 0, "Buckets must be a power of two");
+// Longer names go to the filesystem every time.
+constexpr size_t kDcacheNameMax = 39;
+
+struct Dentry : public mxtl::DoublyLinkedListable<Dentry*> {
+    // Not referenced: a vnode purges the entries in it when it is destroyed.
+    Vnode* parent;
+    // Referenced; nullptr if 'name' was not found in 'parent'.
+    Vnode* child;
+    Dentry* hash_next;
+    uint32_t hash;
+    uint8_t len;
+    char name[kDcacheNameMax];
+};
+
+// The dentry cache is only a cache of names: namespace changes are still
+// serialized against lookups by the caller (vfs_lock, on Fuchsia). The lock
+// only keeps the cache's own structures intact.
+//
+// References are never dropped with the lock held, since releasing a vnode
+// may destroy it, and so purge the cache.
+mxtl::Mutex dcache_lock;
+Dentry* dcache_buckets[kDcacheBuckets] TA_GUARDED(dcache_lock);
+// Most recently used first.
+mxtl::DoublyLinkedList<Dentry*> dcache_lru TA_GUARDED(dcache_lock);
+size_t dcache_count TA_GUARDED(dcache_lock);
+
+bool dcache_name_ok(const char* name, size_t len) {
+    // "." and ".." are answered by the filesystem directly; ".." also
+    // changes meaning when a directory is renamed.
+    if ((len == 0) || (len > kDcacheNameMax)) {
+        return false;
+    } else if ((name[0] == '.') && ((len == 1) || ((len == 2) && (name[1] == '.')))) {
+        return false;
+    }
+    return true;
+}
+
+// FNV-1a over the parent vnode's address and the name.
+uint32_t dcache_hash(const Vnode* parent, const char* name, size_t len) {
+    uint32_t hash = 2166136261u;
+    uintptr_t p = reinterpret_cast<uintptr_t>(parent);
+    for (size_t i = 0; i < sizeof(p); i++) {
+        hash = (hash ^ static_cast<uint8_t>(p >> (i * 8))) * 16777619u;
+    }
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ static_cast<uint8_t>(name[i])) * 16777619u;
+    }
+    return hash;
+}
+
+// Returns the link pointing at the entry for 'name' in 'parent', or at the
+// end of its bucket if there is none.
+Dentry** dcache_find(const Vnode* parent, const char* name, size_t len, uint32_t hash)
+    TA_REQ(dcache_lock) {
+    Dentry** link = &dcache_buckets[hash & (kDcacheBuckets - 1)];
+    for (; *link != nullptr; link = &(*link)->hash_next) {
+        Dentry* de = *link;
+        if ((de->hash == hash) && (de->parent == parent) && (de->len == len) &&
+            (memcmp(de->name, name, len) == 0)) {
+            break;
+        }
+    }
+    return link;
+}
+
+// Takes 'de' out of the hash, leaving it unused, and returns the vnode it
+// referenced (if any) for the caller to release once unlocked.
+Vnode* dcache_unhash(Dentry* de) TA_REQ(dcache_lock) {
+    Dentry** link = dcache_find(de->parent, de->name, de->len, de->hash);
+    MX_DEBUG_ASSERT(*link == de);
+    *link = de->hash_next;
+    Vnode* child = de->child;
+    de->parent = nullptr;
+    de->child = nullptr;
+    return child;
+}
+
+} // namespace anonymous
+
+mx_status_t Vfs::Lookup(Vnode* vndir, Vnode** out, const char* name, size_t len) {
+    if (!dcache_name_ok(name, len)) {
+        return vndir->Lookup(out, name, len);
+    }
+    uint32_t hash = dcache_hash(vndir, name, len);
+    {
+        mxtl::AutoLock lock(&dcache_lock);
+        Dentry* de = *dcache_find(vndir, name, len, hash);
+        if (de != nullptr) {
+            dcache_lru.erase(*de);
+            dcache_lru.push_front(de);
+            if (de->child == nullptr) {
+                return ERR_NOT_FOUND;
+            }
+            de->child->RefAcquire();
+            *out = de->child;
+            return NO_ERROR;
+        }
+    }
+
+    mx_status_t r = vndir->Lookup(out, name, len);
+    Vnode* child;
+    if (r == NO_ERROR) {
+        if (!(*out)->IsCacheable()) {
+            return r;
+        }
+        child = *out;
+        child->RefAcquire();
+    } else if (r == ERR_NOT_FOUND) {
+        child = nullptr;
+    } else {
+        return r;
+    }
+
+    Vnode* evicted = nullptr;
+    {
+        mxtl::AutoLock lock(&dcache_lock);
+        Dentry* de;
+        if (*dcache_find(vndir, name, len, hash) != nullptr) {
+            // Another thread got here first.
+            de = nullptr;
+        } else if (dcache_count < kDcacheEntries) {
+            AllocChecker ac;
+            de = new (&ac) Dentry();
+            if (!ac.check()) {
+                de = nullptr;
+            } else {
+                dcache_count++;
+            }
+        } else {
+            // Unused entries sit at the back, ahead of the least recently used.
+            de = dcache_lru.pop_back();
+            if (de->parent != nullptr) {
+                evicted = dcache_unhash(de);
+            }
+        }
+        if (de != nullptr) {
+            de->parent = vndir;
+            de->child = child;
+            de->hash = hash;
+            de->len = static_cast<uint8_t>(len);
+            memcpy(de->name, name, len);
+            Dentry** bucket = &dcache_buckets[hash & (kDcacheBuckets - 1)];
+            de->hash_next = *bucket;
+            *bucket = de;
+            dcache_lru.push_front(de);
+            vndir->flags_ |= V_FLAG_DCACHE_PARENT;
+            child = nullptr;
+        }
+    }
+    if (evicted != nullptr) {
+        evicted->RefRelease();
+    }
+    if (child != nullptr) {
+        // Not cached after all.
+        child->RefRelease();
+    }
+    return r;
+}
+
+void Vfs::DcacheInvalidate(Vnode* vndir, const char* name, size_t len) {
+    if (!dcache_name_ok(name, len) || !(vndir->flags_ & V_FLAG_DCACHE_PARENT)) {
+        return;
+    }
+    uint32_t hash = dcache_hash(vndir, name, len);
+    Vnode* child;
+    {
+        mxtl::AutoLock lock(&dcache_lock);
+        Dentry* de = *dcache_find(vndir, name, len, hash);
+        if (de == nullptr) {
+            return;
+        }
+        child = dcache_unhash(de);
+        dcache_lru.erase(*de);
+        dcache_lru.push_back(de);
+    }
+    if (child != nullptr) {
+        child->RefRelease();
+    }
+}
+
+void Vfs::DcachePurge(Vnode* vndir) {
+    if (!(vndir->flags_ & V_FLAG_DCACHE_PARENT)) {
+        return;
+    }
+    vndir->flags_ &= ~V_FLAG_DCACHE_PARENT;
+    Vnode* children[kDcacheEntries];
+    size_t count = 0;
+    {
+        mxtl::AutoLock lock(&dcache_lock);
+        for (size_t i = 0; i < kDcacheBuckets; i++) {
+            Dentry* next;
+            for (Dentry* de = dcache_buckets[i]; de != nullptr; de = next) {
+                next = de->hash_next;
+                if (de->parent == vndir) {
+                    Vnode* child = dcache_unhash(de);
+                    dcache_lru.erase(*de);
+                    dcache_lru.push_back(de);
+                    if (child != nullptr) {
+                        children[count++] = child;
+                    }
+                }
+            }
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        children[i]->RefRelease();
+    }
+}
+
+} // namespace fs
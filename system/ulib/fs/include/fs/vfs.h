@@ -28,6 +28,7 @@
 // VFS Helpers (vfs.c)
 #define V_FLAG_DEVICE                 1
 #define V_FLAG_MOUNT_READY            2
+#define V_FLAG_DCACHE_PARENT          4
 #define V_FLAG_RESERVED_MASK 0x0000FFFF
 
 // On Fuchsia, the Block Device is transmitted by file descriptor, rather than
@@ -166,12 +167,29 @@ public:
         return ERR_NOT_SUPPORTED;
     }
 
+    // Returns a vmo holding the contents of the file, starting at offset
+    // zero, and the size of the file. Its contents must never change: only a
+    // filesystem whose files are immutable may hand out its own vmo, with
+    // VFS_VMO_RIGHTS_READONLY. Files which may still be written should not
+    // implement this; copying the whole file costs more than the client
+    // reading just the part it needs.
+    virtual mx_status_t GetVmo(mx_handle_t* out, size_t* size) {
+        return ERR_NOT_SUPPORTED;
+    }
+
     // Attaches a handle to the vnode, if possible. Otherwise, returns an error.
     virtual mx_status_t AttachRemote(mx_handle_t h) {
         return ERR_NOT_SUPPORTED;
     }
 
-    virtual ~Vnode() {};
+    // Whether the dentry cache may keep this vnode, found by a lookup, alive.
+    // A vnode which relies on the release of its last reference (e.g. to
+    // discard a partially written file) should say no until it is complete.
+    virtual bool IsCacheable() const {
+        return true;
+    }
+
+    virtual ~Vnode();
 
     // The vnode is acting as a mount point for a remote filesystem or device.
     bool IsRemote() const { return remote_ > 0; }
@@ -181,7 +199,7 @@ public:
     // they contain remote handles.
     bool IsDevice() const { return (flags_ & V_FLAG_DEVICE) && IsRemote(); }
     // The vnode is "open elsewhere".
-    bool IsBusy() const { return refcount_ > 1; }
+    bool IsBusy() const { return __atomic_load_n(&refcount_, __ATOMIC_RELAXED) > 1; }
 
     mx_handle_t DetachRemote() {
         mx_handle_t h = remote_;
@@ -194,12 +212,16 @@ public:
     // so we can avoid leaking information outside the Vnode / Vfs classes.
     mx_handle_t WaitForRemote();
 protected:
+    friend struct Vfs;
     DISALLOW_COPY_ASSIGN_AND_MOVE(Vnode);
     Vnode() : flags_(0), remote_(MX_HANDLE_INVALID), refcount_(1) {};
 
     uint32_t flags_;
     mx_handle_t remote_;
 private:
+    // Updated atomically, as a server with several dispatcher threads takes
+    // and drops references concurrently. The last reference is only dropped
+    // with vfs_lock held, so a lookup never revives a vnode being released.
     uint32_t refcount_;
 };
 
@@ -207,6 +229,17 @@ struct Vfs {
     // Walk from vn --> out until either only one path segment remains or we
     // encounter a remote filesystem.
     static mx_status_t Walk(Vnode* vn, Vnode** out, const char* path, const char** pathout);
+    // Look up a single name in vndir, as vndir->Lookup() would.
+    //
+    // Results, both the vnodes found and names not found, are remembered in
+    // an LRU dentry cache (dcache.cpp), which holds a reference to each vnode
+    // it remembers. Operations made through Vfs keep the cache coherent; a
+    // filesystem which adds or removes a directory entry by other means must
+    // call DcacheInvalidate() for that name.
+    static mx_status_t Lookup(Vnode* vndir, Vnode** out, const char* name, size_t len);
+    static void DcacheInvalidate(Vnode* vndir, const char* name, size_t len);
+    // Forget all cached lookups in vndir.
+    static void DcachePurge(Vnode* vndir);
     // Traverse the path to the target vnode, and create / open it using
     // the underlying filesystem functions (lookup, create, open).
     static mx_status_t Open(Vnode* vn, Vnode** out, const char* path, const char** pathout,
@@ -81,7 +81,9 @@ void vfs_rpc_open(mxrio_msg_t* msg, mx_handle_t rh, fs::Vnode* vn, const char* p
 
     obj.esize = 0;
     if ((r = vn->GetHandles(flags, obj.handle, &obj.type, obj.extra, &obj.esize)) < 0) {
+        mtx_lock(&vfs_lock);
         vn->Close();
+        mtx_unlock(&vfs_lock);
         goto done;
     }
     if (obj.type == 0) {
@@ -212,7 +214,9 @@ mx_status_t vfs_handler_generic(mxrio_msg_t* msg, mx_handle_t rh, void* cookie)
     }
     case MXRIO_CLOSE:
         // this will drop the ref on the vn
+        mtx_lock(&vfs_lock);
         fs::Vfs::Close(vn);
+        mtx_unlock(&vfs_lock);
         free(ios);
         return NO_ERROR;
     case MXRIO_CLONE: {
@@ -450,8 +454,23 @@ mx_status_t vfs_handler_generic(mxrio_msg_t* msg, mx_handle_t rh, void* cookie)
     case MXRIO_SYNC: {
         return vn->Sync();
     }
-    case MXRIO_UNLINK:
-        return fs::Vfs::Unlink(vn, (const char*)msg->data, len);
+    case MXRIO_GET_VMO: {
+        size_t size;
+        mx_status_t r = vn->GetVmo(&msg->handle[0], &size);
+        if (r < 0) {
+            return r;
+        }
+        msg->hcount = 1;
+        msg->arg2.off = size;
+        return NO_ERROR;
+    }
+    case MXRIO_UNLINK: {
+        mx_status_t r;
+        mtx_lock(&vfs_lock);
+        r = fs::Vfs::Unlink(vn, (const char*)msg->data, len);
+        mtx_unlock(&vfs_lock);
+        return r;
+    }
     default:
         // close inbound handles so they do not leak
         for (unsigned i = 0; i < MXRIO_HC(msg->op); i++) {
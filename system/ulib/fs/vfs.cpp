@@ -99,7 +99,9 @@ mx_status_t Vfs::Open(Vnode* vndir, Vnode** out, const char* path,
         if (must_be_dir && !S_ISDIR(mode)) {
             return ERR_INVALID_ARGS;
         }
-        if ((r = vndir->Create(&vn, path, len, mode)) < 0) {
+        r = vndir->Create(&vn, path, len, mode);
+        Vfs::DcacheInvalidate(vndir, path, len);
+        if (r < 0) {
             if ((r == ERR_ALREADY_EXISTS) && (!(flags & O_EXCL))) {
                 goto try_open;
             }
@@ -115,7 +117,7 @@ mx_status_t Vfs::Open(Vnode* vndir, Vnode** out, const char* path,
         }
     } else {
     try_open:
-        r = vndir->Lookup(&vn, path, len);
+        r = Vfs::Lookup(vndir, &vn, path, len);
         vndir->RefRelease();
         if (r < 0) {
             return r;
@@ -168,7 +170,9 @@ mx_status_t Vfs::Unlink(Vnode* vndir, const char* path, size_t len) {
     if ((r = vfs_name_trim(path, len, &len, &must_be_dir)) != NO_ERROR) {
         return r;
     }
-    return vndir->Unlink(path, len, must_be_dir);
+    r = vndir->Unlink(path, len, must_be_dir);
+    Vfs::DcacheInvalidate(vndir, path, len);
+    return r;
 }
 
 mx_status_t Vfs::Link(Vnode* vndir, const char* oldpath, const char* newpath,
@@ -212,10 +216,11 @@ mx_status_t Vfs::Link(Vnode* vndir, const char* oldpath, const char* newpath,
 
         // Look up the target vnode
         Vnode* target;
-        if ((r = oldparent->Lookup(&target, oldpath, oldlen)) < 0) { // target: +1
+        if ((r = Vfs::Lookup(oldparent, &target, oldpath, oldlen)) < 0) { // target: +1
             goto done;
         }
         r = newparent->Link(newpath, newlen, target);
+        Vfs::DcacheInvalidate(newparent, newpath, newlen);
         target->RefRelease(); // target: +0
     } else {
         // Remote filesystem -- forward the request
@@ -263,6 +268,8 @@ mx_status_t Vfs::Rename(Vnode* vndir, const char* oldpath, const char* newpath,
         }
         r = oldparent->Rename(newparent, oldpath, oldlen, newpath, newlen,
                               old_must_be_dir, new_must_be_dir);
+        Vfs::DcacheInvalidate(oldparent, oldpath, oldlen);
+        Vfs::DcacheInvalidate(newparent, newpath, newlen);
     } else {
         // Remote filesystem -- forward the request
         *oldpathout = oldpath;
@@ -310,6 +317,9 @@ ssize_t Vfs::Ioctl(Vnode* vn, uint32_t op, const void* in_buf, size_t in_len,
     }
     case IOCTL_DEVMGR_UNMOUNT_FS: {
         vfs_uninstall_all(MX_TIME_INFINITE);
+        // Keep other dispatcher threads out of the filesystem while it shuts
+        // down; the lock is never released, as the process exits.
+        mtx_lock(&vfs_lock);
         vn->Ioctl(op, in_buf, in_len, out_buf, out_len);
         exit(0);
     }
@@ -325,9 +335,15 @@ mx_status_t Vfs::Close(Vnode* vn) {
     return r;
 }
 
+Vnode::~Vnode() {
+    // Cached names in this vnode can no longer be found, and would otherwise
+    // be found again in whichever vnode next has the same address.
+    Vfs::DcachePurge(this);
+}
+
 void Vnode::RefAcquire() {
     trace(REFS, "acquire vn=%p ref=%u\n", this, refcount_);
-    refcount_++;
+    __atomic_fetch_add(&refcount_, 1, __ATOMIC_RELAXED);
 }
 
 // TODO(orr): figure out x-system panic
@@ -339,11 +355,11 @@ void Vnode::RefAcquire() {
 
 void Vnode::RefRelease() {
     trace(REFS, "release vn=%p ref=%u\n", this, refcount_);
-    if (refcount_ == 0) {
+    uint32_t refs = __atomic_fetch_sub(&refcount_, 1, __ATOMIC_ACQ_REL);
+    if (refs == 0) {
         panic("vn %p: ref underflow\n", this);
     }
-    refcount_--;
-    if (refcount_ == 0) {
+    if (refs == 1) {
         assert(!IsRemote());
         trace(VFS, "vfs_release: vn=%p\n", this);
         Release();
@@ -417,7 +433,7 @@ mx_status_t Vfs::Walk(Vnode* vn, Vnode** out, const char* path, const char** pat
             // traverse to the next segment
             size_t len = nextpath - path;
             nextpath++;
-            r = vn->Lookup(&vn, path, len);
+            r = Vfs::Lookup(vn, &vn, path, len);
             assert(r <= 0);
             if (oldvn) {
                 // release the old vnode, even if there was an error
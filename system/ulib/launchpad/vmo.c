@@ -9,6 +9,7 @@
 #include <limits.h>
 #include <magenta/process.h>
 #include <magenta/syscalls.h>
+#include <mxio/io.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -43,8 +44,19 @@ mx_handle_t launchpad_vmo_from_fd(int fd) {
     uint64_t size = st.st_size;
     uint64_t offset = 0;
 
+    // If the filesystem can hand out a VMO holding the file, starting at the
+    // beginning of it, use that rather than reading the file into one.
     mx_handle_t vmo;
-    mx_status_t status = mx_vmo_create(size, 0, &vmo);
+    size_t vmo_off, vmo_len;
+    mx_status_t status = mxio_get_vmo(fd, &vmo, &vmo_off, &vmo_len);
+    if (status == NO_ERROR) {
+        if (vmo_off == 0) {
+            return vmo;
+        }
+        mx_handle_close(vmo);
+    }
+
+    status = mx_vmo_create(size, 0, &vmo);
     if (status < 0)
         return status;
 
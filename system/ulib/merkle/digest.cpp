@@ -5,17 +5,21 @@
 #include <merkle/digest.h>
 
 #include <ctype.h>
-#include <limits.h>
 #include <stdio.h>
 #include <string.h>
 
 #include <magenta/assert.h>
 #include <magenta/errors.h>
 #include <magenta/new.h>
+#include <mxtl/algorithm.h>
 #include <mxtl/unique_ptr.h>
 
+#include "sha256-private.h"
+
 namespace merkle {
 
+static_assert(Digest::kLength == 32, "SHA-256 digests are 32 bytes");
+
 Digest::Digest(const Digest& other) {
     ref_count_ = 0;
     *this = other;
@@ -47,30 +51,93 @@ Digest& Digest::operator=(const uint8_t* rhs) {
 
 void Digest::Init() {
     MX_DEBUG_ASSERT(ref_count_ == 0);
-#ifdef USE_LIBCRYPTO
-    SHA256_Init(&ctx_);
-#else
-    clSHA256_init(&ctx_);
-#endif // USE_LIBCRYPTO
+    memcpy(ctx_.state, sha256::kInitialState, sizeof(ctx_.state));
+    ctx_.count = 0;
 }
 
 void Digest::Update(const void* buf, size_t len) {
     MX_DEBUG_ASSERT(ref_count_ == 0);
-    MX_DEBUG_ASSERT(len <= INT_MAX);
-#ifdef USE_LIBCRYPTO
-    SHA256_Update(&ctx_, buf, len);
-#else
-    clHASH_update(&ctx_, buf, static_cast<int>(len));
-#endif // USE_LIBCRYPTO
+    const uint8_t* p = static_cast<const uint8_t*>(buf);
+    size_t used = static_cast<size_t>(ctx_.count % sha256::kBlockSize);
+    ctx_.count += len;
+    if (used != 0) {
+        size_t n = mxtl::min(sha256::kBlockSize - used, len);
+        memcpy(ctx_.buf + used, p, n);
+        p += n;
+        len -= n;
+        if (used + n < sha256::kBlockSize) {
+            return;
+        }
+        sha256::Blocks(ctx_.state, ctx_.buf, 1);
+    }
+    sha256::Blocks(ctx_.state, p, len / sha256::kBlockSize);
+    p += len - (len % sha256::kBlockSize);
+    memcpy(ctx_.buf, p, len % sha256::kBlockSize);
+}
+
+void Digest::UpdateMany(Digest* digests, const void* const* data, size_t count,
+                        size_t len) {
+    size_t i = 0;
+    for (; i + 1 < count; i += 2) {
+        Digest& a = digests[i];
+        Digest& b = digests[i + 1];
+        MX_DEBUG_ASSERT(a.ref_count_ == 0 && b.ref_count_ == 0);
+        size_t used = static_cast<size_t>(a.ctx_.count % sha256::kBlockSize);
+        if (used != b.ctx_.count % sha256::kBlockSize) {
+            a.Update(data[i], len);
+            b.Update(data[i + 1], len);
+            continue;
+        }
+        // Both have the same partial block, so whole blocks line up.
+        const uint8_t* pa = static_cast<const uint8_t*>(data[i]);
+        const uint8_t* pb = static_cast<const uint8_t*>(data[i + 1]);
+        size_t n = len;
+        a.ctx_.count += len;
+        b.ctx_.count += len;
+        if (used != 0) {
+            size_t fill = mxtl::min(sha256::kBlockSize - used, n);
+            memcpy(a.ctx_.buf + used, pa, fill);
+            memcpy(b.ctx_.buf + used, pb, fill);
+            pa += fill;
+            pb += fill;
+            n -= fill;
+            if (used + fill < sha256::kBlockSize) {
+                continue;
+            }
+            sha256::Blocks2(a.ctx_.state, a.ctx_.buf, b.ctx_.state, b.ctx_.buf, 1);
+        }
+        sha256::Blocks2(a.ctx_.state, pa, b.ctx_.state, pb, n / sha256::kBlockSize);
+        pa += n - (n % sha256::kBlockSize);
+        pb += n - (n % sha256::kBlockSize);
+        memcpy(a.ctx_.buf, pa, n % sha256::kBlockSize);
+        memcpy(b.ctx_.buf, pb, n % sha256::kBlockSize);
+    }
+    for (; i < count; ++i) {
+        digests[i].Update(data[i], len);
+    }
 }
 
 const uint8_t* Digest::Final() {
     MX_DEBUG_ASSERT(ref_count_ == 0);
-#ifdef USE_LIBCRYPTO
-    SHA256_Final(bytes_, &ctx_);
-#else
-    memcpy(bytes_, clHASH_final(&ctx_), kLength);
-#endif // USE_LIBCRYPTO
+    uint64_t bits = ctx_.count * 8;
+    size_t used = static_cast<size_t>(ctx_.count % sha256::kBlockSize);
+    ctx_.buf[used++] = 0x80;
+    if (used > sha256::kBlockSize - sizeof(bits)) {
+        memset(ctx_.buf + used, 0, sha256::kBlockSize - used);
+        sha256::Blocks(ctx_.state, ctx_.buf, 1);
+        used = 0;
+    }
+    memset(ctx_.buf + used, 0, sha256::kBlockSize - sizeof(bits) - used);
+    for (size_t i = 0; i < sizeof(bits); ++i) {
+        ctx_.buf[sha256::kBlockSize - 1 - i] = static_cast<uint8_t>(bits >> (i * 8));
+    }
+    sha256::Blocks(ctx_.state, ctx_.buf, 1);
+    for (size_t i = 0; i < kLength / sizeof(uint32_t); ++i) {
+        bytes_[i * 4] = static_cast<uint8_t>(ctx_.state[i] >> 24);
+        bytes_[i * 4 + 1] = static_cast<uint8_t>(ctx_.state[i] >> 16);
+        bytes_[i * 4 + 2] = static_cast<uint8_t>(ctx_.state[i] >> 8);
+        bytes_[i * 4 + 3] = static_cast<uint8_t>(ctx_.state[i]);
+    }
     return bytes_;
 }
 
@@ -9,18 +9,8 @@
 
 #include <magenta/types.h>
 
-#ifdef USE_LIBCRYPTO
-#include <openssl/sha.h>
-#else
-#include <lib/crypto/cryptolib.h>
-#endif // USE_LIBCRYPTO
-
 #ifndef __cplusplus
-#ifdef USE_LIBCRYPTO
-#define MERKLE_DIGEST_LENGTH SHA256_DIGEST_LENGTH;
-#else
-#define MERKLE_DIGEST_LENGTH clSHA256_DIGEST_SIZE;
-#endif // USE_LIBCRYPTO
+#define MERKLE_DIGEST_LENGTH 32
 #else
 namespace merkle {
 
@@ -29,11 +19,7 @@ namespace merkle {
 class Digest final {
 public:
 // The length of a digest in bytes; this matches sizeof(this->data).
-#ifdef USE_LIBCRYPTO
-    static constexpr size_t kLength = SHA256_DIGEST_LENGTH;
-#else
-    static constexpr size_t kLength = clSHA256_DIGEST_SIZE;
-#endif // USE_LIBCRYPTO
+    static constexpr size_t kLength = 32;
 
     Digest() : ctx_{}, bytes_{0}, ref_count_(0) {}
     explicit Digest(const Digest& other);
@@ -55,6 +41,13 @@ public:
     // |Final| is called.
     void Update(const void* data, size_t len);
 
+    // Adds |len| bytes from each of |data[0]| to |data[count - 1]| to the
+    // corresponding |digests|, with the same result as calling |Update| on
+    // each in turn.  Digests which have been given the same number of bytes so
+    // far are updated together, which is faster on CPUs with SHA instructions.
+    static void UpdateMany(Digest* digests, const void* const* data, size_t count,
+                           size_t len);
+
     // Completes the hash algorithm and returns the digest.  This must only be
     // called after a call to |Init|; intervening calls to |Update| are
     // optional.
@@ -98,12 +91,13 @@ public:
     bool operator!=(const uint8_t* rhs) const;
 
 private:
-// The hash algorithm context.
-#ifdef USE_LIBCRYPTO
-    SHA256_CTX ctx_;
-#else
-    clSHA256_CTX ctx_;
-#endif // USE_LIBCRYPTO
+    // The hash algorithm context.
+    struct {
+        uint32_t state[8];
+        // Bytes hashed so far; those past the last whole block are in |buf|.
+        uint64_t count;
+        uint8_t buf[64];
+    } ctx_;
 
     // The raw bytes of the current digest.  This is filled in either by the
     // assignment operators or the Parse and Final methods.
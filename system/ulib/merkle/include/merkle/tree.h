@@ -103,6 +103,13 @@ public:
     mx_status_t Create(const void* data, size_t data_len, void* tree,
                        size_t tree_len, Digest* digest);
 
+    // As above, but spreads the hashing over up to |threads| threads,
+    // including the calling one.  Each level of the tree is split between
+    // them in turn.  The tree and root digest are the same as when made by a
+    // single thread.
+    mx_status_t Create(const void* data, size_t data_len, void* tree,
+                       size_t tree_len, Digest* digest, unsigned threads);
+
     // Sets the range of addresses within the tree that will need to be read to
     // fulfill a corresponding call to Verify. |offset| and |length| must
     // describe a range wholly within |data_len|. If the ranges fail to be set
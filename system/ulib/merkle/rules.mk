@@ -8,16 +8,19 @@ MODULE := $(LOCAL_DIR)
 
 MODULE_TYPE := userlib
 
+# SHA-256 is built in rather than taken from cryptolib, which is far too slow
+# for general purpose use.  The accelerated versions are only used if the CPU
+# has the instructions; each file builds to nothing on other architectures.
+# On arm64 that needs the crypto extensions in the target's -mcpu, since
+# Magenta cannot report them at runtime.
 MODULE_SRCS += \
     $(LOCAL_DIR)/digest.cpp \
+    $(LOCAL_DIR)/sha256.cpp \
+    $(LOCAL_DIR)/sha256-arm64.cpp \
+    $(LOCAL_DIR)/sha256-x86.cpp \
     $(LOCAL_DIR)/tree.cpp
 
 MODULE_SO_NAME := merkle
 MODULE_LIBS := ulib/mxcpp ulib/mxtl ulib/c
 
-# TODO(aarongreen): cryptolib is FAR too slow for general purpose use.  We'll
-# need to use it to bootstrap and verify libcrypto.so before switching to
-# BoringSSL's optimized digests.
-MODULE_STATIC_LIBS := ulib/cryptolib
-
 include make/module.mk
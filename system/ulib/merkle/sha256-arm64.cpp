@@ -0,0 +1,130 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sha256-private.h"
+
+#if SHA256_HAS_ARMV8
+
+#include <arm_neon.h>
+
+#if defined(__linux__)
+#include <sys/auxv.h>
+#ifndef HWCAP_SHA2
+#define HWCAP_SHA2 (1 << 6)
+#endif
+#endif
+
+// SHA-256 using the ARMv8 crypto extensions.  SHA256H and SHA256H2 do four
+// rounds on the ABCD and EFGH halves of the state, and SHA256SU0/SU1 extend
+// the message schedule four words at a time.  As on x86, the two-message
+// version runs the same steps on two sets of registers so that they overlap.
+
+#if defined(__ARM_FEATURE_CRYPTO)
+#define ARMV8_TARGET
+#else
+#define ARMV8_TARGET __attribute__((target("+crypto")))
+#endif
+#define ARMV8_INLINE ARMV8_TARGET __attribute__((always_inline)) inline
+
+namespace merkle {
+namespace sha256 {
+namespace {
+
+struct Lane {
+    uint32x4_t abcd;
+    uint32x4_t efgh;
+    uint32x4_t w[4];
+};
+
+ARMV8_INLINE void LoadWords(Lane* l, const uint8_t* data, int i) {
+    l->w[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + i * 16)));
+}
+
+// Does rounds 4i to 4i+3 and, if more are to come, works out the message
+// words for rounds 4i+16 to 4i+19 in place of those just used.
+ARMV8_INLINE void Rounds(Lane* l, int i) {
+    uint32x4_t& w = l->w[i % 4];
+    uint32x4_t wk = vaddq_u32(w, vld1q_u32(&kRoundConstants[i * 4]));
+    if (i < 12) {
+        w = vsha256su1q_u32(vsha256su0q_u32(w, l->w[(i + 1) % 4]),
+                            l->w[(i + 2) % 4], l->w[(i + 3) % 4]);
+    }
+    uint32x4_t abcd = l->abcd;
+    l->abcd = vsha256hq_u32(abcd, l->efgh, wk);
+    l->efgh = vsha256h2q_u32(l->efgh, abcd, wk);
+}
+
+ARMV8_INLINE void Block(Lane* l, const uint8_t* data) {
+    uint32x4_t abcd = l->abcd;
+    uint32x4_t efgh = l->efgh;
+    for (int i = 0; i < 4; ++i) {
+        LoadWords(l, data, i);
+    }
+    for (int i = 0; i < 16; ++i) {
+        Rounds(l, i);
+    }
+    l->abcd = vaddq_u32(l->abcd, abcd);
+    l->efgh = vaddq_u32(l->efgh, efgh);
+}
+
+ARMV8_INLINE void Block2(Lane* l0, const uint8_t* data0, Lane* l1, const uint8_t* data1) {
+    uint32x4_t abcd0 = l0->abcd;
+    uint32x4_t efgh0 = l0->efgh;
+    uint32x4_t abcd1 = l1->abcd;
+    uint32x4_t efgh1 = l1->efgh;
+    for (int i = 0; i < 4; ++i) {
+        LoadWords(l0, data0, i);
+        LoadWords(l1, data1, i);
+    }
+    for (int i = 0; i < 16; ++i) {
+        Rounds(l0, i);
+        Rounds(l1, i);
+    }
+    l0->abcd = vaddq_u32(l0->abcd, abcd0);
+    l0->efgh = vaddq_u32(l0->efgh, efgh0);
+    l1->abcd = vaddq_u32(l1->abcd, abcd1);
+    l1->efgh = vaddq_u32(l1->efgh, efgh1);
+}
+
+} // namespace
+
+bool HasArmv8() {
+#if defined(__ARM_FEATURE_CRYPTO)
+    return true;
+#else
+    return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+#endif
+}
+
+ARMV8_TARGET void BlocksArmv8(uint32_t* state, const uint8_t* data, size_t blocks) {
+    Lane l;
+    l.abcd = vld1q_u32(&state[0]);
+    l.efgh = vld1q_u32(&state[4]);
+    for (; blocks > 0; --blocks, data += kBlockSize) {
+        Block(&l, data);
+    }
+    vst1q_u32(&state[0], l.abcd);
+    vst1q_u32(&state[4], l.efgh);
+}
+
+ARMV8_TARGET void Blocks2Armv8(uint32_t* state0, const uint8_t* data0,
+                               uint32_t* state1, const uint8_t* data1, size_t blocks) {
+    Lane l0, l1;
+    l0.abcd = vld1q_u32(&state0[0]);
+    l0.efgh = vld1q_u32(&state0[4]);
+    l1.abcd = vld1q_u32(&state1[0]);
+    l1.efgh = vld1q_u32(&state1[4]);
+    for (; blocks > 0; --blocks, data0 += kBlockSize, data1 += kBlockSize) {
+        Block2(&l0, data0, &l1, data1);
+    }
+    vst1q_u32(&state0[0], l0.abcd);
+    vst1q_u32(&state0[4], l0.efgh);
+    vst1q_u32(&state1[0], l1.abcd);
+    vst1q_u32(&state1[4], l1.efgh);
+}
+
+} // namespace sha256
+} // namespace merkle
+
+#endif // SHA256_HAS_ARMV8
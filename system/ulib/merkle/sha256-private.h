@@ -0,0 +1,56 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The SHA-256 compression function, as used by merkle::Digest.  The portable
+// version is always available; faster ones are picked at runtime when the CPU
+// has SHA instructions (SHA-NI on x86, the crypto extensions on ARMv8).
+//
+// Magenta does not tell userspace about ARM CPU features, so there the ARMv8
+// version is only built when the target is known to have the crypto
+// extensions.  Linux hosts report them through the auxiliary vector.
+
+namespace merkle {
+namespace sha256 {
+
+constexpr size_t kBlockSize = 64;
+
+extern const uint32_t kInitialState[8];
+extern const uint32_t kRoundConstants[64];
+
+// Compresses |blocks| consecutive blocks of |data| into |state|.
+void Blocks(uint32_t* state, const uint8_t* data, size_t blocks);
+
+// As |Blocks|, but for two independent messages of the same number of blocks
+// at once.  Where the CPU can interleave them, this is close to twice as fast.
+void Blocks2(uint32_t* state0, const uint8_t* data0,
+             uint32_t* state1, const uint8_t* data1, size_t blocks);
+
+// The implementations.  The accelerated ones must only be called if the
+// matching Has* function returns true.
+void BlocksGeneric(uint32_t* state, const uint8_t* data, size_t blocks);
+
+#if defined(__x86_64__)
+#define SHA256_HAS_SHANI 1
+bool HasShaNi();
+void BlocksShaNi(uint32_t* state, const uint8_t* data, size_t blocks);
+void Blocks2ShaNi(uint32_t* state0, const uint8_t* data0,
+                  uint32_t* state1, const uint8_t* data1, size_t blocks);
+#endif
+
+#if defined(__aarch64__) && (defined(__ARM_FEATURE_CRYPTO) || \
+    (defined(__linux__) && defined(__GNUC__) && !defined(__clang__)))
+#define SHA256_HAS_ARMV8 1
+bool HasArmv8();
+void BlocksArmv8(uint32_t* state, const uint8_t* data, size_t blocks);
+void Blocks2Armv8(uint32_t* state0, const uint8_t* data0,
+                  uint32_t* state1, const uint8_t* data1, size_t blocks);
+#endif
+
+} // namespace sha256
+} // namespace merkle
@@ -0,0 +1,147 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sha256-private.h"
+
+#if SHA256_HAS_SHANI
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+// SHA-256 using the SHA-NI instructions.  The state is kept as the two
+// vectors that SHA256RNDS2 works on, ABEF and CDGH, and four rounds are done
+// per group of four message words.  The two-message version just runs the
+// same steps on two sets of registers, which lets the CPU overlap them; a
+// single message's rounds are a chain of dependent SHA256RNDS2s.
+
+#define SHANI_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+#define SHANI_INLINE SHANI_TARGET __attribute__((always_inline)) inline
+
+namespace merkle {
+namespace sha256 {
+namespace {
+
+struct Lane {
+    __m128i abef;
+    __m128i cdgh;
+    __m128i w[4];
+};
+
+SHANI_INLINE void Load(Lane* l, const uint32_t* state) {
+    __m128i dcba = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[0]));
+    __m128i hgfe = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[4]));
+    __m128i cdab = _mm_shuffle_epi32(dcba, 0xb1);
+    __m128i efgh = _mm_shuffle_epi32(hgfe, 0x1b);
+    l->abef = _mm_alignr_epi8(cdab, efgh, 8);
+    l->cdgh = _mm_blend_epi16(efgh, cdab, 0xf0);
+}
+
+SHANI_INLINE void Store(const Lane* l, uint32_t* state) {
+    __m128i feba = _mm_shuffle_epi32(l->abef, 0x1b);
+    __m128i dchg = _mm_shuffle_epi32(l->cdgh, 0xb1);
+    __m128i dcba = _mm_blend_epi16(feba, dchg, 0xf0);
+    __m128i hgfe = _mm_alignr_epi8(dchg, feba, 8);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]), dcba);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]), hgfe);
+}
+
+// Loads message words 4i to 4i+3 of the block at |data|.
+SHANI_INLINE void LoadWords(Lane* l, const uint8_t* data, int i) {
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i * 16));
+    l->w[i] = _mm_shuffle_epi8(w, bswap);
+}
+
+// Does rounds 4i to 4i+3 and, if more are to come, works out the message
+// words for rounds 4i+16 to 4i+19 in place of those just used.
+SHANI_INLINE void Rounds(Lane* l, int i) {
+    __m128i& w = l->w[i % 4];
+    __m128i k = _mm_load_si128(reinterpret_cast<const __m128i*>(&kRoundConstants[i * 4]));
+    __m128i wk = _mm_add_epi32(w, k);
+    l->cdgh = _mm_sha256rnds2_epu32(l->cdgh, l->abef, wk);
+    wk = _mm_shuffle_epi32(wk, 0x0e);
+    l->abef = _mm_sha256rnds2_epu32(l->abef, l->cdgh, wk);
+    if (i < 12) {
+        const __m128i& w1 = l->w[(i + 1) % 4];
+        const __m128i& w2 = l->w[(i + 2) % 4];
+        const __m128i& w3 = l->w[(i + 3) % 4];
+        __m128i t = _mm_sha256msg1_epu32(w, w1);
+        t = _mm_add_epi32(t, _mm_alignr_epi8(w3, w2, 4));
+        w = _mm_sha256msg2_epu32(t, w3);
+    }
+}
+
+SHANI_INLINE void Block(Lane* l, const uint8_t* data) {
+    __m128i abef = l->abef;
+    __m128i cdgh = l->cdgh;
+    for (int i = 0; i < 4; ++i) {
+        LoadWords(l, data, i);
+    }
+    for (int i = 0; i < 16; ++i) {
+        Rounds(l, i);
+    }
+    l->abef = _mm_add_epi32(l->abef, abef);
+    l->cdgh = _mm_add_epi32(l->cdgh, cdgh);
+}
+
+SHANI_INLINE void Block2(Lane* l0, const uint8_t* data0, Lane* l1, const uint8_t* data1) {
+    __m128i abef0 = l0->abef;
+    __m128i cdgh0 = l0->cdgh;
+    __m128i abef1 = l1->abef;
+    __m128i cdgh1 = l1->cdgh;
+    for (int i = 0; i < 4; ++i) {
+        LoadWords(l0, data0, i);
+        LoadWords(l1, data1, i);
+    }
+    for (int i = 0; i < 16; ++i) {
+        Rounds(l0, i);
+        Rounds(l1, i);
+    }
+    l0->abef = _mm_add_epi32(l0->abef, abef0);
+    l0->cdgh = _mm_add_epi32(l0->cdgh, cdgh0);
+    l1->abef = _mm_add_epi32(l1->abef, abef1);
+    l1->cdgh = _mm_add_epi32(l1->cdgh, cdgh1);
+}
+
+} // namespace
+
+bool HasShaNi() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) ||
+        !(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1)) {
+        return false;
+    }
+    if (__get_cpuid_max(0, nullptr) < 7) {
+        return false;
+    }
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    // CPUID.(EAX=07H, ECX=0):EBX.SHA[bit 29]
+    return (ebx & (1u << 29)) != 0;
+}
+
+SHANI_TARGET void BlocksShaNi(uint32_t* state, const uint8_t* data, size_t blocks) {
+    Lane l;
+    Load(&l, state);
+    for (; blocks > 0; --blocks, data += kBlockSize) {
+        Block(&l, data);
+    }
+    Store(&l, state);
+}
+
+SHANI_TARGET void Blocks2ShaNi(uint32_t* state0, const uint8_t* data0,
+                               uint32_t* state1, const uint8_t* data1, size_t blocks) {
+    Lane l0, l1;
+    Load(&l0, state0);
+    Load(&l1, state1);
+    for (; blocks > 0; --blocks, data0 += kBlockSize, data1 += kBlockSize) {
+        Block2(&l0, data0, &l1, data1);
+    }
+    Store(&l0, state0);
+    Store(&l1, state1);
+}
+
+} // namespace sha256
+} // namespace merkle
+
+#endif // SHA256_HAS_SHANI
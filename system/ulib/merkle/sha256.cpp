@@ -0,0 +1,141 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sha256-private.h"
+
+namespace merkle {
+namespace sha256 {
+
+const uint32_t kInitialState[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+alignas(16) const uint32_t kRoundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+namespace {
+
+inline uint32_t Ror(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+inline uint32_t LoadBE32(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+using BlocksFn = void (*)(uint32_t*, const uint8_t*, size_t);
+using Blocks2Fn = void (*)(uint32_t*, const uint8_t*, uint32_t*, const uint8_t*, size_t);
+
+void Blocks2Generic(uint32_t* state0, const uint8_t* data0,
+                    uint32_t* state1, const uint8_t* data1, size_t blocks) {
+    // Without SHA instructions there is little to gain from interleaving.
+    BlocksGeneric(state0, data0, blocks);
+    BlocksGeneric(state1, data1, blocks);
+}
+
+// The implementation is picked the first time it is needed.  Racing callers
+// all pick the same one, so relaxed atomics are enough.
+BlocksFn blocks_fn;
+Blocks2Fn blocks2_fn;
+
+void Select() {
+    BlocksFn one = BlocksGeneric;
+    Blocks2Fn two = Blocks2Generic;
+#if SHA256_HAS_SHANI
+    if (HasShaNi()) {
+        one = BlocksShaNi;
+        two = Blocks2ShaNi;
+    }
+#endif
+#if SHA256_HAS_ARMV8
+    if (HasArmv8()) {
+        one = BlocksArmv8;
+        two = Blocks2Armv8;
+    }
+#endif
+    __atomic_store_n(&blocks2_fn, two, __ATOMIC_RELAXED);
+    __atomic_store_n(&blocks_fn, one, __ATOMIC_RELAXED);
+}
+
+} // namespace
+
+void BlocksGeneric(uint32_t* state, const uint8_t* data, size_t blocks) {
+    uint32_t w[64];
+    for (; blocks > 0; --blocks, data += kBlockSize) {
+        for (int t = 0; t < 16; ++t) {
+            w[t] = LoadBE32(data + t * 4);
+        }
+        for (int t = 16; t < 64; ++t) {
+            uint32_t s0 = Ror(w[t - 15], 7) ^ Ror(w[t - 15], 18) ^ (w[t - 15] >> 3);
+            uint32_t s1 = Ror(w[t - 2], 17) ^ Ror(w[t - 2], 19) ^ (w[t - 2] >> 10);
+            w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int t = 0; t < 64; ++t) {
+            uint32_t s1 = Ror(e, 6) ^ Ror(e, 11) ^ Ror(e, 25);
+            uint32_t ch = (e & f) ^ (~e & g);
+            uint32_t t1 = h + s1 + ch + kRoundConstants[t] + w[t];
+            uint32_t s0 = Ror(a, 2) ^ Ror(a, 13) ^ Ror(a, 22);
+            uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t t2 = s0 + maj;
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+void Blocks(uint32_t* state, const uint8_t* data, size_t blocks) {
+    BlocksFn fn = __atomic_load_n(&blocks_fn, __ATOMIC_RELAXED);
+    if (!fn) {
+        Select();
+        fn = __atomic_load_n(&blocks_fn, __ATOMIC_RELAXED);
+    }
+    fn(state, data, blocks);
+}
+
+void Blocks2(uint32_t* state0, const uint8_t* data0,
+             uint32_t* state1, const uint8_t* data1, size_t blocks) {
+    Blocks2Fn fn = __atomic_load_n(&blocks2_fn, __ATOMIC_RELAXED);
+    if (!fn) {
+        Select();
+        fn = __atomic_load_n(&blocks2_fn, __ATOMIC_RELAXED);
+    }
+    fn(state0, data0, state1, data1, blocks);
+}
+
+} // namespace sha256
+} // namespace merkle
@@ -4,11 +4,13 @@
 
 #include <merkle/tree.h>
 
+#include <pthread.h>
 #include <string.h>
 
 #include <magenta/errors.h>
 #include <magenta/new.h>
 #include <mxtl/algorithm.h>
+#include <mxtl/atomic.h>
 #include <mxtl/unique_ptr.h>
 
 namespace merkle {
@@ -16,6 +18,68 @@ namespace merkle {
 constexpr size_t Tree::kNodeSize;
 const size_t kDigestsPerNode = Tree::kNodeSize / Digest::kLength;
 const size_t kMaxFailures = kDigestsPerNode;
+// The most nodes hashed at once by |HashNodes|.
+const size_t kMaxBatch = 8;
+// The number of nodes threads take from a level at a time when creating a tree
+// in parallel.
+const size_t kNodesPerChunk = 64;
+
+namespace {
+
+// Hashes the nodes in the |length| bytes at |nodes|, which start at |offset|
+// in the given |level|, and writes their digests to |out|.  Only the last node
+// may be short.
+void HashNodes(const uint8_t* nodes, uint64_t offset, size_t length,
+               size_t level, uint8_t* out) {
+    const size_t kNodeSize = Tree::kNodeSize;
+    Digest digests[kMaxBatch];
+    const void* batch[kMaxBatch];
+    while (length > 0) {
+        // Whole nodes are independent of each other, so hash several at once.
+        size_t n = mxtl::max(mxtl::min(length / kNodeSize, kMaxBatch), size_t(1));
+        size_t len = mxtl::min(length, kNodeSize);
+        for (size_t i = 0; i < n; ++i) {
+            digests[i].Init();
+            uint64_t locality = static_cast<uint64_t>((offset + i * kNodeSize) | level);
+            digests[i].Update(&locality, sizeof(locality));
+            batch[i] = nodes + i * kNodeSize;
+        }
+        Digest::UpdateMany(digests, batch, n, len);
+        for (size_t i = 0; i < n; ++i) {
+            memcpy(out, digests[i].Final(), Digest::kLength);
+            out += Digest::kLength;
+        }
+        nodes += n * len;
+        offset += n * len;
+        length -= n * len;
+    }
+}
+
+// A level of the tree being hashed by several threads.
+struct LevelJob {
+    const uint8_t* nodes;
+    uint64_t offset;
+    size_t length;
+    size_t level;
+    uint8_t* out;
+    size_t chunks;
+    mxtl::atomic<size_t> next;
+};
+
+void* HashChunks(void* arg) {
+    LevelJob* job = static_cast<LevelJob*>(arg);
+    const size_t kChunkSize = kNodesPerChunk * Tree::kNodeSize;
+    size_t n;
+    while ((n = job->next.fetch_add(1)) < job->chunks) {
+        size_t start = n * kChunkSize;
+        HashNodes(job->nodes + start, job->offset + start,
+                  mxtl::min(job->length - start, kChunkSize), job->level,
+                  job->out + n * kNodesPerChunk * Digest::kLength);
+    }
+    return nullptr;
+}
+
+} // namespace
 
 Tree::~Tree() {}
 
@@ -63,7 +127,7 @@ mx_status_t Tree::CreateUpdate(const void* data, size_t length, void* tree) {
     if (offset_ + length > data_len_) {
         return ERR_BUFFER_TOO_SMALL;
     }
-    return HashData(data, length, data_len_ < kNodeSize ? nullptr : tree);
+    return HashData(data, length, data_len_ <= kNodeSize ? nullptr : tree);
 }
 
 mx_status_t Tree::CreateFinal(void* tree, Digest* digest) {
@@ -93,13 +157,19 @@ mx_status_t Tree::CreateFinal(void* tree, Digest* digest) {
         static_cast<uint8_t*>(tree) + offsets_[offsets_.size() - 1] + kNodeSize;
     while (level_ < offsets_.size()) {
         HashNode(tree);
-        mx_status_t rc = digest_.CopyTo(hash, end - hash);
+        // Only copy the digest; the rest of the level is already zeroed.
+        mx_status_t rc = digest_.CopyTo(
+            hash, mxtl::min(static_cast<size_t>(end - hash), Digest::kLength));
         if (rc != NO_ERROR) {
             return rc;
         }
         hash += Digest::kLength;
         if (offset_ == offsets_[level_]) {
+            // The next level's digests start on a node boundary.
             ++level_;
+            if (level_ < offsets_.size()) {
+                hash = static_cast<uint8_t*>(tree) + offsets_[level_];
+            }
         }
     }
     HashNode(tree);
@@ -124,11 +194,75 @@ mx_status_t Tree::Create(const void* data, size_t data_len, void* tree,
     return NO_ERROR;
 }
 
+mx_status_t Tree::Create(const void* data, size_t data_len, void* tree,
+                         size_t tree_len, Digest* digest, unsigned threads) {
+    // Trees without enough leaves for every thread to have a share are made
+    // just as quickly by one.
+    if (threads < 2 || data_len / (kNodesPerChunk * kNodeSize) < threads) {
+        return Create(data, data_len, tree, tree_len, digest);
+    }
+    if (!data || !tree || !digest) {
+        return ERR_INVALID_ARGS;
+    }
+    mx_status_t rc = CreateInit(data_len, tree, tree_len);
+    if (rc != NO_ERROR) {
+        return rc;
+    }
+    AllocChecker ac;
+    mxtl::unique_ptr<pthread_t[]> workers(new (&ac) pthread_t[threads - 1]);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    uint8_t* hashes = static_cast<uint8_t*>(tree);
+    LevelJob job;
+    job.nodes = static_cast<const uint8_t*>(data);
+    job.offset = 0;
+    job.length = data_len;
+    // Each level's digests make up the nodes of the one above, and the
+    // digests of the last, single node level are the root.  A level must be
+    // finished before the next is started.
+    for (level_ = 0; level_ < offsets_.size(); ++level_) {
+        job.level = level_;
+        job.out = hashes + offsets_[level_];
+        job.chunks = mxtl::roundup(job.length, kNodesPerChunk * kNodeSize) /
+                     (kNodesPerChunk * kNodeSize);
+        job.next.store(0);
+        size_t wanted = mxtl::min(static_cast<size_t>(threads - 1), job.chunks - 1);
+        size_t started = 0;
+        while (started < wanted) {
+            if (pthread_create(&workers[started], nullptr, HashChunks, &job) != 0) {
+                // Make do with the threads we have.
+                break;
+            }
+            ++started;
+        }
+        HashChunks(&job);
+        for (size_t i = 0; i < started; ++i) {
+            pthread_join(workers[i], nullptr);
+        }
+        job.nodes = hashes + offsets_[level_];
+        job.offset = offsets_[level_];
+        job.length = (level_ + 1 < offsets_.size() ? offsets_[level_ + 1]
+                                                   : offsets_[level_] + kNodeSize) -
+                     offsets_[level_];
+    }
+    offset_ = job.offset;
+    HashNode(tree);
+    *digest = digest_;
+    return NO_ERROR;
+}
+
 mx_status_t Tree::SetRanges(size_t data_len, uint64_t offset, size_t length) {
     uint64_t finish = offset + length;
     if (finish < offset || finish > data_len) {
         return ERR_INVALID_ARGS;
     }
+    // The geometry may not be known yet if this tree has not been used to
+    // create or verify anything.
+    mx_status_t rc = SetLengths(data_len, GetTreeLength(data_len));
+    if (rc != NO_ERROR) {
+        return rc;
+    }
     offset -= offset % kNodeSize;
     if (finish != data_len) {
         finish = mxtl::roundup(finish, kNodeSize);
@@ -138,17 +272,18 @@ mx_status_t Tree::SetRanges(size_t data_len, uint64_t offset, size_t length) {
     if (!ac.check()) {
         return ERR_NO_MEMORY;
     }
+    // |offset| and |finish| are relative to the start of the level they are
+    // in; each level is found from the one below it.
     for (size_t i = 0; i < offsets_.size(); ++i) {
         offset /= kDigestsPerNode;
-        offset = offsets_[i] + offset - (offset % kNodeSize);
-        raw[i].offset = offset;
+        offset -= offset % kNodeSize;
+        raw[i].offset = offsets_[i] + offset;
         if (length == 0) {
             raw[i].length = 0;
             continue;
         }
         finish /= kDigestsPerNode;
-        finish = offsets_[i] + mxtl::roundup(finish, kNodeSize);
-        raw[i].offset = offset;
+        finish = mxtl::roundup(finish, kNodeSize);
         raw[i].length = static_cast<size_t>(finish - offset);
     }
     ranges_.reset(raw, offsets_.size());
@@ -270,6 +405,18 @@ mx_status_t Tree::HashData(const void* data, size_t length, void* tree) {
     hashes += (offset_ / kNodeSize) * Digest::kLength;
     end += offsets_.size() > 1 ? offsets_[1] : kNodeSize;
     while (length > 0) {
+        if (offset_ % kNodeSize == 0 && length >= 2 * kNodeSize) {
+            size_t n = length / kNodeSize;
+            if (static_cast<size_t>(end - hashes) < n * Digest::kLength) {
+                return ERR_BUFFER_TOO_SMALL;
+            }
+            HashNodes(bytes, offset_, n * kNodeSize, level_, hashes);
+            hashes += n * Digest::kLength;
+            bytes += n * kNodeSize;
+            offset_ += n * kNodeSize;
+            length -= n * kNodeSize;
+            continue;
+        }
         if (offset_ % kNodeSize == 0) {
             digest_.Init();
             uint64_t locality = static_cast<uint64_t>(offset_ | level_);
@@ -288,7 +435,8 @@ mx_status_t Tree::HashData(const void* data, size_t length, void* tree) {
         if (!hashes) {
             continue;
         }
-        mx_status_t rc = digest_.CopyTo(hashes, end - hashes);
+        mx_status_t rc = digest_.CopyTo(
+            hashes, mxtl::min(static_cast<size_t>(end - hashes), Digest::kLength));
         if (rc != NO_ERROR) {
             return rc;
         }
@@ -6,6 +6,7 @@
 
 #include <mx/handle.h>
 #include <mx/object.h>
+#include <mx/vmo.h>
 
 namespace mx {
 
@@ -38,6 +39,16 @@ public:
                      size_t* actual) const {
         return mx_socket_read(get(), flags, buffer, len, actual);
     }
+
+    mx_status_t write_vmo(uint32_t flags, const vmo& source, uint64_t offset,
+                          size_t len, size_t* actual) const {
+        return mx_socket_write_vmo(get(), flags, source.get(), offset, len, actual);
+    }
+
+    mx_status_t read_vmo(uint32_t flags, const vmo& dest, uint64_t offset,
+                         size_t len, size_t* actual) const {
+        return mx_socket_read_vmo(get(), flags, dest.get(), offset, len, actual);
+    }
 };
 
 } // namespace mx
@@ -7,9 +7,12 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <bootdata/bootfs.h>
 #include <magenta/boot/bootdata.h>
+#include <magenta/process.h>
 #include <magenta/syscalls.h>
 #include <magenta/types.h>
+#include <mxio/util.h>
 
 #define BOOTFS_MAX_NAME_LEN 256
 
@@ -24,6 +27,7 @@
 //   namedata   (namelength bytes, includes \0)
 //
 // - fileoffsets must be page aligned (multiple of 4096)
+// - the first record may be an index of the rest (see <bootdata/bootfs.h>)
 
 #define NLEN 0
 #define FSIZ 1
@@ -101,6 +105,34 @@ void bootfs_parse(mx_handle_t vmo, size_t len,
         data += header[NLEN];
         name[header[NLEN] - 1] = 0;
 
+        // the index is not a file
+        if ((header[NLEN] == sizeof(BOOTFS_INDEX_NAME)) &&
+            !strcmp(name, BOOTFS_INDEX_NAME)) {
+            continue;
+        }
+
         (*cb)(cb_arg, name, header[FOFF], header[FSIZ]);
     }
 }
+
+mx_status_t bootfs_lookup(mx_handle_t vmo, size_t len, const char* name,
+                          size_t* off, size_t* size) {
+    uintptr_t addr;
+    mx_status_t r = mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, len,
+                                MX_VM_FLAG_PERM_READ, &addr);
+    if (r < 0) {
+        return r;
+    }
+    uint32_t foff, fsiz;
+    r = bootfs_find((const uint8_t*)addr, len, name, &foff, &fsiz);
+    mx_vmar_unmap(mx_vmar_root_self(), addr, len);
+    if (r < 0) {
+        return r;
+    }
+    if ((foff > len) || (fsiz > len - foff)) {
+        return ERR_IO;
+    }
+    *off = foff;
+    *size = fsiz;
+    return NO_ERROR;
+}
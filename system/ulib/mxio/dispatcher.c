@@ -44,6 +44,9 @@ struct mxio_dispatcher {
     mx_handle_t ioport;
     mxio_dispatcher_cb_t default_cb;
     thrd_t t;
+    // Threads still running the dispatch loop; the last one to exit
+    // destroys the dispatcher.
+    uint32_t threads;
 };
 
 static void mxio_dispatcher_destroy(mxio_dispatcher_t* md) {
@@ -147,7 +150,9 @@ static int mxio_dispatcher_thread(void* _md) {
     }
 
     xprintf("dispatcher: FATAL ERROR, EXITING\n");
-    mxio_dispatcher_destroy(md);
+    if (__atomic_sub_fetch(&md->threads, 1, __ATOMIC_ACQ_REL) == 0) {
+        mxio_dispatcher_destroy(md);
+    }
     return NO_ERROR;
 }
 
@@ -173,6 +178,7 @@ mx_status_t mxio_dispatcher_start(mxio_dispatcher_t* md, const char* name) {
     mx_status_t r;
     mtx_lock(&md->lock);
     if (md->t == NULL) {
+        md->threads = 1;
         if (thrd_create_with_name(&md->t, mxio_dispatcher_thread, md, name) != thrd_success) {
             mxio_dispatcher_destroy(md);
             r = ERR_NO_RESOURCES;
@@ -188,6 +194,30 @@ mx_status_t mxio_dispatcher_start(mxio_dispatcher_t* md, const char* name) {
 }
 
 void mxio_dispatcher_run(mxio_dispatcher_t* md) {
+    mxio_dispatcher_run_workers(md, NULL, 1);
+}
+
+void mxio_dispatcher_run_workers(mxio_dispatcher_t* md, const char* name, uint32_t count) {
+#if !USE_WAIT_ONCE
+    // A repeating wait may queue a second packet for a handle while the
+    // first is still being handled.
+    count = 1;
+#endif
+    if (count == 0) {
+        count = 1;
+    }
+    // Account for every thread up front, so that an early exit by one
+    // cannot destroy the dispatcher under the others.
+    __atomic_store_n(&md->threads, count, __ATOMIC_RELEASE);
+    for (uint32_t n = 1; n < count; n++) {
+        thrd_t t;
+        if (thrd_create_with_name(&t, mxio_dispatcher_thread, md, name) != thrd_success) {
+            printf("dispatcher: could only start %u of %u threads\n", n, count);
+            __atomic_sub_fetch(&md->threads, count - n, __ATOMIC_ACQ_REL);
+            break;
+        }
+        thrd_detach(t);
+    }
     mxio_dispatcher_thread(md);
 }
 
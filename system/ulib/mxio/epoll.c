@@ -99,6 +99,7 @@ static mxio_ops_t mxio_epoll_ops = {
     .wait_begin = mxio_default_wait_begin,
     .wait_end = mxio_default_wait_end,
     .posix_ioctl = mxio_default_posix_ioctl,
+    .get_vmo = mxio_default_get_vmo,
 };
 
 mxio_t* mxio_epoll_create(mx_handle_t h) {
@@ -32,6 +32,13 @@ mx_status_t mxio_dispatcher_start(mxio_dispatcher_t* md, const char* name);
 // run the dispatcher loop on the current thread, never to return
 void mxio_dispatcher_run(mxio_dispatcher_t* md);
 
+// run the dispatcher loop on the current thread and |count| - 1 more
+// threads (named |name|), never to return.
+//
+// Each handle is serviced by one thread at a time, but different handles
+// are serviced in parallel, so the callbacks must be thread-safe.
+void mxio_dispatcher_run_workers(mxio_dispatcher_t* md, const char* name, uint32_t count);
+
 // add a channel to the dispatcher, using the default callback
 mx_status_t mxio_dispatcher_add(mxio_dispatcher_t* md, mx_handle_t h,
                                 void* func, void* cookie);
@@ -47,6 +47,13 @@ int mxio_handle_fd(mx_handle_t h, mx_signals_t signals_in, mx_signals_t signals_
 // invoke a raw mxio ioctl
 ssize_t mxio_ioctl(int fd, int op, const void* in_buf, size_t in_len, void* out_buf, size_t out_len);
 
+// get a vmo holding the contents of a file, which will not change under the
+// caller; the file occupies [offset, offset + len) of the vmo
+// the vmo is shared with the filesystem (and read-only) when its files are
+// immutable, and otherwise a copy; ERR_NOT_SUPPORTED if the file may still
+// change, in which case the caller should read it instead
+mx_status_t mxio_get_vmo(int fd, mx_handle_t* out_vmo, size_t* out_offset, size_t* out_len);
+
 // create a pipe, installing one half in a fd, returning the other
 // for transport to another process
 mx_status_t mxio_pipe_half(mx_handle_t* handle, uint32_t* type);
@@ -49,7 +49,8 @@ __BEGIN_CDECLS
 #define MXRIO_SETATTR      0x00000018
 #define MXRIO_SYNC         0x00000019
 #define MXRIO_LINK        (0x0000001a | MXRIO_ONE_HANDLE)
-#define MXRIO_NUM_OPS      27
+#define MXRIO_GET_VMO      0x0000001b
+#define MXRIO_NUM_OPS      28
 
 #define MXRIO_OP(n)        ((n) & 0x3FF) // opcode
 #define MXRIO_HC(n)        (((n) >> 8) & 3) // handle count
@@ -62,7 +63,7 @@ __BEGIN_CDECLS
     "read_at", "write_at", "truncate", "rename", \
     "connect", "bind", "listen", "getsockname", \
     "getpeername", "getsockopt", "setsockopt", "getaddrinfo", \
-    "setattr", "sync", "link" }
+    "setattr", "sync", "link", "get_vmo" }
 
 const char* mxio_opname(uint32_t op);
 
@@ -27,6 +27,13 @@ void bootfs_parse(mx_handle_t vmo, size_t len,
                   void (*cb)(void*, const char* fn, size_t off, size_t len),
                   void* cb_arg);
 
+// Finds the file 'name' in the bootfs image of 'len' bytes in 'vmo', using
+// the image's index if it has one, and returns the offset and size of its
+// data. Returns ERR_NOT_FOUND if there is no such file, or ERR_IO if the
+// image is malformed.
+mx_status_t bootfs_lookup(mx_handle_t vmo, size_t len, const char* name,
+                          size_t* off, size_t* size);
+
 // used for bootstrap
 void mxio_install_root(mxio_t* root);
 
@@ -59,6 +59,12 @@ typedef struct vnattr {
 #define VTYPE_TO_DTYPE(mode) (((mode)&V_TYPE_MASK) >> 12)
 #define DTYPE_TO_VTYPE(type) (((type)&15) << 12)
 
+// Rights on the vmos handed out by MXRIO_GET_VMO: enough to read, map and
+// execute a file, but never to modify the filesystem's own copy of it.
+#define VFS_VMO_RIGHTS_READONLY (MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER | \
+                                 MX_RIGHT_READ | MX_RIGHT_EXECUTE | \
+                                 MX_RIGHT_MAP)
+
 typedef struct vdirent {
     uint32_t size;
     uint32_t type;
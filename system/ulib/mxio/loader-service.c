@@ -6,6 +6,7 @@
 
 #include <mxio/debug.h>
 #include <mxio/dispatcher.h>
+#include <mxio/io.h>
 
 #include <errno.h>
 #include <fcntl.h>
@@ -47,9 +48,120 @@ static const char* libpaths[] = {
     "/boot/lib",
 };
 
-static mx_handle_t default_load_object(void* ignored,
+// Every process start loads much the same set of libraries, so a loader
+// keeps the VMOs it has made for recently loaded files and hands out
+// read-only duplicates of them. An entry is used only while the file at its
+// path still has the same identity (inode, size and modification time);
+// otherwise the file is read again.
+#define LOADER_CACHE_ENTRIES 32
+
+// Enough to map a file and copy its writable segments, but not to change it
+// beneath the other processes which share it.
+#define LOADER_VMO_RIGHTS (MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER | MX_RIGHT_READ | \
+                           MX_RIGHT_EXECUTE | MX_RIGHT_MAP)
+
+typedef struct loader_cache_entry {
+    char* path; // NULL if unused
+    uint64_t ino;
+    uint64_t size;
+    struct timespec mtime;
+    uint64_t last_use;
+    mx_handle_t vmo;
+} loader_cache_entry_t;
+
+typedef struct loader_cache {
+    mtx_t lock;
+    uint64_t clock;
+    loader_cache_entry_t entries[LOADER_CACHE_ENTRIES];
+} loader_cache_t;
+
+static bool loader_cache_entry_matches(const loader_cache_entry_t* e,
+                                       const struct stat* s) {
+    return (e->ino == (uint64_t)s->st_ino) &&
+           (e->size == (uint64_t)s->st_size) &&
+           (e->mtime.tv_sec == s->st_mtim.tv_sec) &&
+           (e->mtime.tv_nsec == s->st_mtim.tv_nsec);
+}
+
+static void loader_cache_entry_clear(loader_cache_entry_t* e) {
+    if (e->path != NULL) {
+        free(e->path);
+        mx_handle_close(e->vmo);
+        e->path = NULL;
+        e->vmo = MX_HANDLE_INVALID;
+    }
+}
+
+// Returns a duplicate of the cached VMO for 'path', or 0 if there is none
+// for the file as it is now.
+static mx_handle_t loader_cache_lookup(loader_cache_t* cache, const char* path,
+                                       const struct stat* s) {
+    mx_handle_t vmo = 0;
+    mtx_lock(&cache->lock);
+    for (unsigned n = 0; n < countof(cache->entries); n++) {
+        loader_cache_entry_t* e = &cache->entries[n];
+        if ((e->path == NULL) || strcmp(e->path, path)) {
+            continue;
+        }
+        if (!loader_cache_entry_matches(e, s)) {
+            // The file has changed since it was cached.
+            loader_cache_entry_clear(e);
+        } else if (mx_handle_duplicate(e->vmo, LOADER_VMO_RIGHTS, &vmo) < 0) {
+            vmo = 0;
+        } else {
+            e->last_use = ++cache->clock;
+        }
+        break;
+    }
+    mtx_unlock(&cache->lock);
+    return vmo;
+}
+
+// Takes ownership of 'vmo', freshly read from 'path', and returns the handle
+// to hand out for it: a duplicate if it was cached, or 'vmo' itself if not.
+static mx_handle_t loader_cache_insert(loader_cache_t* cache, const char* path,
+                                       const struct stat* s, mx_handle_t vmo) {
+    char* copy = strdup(path);
+    if (copy == NULL) {
+        return vmo;
+    }
+    mx_handle_t dup;
+    if (mx_handle_duplicate(vmo, LOADER_VMO_RIGHTS, &dup) < 0) {
+        free(copy);
+        return vmo;
+    }
+
+    mtx_lock(&cache->lock);
+    // Replace any entry for the same path (another request may have read it
+    // at the same time), else an unused entry, else the least recently used.
+    loader_cache_entry_t* victim = &cache->entries[0];
+    for (unsigned n = 0; n < countof(cache->entries); n++) {
+        loader_cache_entry_t* e = &cache->entries[n];
+        if ((e->path != NULL) && !strcmp(e->path, path)) {
+            victim = e;
+            break;
+        }
+        if ((victim->path != NULL) &&
+            ((e->path == NULL) || (e->last_use < victim->last_use))) {
+            victim = e;
+        }
+    }
+    loader_cache_entry_clear(victim);
+    victim->path = copy;
+    victim->ino = s->st_ino;
+    victim->size = s->st_size;
+    victim->mtime = s->st_mtim;
+    victim->last_use = ++cache->clock;
+    victim->vmo = vmo;
+    mtx_unlock(&cache->lock);
+    return dup;
+}
+
+// |arg| is the loader_cache_t of a multiloader, or NULL.
+static mx_handle_t default_load_object(void* arg,
                                        uint32_t load_op,
                                        const char* fn) {
+    loader_cache_t* cache = arg;
     char buffer[8192];  // 8K is the max io size of the mxio layer right now
     char path[PATH_MAX];
     mx_handle_t vmo = 0;
@@ -89,6 +201,23 @@ found:
         goto fail;
     }
 
+    if ((cache != NULL) && ((vmo = loader_cache_lookup(cache, resolved_fn, &s)) > 0)) {
+        close(fd);
+        return vmo;
+    }
+
+    // Use the VMO the filesystem hands out, if it can, when the file starts
+    // at the beginning of it (the loader protocol has no way to pass an
+    // offset). Its contents never change, so it may be cached and shared.
+    size_t vmo_off, vmo_len;
+    if (mxio_get_vmo(fd, &vmo, &vmo_off, &vmo_len) == NO_ERROR) {
+        if (vmo_off == 0) {
+            goto loaded;
+        }
+        mx_handle_close(vmo);
+        vmo = 0;
+    }
+
     if ((err = mx_vmo_create(s.st_size, 0, &vmo)) < 0) {
         fprintf(stderr, "dlsvc: could not create %lld-byte vmo for '%s': %d\n",
                 (long long int)s.st_size, resolved_fn, err);
@@ -129,7 +258,11 @@ found:
         off += nwrite;
         size -= nwrite;
     }
+loaded:
     close(fd);
+    if (cache != NULL) {
+        return loader_cache_insert(cache, resolved_fn, &s, vmo);
+    }
     return vmo;
 
 fail:
@@ -232,6 +365,7 @@ struct mxio_multiloader {
     mtx_t dispatcher_lock;
     mxio_dispatcher_t* dispatcher;
     mx_handle_t dispatcher_log;
+    loader_cache_t cache;
 };
 
 mx_status_t mxio_multiloader_create(const char* name,
@@ -259,7 +393,7 @@ static mx_status_t multiloader_cb(mx_handle_t h, void* cb, void* cookie) {
     // This uses ml->dispatcher_log without grabbing the lock, but
     // it will never change once the dispatcher that called us is created.
     mxio_multiloader_t* ml = (mxio_multiloader_t*) cookie;
-    return handle_loader_rpc(h, default_load_object, NULL, ml->dispatcher_log);
+    return handle_loader_rpc(h, default_load_object, &ml->cache, ml->dispatcher_log);
 }
 
 // TODO(dbort): Provide a name/id for the process that this handle will
@@ -565,6 +565,29 @@ static mx_status_t mxrio_misc(mxio_t* io, uint32_t op, int64_t off,
     return r;
 }
 
+static mx_status_t mxrio_get_vmo(mxio_t* io, mx_handle_t* out, size_t* off, size_t* len) {
+    mxrio_t* rio = (mxrio_t*)io;
+    mxrio_msg_t msg;
+    mx_status_t r;
+
+    memset(&msg, 0, MXRIO_HDR_SZ);
+    msg.op = MXRIO_GET_VMO;
+
+    if ((r = mxrio_txn(rio, &msg)) < 0) {
+        return r;
+    }
+    // The server replies with the vmo, which holds the file starting at
+    // offset zero, and the length of the file.
+    if ((msg.hcount != 1) || (msg.arg2.off < 0)) {
+        discard_handles(msg.handle, msg.hcount);
+        return ERR_IO;
+    }
+    *out = msg.handle[0];
+    *off = 0;
+    *len = msg.arg2.off;
+    return NO_ERROR;
+}
+
 mx_status_t mxio_from_handles(uint32_t type, mx_handle_t* handles, int hcount,
                               void* extra, uint32_t esize, mxio_t** out) {
     mx_status_t r;
@@ -729,6 +752,7 @@ static mxio_ops_t mx_remote_ops = {
     .wait_end = mxrio_wait_end,
     .unwrap = mxrio_unwrap,
     .posix_ioctl = mxio_default_posix_ioctl,
+    .get_vmo = mxrio_get_vmo,
 };
 
 mxio_t* mxio_remote_create(mx_handle_t h, mx_handle_t e) {
@@ -1176,6 +1200,7 @@ static mxio_ops_t mxio_socket_stream_ops = {
     .wait_end = mxsio_wait_end_stream,
     .unwrap = mxio_default_unwrap,
     .posix_ioctl = mxsio_posix_ioctl_stream,
+    .get_vmo = mxio_default_get_vmo,
 };
 
 static mxio_ops_t mxio_socket_dgram_ops = {
@@ -1193,6 +1218,7 @@ static mxio_ops_t mxio_socket_dgram_ops = {
     .wait_end = mxsio_wait_end_dgram,
     .unwrap = mxio_default_unwrap,
     .posix_ioctl = mxio_default_posix_ioctl, // not supported
+    .get_vmo = mxio_default_get_vmo,
 };
 
 mxio_t* mxio_socket_create(mx_handle_t h, mx_handle_t s) {
@@ -28,5 +28,6 @@ MODULE_EXPORT := so
 
 MODULE_SO_NAME := mxio
 MODULE_LIBS := ulib/magenta ulib/c
+MODULE_STATIC_LIBS := ulib/bootdata
 
 include make/module.mk
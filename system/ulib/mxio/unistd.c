@@ -14,6 +14,7 @@
 #include <string.h>
 #include <sys/epoll.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/select.h>
 #include <sys/stat.h>
 #include <sys/uio.h>
@@ -21,6 +22,7 @@
 #include <threads.h>
 #include <unistd.h>
 
+#include <magenta/process.h>
 #include <magenta/processargs.h>
 #include <magenta/syscalls.h>
 
@@ -497,6 +499,127 @@ ssize_t mxio_ioctl(int fd, int op, const void* in_buf, size_t in_len, void* out_
     return r;
 }
 
+mx_status_t mxio_get_vmo(int fd, mx_handle_t* out_vmo, size_t* out_offset, size_t* out_len) {
+    mxio_t* io;
+    if ((io = fd_to_io(fd)) == NULL) {
+        return ERR_BAD_HANDLE;
+    }
+    mx_status_t r = io->ops->get_vmo(io, out_vmo, out_offset, out_len);
+    mxio_release(io);
+    return r;
+}
+
+// read [fd_off, fd_off + len) of a file into a new vmo; past the end of the
+// file it is left zero
+static mx_status_t mmap_file_read(int fd, off_t fd_off, size_t len, mx_handle_t* out) {
+    mx_handle_t vmo;
+    mx_status_t r;
+    if ((r = mx_vmo_create(len, 0, &vmo)) < 0) {
+        return r;
+    }
+    char buf[PAGE_SIZE];
+    for (size_t at = 0; at < len;) {
+        size_t xfer = len - at;
+        if (xfer > sizeof(buf)) {
+            xfer = sizeof(buf);
+        }
+        ssize_t n = pread(fd, buf, xfer, fd_off + at);
+        if (n < 0) {
+            r = ERR_IO;
+            break;
+        } else if (n == 0) {
+            break;
+        }
+        size_t actual;
+        if ((r = mx_vmo_write(vmo, buf, at, n, &actual)) < 0) {
+            break;
+        }
+        at += n;
+    }
+    if (r < 0) {
+        mx_handle_close(vmo);
+        return r;
+    }
+    *out = vmo;
+    return NO_ERROR;
+}
+
+// hook into libc mmap, for mappings of files
+// read-only mappings map the vmo from mxio_get_vmo(), which does not follow
+// later writes to the file; private writable mappings (and files which are
+// not page aligned within their vmo) get a copy, since writes must not reach
+// the file
+// files which may still change have no such vmo, and only the mapped range
+// of them is read into one
+mx_status_t _mmap_file(size_t offset, size_t len, uint32_t mx_flags, int flags,
+                       int fd, off_t fd_off, uintptr_t* out) {
+    if (fd_off < 0) {
+        return ERR_INVALID_ARGS;
+    }
+    mx_handle_t vmo;
+    size_t vmo_off, vmo_len;
+    mx_status_t r = mxio_get_vmo(fd, &vmo, &vmo_off, &vmo_len);
+    if (r == ERR_NOT_SUPPORTED) {
+        if ((flags & MAP_SHARED) && (mx_flags & MX_VM_FLAG_PERM_WRITE)) {
+            // Nothing would carry writes back to the file.
+            return ERR_ACCESS_DENIED;
+        }
+        if ((r = mmap_file_read(fd, fd_off, len, &vmo)) < 0) {
+            return r;
+        }
+        r = mx_vmar_map(mx_vmar_root_self(), offset, vmo, 0, len, mx_flags, out);
+        mx_handle_close(vmo);
+        return r;
+    } else if (r < 0) {
+        return r;
+    }
+    if ((size_t)fd_off > vmo_len) {
+        r = ERR_INVALID_ARGS;
+        goto done;
+    }
+
+    if (!(mx_flags & MX_VM_FLAG_PERM_WRITE) && (((vmo_off + fd_off) % PAGE_SIZE) == 0)) {
+        r = mx_vmar_map(mx_vmar_root_self(), offset, vmo, vmo_off + fd_off,
+                        len, mx_flags, out);
+        goto done;
+    }
+    if (flags & MAP_SHARED) {
+        // Nothing would carry writes back to the file.
+        r = (mx_flags & MX_VM_FLAG_PERM_WRITE) ? ERR_ACCESS_DENIED : ERR_INVALID_ARGS;
+        goto done;
+    }
+
+    mx_handle_t copy;
+    if ((r = mx_vmo_create(len, 0, &copy)) < 0) {
+        goto done;
+    }
+    size_t remaining = vmo_len - fd_off;
+    if (remaining > len) {
+        remaining = len;
+    }
+    char buf[PAGE_SIZE];
+    for (size_t at = 0; at < remaining; at += sizeof(buf)) {
+        size_t xfer = remaining - at;
+        if (xfer > sizeof(buf)) {
+            xfer = sizeof(buf);
+        }
+        size_t actual;
+        if ((r = mx_vmo_read(vmo, buf, vmo_off + fd_off + at, xfer, &actual)) < 0) {
+            break;
+        }
+        if ((r = mx_vmo_write(copy, buf, at, actual, &actual)) < 0) {
+            break;
+        }
+    }
+    if (r >= 0) {
+        r = mx_vmar_map(mx_vmar_root_self(), offset, copy, 0, len, mx_flags, out);
+    }
+    mx_handle_close(copy);
+done:
+    mx_handle_close(vmo);
+    return r;
+}
+
 mx_status_t mxio_wait_fd(int fd, uint32_t events, uint32_t* _pending, mx_time_t timeout) {
     mx_status_t r = NO_ERROR;
     mxio_t* io;
@@ -2,6 +2,7 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <limits.h>
 #include <stdatomic.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -135,6 +136,35 @@ static mx_status_t vmofile_misc(mxio_t* io, uint32_t op, int64_t off, uint32_t m
     }
 }
 
+// The handle covers the whole boot image, and may not be mapped, so the file
+// is copied out to a vmo of its own.
+static mx_status_t vmofile_get_vmo(mxio_t* io, mx_handle_t* out, size_t* off, size_t* len) {
+    vmofile_t* vf = (vmofile_t*)io;
+    size_t size = vf->end - vf->off;
+    mx_handle_t vmo;
+    mx_status_t status = mx_vmo_create(size, 0, &vmo);
+    if (status < 0) {
+        return status;
+    }
+    char buf[PAGE_SIZE];
+    for (size_t at = 0; at < size; at += sizeof(buf)) {
+        size_t xfer = size - at;
+        if (xfer > sizeof(buf)) {
+            xfer = sizeof(buf);
+        }
+        size_t actual;
+        if (((status = mx_vmo_read(vf->vmo, buf, vf->off + at, xfer, &actual)) < 0) ||
+            ((status = mx_vmo_write(vmo, buf, at, actual, &actual)) < 0)) {
+            mx_handle_close(vmo);
+            return status;
+        }
+    }
+    *out = vmo;
+    *off = 0;
+    *len = size;
+    return NO_ERROR;
+}
+
 static mxio_ops_t vmofile_ops = {
     .read = vmofile_read,
     .read_at = vmofile_read_at,
@@ -152,6 +182,7 @@ static mxio_ops_t vmofile_ops = {
     .wait_end = mxio_default_wait_end,
     .unwrap = mxio_default_unwrap,
     .posix_ioctl = mxio_default_posix_ioctl,
+    .get_vmo = vmofile_get_vmo,
 };
 
 mxio_t* mxio_vmofile_create(mx_handle_t h, mx_off_t off, mx_off_t len) {
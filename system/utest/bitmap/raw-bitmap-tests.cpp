@@ -335,6 +335,53 @@ static bool SetOutOfOrder(void) {
     END_TEST;
 }
 
+template <typename RawBitmap>
+static bool SummaryScan(void) {
+    BEGIN_TEST;
+
+    // Spans several summary words, with a ragged end.
+    constexpr size_t kSize = 64 * 64 * 3 + 37;
+    RawBitmap plain;
+    RawBitmap summarized;
+    EXPECT_EQ(plain.Reset(kSize), NO_ERROR, "");
+    EXPECT_EQ(summarized.Reset(kSize), NO_ERROR, "");
+    EXPECT_EQ(summarized.BuildSummary(), NO_ERROR, "");
+
+    // Long full and empty stretches, with a few stray bits between them.
+    const size_t ranges[][2] = {
+        {0, 3000}, {3001, 3002}, {4096, 9000}, {9100, 9101}, {10000, kSize - 5},
+    };
+    for (const auto& range : ranges) {
+        EXPECT_EQ(plain.Set(range[0], range[1]), NO_ERROR, "");
+        EXPECT_EQ(summarized.Set(range[0], range[1]), NO_ERROR, "");
+    }
+    EXPECT_EQ(plain.Clear(11000, 11001), NO_ERROR, "");
+    EXPECT_EQ(summarized.Clear(11000, 11001), NO_ERROR, "");
+
+    for (size_t off = 0; off < kSize; off += 97) {
+        EXPECT_EQ(summarized.Scan(off, kSize, true), plain.Scan(off, kSize, true),
+                  "scan set bits");
+        EXPECT_EQ(summarized.Scan(off, kSize, false), plain.Scan(off, kSize, false),
+                  "scan clear bits");
+        size_t expected;
+        size_t actual;
+        EXPECT_EQ(summarized.Find(false, off, kSize, 90, &actual),
+                  plain.Find(false, off, kSize, 90, &expected), "find clear run");
+        EXPECT_EQ(actual, expected, "check returned arg");
+    }
+
+    // Rebuilding from the storage gives the same answers.
+    EXPECT_EQ(summarized.BuildSummary(), NO_ERROR, "");
+    EXPECT_EQ(summarized.Scan(0, kSize, true), 3000U, "scan after rebuild");
+    EXPECT_EQ(summarized.Scan(4096, kSize, true), 9000U, "scan after rebuild");
+    EXPECT_EQ(summarized.Scan(10000, kSize, true), 11000U, "scan after rebuild");
+
+    summarized.ClearAll();
+    EXPECT_EQ(summarized.Scan(0, kSize, false), kSize, "scan cleared bitmap");
+
+    END_TEST;
+}
+
 #define RUN_TEMPLATIZED_TEST(test, specialization) RUN_TEST(test<specialization>)
 #define ALL_TESTS(specialization)                           \
     RUN_TEMPLATIZED_TEST(InitializedEmpty, specialization)  \
@@ -347,7 +394,8 @@ static bool SetOutOfOrder(void) {
     RUN_TEMPLATIZED_TEST(ClearSubrange, specialization)     \
     RUN_TEMPLATIZED_TEST(BoundaryArguments, specialization) \
     RUN_TEMPLATIZED_TEST(ClearAll, specialization)          \
-    RUN_TEMPLATIZED_TEST(SetOutOfOrder, specialization)
+    RUN_TEMPLATIZED_TEST(SetOutOfOrder, specialization)     \
+    RUN_TEMPLATIZED_TEST(SummaryScan, specialization)
 
 BEGIN_TEST_CASE(raw_bitmap_tests)
 ALL_TESTS(RawBitmapGeneric<DefaultStorage>)
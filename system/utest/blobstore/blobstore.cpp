@@ -186,7 +186,11 @@ typedef struct blob_info {
 
 // Creates, writes, reads (to verify) and operates on a blob.
 // Returns the result of the post-processing 'func' (true == success).
-static bool GenerateBlob(size_t size_data, mxtl::unique_ptr<blob_info_t>* out) {
+//
+// Random data does not compress; 'compressible' data is made of short runs
+// of the same byte instead.
+static bool GenerateBlob(size_t size_data, mxtl::unique_ptr<blob_info_t>* out,
+                         bool compressible = false) {
     // Generate a Blob of random data
     AllocChecker ac;
     mxtl::unique_ptr<blob_info_t> info(new (&ac) blob_info_t);
@@ -194,8 +198,12 @@ static bool GenerateBlob(size_t size_data, mxtl::unique_ptr<blob_info_t>* out) {
     info->data.reset(new (&ac) char[size_data]);
     EXPECT_EQ(ac.check(), true, "");
     unsigned int seed = static_cast<unsigned int>(mx_ticks_get());
+    char c = 0;
     for (size_t i = 0; i < size_data; i++) {
-        info->data[i] = (char) rand_r(&seed);
+        if (!compressible || (i % 32 == 0)) {
+            c = (char) rand_r(&seed);
+        }
+        info->data[i] = c;
     }
     info->size_data = size_data;
 
@@ -522,6 +530,194 @@ static bool CreateUmountRemountSmall(void) {
     END_TEST;
 }
 
+static bool CompressibleBlob(void) {
+    BEGIN_TEST;
+    char ramdisk_path[PATH_MAX];
+    ASSERT_EQ(StartBlobstoreTest(512, 1 << 20, ramdisk_path), 0, "Mounting Blobstore");
+
+    unsigned int seed = static_cast<unsigned int>(mx_ticks_get());
+    for (size_t i = 10; i < 21; i++) {
+        // Sizes which do not fill the last block or chunk, too.
+        size_t size = (1 << i) + ((i % 2) ? rand_r(&seed) % 8192 : 0);
+        mxtl::unique_ptr<blob_info_t> info;
+        ASSERT_TRUE(GenerateBlob(size, &info, true), "");
+
+        int fd;
+        ASSERT_TRUE(MakeBlob(info->path, info->merkle.get(), info->size_merkle,
+                             info->data.get(), info->size_data, &fd), "");
+        ASSERT_EQ(close(fd), 0, "");
+
+        // Remount, so that the blob is read back from disk.
+        ASSERT_EQ(umount(MOUNT_PATH), NO_ERROR, "Could not unmount blobstore");
+        ASSERT_EQ(MountBlobstore(ramdisk_path), 0, "Could not re-mount blobstore");
+        fd = open(info->path, O_RDWR);
+        ASSERT_GT(fd, 0, "Failed to open blob");
+
+        // Read from random places first, so that chunks are loaded out of
+        // order, then read the whole thing.
+        char buf[1024];
+        for (size_t j = 0; j < 16; j++) {
+            size_t off = rand_r(&seed) % info->size_data;
+            size_t len = mxtl::min(sizeof(buf), info->size_data - off);
+            ASSERT_EQ(lseek(fd, off, SEEK_SET), (off_t) off, "");
+            ASSERT_EQ(StreamAll(read, fd, buf, len), 0, "Failed to read data");
+            ASSERT_EQ(memcmp(buf, &info->data[off], len), 0, "Read data, but it was bad");
+        }
+        ASSERT_TRUE(VerifyContents(fd, info->data.get(), info->size_data), "");
+
+        ASSERT_EQ(close(fd), 0, "Could not close blob");
+        ASSERT_EQ(unlink(info->path), 0, "");
+    }
+
+    ASSERT_EQ(EndBlobstoreTest(ramdisk_path), 0, "unmounting blobstore");
+    END_TEST;
+}
+
+// Writes a blob, closing it afterwards. ERR_NO_SPACE from the allocation is
+// passed back in |status|, rather than failing the test.
+static bool TryMakeBlob(const blob_info_t* info, mx_status_t* status) {
+    int fd = open(info->path, O_CREAT | O_RDWR);
+    ASSERT_GT(fd, 0, "Failed to create blob");
+    blob_ioctl_config_t config;
+    config.size_data = info->size_data;
+    *status = static_cast<mx_status_t>(ioctl_blobstore_blob_init(fd, &config));
+    if (*status == NO_ERROR) {
+        ASSERT_EQ(StreamAll(write, fd, info->merkle.get(), info->size_merkle), 0,
+                  "Failed to write Merkle Tree");
+        ASSERT_EQ(StreamAll(write, fd, info->data.get(), info->size_data), 0,
+                  "Failed to write Data");
+    } else {
+        ASSERT_EQ(*status, ERR_NO_SPACE, "Blobstore expected to run out of space");
+    }
+    ASSERT_EQ(close(fd), 0, "");
+    return true;
+}
+
+static bool VerifyBlob(const blob_info_t* info) {
+    int fd = open(info->path, O_RDONLY);
+    ASSERT_GT(fd, 0, "Failed to open blob");
+    ASSERT_TRUE(VerifyContents(fd, info->data.get(), info->size_data), "");
+    ASSERT_EQ(close(fd), 0, "");
+    return true;
+}
+
+static bool FragmentationStress(void) {
+    BEGIN_TEST;
+    // A small disk, so that it can be filled quickly.
+    char ramdisk_path[PATH_MAX];
+    ASSERT_EQ(StartBlobstoreTest(512, 1 << 15, ramdisk_path), 0, "Mounting Blobstore");
+
+    // Fill the disk with small blobs, then delete every other one, which
+    // leaves no free run longer than a few blocks.
+    constexpr size_t kMaxSmall = 1024;
+    AllocChecker ac;
+    mxtl::unique_ptr<mxtl::unique_ptr<blob_info_t>[]> small(
+            new (&ac) mxtl::unique_ptr<blob_info_t>[kMaxSmall]);
+    ASSERT_EQ(ac.check(), true, "");
+    size_t count = 0;
+    mx_status_t status = NO_ERROR;
+    while (count < kMaxSmall) {
+        ASSERT_TRUE(GenerateBlob(1 << 14, &small[count]), "");
+        ASSERT_TRUE(TryMakeBlob(small[count].get(), &status), "");
+        if (status != NO_ERROR) {
+            break;
+        }
+        count++;
+    }
+    ASSERT_EQ(status, ERR_NO_SPACE, "Disk should have filled up");
+    for (size_t i = 0; i < count; i += 2) {
+        ASSERT_EQ(unlink(small[i]->path), 0, "");
+        small[i].reset();
+    }
+
+    // A blob far larger than any hole must still fit, in pieces, whether
+    // or not it compresses.
+    mxtl::unique_ptr<blob_info_t> large;
+    mxtl::unique_ptr<blob_info_t> packed;
+    ASSERT_TRUE(GenerateBlob(1 << 20, &large), "");
+    ASSERT_TRUE(GenerateBlob(1 << 20, &packed, true), "");
+    ASSERT_TRUE(TryMakeBlob(large.get(), &status), "");
+    ASSERT_EQ(status, NO_ERROR, "Could not fit large blob in fragmented space");
+    ASSERT_TRUE(TryMakeBlob(packed.get(), &status), "");
+    ASSERT_EQ(status, NO_ERROR, "Could not fit compressible blob in fragmented space");
+
+    // One too large for all the space that is left is turned away cleanly.
+    mxtl::unique_ptr<blob_info_t> huge;
+    ASSERT_TRUE(GenerateBlob(1 << 23, &huge), "");
+    ASSERT_TRUE(TryMakeBlob(huge.get(), &status), "");
+    ASSERT_EQ(status, ERR_NO_SPACE, "Huge blob should not fit");
+
+    // Everything reads back after a remount, from its extents on disk.
+    ASSERT_EQ(umount(MOUNT_PATH), NO_ERROR, "Could not unmount blobstore");
+    ASSERT_EQ(MountBlobstore(ramdisk_path), 0, "Could not re-mount blobstore");
+    ASSERT_TRUE(VerifyBlob(large.get()), "");
+    ASSERT_TRUE(VerifyBlob(packed.get()), "");
+    for (size_t i = 1; i < count; i += 2) {
+        ASSERT_TRUE(VerifyBlob(small[i].get()), "");
+    }
+
+    // Unlinking the fragmented blob frees all of its pieces, and its table,
+    // so that it can be written again.
+    ASSERT_EQ(unlink(large->path), 0, "");
+    ASSERT_EQ(unlink(packed->path), 0, "");
+    ASSERT_TRUE(TryMakeBlob(large.get(), &status), "");
+    ASSERT_EQ(status, NO_ERROR, "Could not rewrite large blob");
+    ASSERT_TRUE(TryMakeBlob(packed.get(), &status), "");
+    ASSERT_EQ(status, NO_ERROR, "Could not rewrite compressible blob");
+    ASSERT_TRUE(VerifyBlob(large.get()), "");
+    ASSERT_TRUE(VerifyBlob(packed.get()), "");
+
+    ASSERT_EQ(EndBlobstoreTest(ramdisk_path), 0, "unmounting blobstore");
+    END_TEST;
+}
+
+static bool QueuedWrites(void) {
+    BEGIN_TEST;
+    char ramdisk_path[PATH_MAX];
+    ASSERT_EQ(StartBlobstoreTest(512, 1 << 20, ramdisk_path), 0, "Mounting Blobstore");
+
+    // Write blobs back to back, so that each is hashed while those before it
+    // are still queued to be written out.
+    constexpr size_t kBlobCount = 64;
+    unsigned int seed = static_cast<unsigned int>(mx_ticks_get());
+    mxtl::unique_ptr<blob_info_t> info[kBlobCount];
+    mx_status_t status;
+    for (size_t i = 0; i < kBlobCount; i++) {
+        size_t size = 1 + rand_r(&seed) % (1 << 17);
+        ASSERT_TRUE(GenerateBlob(size, &info[i], (i % 2) == 1), "");
+        ASSERT_TRUE(TryMakeBlob(info[i].get(), &status), "");
+        ASSERT_EQ(status, NO_ERROR, "");
+    }
+
+    // Once closed, these may be read back from disk, which means waiting
+    // for them to get there.
+    for (size_t i = 0; i < kBlobCount; i += 3) {
+        ASSERT_TRUE(VerifyBlob(info[i].get()), "");
+    }
+
+    // A blob may be removed, and written again, before it is on disk.
+    for (size_t i = 0; i < kBlobCount; i += 4) {
+        ASSERT_EQ(unlink(info[i]->path), 0, "");
+        ASSERT_TRUE(TryMakeBlob(info[i].get(), &status), "");
+        ASSERT_EQ(status, NO_ERROR, "");
+    }
+
+    // Once synced, a blob is on disk.
+    int fd = open(info[kBlobCount - 1]->path, O_RDONLY);
+    ASSERT_GT(fd, 0, "Failed to open blob");
+    ASSERT_EQ(fsync(fd), 0, "");
+    ASSERT_EQ(close(fd), 0, "");
+
+    ASSERT_EQ(umount(MOUNT_PATH), NO_ERROR, "Could not unmount blobstore");
+    ASSERT_EQ(MountBlobstore(ramdisk_path), 0, "Could not re-mount blobstore");
+    for (size_t i = 0; i < kBlobCount; i++) {
+        ASSERT_TRUE(VerifyBlob(info[i].get()), "");
+    }
+
+    ASSERT_EQ(EndBlobstoreTest(ramdisk_path), 0, "unmounting blobstore");
+    END_TEST;
+}
+
 enum TestState {
     empty,
     configured,
@@ -1129,6 +1325,9 @@ RUN_TEST(CorruptedBlob)
 RUN_TEST(CorruptedDigest)
 RUN_TEST(EdgeAllocation)
 RUN_TEST(CreateUmountRemountSmall)
+RUN_TEST(CompressibleBlob)
+RUN_TEST(FragmentationStress)
+RUN_TEST(QueuedWrites)
 RUN_TEST(EarlyRead)
 RUN_TEST(WaitForRead)
 RUN_TEST(WriteSeekIgnored)
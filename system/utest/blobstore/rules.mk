@@ -15,7 +15,6 @@ MODULE_SRCS := \
 
 MODULE_STATIC_LIBS := \
     ulib/merkle \
-    ulib/cryptolib \
 
 MODULE_LIBS := \
     ulib/mxio \
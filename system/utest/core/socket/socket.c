@@ -328,6 +328,118 @@ static bool socket_short_write(void) {
     END_TEST;
 }
 
+static bool socket_create_size(void) {
+    BEGIN_TEST;
+
+    mx_status_t status;
+    mx_handle_t h0, h1;
+
+    status = mx_socket_create(MX_SOCKET_SIZE(MX_SOCKET_SIZE_LOG2_MIN - 1), &h0, &h1);
+    ASSERT_EQ(status, ERR_INVALID_ARGS, "");
+    status = mx_socket_create(MX_SOCKET_SIZE(MX_SOCKET_SIZE_LOG2_MAX + 1), &h0, &h1);
+    ASSERT_EQ(status, ERR_INVALID_ARGS, "");
+
+    const size_t capacity = 1u << 13;
+    status = mx_socket_create(MX_SOCKET_SIZE(13), &h0, &h1);
+    ASSERT_EQ(status, NO_ERROR, "");
+
+    char* wbuf = malloc(capacity);
+    char* rbuf = malloc(capacity);
+    ASSERT_NONNULL(wbuf, "");
+    ASSERT_NONNULL(rbuf, "");
+    for (size_t i = 0; i < capacity; i++)
+        wbuf[i] = (char)i;
+
+    // Fill, drain, and refill to exercise the buffer being released and
+    // committed again.
+    for (int pass = 0; pass < 3; pass++) {
+        size_t count;
+        status = mx_socket_write(h0, 0u, wbuf, capacity, &count);
+        ASSERT_EQ(status, NO_ERROR, "");
+        ASSERT_EQ(count, capacity - 1, "");
+        EXPECT_EQ(get_satisfied_signals(h0), 0u, "");
+
+        status = mx_socket_read(h1, 0u, rbuf, capacity, &count);
+        ASSERT_EQ(status, NO_ERROR, "");
+        ASSERT_EQ(count, capacity - 1, "");
+        ASSERT_EQ(memcmp(rbuf, wbuf, count), 0, "");
+        EXPECT_EQ(get_satisfied_signals(h0), MX_SOCKET_WRITABLE, "");
+    }
+
+    free(wbuf);
+    free(rbuf);
+    mx_handle_close(h0);
+    mx_handle_close(h1);
+
+    END_TEST;
+}
+
+static bool socket_vmo_splice(void) {
+    BEGIN_TEST;
+
+    mx_status_t status;
+    mx_handle_t h0, h1;
+    status = mx_socket_create(0, &h0, &h1);
+    ASSERT_EQ(status, NO_ERROR, "");
+
+    const size_t vmo_size = 4 * 4096;
+    mx_handle_t src, dst;
+    ASSERT_EQ(mx_vmo_create(vmo_size, 0, &src), NO_ERROR, "");
+    ASSERT_EQ(mx_vmo_create(vmo_size, 0, &dst), NO_ERROR, "");
+
+    char* wbuf = malloc(vmo_size);
+    char* rbuf = malloc(vmo_size);
+    ASSERT_NONNULL(wbuf, "");
+    ASSERT_NONNULL(rbuf, "");
+    for (size_t i = 0; i < vmo_size; i++)
+        wbuf[i] = (char)(i * 7);
+    size_t actual;
+    ASSERT_EQ(mx_vmo_write(src, wbuf, 0, vmo_size, &actual), NO_ERROR, "");
+
+    // Unaligned offsets and a length that spans several pages.
+    const size_t len = 9000;
+    status = mx_socket_write_vmo(h0, 0u, src, 100, len, &actual);
+    ASSERT_EQ(status, NO_ERROR, "");
+    ASSERT_EQ(actual, len, "");
+    EXPECT_EQ(get_satisfied_signals(h1), MX_SOCKET_READABLE | MX_SOCKET_WRITABLE, "");
+
+    status = mx_socket_read_vmo(h1, 0u, dst, 50, len, &actual);
+    ASSERT_EQ(status, NO_ERROR, "");
+    ASSERT_EQ(actual, len, "");
+    EXPECT_EQ(get_satisfied_signals(h1), MX_SOCKET_WRITABLE, "");
+
+    ASSERT_EQ(mx_vmo_read(dst, rbuf, 50, len, &actual), NO_ERROR, "");
+    ASSERT_EQ(memcmp(rbuf, wbuf + 100, len), 0, "");
+
+    // Transfers stop at the end of the vmo.
+    status = mx_socket_write_vmo(h0, 0u, src, vmo_size - 10, len, &actual);
+    ASSERT_EQ(status, NO_ERROR, "");
+    ASSERT_EQ(actual, 10u, "");
+    status = mx_socket_write_vmo(h0, 0u, src, vmo_size + 1, len, &actual);
+    ASSERT_EQ(status, ERR_OUT_OF_RANGE, "");
+    status = mx_socket_read_vmo(h1, 0u, dst, vmo_size - 4, len, &actual);
+    ASSERT_EQ(status, NO_ERROR, "");
+    ASSERT_EQ(actual, 4u, "");
+
+    // Mixing with ordinary reads keeps the byte stream intact.
+    status = mx_socket_read(h1, 0u, rbuf, 16, &actual);
+    ASSERT_EQ(status, NO_ERROR, "");
+    ASSERT_EQ(actual, 6u, "");
+    ASSERT_EQ(memcmp(rbuf, wbuf + vmo_size - 6, 6), 0, "");
+
+    status = mx_socket_read_vmo(h1, 0u, dst, 0, len, &actual);
+    ASSERT_EQ(status, ERR_SHOULD_WAIT, "");
+
+    free(wbuf);
+    free(rbuf);
+    mx_handle_close(src);
+    mx_handle_close(dst);
+    mx_handle_close(h0);
+    mx_handle_close(h1);
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(socket_tests)
 RUN_TEST(socket_basic)
 RUN_TEST(socket_signals)
@@ -335,6 +447,8 @@ RUN_TEST(socket_half_close)
 RUN_TEST(socket_bytes_outstanding)
 RUN_TEST(socket_bytes_outstanding_half_close)
 RUN_TEST(socket_short_write)
+RUN_TEST(socket_create_size)
+RUN_TEST(socket_vmo_splice)
 END_TEST_CASE(socket_tests)
 
 #ifndef BUILD_COMBINED_TESTS
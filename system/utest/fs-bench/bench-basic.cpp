@@ -90,6 +90,56 @@ bool benchmark_write_read(void) {
     END_TEST;
 }
 
+constexpr size_t kSmallFileSize = 8192;
+constexpr size_t kNumSmallFiles = 500;
+
+// Many small files stress the filesystem's metadata path (inode table,
+// bitmaps, directory blocks) far more than one big file does, so this is
+// mostly a measure of how quickly blocks get to and from the device.
+bool benchmark_small_files(void) {
+    BEGIN_TEST;
+    printf("\nBenchmarking Small files\n");
+    char path[PATH_MAX];
+    uint8_t data[kSmallFileSize];
+    memset(data, kMagicByte, sizeof(data));
+
+    uint64_t start, end;
+    uint64_t ticks_per_msec = mx_ticks_per_second() / 1000;
+
+    start = mx_ticks_get();
+    for (size_t i = 0; i < kNumSmallFiles; i++) {
+        snprintf(path, sizeof(path), MOUNT_POINT "/small-%zu", i);
+        int fd = open(path, O_CREAT | O_RDWR, 0644);
+        ASSERT_GT(fd, 0, "Cannot create file");
+        ASSERT_EQ(write(fd, data, sizeof(data)), (ssize_t)sizeof(data), "");
+        ASSERT_EQ(close(fd), 0, "");
+    }
+    end = mx_ticks_get();
+    printf("Benchmark create+write: [%10lu] msec\n", (end - start) / ticks_per_msec);
+
+    start = mx_ticks_get();
+    for (size_t i = 0; i < kNumSmallFiles; i++) {
+        snprintf(path, sizeof(path), MOUNT_POINT "/small-%zu", i);
+        int fd = open(path, O_RDONLY);
+        ASSERT_GT(fd, 0, "Cannot open file");
+        ASSERT_EQ(read(fd, data, sizeof(data)), (ssize_t)sizeof(data), "");
+        ASSERT_EQ(data[0], kMagicByte, "");
+        ASSERT_EQ(close(fd), 0, "");
+    }
+    end = mx_ticks_get();
+    printf("Benchmark open+read:    [%10lu] msec\n", (end - start) / ticks_per_msec);
+
+    start = mx_ticks_get();
+    for (size_t i = 0; i < kNumSmallFiles; i++) {
+        snprintf(path, sizeof(path), MOUNT_POINT "/small-%zu", i);
+        ASSERT_EQ(unlink(path), 0, "");
+    }
+    end = mx_ticks_get();
+    printf("Benchmark unlink:       [%10lu] msec\n", (end - start) / ticks_per_msec);
+
+    END_TEST;
+}
+
 #define START_STRING "/aaa"
 
 size_t constexpr cStrlen(const char* str) {
@@ -184,4 +234,5 @@ bool benchmark_path_walk(void) {
 BEGIN_TEST_CASE(basic_benchmarks)
 RUN_TEST_PERFORMANCE(benchmark_write_read)
 RUN_TEST_PERFORMANCE(benchmark_path_walk)
+RUN_TEST_PERFORMANCE(benchmark_small_files)
 END_TEST_CASE(basic_benchmarks)
@@ -0,0 +1,103 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <threads.h>
+#include <unistd.h>
+
+#include <magenta/new.h>
+#include <magenta/syscalls.h>
+#include <mxtl/unique_ptr.h>
+#include <unittest/unittest.h>
+
+#define MOUNT_POINT "/benchmark"
+
+constexpr size_t kChunkSize = (1 << 13);
+constexpr size_t kChunksPerClient = 256;
+constexpr size_t kMaxClients = 8;
+constexpr uint8_t kMagicByte = 0xee;
+
+struct Client {
+    thrd_t thread;
+    size_t id;
+    bool ok;
+};
+
+// Each client writes a file of its own, then reads it back twice, so clients
+// share nothing but the filesystem.
+static int client_thread(void* arg) {
+    Client* client = static_cast<Client*>(arg);
+    client->ok = false;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), MOUNT_POINT "/client-%zu", client->id);
+    int fd = open(path, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+
+    uint8_t data[kChunkSize];
+    memset(data, kMagicByte, sizeof(data));
+    for (size_t i = 0; i < kChunksPerClient; i++) {
+        if (write(fd, data, sizeof(data)) != (ssize_t)sizeof(data)) {
+            goto done;
+        }
+    }
+    for (size_t pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < kChunksPerClient; i++) {
+            if ((pread(fd, data, sizeof(data), i * sizeof(data)) != (ssize_t)sizeof(data)) ||
+                (data[0] != kMagicByte)) {
+                goto done;
+            }
+        }
+    }
+    client->ok = true;
+done:
+    close(fd);
+    unlink(path);
+    return 0;
+}
+
+static bool run_clients(size_t count) {
+    Client clients[kMaxClients];
+    uint64_t ticks_per_msec = mx_ticks_per_second() / 1000;
+    uint64_t start = mx_ticks_get();
+    for (size_t i = 0; i < count; i++) {
+        clients[i].id = i;
+        ASSERT_EQ(thrd_create(&clients[i].thread, client_thread, &clients[i]), thrd_success, "");
+    }
+    for (size_t i = 0; i < count; i++) {
+        thrd_join(clients[i].thread, nullptr);
+    }
+    uint64_t msec = (mx_ticks_get() - start) / ticks_per_msec;
+    for (size_t i = 0; i < count; i++) {
+        ASSERT_TRUE(clients[i].ok, "Client failed");
+    }
+
+    // Each client moves its file three times: one write, two reads.
+    size_t kb = count * 3 * kChunksPerClient * kChunkSize / 1024;
+    printf("Benchmark %zu client(s): [%10lu] msec, [%10lu] KB/s\n", count, msec,
+           msec ? kb * 1000 / msec : 0);
+    return true;
+}
+
+// Independent clients should not queue behind one another: with a
+// filesystem which services requests in parallel, aggregate throughput
+// grows with the number of clients until the device is saturated.
+bool benchmark_concurrent_clients(void) {
+    BEGIN_TEST;
+    printf("\nBenchmarking Concurrent clients\n");
+    for (size_t count = 1; count <= kMaxClients; count *= 2) {
+        ASSERT_TRUE(run_clients(count), "");
+    }
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(concurrent_benchmarks)
+RUN_TEST_PERFORMANCE(benchmark_concurrent_clients)
+END_TEST_CASE(concurrent_benchmarks)
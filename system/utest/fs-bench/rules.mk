@@ -13,6 +13,7 @@ MODULE_NAME := fs-bench-test
 MODULE_SRCS := \
     $(LOCAL_DIR)/main.cpp \
     $(LOCAL_DIR)/bench-basic.cpp \
+    $(LOCAL_DIR)/bench-concurrent.cpp \
 
 MODULE_LIBS := \
     ulib/c \
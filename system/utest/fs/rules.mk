@@ -18,6 +18,7 @@ MODULE_SRCS := \
     $(LOCAL_DIR)/test-attr.c \
     $(LOCAL_DIR)/test-append.c \
     $(LOCAL_DIR)/test-basic.c \
+    $(LOCAL_DIR)/test-dcache.c \
     $(LOCAL_DIR)/test-directory.c \
     $(LOCAL_DIR)/test-link.c \
     $(LOCAL_DIR)/test-maxfile.c \
@@ -0,0 +1,229 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fs-management/mount.h>
+#include <fs-management/ramdisk.h>
+#include <magenta/compiler.h>
+#include <magenta/process.h>
+#include <magenta/syscalls.h>
+#include <magenta/syscalls/object.h>
+
+#include "filesystems.h"
+#include "misc.h"
+
+// Names looked up by these tests are kept short enough to be cached by the
+// VFS, so each lookup before a change leaves an entry behind which the
+// change must invalidate.
+
+static bool exists(const char* path) {
+    struct stat s;
+    return stat(path, &s) == 0;
+}
+
+static bool create_file(const char* path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+    ASSERT_GT(fd, 0, "");
+    ASSERT_EQ(close(fd), 0, "");
+    return true;
+}
+
+bool test_dcache_negative_create(void) {
+    BEGIN_TEST;
+
+    ASSERT_FALSE(exists("::a"), "");
+    ASSERT_FALSE(exists("::a"), "");
+    ASSERT_TRUE(create_file("::a"), "");
+    ASSERT_TRUE(exists("::a"), "");
+
+    ASSERT_EQ(mkdir("::dir", 0755), 0, "");
+    ASSERT_FALSE(exists("::dir/b"), "");
+    ASSERT_EQ(mkdir("::dir/b", 0755), 0, "");
+    ASSERT_TRUE(exists("::dir/b"), "");
+
+    ASSERT_EQ(rmdir("::dir/b"), 0, "");
+    ASSERT_EQ(rmdir("::dir"), 0, "");
+    ASSERT_EQ(unlink("::a"), 0, "");
+
+    END_TEST;
+}
+
+bool test_dcache_negative_link(void) {
+    if (!test_info->supports_hardlinks) {
+        return true;
+    }
+    BEGIN_TEST;
+
+    ASSERT_TRUE(create_file("::a"), "");
+    ASSERT_FALSE(exists("::b"), "");
+    ASSERT_EQ(link("::a", "::b"), 0, "");
+    ASSERT_TRUE(exists("::b"), "");
+
+    ASSERT_EQ(unlink("::a"), 0, "");
+    ASSERT_EQ(unlink("::b"), 0, "");
+
+    END_TEST;
+}
+
+bool test_dcache_negative_rename(void) {
+    BEGIN_TEST;
+
+    ASSERT_TRUE(create_file("::a"), "");
+    ASSERT_FALSE(exists("::b"), "");
+    ASSERT_EQ(rename("::a", "::b"), 0, "");
+    ASSERT_TRUE(exists("::b"), "");
+
+    // Into another directory.
+    ASSERT_EQ(mkdir("::dir", 0755), 0, "");
+    ASSERT_FALSE(exists("::dir/c"), "");
+    ASSERT_EQ(rename("::b", "::dir/c"), 0, "");
+    ASSERT_TRUE(exists("::dir/c"), "");
+
+    ASSERT_EQ(unlink("::dir/c"), 0, "");
+    ASSERT_EQ(rmdir("::dir"), 0, "");
+
+    END_TEST;
+}
+
+bool test_dcache_positive_unlink(void) {
+    BEGIN_TEST;
+
+    ASSERT_TRUE(create_file("::a"), "");
+    ASSERT_TRUE(exists("::a"), "");
+    ASSERT_EQ(unlink("::a"), 0, "");
+    ASSERT_FALSE(exists("::a"), "");
+
+    ASSERT_EQ(mkdir("::dir", 0755), 0, "");
+    ASSERT_TRUE(exists("::dir"), "");
+    ASSERT_EQ(rmdir("::dir"), 0, "");
+    ASSERT_FALSE(exists("::dir"), "");
+
+    // A new file of the same name is not confused with the old one.
+    int fd = open("::a", O_RDWR | O_CREAT | O_EXCL, 0644);
+    ASSERT_GT(fd, 0, "");
+    ASSERT_EQ(write(fd, "hello", 5), 5, "");
+    ASSERT_EQ(close(fd), 0, "");
+    ASSERT_TRUE(create_file("::b"), "");
+    ASSERT_TRUE(exists("::b"), "");
+    ASSERT_EQ(unlink("::b"), 0, "");
+    ASSERT_EQ(rename("::a", "::b"), 0, "");
+    struct stat s;
+    ASSERT_EQ(stat("::b", &s), 0, "");
+    ASSERT_EQ(s.st_size, 5, "");
+    ASSERT_EQ(unlink("::b"), 0, "");
+
+    END_TEST;
+}
+
+bool test_dcache_positive_rename(void) {
+    BEGIN_TEST;
+
+    ASSERT_TRUE(create_file("::a"), "");
+    ASSERT_TRUE(exists("::a"), "");
+    ASSERT_EQ(rename("::a", "::b"), 0, "");
+    ASSERT_FALSE(exists("::a"), "");
+    ASSERT_TRUE(exists("::b"), "");
+
+    // Away into another directory, and over an existing file.
+    ASSERT_EQ(mkdir("::dir", 0755), 0, "");
+    ASSERT_TRUE(create_file("::dir/c"), "");
+    ASSERT_TRUE(exists("::dir/c"), "");
+    ASSERT_EQ(rename("::dir/c", "::b"), 0, "");
+    ASSERT_FALSE(exists("::dir/c"), "");
+    ASSERT_TRUE(exists("::b"), "");
+
+    ASSERT_EQ(unlink("::b"), 0, "");
+    ASSERT_EQ(rmdir("::dir"), 0, "");
+
+    END_TEST;
+}
+
+RUN_FOR_ALL_FILESYSTEMS(dcache_tests,
+    RUN_TEST_MEDIUM(test_dcache_negative_create)
+    RUN_TEST_MEDIUM(test_dcache_negative_link)
+    RUN_TEST_MEDIUM(test_dcache_negative_rename)
+    RUN_TEST_MEDIUM(test_dcache_positive_unlink)
+    RUN_TEST_MEDIUM(test_dcache_positive_rename)
+)
+
+#define RAMCTL_PATH "/dev/misc/ramctl"
+
+static bool ramdisk_name(const char* prefix, char* name, size_t len) {
+    // create_ramdisk() names the device after the process' koid.
+    mx_info_handle_basic_t info;
+    ASSERT_EQ(mx_object_get_info(mx_process_self(), MX_INFO_HANDLE_BASIC, &info,
+                                 sizeof(info), NULL, NULL), NO_ERROR, "");
+    snprintf(name, len, RAMCTL_PATH "/%s-%016" PRIx64, prefix, info.koid);
+    return true;
+}
+
+// Devices are added to devfs by the device manager, not through the VFS, so
+// these names are invalidated as they are attached to their parent.
+bool test_dcache_devfs_add(void) {
+    BEGIN_TEST;
+
+    char path[PATH_MAX];
+    ASSERT_TRUE(ramdisk_name("dcache", path, sizeof(path)), "");
+    ASSERT_FALSE(exists(path), "");
+
+    char ramdisk_path[PATH_MAX];
+    ASSERT_EQ(create_ramdisk("dcache", ramdisk_path, 512, 1 << 10), 0, "");
+    ASSERT_TRUE(exists(path), "");
+    ASSERT_TRUE(exists(ramdisk_path), "");
+    ASSERT_EQ(destroy_ramdisk(ramdisk_path), 0, "");
+
+    END_TEST;
+}
+
+#define BLOB_MOUNT_PATH "/tmp/magenta-fs-test-dcache"
+
+// A blob which is still being written goes away if its writer closes it
+// early. A lookup made meanwhile must not keep it alive in the cache.
+bool test_dcache_blob_unfinished(void) {
+    BEGIN_TEST;
+
+    ASSERT_TRUE((mkdir(BLOB_MOUNT_PATH, 0755) == 0) || (errno == EEXIST), "");
+    char ramdisk_path[PATH_MAX];
+    ASSERT_EQ(create_ramdisk("dcache-blob", ramdisk_path, 512, 1 << 16), 0, "");
+    ASSERT_EQ(mkfs(ramdisk_path, DISK_FORMAT_BLOBFS, launch_stdio_sync), NO_ERROR, "");
+    int fd = open(ramdisk_path, O_RDWR);
+    ASSERT_GE(fd, 0, "");
+    ASSERT_EQ(mount(fd, BLOB_MOUNT_PATH, DISK_FORMAT_BLOBFS, &default_mount_options,
+                    launch_stdio_async), NO_ERROR, "");
+
+    // The data is never completed, so the name need not match it.
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), BLOB_MOUNT_PATH "/%064x", 0xdcac4e);
+    char data[8192];
+    memset(data, 'a', sizeof(data));
+    for (int i = 0; i < 2; i++) {
+        fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+        ASSERT_GT(fd, 0, "");
+        ASSERT_EQ(ftruncate(fd, sizeof(data)), 0, "");
+        ASSERT_EQ(write(fd, data, sizeof(data) / 2), (ssize_t)sizeof(data) / 2, "");
+        ASSERT_TRUE(exists(path), "");
+        ASSERT_EQ(close(fd), 0, "");
+        ASSERT_FALSE(exists(path), "");
+    }
+
+    ASSERT_EQ(umount(BLOB_MOUNT_PATH), NO_ERROR, "");
+    ASSERT_EQ(destroy_ramdisk(ramdisk_path), 0, "");
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(dcache_other_tests)
+RUN_TEST_MEDIUM(test_dcache_devfs_add)
+RUN_TEST_MEDIUM(test_dcache_blob_unfinished)
+END_TEST_CASE(dcache_other_tests)
@@ -74,6 +74,64 @@ bool test_directory_large(void) {
     END_TEST;
 }
 
+// Enough entries for filesystems which index large directories to do so.
+bool test_directory_large_lookup(void) {
+    BEGIN_TEST;
+
+    ASSERT_EQ(mkdir("::dir", 0755), 0, "");
+    const int num_files = 1024;
+    char path[PATH_MAX];
+    char other[PATH_MAX];
+    for (int i = 0; i < num_files; i++) {
+        snprintf(path, sizeof(path), "::dir/file-%d", i);
+        int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+        ASSERT_GT(fd, 0, "");
+        ASSERT_EQ(close(fd), 0, "");
+    }
+
+    // Every name can be found, and none can be created twice
+    for (int i = 0; i < num_files; i++) {
+        snprintf(path, sizeof(path), "::dir/file-%d", i);
+        int fd = open(path, O_RDWR, 0644);
+        ASSERT_GT(fd, 0, "");
+        ASSERT_EQ(close(fd), 0, "");
+        ASSERT_EQ(open(path, O_RDWR | O_CREAT | O_EXCL, 0644), -1, "");
+    }
+
+    // Remove half the names, and rename a few of the others
+    for (int i = 0; i < num_files; i += 2) {
+        snprintf(path, sizeof(path), "::dir/file-%d", i);
+        ASSERT_EQ(unlink(path), 0, "");
+    }
+    for (int i = 1; i < num_files; i += 8) {
+        snprintf(path, sizeof(path), "::dir/file-%d", i);
+        snprintf(other, sizeof(other), "::dir/renamed-%d", i);
+        ASSERT_EQ(rename(path, other), 0, "");
+    }
+    for (int i = 0; i < num_files; i++) {
+        snprintf(path, sizeof(path), "::dir/file-%d", i);
+        int fd = open(path, O_RDWR, 0644);
+        if ((i % 2 == 0) || (i % 8 == 1)) {
+            ASSERT_EQ(fd, -1, "");
+        } else {
+            ASSERT_GT(fd, 0, "");
+            ASSERT_EQ(close(fd), 0, "");
+        }
+    }
+
+    for (int i = 1; i < num_files; i += 2) {
+        if (i % 8 == 1) {
+            snprintf(path, sizeof(path), "::dir/renamed-%d", i);
+        } else {
+            snprintf(path, sizeof(path), "::dir/file-%d", i);
+        }
+        ASSERT_EQ(unlink(path), 0, "");
+    }
+    ASSERT_EQ(rmdir("::dir"), 0, "");
+
+    END_TEST;
+}
+
 bool test_directory_max(void) {
     BEGIN_TEST;
 
@@ -342,6 +400,7 @@ RUN_FOR_ALL_FILESYSTEMS(directory_tests,
     RUN_TEST_MEDIUM(test_directory_coalesce)
     RUN_TEST_MEDIUM(test_directory_filename_max)
     RUN_TEST_LARGE(test_directory_large)
+    RUN_TEST_LARGE(test_directory_large_lookup)
     RUN_TEST_MEDIUM(test_directory_trailing_slash)
     RUN_TEST_MEDIUM(test_directory_readdir)
     RUN_TEST_MEDIUM(test_directory_rewind)
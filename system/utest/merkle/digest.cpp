@@ -5,6 +5,7 @@
 #include <merkle/digest.h>
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <magenta/status.h>
 #include <unittest/unittest.h>
@@ -24,6 +25,14 @@ const char* kZeroDigest =
 // echo -n | sha256sum | cut -c1-64 | tr -d '\n' | xxd -p -r | sha256sum
 const char* kDoubleZeroDigest =
     "5df6e0e2761359d30a8275058e299fcc0381534545f55cf43e41983f5d4c9456";
+// The padding of this one spills into a second block (FIPS 180-2, B.2).
+const char* kTwoBlockInput =
+    "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+const char* kTwoBlockDigest =
+    "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1";
+// printf 'a%.0s' $(seq 8192) | sha256sum
+const char* kNodeOfAsDigest =
+    "dd4e6730520932767ec0a9e33fe19c4ce24399d6eba4ff62f13013c9ed30ef87";
 
 ////////////////
 // Test cases
@@ -81,6 +90,54 @@ bool DigestSplit(void) {
     END_TEST;
 }
 
+bool DigestLong(void) {
+    BEGIN_TEST;
+    Digest actual, expected;
+    mx_status_t rc = expected.Parse(kTwoBlockDigest, strlen(kTwoBlockDigest));
+    ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+    actual.Hash(kTwoBlockInput, strlen(kTwoBlockInput));
+    ASSERT_TRUE(actual == expected, __FUNCTION__);
+    rc = expected.Parse(kNodeOfAsDigest, strlen(kNodeOfAsDigest));
+    ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+    uint8_t buf[8192];
+    memset(buf, 'a', sizeof(buf));
+    actual.Hash(buf, sizeof(buf));
+    ASSERT_TRUE(actual == expected, __FUNCTION__);
+    END_TEST;
+}
+
+bool DigestUpdateMany(void) {
+    BEGIN_TEST;
+    const size_t kCount = 5;
+    uint8_t buf[4096];
+    for (size_t i = 0; i < sizeof(buf); ++i) {
+        buf[i] = static_cast<uint8_t>(rand());
+    }
+    // Lengths around block boundaries, and leading updates that leave the
+    // digests with both matching and differing partial blocks.
+    const size_t lengths[] = {0, 1, 55, 64, 100, 1000, 3000};
+    const size_t leads[kCount] = {8, 8, 0, 63, 8};
+    for (size_t len : lengths) {
+        Digest actual[kCount], expected[kCount];
+        const void* data[kCount];
+        for (size_t i = 0; i < kCount; ++i) {
+            data[i] = buf + i * 200;
+            actual[i].Init();
+            actual[i].Update(buf, leads[i]);
+            expected[i].Init();
+            expected[i].Update(buf, leads[i]);
+            expected[i].Update(data[i], len);
+            expected[i].Final();
+        }
+        Digest::UpdateMany(actual, data, kCount, len);
+        for (size_t i = 0; i < kCount; ++i) {
+            actual[i].Final();
+            ASSERT_TRUE(actual[i] == expected[i], __FUNCTION__);
+        }
+    }
+    END_TEST;
+}
+
 bool DigestCWrappers(void) {
     BEGIN_TEST;
     uint8_t buf[Digest::kLength];
@@ -134,6 +191,8 @@ RUN_TEST(DigestStrings)
 RUN_TEST(DigestZero)
 RUN_TEST(DigestSelf)
 RUN_TEST(DigestSplit)
+RUN_TEST(DigestLong)
+RUN_TEST(DigestUpdateMany)
 RUN_TEST(DigestCWrappers)
 RUN_TEST(DigestEquality)
 END_TEST_CASE(MerkleDigestTests)
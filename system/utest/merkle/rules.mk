@@ -24,6 +24,4 @@ MODULE_LIBS := \
     ulib/mxtl \
     ulib/mxio \
 
-MODULE_STATIC_LIBS := ulib/cryptolib
-
 include make/module.mk
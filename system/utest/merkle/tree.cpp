@@ -10,6 +10,8 @@
 #include <magenta/assert.h>
 #include <magenta/new.h>
 #include <magenta/status.h>
+#include <mxtl/algorithm.h>
+#include <mxtl/unique_ptr.h>
 #include <unittest/unittest.h>
 
 namespace {
@@ -28,6 +30,10 @@ const size_t kNodeSize = Tree::kNodeSize;
 const size_t kSmall = 8 * kNodeSize;
 const size_t kLarge = ((kNodeSize / Digest::kLength) + 1) * kNodeSize;
 const size_t kUnaligned = kLarge + (kNodeSize / 2);
+// The smallest data needing a tree of three levels.  Too large for |gData|, it
+// is fed to the tree a buffer at a time.
+const size_t kHuge = ((kNodeSize / Digest::kLength) * (kNodeSize / Digest::kLength) + 1) *
+                     kNodeSize;
 
 // The hard-coded trees used for testing were created by using sha256sum on
 // files generated using echo -ne, dd, and xxd
@@ -298,6 +304,27 @@ bool CreateFinalIncompleteData(void) {
     END_TEST;
 }
 
+bool CreateFinalThreeLevels(void) {
+    BEGIN_TEST;
+    InitZeroData(sizeof(gData));
+    Tree merkleTree;
+    gTreeLen = merkleTree.GetTreeLength(kHuge);
+    mx_status_t rc = merkleTree.CreateInit(kHuge, gTree, gTreeLen);
+    ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+    for (size_t done = 0; done < kHuge; done += gDataLen) {
+        gDataLen = mxtl::min(kHuge - done, sizeof(gData));
+        rc = merkleTree.CreateUpdate(gData, gDataLen, gTree);
+        ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+    }
+    rc = merkleTree.CreateFinal(gTree, &gDigest);
+    ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+    // Each level's digests must start on a node boundary for the first data
+    // node to verify.  Only that node is read, so |gData| suffices.
+    rc = merkleTree.Verify(gData, kHuge, gTree, gTreeLen, 0, kNodeSize, gDigest);
+    ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+    END_TEST;
+}
+
 bool Create(void) {
     BEGIN_TEST;
     InitZeroData(kSmall);
@@ -427,6 +454,36 @@ bool CreateDataUnaligned(void) {
     END_TEST;
 }
 
+bool CreateParallel(void) {
+    BEGIN_TEST;
+    for (size_t i = 0; i < sizeof(gData); ++i) {
+        gData[i] = static_cast<uint8_t>(rand());
+    }
+    AllocChecker ac;
+    mxtl::unique_ptr<uint8_t[]> tree(new (&ac) uint8_t[sizeof(gTree)]);
+    ASSERT_TRUE(ac.check(), "Failed to allocate tree");
+    // Sizes with one and two levels of tree, with and without a short last
+    // node; each is split up between some of the threads.
+    const size_t lengths[] = {kLarge, kUnaligned, sizeof(gData) / 4 + 5,
+                              sizeof(gData) - 1, sizeof(gData)};
+    const unsigned threads[] = {1, 2, 3, 8};
+    for (size_t length : lengths) {
+        Tree merkleTree;
+        gDataLen = length;
+        gTreeLen = merkleTree.GetTreeLength(gDataLen);
+        mx_status_t rc = merkleTree.Create(gData, gDataLen, gTree, gTreeLen, &gDigest);
+        ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+        for (unsigned n : threads) {
+            Digest digest;
+            rc = merkleTree.Create(gData, gDataLen, tree.get(), gTreeLen, &digest, n);
+            ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+            ASSERT_TRUE(digest == gDigest, "Incorrect root digest");
+            ASSERT_EQ(memcmp(tree.get(), gTree, gTreeLen), 0, "Incorrect tree");
+        }
+    }
+    END_TEST;
+}
+
 bool SetRanges(void) {
     BEGIN_TEST;
     Tree merkleTree;
@@ -517,6 +574,39 @@ bool SetRangesUnalignedLength(void) {
     END_TEST;
 }
 
+bool SetRangesWithoutCreate(void) {
+    BEGIN_TEST;
+    Tree merkleTree;
+    InitZeroData(kLarge);
+    mx_status_t rc = merkleTree.SetRanges(gDataLen, gOffset, gLength);
+    ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+    const auto& ranges = merkleTree.ranges();
+    ASSERT_EQ(ranges.size(), 2, "number of ranges");
+    ASSERT_EQ(ranges[0].offset, 0, "offset 0");
+    ASSERT_EQ(ranges[0].length, kNodeSize, "length 0");
+    ASSERT_EQ(ranges[1].offset, kNodeSize * 2, "offset 1");
+    ASSERT_EQ(ranges[1].length, kNodeSize, "length 1");
+    END_TEST;
+}
+
+bool SetRangesThreeLevels(void) {
+    BEGIN_TEST;
+    Tree merkleTree;
+    mx_status_t rc = merkleTree.SetRanges(kHuge, kHuge - kNodeSize, kNodeSize);
+    ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+    // Levels of 257, 2 and 1 nodes; the last data node's digest is in the
+    // last node of each.
+    const auto& ranges = merkleTree.ranges();
+    ASSERT_EQ(ranges.size(), 3, "number of ranges");
+    ASSERT_EQ(ranges[0].offset, kNodeSize * 256, "offset 0");
+    ASSERT_EQ(ranges[0].length, kNodeSize, "length 0");
+    ASSERT_EQ(ranges[1].offset, kNodeSize * 258, "offset 1");
+    ASSERT_EQ(ranges[1].length, kNodeSize, "length 1");
+    ASSERT_EQ(ranges[2].offset, kNodeSize * 259, "offset 2");
+    ASSERT_EQ(ranges[2].length, kNodeSize, "length 2");
+    END_TEST;
+}
+
 bool SetRangesOutOfBounds(void) {
     BEGIN_TEST;
     Tree merkleTree;
@@ -989,6 +1079,7 @@ RUN_TEST(CreateFinalWithoutData)
 RUN_TEST(CreateFinalWithoutTree)
 RUN_TEST(CreateFinalMissingDigest)
 RUN_TEST(CreateFinalIncompleteData)
+RUN_TEST(CreateFinalThreeLevels)
 RUN_TEST(Create)
 RUN_TEST(CreateCWrappers)
 RUN_TEST(CreateByteByByte)
@@ -998,11 +1089,14 @@ RUN_TEST(CreateMissingData)
 RUN_TEST(CreateMissingTree)
 RUN_TEST(CreateTreeTooSmall)
 RUN_TEST(CreateDataUnaligned)
+RUN_TEST(CreateParallel)
 RUN_TEST(SetRanges)
 RUN_TEST(SetRangesEmpty)
 RUN_TEST(SetRangesFull)
 RUN_TEST(SetRangesUnalignedOffset)
 RUN_TEST(SetRangesUnalignedLength)
+RUN_TEST(SetRangesWithoutCreate)
+RUN_TEST(SetRangesThreeLevels)
 RUN_TEST(SetRangesOutOfBounds)
 RUN_TEST(Verify)
 RUN_TEST(VerifyCWrapper)